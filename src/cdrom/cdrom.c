@@ -990,6 +990,20 @@ read_mode2_xa_form2(cdrom_t *dev, int cdrom_sector_flags, uint32_t lba, uint32_t
 }
 
 
+/* Read the user data of num Mode 1 sectors, 2048 bytes each, with a single
+   request to the backend. Returns 0 if the backend can not do that for
+   this run, in which case the caller goes a sector at a time. */
+int
+cdrom_read_data_blocks(cdrom_t *dev, uint8_t *buffer, uint32_t lba, uint32_t num)
+{
+    if ((dev->cd_status == CD_STATUS_EMPTY) || (dev->ops == NULL) ||
+	(dev->ops->read_sectors == NULL) || (num == 0))
+	return 0;
+
+    return dev->ops->read_sectors(dev, buffer, lba, num);
+}
+
+
 int
 cdrom_readsector_raw(cdrom_t *dev, uint8_t *buffer, int sector, int ismsf, int cdrom_sector_type,
 		     int cdrom_sector_flags, int *len)
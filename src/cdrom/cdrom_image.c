@@ -192,6 +192,24 @@ image_read_sector(struct cdrom *dev, int type, uint8_t *b, uint32_t lba)
 }
 
 
+/* Read the 2048-byte user data of a run of Mode 1 sectors in one go. Runs
+   that leave the track or are of any other type are left to the caller. */
+static int
+image_read_sectors(struct cdrom *dev, uint8_t *b, uint32_t lba, uint32_t num)
+{
+    cd_img_t *img = (cd_img_t *)dev->image;
+    int track = cdi_get_track(img, lba);
+
+    if ((track < 1) || (cdi_get_track(img, lba + num - 1) != track))
+	return 0;
+
+    if (image_is_track_audio(dev, lba, 0) || cdi_is_mode2(img, lba))
+	return 0;
+
+    return cdi_read_sectors(img, b, 0, lba, num);
+}
+
+
 static int
 image_track_type(cdrom_t *dev, uint32_t lba)
 {
@@ -233,6 +251,7 @@ static const cdrom_ops_t cdrom_image_ops = {
     image_get_subchannel,
     image_sector_size,
     image_read_sector,
+    image_read_sectors,
     image_track_type,
     image_exit
 };
@@ -34,6 +34,12 @@
 # include <libgen.h>
 #endif
 #include <wchar.h>
+#ifdef _WIN32
+# include <windows.h>
+# include <io.h>
+#else
+# include <sys/mman.h>
+#endif
 #define HAVE_STDARG_H
 #include <86box/86box.h>
 #include <86box/plat.h>
@@ -71,16 +77,33 @@ cdrom_image_backend_log(const char *fmt, ...)
 
 
 /* Binary file functions. */
+
+/* Read from the file, serving small reads from the read-ahead buffer.
+   Called with the track file's lock held. */
 static int
-bin_read(void *p, uint8_t *buffer, uint64_t seek, size_t count)
+bin_read_file(track_file_t *tf, uint8_t *buffer, uint64_t seek, size_t count)
 {
-    track_file_t *tf = (track_file_t *) p;
-
-    cdrom_image_backend_log("CDROM: binary_read(%08lx, pos=%" PRIu64 " count=%lu\n",
-		     tf->file, seek, count);
-
-    if (tf->file == NULL)
-	return 0;
+    /* Serve small reads from the read-ahead buffer, refilling it from
+       the requested offset on a miss, so a sequential run of sector
+       reads costs one host read per buffer rather than one per sector.
+       Larger reads go straight to the file. */
+    if ((tf->ra_buf != NULL) && (count <= tf->ra_size)) {
+	if ((seek < tf->ra_pos) || ((seek + count) > (tf->ra_pos + tf->ra_len))) {
+		tf->ra_len = 0;
+		if (fseeko64(tf->file, seek, SEEK_SET) == -1) {
+			cdrom_image_backend_log("CDROM: binary_read failed during seek!\n");
+			return 0;
+		}
+		tf->ra_pos = seek;
+		tf->ra_len = fread(tf->ra_buf, 1, tf->ra_size, tf->file);
+		if (tf->ra_len < count) {
+			cdrom_image_backend_log("CDROM: binary_read failed during read!\n");
+			return 0;
+		}
+	}
+	memcpy(buffer, tf->ra_buf + (seek - tf->ra_pos), count);
+	return 1;
+    }
 
     if (fseeko64(tf->file, seek, SEEK_SET) == -1) {
 #ifdef ENABLE_CDROM_IMAGE_BACKEND_LOG
@@ -100,6 +123,39 @@ bin_read(void *p, uint8_t *buffer, uint64_t seek, size_t count)
 }
 
 
+static int
+bin_read(void *p, uint8_t *buffer, uint64_t seek, size_t count)
+{
+    track_file_t *tf = (track_file_t *) p;
+    int ret;
+
+    cdrom_image_backend_log("CDROM: binary_read(%08lx, pos=%" PRIu64 " count=%lu\n",
+		     tf->file, seek, count);
+
+    if (tf->file == NULL)
+	return 0;
+
+    if (tf->map != NULL) {
+	if ((seek > tf->length) || (count > (tf->length - seek))) {
+		cdrom_image_backend_log("CDROM: binary_read past the end of the mapping!\n");
+		return 0;
+	}
+	memcpy(buffer, tf->map + seek, count);
+	return 1;
+    }
+
+    /* The emulation thread reads data sectors and the CD audio thread
+       reads audio sectors, possibly through the same file on a mixed
+       mode image, so the file position and the read-ahead buffer are
+       only touched with the lock held. */
+    thread_wait_mutex(tf->mutex);
+    ret = bin_read_file(tf, buffer, seek, count);
+    thread_release_mutex(tf->mutex);
+
+    return ret;
+}
+
+
 static uint64_t
 bin_get_length(void *p)
 {
@@ -119,6 +175,59 @@ bin_get_length(void *p)
 }
 
 
+/* Map the whole file read-only, if asked to and the host can; reads
+   then become a memcpy out of the page cache. Any failure just leaves
+   the file to be read the normal way. */
+static void
+bin_map(track_file_t *tf)
+{
+    if ((tf->length == 0ULL) || ((uint64_t) (size_t) tf->length != tf->length))
+	return;
+
+#ifdef _WIN32
+    tf->map_handle = CreateFileMapping((HANDLE) _get_osfhandle(_fileno(tf->file)),
+				       NULL, PAGE_READONLY, 0, 0, NULL);
+    if (tf->map_handle == NULL)
+	return;
+
+    tf->map = (uint8_t *) MapViewOfFile((HANDLE) tf->map_handle, FILE_MAP_READ, 0, 0, 0);
+    if (tf->map == NULL) {
+	CloseHandle((HANDLE) tf->map_handle);
+	tf->map_handle = NULL;
+    }
+#else
+    tf->map = (uint8_t *) mmap(NULL, (size_t) tf->length, PROT_READ, MAP_SHARED,
+			       fileno(tf->file), 0);
+    if (tf->map == (uint8_t *) MAP_FAILED) {
+	tf->map = NULL;
+	return;
+    }
+# ifdef MADV_SEQUENTIAL
+    madvise(tf->map, (size_t) tf->length, MADV_SEQUENTIAL);
+# endif
+#endif
+
+    cdrom_image_backend_log("CDROM: binary_map(%ls) = %p\n", tf->fn, tf->map);
+}
+
+
+static void
+bin_unmap(track_file_t *tf)
+{
+    if (tf->map == NULL)
+	return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(tf->map);
+    CloseHandle((HANDLE) tf->map_handle);
+    tf->map_handle = NULL;
+#else
+    munmap(tf->map, (size_t) tf->length);
+#endif
+    tf->map = NULL;
+}
+
+
 static void
 bin_close(void *p)
 {
@@ -127,11 +236,23 @@ bin_close(void *p)
     if (tf == NULL)
 	return;
 
+    bin_unmap(tf);
+
+    if (tf->ra_buf != NULL) {
+	free(tf->ra_buf);
+	tf->ra_buf = NULL;
+    }
+
     if (tf->file != NULL) {
 	fclose(tf->file);
 	tf->file = NULL;
     }
 
+    if (tf->mutex != NULL) {
+	thread_close_mutex(tf->mutex);
+	tf->mutex = NULL;
+    }
+
     memset(tf->fn, 0x00, sizeof(tf->fn));
 
     free(p);
@@ -148,7 +269,7 @@ bin_init(const wchar_t *filename, int *error)
 	return NULL;
     }
 
-    memset(tf->fn, 0x00, sizeof(tf->fn));
+    memset(tf, 0x00, sizeof(track_file_t));
     if (wcslen(filename) <= 260)
 	wcscpy(tf->fn, filename);
     else
@@ -163,6 +284,17 @@ bin_init(const wchar_t *filename, int *error)
 	tf->read = bin_read;
 	tf->get_length = bin_get_length;
 	tf->close = bin_close;
+
+	tf->mutex = thread_create_mutex();
+	tf->length = bin_get_length(tf);
+	if (cdrom_mmap)
+		bin_map(tf);
+	if ((tf->map == NULL) && (cdrom_read_ahead > 0)) {
+		tf->ra_size = ((size_t) cdrom_read_ahead) << 10;
+		tf->ra_buf = (uint8_t *) malloc(tf->ra_size);
+		if (tf->ra_buf == NULL)
+			tf->ra_size = 0;
+	}
     } else {
 	free(tf);
 	tf = NULL;
@@ -359,6 +491,20 @@ cdi_get_audio_sub(cd_img_t *cdi, uint32_t sector, uint8_t *attr, uint8_t *track,
 }
 
 
+static int
+cdi_cooked_size(track_t *trk, int track_is_raw)
+{
+    if (trk->mode2 && (trk->form != 1)) {
+	if (trk->form == 2)
+		return (track_is_raw ? 2328 : trk->sector_size);	/* Both 2324 + ECC and 2328 variants are valid. */
+	else
+		return 2336;
+    }
+
+    return COOKED_SECTOR_SIZE;
+}
+
+
 int
 cdi_read_sector(cd_img_t *cdi, uint8_t *buffer, int raw, uint32_t sector)
 {
@@ -384,13 +530,7 @@ cdi_read_sector(cd_img_t *cdi, uint8_t *buffer, int raw, uint32_t sector)
     else
 	raw_size = 2448;
 
-    if (trk->mode2 && (trk->form != 1)) {
-	if (trk->form == 2)
-		cooked_size = (track_is_raw ? 2328 : trk->sector_size);	/* Both 2324 + ECC and 2328 variants are valid. */
-	else
-		cooked_size = 2336;
-    } else
-	cooked_size = COOKED_SECTOR_SIZE;
+    cooked_size = cdi_cooked_size(trk, track_is_raw);
 
     length = (raw ? raw_size : cooked_size);
 
@@ -401,7 +541,8 @@ cdi_read_sector(cd_img_t *cdi, uint8_t *buffer, int raw, uint32_t sector)
 
     if (raw && !track_is_raw) {
 	memset(buffer, 0x00, 2448);
-    	ret = trk->file->read(trk->file, buffer + offset, seek, length);
+	/* Only the user data is in the file, the rest is made up below. */
+    	ret = trk->file->read(trk->file, buffer + offset, seek, cooked_size);
 	if (!ret)
 		return 0;
 	/* Construct the rest of the raw sector. */
@@ -421,30 +562,54 @@ cdi_read_sector(cd_img_t *cdi, uint8_t *buffer, int raw, uint32_t sector)
 }
 
 
+/* Read num consecutive sectors into buffer, RAW_SECTOR_SIZE bytes apart
+   if raw is set, or the track's cooked sector size apart otherwise. Runs
+   whose layout in the file matches the requested one are read with a
+   single host read per track; anything else goes a sector at a time. */
 int
 cdi_read_sectors(cd_img_t *cdi, uint8_t *buffer, int raw, uint32_t sector, uint32_t num)
 {
-    int sector_size, success = 1;
-    uint8_t buf_len, *buf;
-    uint32_t i;
-
-    /* TODO: This fails to account for Mode 2. Shouldn't we have a function 
-	     to get sector size? */
-    sector_size = raw ? RAW_SECTOR_SIZE : COOKED_SECTOR_SIZE;
-    buf_len = num * sector_size;
-    buf = (uint8_t *) malloc(buf_len * sizeof(uint8_t));
-
-    for (i = 0; i < num; i++) {
-	success = cdi_read_sector(cdi, &buf[i * sector_size], raw, sector + i);
-	if (!success)
-		break;
-    }
+    uint8_t buf[2448];
+    track_t *trk;
+    int track, track_is_raw, stride;
+    uint64_t seek;
+    uint32_t i, run;
 
-    memcpy((void *) buffer, buf, buf_len);
-    free(buf);
-    buf = NULL;
+    while (num > 0) {
+	track = cdi_get_track(cdi, sector) - 1;
+	if (track < 0)
+		return 0;
 
-    return success;
+	trk = &cdi->tracks[track];
+	track_is_raw = ((trk->sector_size == RAW_SECTOR_SIZE) || (trk->sector_size == 2448));
+	stride = raw ? RAW_SECTOR_SIZE : cdi_cooked_size(trk, track_is_raw);
+
+	/* cdi_get_track() never returns the lead out, so there is always
+	   a next track to bound the run. */
+	run = (uint32_t) (cdi->tracks[track + 1].start - sector);
+	if (run > num)
+		run = num;
+
+	if ((raw && (trk->sector_size == RAW_SECTOR_SIZE)) ||
+	    (!raw && !track_is_raw && (trk->sector_size == stride))) {
+		seek = trk->skip + (((uint64_t) sector - trk->start) * trk->sector_size);
+		if (!trk->file->read(trk->file, buffer, seek, (size_t) run * stride))
+			return 0;
+		buffer += (size_t) run * stride;
+	} else {
+		for (i = 0; i < run; i++) {
+			if (!cdi_read_sector(cdi, buf, raw, sector + i))
+				return 0;
+			memcpy(buffer, buf, stride);
+			buffer += stride;
+		}
+	}
+
+	sector += run;
+	num -= run;
+    }
+
+    return 1;
 }
 
 
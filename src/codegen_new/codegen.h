@@ -28,8 +28,59 @@
   The 64 byte granularity appears to work reasonably well for most cases,
   avoiding most unnecessary evictions (eg when code & data are stored in the
   same page).
+
+  Block linking :
+
+  Each codeblock ends in CODEBLOCK_LINKS link exits, each comparing EIP with
+  the block it was last seen to exit to and jumping straight into that block's
+  code if they match. A link exit is only taken if codegen_link_rout finds
+  that nothing has to be done between blocks - no abort, pending interrupt,
+  SMI or NMI, cycles left before the next timer is due, and the same CS and
+  CPU status that the dispatcher last entered a block with. Otherwise, or if
+  no exit matches, the block leaves through exec386_dynarec_link(), which does
+  the work between blocks and either returns to exec386_dynarec_dyn() or, if
+  one of the linked blocks checks out, jumps to it.
+
+  An exit is only patched to jump to a block with the same CS and status, and
+  only while neither of the block's pages is in the evict list. Incoming exits
+  are listed on the target block, and are patched back to exec386_dynarec_link()
+  when the target is deleted or invalidated, or when a write to either of its
+  pages puts that page in the evict list. Exits into a block on another linear
+  page, or one that spans two pages, are also patched back by codegen_flush()
+  whenever the TLB is flushed, as the page could now be mapped elsewhere; one
+  within the page can stay, as the block it leaves was reached through a
+  checked mapping of the same page. Blocks with a static FPU top-of-stack are
+  never linked to directly, as that would need TOP checked too.
+
+  Background compilation :
+
+  With codegen_async_compile set, codegen_block_end_recompile() does not
+  compile the block itself. The IR has to be built on the emulation thread, as
+  it is generated while the block's instructions are interpreted, but register
+  allocation and host code generation are handed to the compile thread. The
+  block is marked CODEBLOCK_IN_COMPILE until codegen_compile_poll() sees that
+  the compile thread is done and sets CODEBLOCK_WAS_RECOMPILED. Only one block
+  is compiled at a time, as the IR and register allocator state is global;
+  while the compile thread is busy, blocks that would be recompiled are
+  interpreted instead. Anything that deletes or invalidates the block being
+  compiled waits for the compile thread first.
+
+  Persistent code cache :
+
+  With codegen_cache_enabled set, the blocks compiled in a session are saved to
+  dynarec.cache on exit, keyed by physical address, CS:EIP and CPU status, with
+  their code masks and a hash of the guest bytes they cover. When a block that
+  is not in the code cache is about to be run and an entry matches with the
+  guest bytes still hashing the same, it is taken from the file. On backends
+  that report relocations (only x86-64 so far, see codegen_backend.h) the saved
+  code is copied and relocated, so the block is not translated at all.
+  Otherwise, or if the code can't be used this time round, the entry is only a
+  hint to compile the block straight away rather than interpreting and marking
+  it first.
 */
 
+#define CODEBLOCK_LINKS 2
+
 typedef struct codeblock_t
 {
         uint32_t pc;
@@ -58,6 +109,23 @@ typedef struct codeblock_t
         /*First mem_block_t used by this block. Any subsequent mem_block_ts
           will be in the list starting at head_mem_block->next.*/
         struct mem_block_t *head_mem_block;
+
+        /*Blocks this block has exited to, and the slot to replace next.*/
+        uint16_t link[CODEBLOCK_LINKS];
+        uint8_t link_next;
+        /*Link exits patched to jump straight to link[], and those on the
+          list patched back by codegen_flush()*/
+        uint8_t link_patched, link_far;
+        /*First link exit, set by codegen_backend_epilogue()*/
+        uint8_t *link_exit;
+        /*Link exits jumping to this block, as block number * CODEBLOCK_LINKS +
+          exit number. Each exit holds the next one in link_in_next[]*/
+        uint32_t link_in;
+        uint32_t link_in_next[CODEBLOCK_LINKS];
+
+        /*Times entered since the eviction clock last passed, saturating. See
+          codegen_allocator.h*/
+        uint8_t usage;
 } codeblock_t;
 
 extern codeblock_t *codeblock;
@@ -66,6 +134,23 @@ extern uint16_t *codeblock_hash;
 
 extern uint8_t *block_write_data;
 
+/*What codegen_link_rout checks before taking a link exit, set up by
+  exec386_dynarec whenever it enters a block*/
+typedef struct codegen_link_state_t
+{
+        /*Block that last left through its link exits, 0 after any other exit*/
+        int block;
+        /*Link exits are taken while cycles is above this and timer_target is
+          unchanged*/
+        int cycle_limit;
+        uint32_t timer;
+        /*CS base and cpu_cur_status of the block entered*/
+        uint32_t cs_base;
+        uint16_t status;
+} codegen_link_state_t;
+
+extern codegen_link_state_t codegen_link;
+
 /*Code block uses FPU*/
 #define CODEBLOCK_HAS_FPU 1
 /*Code block is always entered with the same FPU top-of-stack*/
@@ -82,6 +167,11 @@ extern uint8_t *block_write_data;
 #define CODEBLOCK_IN_DIRTY_LIST 0x40
 /*Code block is not inlining immediate parameters, parameters must be fetched from memory*/
 #define CODEBLOCK_NO_IMMEDIATES 0x80
+/*Code block is being compiled by the compile thread and can not be run yet*/
+#define CODEBLOCK_IN_COMPILE 0x100
+/*Code block did not fit in the compile thread's memory reserve, compile it on
+  the emulation thread*/
+#define CODEBLOCK_SYNC_COMPILE 0x200
 
 #define BLOCK_PC_INVALID 0xffffffff
 
@@ -323,6 +413,24 @@ void codegen_block_start_recompile(codeblock_t *block);
 void codegen_block_end_recompile(codeblock_t *block);
 void codegen_block_end();
 void codegen_delete_block(codeblock_t *block);
+void codegen_block_link(codeblock_t *block, codeblock_t *next);
+void codegen_block_unlink(codeblock_t *block);
+void codegen_compile_poll();
+int codegen_compile_busy();
+codeblock_t *codegen_block_init_hinted(uint32_t phys_addr, int flags, uint32_t endpc);
+codeblock_t *codegen_block_init_cached(uint32_t phys_addr, int flags, uint64_t page_mask, uint64_t page_mask2, uint32_t endpc);
+void codegen_cache_load();
+void codegen_cache_save();
+codeblock_t *codegen_cache_lookup(uint32_t phys_addr);
+extern int codegen_profile_enabled;
+void codegen_profile_init();
+void codegen_profile_enter(int block_nr);
+void codegen_profile_leave();
+void codegen_profile_compile(codeblock_t *block, int uops, uint64_t time);
+void codegen_profile_invalidate(codeblock_t *block);
+void codegen_profile_retire(codeblock_t *block);
+void codegen_profile_dump();
+void codegen_profile_poll();
 void codegen_generate_call(uint8_t opcode, OpFn op, uint32_t fetchdat, uint32_t new_pc, uint32_t old_pc);
 void codegen_generate_seg_restore();
 void codegen_set_op32();
@@ -334,9 +442,18 @@ void codegen_check_seg_read(codeblock_t *block, struct ir_data_t *ir, x86seg *se
 void codegen_check_seg_write(codeblock_t *block, struct ir_data_t *ir, x86seg *seg);
 
 int codegen_purge_purgable_list();
-/*Delete a random code block to free memory. This is obviously quite expensive, and
-  will only be called when the allocator is out of memory*/
-void codegen_delete_random_block(int required_mem_block);
+/*Delete a code block to free memory, and remember that it was evicted*/
+void codegen_evict_block(codeblock_t *block);
+/*Evict the first code block found by the eviction clock that has not been run
+  since the clock last passed it. This is quite expensive, and will only be
+  called when there are no free code blocks*/
+void codegen_evict_cold_block(int required_mem_block);
+
+static inline void codegen_block_touch(codeblock_t *block)
+{
+        if (block->usage != 0xff)
+                block->usage++;
+}
 
 extern int cpu_block_end;
 extern uint32_t codegen_endpc;
@@ -23,47 +23,118 @@ typedef struct mem_block_t
         uint16_t code_block;
 } mem_block_t;
 
-static mem_block_t mem_blocks[MEM_BLOCK_NR];
+static mem_block_t *mem_blocks = NULL;
 static uint32_t mem_block_free_list;
 static uint8_t *mem_block_alloc = NULL;
+static uint32_t mem_block_hand; /*Next memory block looked at by the eviction clock*/
 
 int codegen_allocator_usage = 0;
+int codegen_allocator_nr = MEM_BLOCK_NR; /*Memory blocks in use, including the scratch block*/
+int codegen_code_cache_size = 0; /*MB, 0 for the default size*/
+
+/*Memory blocks set aside for the compile thread. The compile thread can not
+  evict code blocks to make room, so the emulation thread tops the reserve up
+  before handing it a block, and while codegen_allocator_use_reserve is set all
+  allocations come from here. If the reserve runs out, the last memory block
+  (which is never handed out otherwise) is returned as scratch space and
+  codegen_allocator_overflow is set; the generated code must then be thrown
+  away.*/
+static uint32_t mem_block_reserve_list;
+static int mem_block_reserve_size;
+int codegen_allocator_use_reserve = 0;
+int codegen_allocator_overflow = 0;
 
 void codegen_allocator_init()
 {
         int c;
 
+        codegen_allocator_nr = MEM_BLOCK_NR;
+        if (codegen_code_cache_size)
+        {
+                uint64_t nr = ((uint64_t)codegen_code_cache_size << 20) / MEM_BLOCK_SIZE;
+
+                if (nr > MEM_BLOCK_MAX)
+                        nr = MEM_BLOCK_MAX;
+                codegen_allocator_nr = (nr < MEM_BLOCK_MIN) ? MEM_BLOCK_MIN : nr;
+        }
+
+        mem_blocks = malloc(codegen_allocator_nr * sizeof(mem_block_t));
+        if (!mem_blocks)
+                fatal("codegen_allocator_init: can not allocate %i memory blocks\n", codegen_allocator_nr);
+
 #if defined WIN32 || defined _WIN32 || defined _WIN32
-        mem_block_alloc = VirtualAlloc(NULL, MEM_BLOCK_NR * MEM_BLOCK_SIZE, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+        mem_block_alloc = VirtualAlloc(NULL, codegen_allocator_nr * MEM_BLOCK_SIZE, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
 #else
-        mem_block_alloc = mmap(0, MEM_BLOCK_NR * MEM_BLOCK_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_ANON|MAP_PRIVATE, 0, 0);
+        mem_block_alloc = mmap(0, codegen_allocator_nr * MEM_BLOCK_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_ANON|MAP_PRIVATE, 0, 0);
+        if (mem_block_alloc == MAP_FAILED)
+                mem_block_alloc = NULL;
 #endif
+        if (!mem_block_alloc)
+                fatal("codegen_allocator_init: can not allocate %i MB of code memory\n", (codegen_allocator_nr * MEM_BLOCK_SIZE) >> 20);
 
-        for (c = 0; c < MEM_BLOCK_NR; c++)
+        for (c = 0; c < codegen_allocator_nr; c++)
         {
                 mem_blocks[c].offset = c * MEM_BLOCK_SIZE;
                 mem_blocks[c].code_block = BLOCK_INVALID;
-                if (c < MEM_BLOCK_NR-1)
+                if (c < codegen_allocator_nr-2)
                         mem_blocks[c].next = c+2;
                 else
                         mem_blocks[c].next = 0;
         }
+        mem_blocks[codegen_allocator_nr-1].next = 0; /*Scratch block*/
         mem_block_free_list = 1;
+        mem_block_reserve_list = 0;
+        mem_block_reserve_size = 0;
+        mem_block_hand = 0;
 }
 
 mem_block_t *codegen_allocator_allocate(mem_block_t *parent, int code_block)
 {
         mem_block_t *block;
         uint32_t block_nr;
-        
+
+        if (codegen_allocator_use_reserve)
+        {
+                if (!mem_block_reserve_list)
+                {
+                        codegen_allocator_overflow = 1;
+                        return &mem_blocks[codegen_allocator_nr-1];
+                }
+
+                /*Remove from reserve, already counted in codegen_allocator_usage*/
+                block_nr = mem_block_reserve_list;
+                block = &mem_blocks[block_nr-1];
+                mem_block_reserve_list = block->next;
+                mem_block_reserve_size--;
+
+                block->code_block = code_block;
+                if (parent)
+                {
+                        block->next = parent->next;
+                        parent->next = block_nr;
+                }
+                else
+                        block->next = 0;
+                return block;
+        }
+
         while (!mem_block_free_list)
         {
-                /*Pick a random memory block and free the owning code block*/
-                block_nr = rand() & MEM_BLOCK_MASK;
-                block = &mem_blocks[block_nr];
-                
+                /*Advance the clock, and free the owning code block if it has
+                  not been run since the hand last passed it*/
+                block = &mem_blocks[mem_block_hand];
+                if (++mem_block_hand >= codegen_allocator_nr-1)
+                        mem_block_hand = 0;
+
                 if (block->code_block && block->code_block != code_block)
-                        codegen_delete_block(&codeblock[block->code_block]);
+                {
+                        codeblock_t *owner = &codeblock[block->code_block];
+
+                        if (owner->usage)
+                                owner->usage >>= 1;
+                        else
+                                codegen_evict_block(owner);
+                }
         }
 
         /*Remove from free list*/
@@ -105,6 +176,22 @@ void codegen_allocator_free(mem_block_t *block)
         }
 }
 
+/*Top the reserve up to nr blocks, evicting code blocks other than code_block if
+  required*/
+void codegen_allocator_reserve(int nr, int code_block)
+{
+        while (mem_block_reserve_size < nr)
+        {
+                mem_block_t *block = codegen_allocator_allocate(NULL, code_block);
+                uint32_t block_nr = (((uintptr_t)block - (uintptr_t)mem_blocks) / sizeof(mem_block_t)) + 1;
+
+                block->code_block = BLOCK_INVALID;
+                block->next = mem_block_reserve_list;
+                mem_block_reserve_list = block_nr;
+                mem_block_reserve_size++;
+        }
+}
+
 uint8_t *codeblock_allocator_get_ptr(mem_block_t *block)
 {
         return &mem_block_alloc[block->offset];
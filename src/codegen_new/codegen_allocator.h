@@ -12,14 +12,34 @@
   
   Due to the chaining, the total memory size is limited by the range of a jump
   instruction. ARMv7 is restricted to +/- 32 MB, ARMv8 to +/- 128 MB, x86 to
-  +/- 2GB. As a result, total memory size is limited to 32 MB on ARMv7*/
+  +/- 2GB. As a result, total memory size is limited to 32 MB on ARMv7.
+
+  MEM_BLOCK_NR is the default number of blocks; codegen_code_cache_size (in MB)
+  can set any size from MEM_BLOCK_MIN up to MEM_BLOCK_MAX at startup. On x86-64
+  MEM_BLOCK_MAX is 1 GB, well within the jump range. Elsewhere it is the
+  default size, either because of the jump range (ARM) or the host address
+  space (32-bit x86). The x86 and x86-64 backends have 64k code blocks
+  (BLOCK_SIZE), so that a larger cache is not just left empty.
+  
+  When no block is free, code blocks are evicted by a clock sweep over memory
+  blocks. Each code block has a saturating usage count, bumped every time it is
+  entered; the sweep halves the count of the owning code block and evicts it
+  once the count has reached zero, so code that keeps being run survives while
+  code that has gone cold is reclaimed.*/
 #if defined __ARM_EABI__ || _ARM_
 #define MEM_BLOCK_NR 32768
 #else
 #define MEM_BLOCK_NR 131072
 #endif
+#ifdef __amd64__
+#define MEM_BLOCK_MAX ((1 << 30) / MEM_BLOCK_SIZE)
+#else
+#define MEM_BLOCK_MAX MEM_BLOCK_NR
+#endif
+/*Smallest usable code cache. The backend routines and the compile thread's
+  reserve must fit with room to spare*/
+#define MEM_BLOCK_MIN 4096
 
-#define MEM_BLOCK_MASK (MEM_BLOCK_NR-1)
 #define MEM_BLOCK_SIZE 0x3c0
 
 void codegen_allocator_init();
@@ -29,11 +49,17 @@ void codegen_allocator_init();
 struct mem_block_t *codegen_allocator_allocate(struct mem_block_t *parent, int code_block);
 /*Free a mem_block_t, and any subsequent blocks in the list at block->next*/
 void codegen_allocator_free(struct mem_block_t *block);
+/*Set aside nr blocks for the compile thread, evicting code blocks other than
+  code_block if required*/
+void codegen_allocator_reserve(int nr, int code_block);
 /*Get a pointer to the backing memory associated with block*/
 uint8_t *codeblock_allocator_get_ptr(struct mem_block_t *block);
 /*Cache clean memory block list*/
 void codegen_allocator_clean_blocks(struct mem_block_t *block);
 
 extern int codegen_allocator_usage;
+extern int codegen_allocator_nr;
+extern int codegen_allocator_use_reserve;
+extern int codegen_allocator_overflow;
 
 #endif
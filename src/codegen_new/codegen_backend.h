@@ -16,6 +16,37 @@
 void codegen_backend_init();
 void codegen_backend_prologue(codeblock_t *block);
 void codegen_backend_epilogue(codeblock_t *block);
+/*Patch link exit nr of block to jump to next, or back to the slow path if
+  next is NULL. See codegen_link.c*/
+void codegen_backend_link(codeblock_t *block, int nr, codeblock_t *next);
+
+/*Relocations, so that generated code can be saved by the persistent code cache
+  (see codegen_cache.c) and run again at another address in a later session. A
+  backend that supports this passes its shared routines to codegen_reloc_init()
+  from codegen_backend_init(), reports every address it puts in a block through
+  codegen_reloc(), and calls codegen_reloc_end() at the end of the epilogue.
+  Blocks of other backends are only saved as compile hints*/
+enum
+{
+        RELOC_REL32,    /*32-bit displacement at site, from the end of the field*/
+        RELOC_ABS64,    /*64-bit address at site*/
+        RELOC_BASE,     /*Addressed relative to the cpu_state pointer the prologue sets up*/
+        RELOC_BLOCK_NR, /*32-bit block number at site*/
+        RELOC_FIXED     /*Address that can't be relocated, the block can't be saved*/
+};
+
+extern int codegen_reloc_enabled;
+
+void codegen_reloc_init(void **routines, int nr);
+void codegen_reloc_start(codeblock_t *block);
+void codegen_reloc_add(codeblock_t *block, int type, void *site, void *target);
+void codegen_reloc_end(codeblock_t *block, void *end);
+
+static inline void codegen_reloc(codeblock_t *block, int type, void *site, void *target)
+{
+        if (codegen_reloc_enabled)
+                codegen_reloc_add(block, type, site, target);
+}
 
 struct ir_data_t;
 struct uop_t;
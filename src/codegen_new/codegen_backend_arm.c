@@ -1,10 +1,14 @@
 #if defined __ARM_EABI__ || defined _ARM_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <86box/86box.h>
 #include "cpu.h"
 #include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include <86box/timer.h>
 
 #include "codegen.h"
 #include "codegen_allocator.h"
@@ -41,6 +45,15 @@ void *codegen_fp_round;
 
 void *codegen_gpf_rout;
 void *codegen_exit_rout;
+static void *codegen_link_exit;
+static void *codegen_link_rout;
+
+/*Link exits start after the prologue has pushed the host registers and set up
+  the stack frame, which the block jumping there has already done*/
+#define BLOCK_LINK_START 8
+
+/*MOVW R2, pc ; MOVT R2, pc >> 16 ; CMP R1, R2 ; BEQ block*/
+#define LINK_EXIT_SIZE 16
 
 host_reg_def_t codegen_host_reg_list[CODEGEN_HOST_REGS] =
 {
@@ -289,9 +302,82 @@ static void build_fp_round_routine(codeblock_t *block)
 	host_arm_MOV_REG(block, REG_PC, REG_LR);
 }
 
+/*Called by the epilogue of every block, with R0 = block number. Returns with
+  R1 = EIP if the block can go on to a linked block directly, otherwise leaves
+  through codegen_link_exit. This makes the same checks exec386_dynarec_link()
+  makes between blocks*/
+static void build_link_routine(codeblock_t *block)
+{
+        uint32_t *fail_offset[7];
+        uint32_t *branch_offset;
+        int c;
+
+	codegen_alloc(block, 64);
+        codegen_link_rout = &block_write_data[block_pos];
+	host_arm_MOV_IMM(block, REG_R2, (uintptr_t)&codegen_link);
+	host_arm_STR_IMM(block, REG_R0, REG_R2, offsetof(codegen_link_state_t, block));
+
+	/*No timer due*/
+	host_arm_LDR_IMM(block, REG_R1, REG_CPUSTATE, (uintptr_t)&cycles - (uintptr_t)&cpu_state);
+	host_arm_LDR_IMM(block, REG_R3, REG_R2, offsetof(codegen_link_state_t, cycle_limit));
+	host_arm_CMP_REG(block, REG_R1, REG_R3);
+	fail_offset[0] = host_arm_BLE_(block);
+	host_arm_MOV_IMM(block, REG_R3, (uintptr_t)&timer_target);
+	host_arm_LDR_IMM(block, REG_R1, REG_R3, 0);
+	host_arm_LDR_IMM(block, REG_R3, REG_R2, offsetof(codegen_link_state_t, timer));
+	host_arm_CMP_REG(block, REG_R1, REG_R3);
+	fail_offset[1] = host_arm_BNE_(block);
+
+	/*Same CS and CPU status as the linked blocks were compiled with*/
+	host_arm_LDR_IMM(block, REG_R1, REG_CPUSTATE, (uintptr_t)&cs - (uintptr_t)&cpu_state);
+	host_arm_LDR_IMM(block, REG_R3, REG_R2, offsetof(codegen_link_state_t, cs_base));
+	host_arm_CMP_REG(block, REG_R1, REG_R3);
+	fail_offset[2] = host_arm_BNE_(block);
+	host_arm_MOV_IMM(block, REG_R3, (uintptr_t)&cpu_cur_status);
+	host_arm_LDRH_IMM(block, REG_R1, REG_R3, 0);
+	host_arm_LDRH_IMM(block, REG_R3, REG_R2, offsetof(codegen_link_state_t, status));
+	host_arm_CMP_REG(block, REG_R1, REG_R3);
+	fail_offset[3] = host_arm_BNE_(block);
+
+	/*No abort, SMI or NMI, cache on*/
+	host_arm_LDRB_IMM(block, REG_R1, REG_CPUSTATE, (uintptr_t)&cpu_state.abrt - (uintptr_t)&cpu_state);
+	host_arm_MOV_IMM(block, REG_R3, (uintptr_t)&smi_line);
+	host_arm_LDR_IMM(block, REG_R3, REG_R3, 0);
+	host_arm_ORR_REG_LSL(block, REG_R1, REG_R1, REG_R3, 0);
+	host_arm_MOV_IMM(block, REG_R3, (uintptr_t)&nmi);
+	host_arm_LDR_IMM(block, REG_R3, REG_R3, 0);
+	host_arm_ORR_REG_LSL(block, REG_R1, REG_R1, REG_R3, 0);
+	host_arm_LDR_IMM(block, REG_R3, REG_CPUSTATE, (uintptr_t)&cr0 - (uintptr_t)&cpu_state);
+	host_arm_AND_IMM(block, REG_R3, REG_R3, 1 << 30);
+	host_arm_ORR_REG_LSL(block, REG_R1, REG_R1, REG_R3, 0);
+	host_arm_CMP_IMM(block, REG_R1, 0);
+	fail_offset[4] = host_arm_BNE_(block);
+
+	/*No single step, and no interrupt to take*/
+	host_arm_LDRH_IMM(block, REG_R1, REG_CPUSTATE, (uintptr_t)&cpu_state.flags - (uintptr_t)&cpu_state);
+	host_arm_TST_IMM(block, REG_R1, T_FLAG);
+	fail_offset[5] = host_arm_BNE_(block);
+	host_arm_TST_IMM(block, REG_R1, I_FLAG);
+	branch_offset = host_arm_BEQ_(block);
+	host_arm_MOV_IMM(block, REG_R3, (uintptr_t)&pic.int_pending);
+	host_arm_LDRB_IMM(block, REG_R3, REG_R3, 0);
+	host_arm_CMP_IMM(block, REG_R3, 0);
+	fail_offset[6] = host_arm_BNE_(block);
+        *branch_offset |= ((((uintptr_t)&block_write_data[block_pos] - (uintptr_t)branch_offset) - 8) & 0x3fffffc) >> 2;
+
+	host_arm_LDR_IMM(block, REG_R1, REG_CPUSTATE, (uintptr_t)&cpu_state.pc - (uintptr_t)&cpu_state);
+	host_arm_MOV_REG(block, REG_PC, REG_LR);
+
+	codegen_alloc(block, 4);
+	for (c = 0; c < 7; c++)
+	        *fail_offset[c] |= ((((uintptr_t)&block_write_data[block_pos] - (uintptr_t)fail_offset[c]) - 8) & 0x3fffffc) >> 2;
+	host_arm_B(block, (uintptr_t)codegen_link_exit);
+}
+
 void codegen_backend_init()
 {
 	codeblock_t *block;
+        uint32_t *branch_offset;
         int c;
 
 	codeblock = malloc(BLOCK_SIZE * sizeof(codeblock_t));
@@ -321,9 +407,25 @@ printf("block_pos=%i\n", block_pos);
 	host_arm_MOV_IMM(block, REG_R1, 0);
 	host_arm_call(block, x86gpf);
 
+        /*All blocks leave through here. exec386_dynarec_link() returns the
+          next block to run, or NULL to return to the dispatcher. Blocks leaving
+          through their link exits enter at codegen_link_exit, with the block
+          number stored in codegen_link.block*/
         codegen_exit_rout = &block_write_data[block_pos];
+	host_arm_MOV_IMM(block, REG_R2, (uintptr_t)&codegen_link);
+	host_arm_MOV_IMM(block, REG_R0, 0);
+	host_arm_STR_IMM(block, REG_R0, REG_R2, offsetof(codegen_link_state_t, block));
+        codegen_link_exit = &block_write_data[block_pos];
+	host_arm_call(block, exec386_dynarec_link);
 	host_arm_ADD_IMM(block, REG_HOST_SP, REG_HOST_SP, 0x40);
-	host_arm_LDMIA_WB(block, REG_HOST_SP, REG_MASK_LOCAL | REG_MASK_PC);
+	host_arm_LDMIA_WB(block, REG_HOST_SP, REG_MASK_LOCAL | REG_MASK_LR);
+	host_arm_CMP_IMM(block, REG_R0, 0);
+	branch_offset = host_arm_BEQ_(block);
+	host_arm_MOV_REG(block, REG_PC, REG_R0);
+        *branch_offset |= ((((uintptr_t)&block_write_data[block_pos] - (uintptr_t)branch_offset) - 8) & 0x3fffffc) >> 2;
+	host_arm_MOV_REG(block, REG_PC, REG_LR);
+
+	build_link_routine(block);
 
         block_write_data = NULL;
 //fatal("block_pos=%i\n", block_pos);
@@ -350,6 +452,10 @@ void codegen_backend_prologue(codeblock_t *block)
 
 	host_arm_STMDB_WB(block, REG_HOST_SP, REG_MASK_LOCAL | REG_MASK_LR);
 	host_arm_SUB_IMM(block, REG_HOST_SP, REG_HOST_SP, 0x40);
+#ifndef RELEASE_BUILD
+	if (block_pos != BLOCK_LINK_START)
+		fatal("codegen_backend_prologue - link start %i\n", block_pos);
+#endif
 	host_arm_MOV_IMM(block, REG_CPUSTATE, (uint32_t)&cpu_state);
         if (block->flags & CODEBLOCK_HAS_FPU)
         {
@@ -361,10 +467,41 @@ void codegen_backend_prologue(codeblock_t *block)
 
 void codegen_backend_epilogue(codeblock_t *block)
 {
-	host_arm_ADD_IMM(block, REG_HOST_SP, REG_HOST_SP, 0x40);
-	host_arm_LDMIA_WB(block, REG_HOST_SP, REG_MASK_LOCAL | REG_MASK_PC);
+	int c;
+
+	host_arm_MOV_IMM(block, REG_R0, get_block_nr(block));
+	host_arm_BL(block, (uintptr_t)codegen_link_rout);
+
+	codegen_alloc(block, LINK_EXIT_SIZE * CODEBLOCK_LINKS + 4);
+	block->link_exit = &block_write_data[block_pos];
+	for (c = 0; c < CODEBLOCK_LINKS; c++)
+	{
+		host_arm_MOVW_IMM(block, REG_R2, 0);
+		host_arm_MOVT_IMM(block, REG_R2, 0);
+		host_arm_CMP_REG(block, REG_R1, REG_R2);
+		host_arm_BEQ(block, (uintptr_t)codegen_link_exit);
+	}
+	host_arm_B(block, (uintptr_t)codegen_link_exit);
 
 	codegen_allocator_clean_blocks(block->head_mem_block);
 }
 
+void codegen_backend_link(codeblock_t *block, int nr, codeblock_t *next)
+{
+	uint32_t *link_exit = (uint32_t *)&block->link_exit[nr * LINK_EXIT_SIZE];
+	uint32_t pc = next ? (next->pc - next->_cs) : 0;
+	uintptr_t dest = next ? (uintptr_t)&next->data[BLOCK_LINK_START] : (uintptr_t)codegen_link_exit;
+	uint32_t offset = (dest - (uintptr_t)&link_exit[3]) - 8;
+
+	if ((offset & 0xfe000000) && (offset & 0xfe000000) != 0xfe000000)
+		fatal("codegen_backend_link - out of range %08x\n", offset);
+
+	/*Replace the immediates of the MOVW and MOVT, and the offset of the BEQ*/
+	link_exit[0] = (link_exit[0] & ~0x000f0fff) | (pc & 0xfff) | ((pc & 0xf000) << 4);
+	link_exit[1] = (link_exit[1] & ~0x000f0fff) | ((pc >> 16) & 0xfff) | ((pc >> 12) & 0xf0000);
+	link_exit[3] = (link_exit[3] & 0xff000000) | ((offset >> 2) & 0xffffff);
+
+	__clear_cache(link_exit, &link_exit[LINK_EXIT_SIZE / 4]);
+}
+
 #endif
@@ -1,10 +1,14 @@
 #ifdef __aarch64__
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <86box/86box.h>
 #include "cpu.h"
 #include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include <86box/timer.h>
 
 #include "codegen.h"
 #include "codegen_allocator.h"
@@ -42,6 +46,15 @@ void *codegen_fp_round_quad;
 
 void *codegen_gpf_rout;
 void *codegen_exit_rout;
+static void *codegen_link_exit;
+static void *codegen_link_rout;
+
+/*Link exits start after the prologue has pushed the host registers, which the
+  block jumping there has already done*/
+#define BLOCK_LINK_START 24
+
+/*MOVZ W2, pc ; MOVK W2, pc >> 16 ; CMP W1, W2 ; B.NE next exit ; B block*/
+#define LINK_EXIT_SIZE 20
 
 host_reg_def_t codegen_host_reg_list[CODEGEN_HOST_REGS] =
 {
@@ -278,6 +291,77 @@ static void build_fp_round_routine(codeblock_t *block, int is_quad)
 	host_arm64_RET(block, REG_X30);
 }
 
+/*Called by the epilogue of every block, with W0 = block number. Returns with
+  W1 = EIP if the block can go on to a linked block directly, otherwise leaves
+  through codegen_link_exit. This makes the same checks exec386_dynarec_link()
+  makes between blocks*/
+static void build_link_routine(codeblock_t *block)
+{
+        uint32_t *fail_offset[7];
+        uint32_t *branch_offset;
+        int c;
+
+        codegen_link_rout = &block_write_data[block_pos];
+        host_arm64_MOVX_IMM(block, REG_X2, (uintptr_t)&codegen_link);
+        host_arm64_STR_IMM_W(block, REG_W0, REG_X2, offsetof(codegen_link_state_t, block));
+
+        /*No timer due*/
+        host_arm64_LDR_IMM_W(block, REG_W1, REG_CPUSTATE, (uintptr_t)&cycles - (uintptr_t)&cpu_state);
+        host_arm64_LDR_IMM_W(block, REG_W3, REG_X2, offsetof(codegen_link_state_t, cycle_limit));
+        host_arm64_CMP_REG(block, REG_W1, REG_W3);
+        fail_offset[0] = host_arm64_BLE_(block);
+        host_arm64_MOVX_IMM(block, REG_X3, (uintptr_t)&timer_target);
+        host_arm64_LDR_IMM_W(block, REG_W1, REG_X3, 0);
+        host_arm64_LDR_IMM_W(block, REG_W3, REG_X2, offsetof(codegen_link_state_t, timer));
+        host_arm64_CMP_REG(block, REG_W1, REG_W3);
+        fail_offset[1] = host_arm64_BNE_(block);
+
+        /*Same CS and CPU status as the linked blocks were compiled with*/
+        host_arm64_LDR_IMM_W(block, REG_W1, REG_CPUSTATE, (uintptr_t)&cs - (uintptr_t)&cpu_state);
+        host_arm64_LDR_IMM_W(block, REG_W3, REG_X2, offsetof(codegen_link_state_t, cs_base));
+        host_arm64_CMP_REG(block, REG_W1, REG_W3);
+        fail_offset[2] = host_arm64_BNE_(block);
+        host_arm64_MOVX_IMM(block, REG_X3, (uintptr_t)&cpu_cur_status);
+        host_arm64_LDRH_IMM(block, REG_W1, REG_X3, 0);
+        host_arm64_LDRH_IMM(block, REG_W3, REG_X2, offsetof(codegen_link_state_t, status));
+        host_arm64_CMP_REG(block, REG_W1, REG_W3);
+        fail_offset[3] = host_arm64_BNE_(block);
+
+        /*No abort, SMI or NMI, cache on*/
+        host_arm64_LDRB_IMM_W(block, REG_W1, REG_CPUSTATE, (uintptr_t)&cpu_state.abrt - (uintptr_t)&cpu_state);
+        host_arm64_MOVX_IMM(block, REG_X3, (uintptr_t)&smi_line);
+        host_arm64_LDR_IMM_W(block, REG_W3, REG_X3, 0);
+        host_arm64_ORR_REG(block, REG_W1, REG_W1, REG_W3, 0);
+        host_arm64_MOVX_IMM(block, REG_X3, (uintptr_t)&nmi);
+        host_arm64_LDR_IMM_W(block, REG_W3, REG_X3, 0);
+        host_arm64_ORR_REG(block, REG_W1, REG_W1, REG_W3, 0);
+        host_arm64_LDR_IMM_W(block, REG_W3, REG_CPUSTATE, (uintptr_t)&cr0 - (uintptr_t)&cpu_state);
+        host_arm64_AND_IMM(block, REG_W3, REG_W3, 1 << 30);
+        host_arm64_ORR_REG(block, REG_W1, REG_W1, REG_W3, 0);
+        host_arm64_CMP_IMM(block, REG_W1, 0);
+        fail_offset[4] = host_arm64_BNE_(block);
+
+        /*No single step, and no interrupt to take*/
+        host_arm64_LDRH_IMM(block, REG_W1, REG_CPUSTATE, (uintptr_t)&cpu_state.flags - (uintptr_t)&cpu_state);
+        host_arm64_TST_IMM(block, REG_W1, T_FLAG);
+        fail_offset[5] = host_arm64_BNE_(block);
+        host_arm64_TST_IMM(block, REG_W1, I_FLAG);
+        branch_offset = host_arm64_BEQ_(block);
+        host_arm64_MOVX_IMM(block, REG_X3, (uintptr_t)&pic.int_pending);
+        host_arm64_LDRB_IMM_W(block, REG_W3, REG_X3, 0);
+        host_arm64_CMP_IMM(block, REG_W3, 0);
+        fail_offset[6] = host_arm64_BNE_(block);
+        host_arm64_branch_set_offset(branch_offset, &block_write_data[block_pos]);
+
+        host_arm64_LDR_IMM_W(block, REG_W1, REG_CPUSTATE, (uintptr_t)&cpu_state.pc - (uintptr_t)&cpu_state);
+        host_arm64_RET(block, REG_X30);
+
+        codegen_alloc(block, 4);
+        for (c = 0; c < 7; c++)
+                host_arm64_branch_set_offset(fail_offset[c], &block_write_data[block_pos]);
+        host_arm64_B(block, codegen_link_exit);
+}
+
 void codegen_backend_init()
 {
 	codeblock_t *block;
@@ -313,20 +397,32 @@ void codegen_backend_init()
         codegen_fp_round_quad = &block_write_data[block_pos];
 	build_fp_round_routine(block, 1);
 
-	codegen_alloc(block, 80);
+	codegen_alloc(block, 128);
         codegen_gpf_rout = &block_write_data[block_pos];
 	host_arm64_mov_imm(block, REG_ARG0, 0);
 	host_arm64_mov_imm(block, REG_ARG1, 0);
 	host_arm64_call(block, (void *)x86gpf);
 
+        /*All blocks leave through here. exec386_dynarec_link() returns the
+          next block to run, or NULL to return to the dispatcher. Blocks leaving
+          through their link exits enter at codegen_link_exit, with the block
+          number stored in codegen_link.block*/
         codegen_exit_rout = &block_write_data[block_pos];
+	host_arm64_MOVX_IMM(block, REG_X2, (uintptr_t)&codegen_link);
+	host_arm64_STR_IMM_W(block, REG_WZR, REG_X2, offsetof(codegen_link_state_t, block));
+	codegen_link_exit = &block_write_data[block_pos];
+	host_arm64_call(block, (void *)exec386_dynarec_link);
 	host_arm64_LDP_POSTIDX_X(block, REG_X19, REG_X20, REG_XSP, 64);
 	host_arm64_LDP_POSTIDX_X(block, REG_X21, REG_X22, REG_XSP, 16);
 	host_arm64_LDP_POSTIDX_X(block, REG_X23, REG_X24, REG_XSP, 16);
 	host_arm64_LDP_POSTIDX_X(block, REG_X25, REG_X26, REG_XSP, 16);
 	host_arm64_LDP_POSTIDX_X(block, REG_X27, REG_X28, REG_XSP, 16);
 	host_arm64_LDP_POSTIDX_X(block, REG_X29, REG_X30, REG_XSP, 16);
+	host_arm64_CBNZ(block, REG_X0, (uintptr_t)&block_write_data[block_pos + 8]);
 	host_arm64_RET(block, REG_X30);
+	host_arm64_BR(block, REG_X0);
+
+	build_link_routine(block);
 
         block_write_data = NULL;
 
@@ -357,6 +453,10 @@ void codegen_backend_prologue(codeblock_t *block)
 	host_arm64_STP_PREIDX_X(block, REG_X23, REG_X24, REG_XSP, -16);
 	host_arm64_STP_PREIDX_X(block, REG_X21, REG_X22, REG_XSP, -16);
 	host_arm64_STP_PREIDX_X(block, REG_X19, REG_X20, REG_XSP, -64);
+#ifndef RELEASE_BUILD
+	if (block_pos != BLOCK_LINK_START)
+		fatal("codegen_backend_prologue - link start %i\n", block_pos);
+#endif
 
 	host_arm64_MOVX_IMM(block, REG_CPUSTATE, (uint64_t)&cpu_state);
 
@@ -370,15 +470,43 @@ void codegen_backend_prologue(codeblock_t *block)
 
 void codegen_backend_epilogue(codeblock_t *block)
 {
-	host_arm64_LDP_POSTIDX_X(block, REG_X19, REG_X20, REG_XSP, 64);
-	host_arm64_LDP_POSTIDX_X(block, REG_X21, REG_X22, REG_XSP, 16);
-	host_arm64_LDP_POSTIDX_X(block, REG_X23, REG_X24, REG_XSP, 16);
-	host_arm64_LDP_POSTIDX_X(block, REG_X25, REG_X26, REG_XSP, 16);
-	host_arm64_LDP_POSTIDX_X(block, REG_X27, REG_X28, REG_XSP, 16);
-	host_arm64_LDP_POSTIDX_X(block, REG_X29, REG_X30, REG_XSP, 16);
-	host_arm64_RET(block, REG_X30);
+	uint32_t *branch_offset;
+	int c;
+
+	host_arm64_MOVZ_IMM(block, REG_W0, get_block_nr(block));
+	host_arm64_call(block, codegen_link_rout);
+
+	codegen_alloc(block, LINK_EXIT_SIZE * CODEBLOCK_LINKS + 4);
+	block->link_exit = &block_write_data[block_pos];
+	for (c = 0; c < CODEBLOCK_LINKS; c++)
+	{
+		host_arm64_MOVZ_IMM(block, REG_W2, 0);
+		host_arm64_MOVK_IMM(block, REG_W2, 0xffff0000);
+		host_arm64_CMP_REG(block, REG_W1, REG_W2);
+		branch_offset = host_arm64_BEQ_(block);
+		host_arm64_branch_set_offset(branch_offset, codegen_link_exit);
+	}
+	host_arm64_B(block, codegen_link_exit);
 
 	codegen_allocator_clean_blocks(block->head_mem_block);
 }
 
+void codegen_backend_link(codeblock_t *block, int nr, codeblock_t *next)
+{
+	uint32_t *link_exit = (uint32_t *)&block->link_exit[nr * LINK_EXIT_SIZE];
+	uint32_t pc = next ? (next->pc - next->_cs) : 0xffff0000;
+	uintptr_t dest = next ? (uintptr_t)&next->data[BLOCK_LINK_START] : (uintptr_t)codegen_link_exit;
+	intptr_t offset = dest - (uintptr_t)&link_exit[4];
+
+	if (offset < -(1 << 27) || offset >= (1 << 27))
+		fatal("codegen_backend_link - out of range %p\n", (void *)dest);
+
+	/*Replace the immediates of the MOVZ and MOVK, and the offset of the B*/
+	link_exit[0] = (link_exit[0] & ~(0xffff << 5)) | ((pc & 0xffff) << 5);
+	link_exit[1] = (link_exit[1] & ~(0xffff << 5)) | ((pc >> 16) << 5);
+	link_exit[4] = (link_exit[4] & 0xfc000000) | ((offset >> 2) & 0x03ffffff);
+
+	__clear_cache(link_exit, &link_exit[LINK_EXIT_SIZE / 4]);
+}
+
 #endif
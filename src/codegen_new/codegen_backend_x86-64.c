@@ -1,9 +1,15 @@
 #ifdef __amd64__
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <86box/86box.h>
 #include "cpu.h"
 #include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include <86box/timer.h>
 
 #include "codegen.h"
 #include "codegen_allocator.h"
@@ -11,6 +17,7 @@
 #include "codegen_backend_x86-64_defs.h"
 #include "codegen_backend_x86-64_ops.h"
 #include "codegen_backend_x86-64_ops_sse.h"
+#include "codegen_backend_x86-64_ops_helpers.h"
 #include "codegen_reg.h"
 #include "x86.h"
 
@@ -38,6 +45,15 @@ void *codegen_mem_store_double;
 
 void *codegen_gpf_rout;
 void *codegen_exit_rout;
+static void *codegen_link_exit;
+static void *codegen_link_rout;
+
+/*Link exits start after the prologue has pushed the host registers and set up
+  the stack frame, which the block jumping there has already done*/
+#define BLOCK_LINK_START 16
+
+/*CMP EAX, pc ; JNZ next exit ; JMP block*/
+#define LINK_EXIT_SIZE 12
 
 host_reg_def_t codegen_host_reg_list[CODEGEN_HOST_REGS] =
 {
@@ -288,9 +304,81 @@ static void build_loadstore_routines(codeblock_t *block)
         build_store_routine(block, 8, 1);
 }
 
+/*Called by the epilogue of every block, with EAX = block number. Returns with
+  EAX = EIP if the block can go on to a linked block directly, otherwise leaves
+  through codegen_link_exit. This makes the same checks exec386_dynarec_link()
+  makes between blocks*/
+static void build_link_routine(codeblock_t *block)
+{
+        uint32_t *fail_offset[7];
+        uint8_t *branch_offset;
+        int c;
+
+        codegen_link_rout = &block_write_data[block_pos];
+        host_x86_MOV64_REG_IMM(block, REG_RDX, (uintptr_t)&codegen_link);
+        host_x86_MOV32_BASE_OFFSET_REG(block, REG_RDX, offsetof(codegen_link_state_t, block), REG_EAX);
+
+        /*No timer due*/
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &cycles);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_ECX, REG_RDX, offsetof(codegen_link_state_t, cycle_limit));
+        host_x86_CMP32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[0] = host_x86_JLE_long(block);
+        host_x86_MOV64_REG_IMM(block, REG_RCX, (uintptr_t)&timer_target);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_EAX, REG_RCX, 0);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_ECX, REG_RDX, offsetof(codegen_link_state_t, timer));
+        host_x86_CMP32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[1] = host_x86_JNZ_long(block);
+
+        /*Same CS and CPU status as the linked blocks were compiled with*/
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &cs);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_ECX, REG_RDX, offsetof(codegen_link_state_t, cs_base));
+        host_x86_CMP32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[2] = host_x86_JNZ_long(block);
+        host_x86_MOV64_REG_IMM(block, REG_RCX, (uintptr_t)&cpu_cur_status);
+        host_x86_MOV16_REG_BASE_OFFSET(block, REG_EAX, REG_RCX, 0);
+        host_x86_MOV16_REG_BASE_OFFSET(block, REG_ECX, REG_RDX, offsetof(codegen_link_state_t, status));
+        host_x86_CMP16_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[3] = host_x86_JNZ_long(block);
+
+        /*No abort, SMI or NMI, cache on*/
+        host_x86_MOVZX_REG_ABS_32_8(block, REG_EAX, &cpu_state.abrt);
+        host_x86_MOV64_REG_IMM(block, REG_RCX, (uintptr_t)&smi_line);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_ECX, REG_RCX, 0);
+        host_x86_OR32_REG_REG(block, REG_EAX, REG_ECX);
+        host_x86_MOV64_REG_IMM(block, REG_RCX, (uintptr_t)&nmi);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_ECX, REG_RCX, 0);
+        host_x86_OR32_REG_REG(block, REG_EAX, REG_ECX);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &cr0);
+        host_x86_AND32_REG_IMM(block, REG_ECX, 1 << 30);
+        host_x86_OR32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[4] = host_x86_JNZ_long(block);
+
+        /*No single step, and no interrupt to take*/
+        host_x86_MOVZX_REG_ABS_32_16(block, REG_EAX, &cpu_state.flags);
+        host_x86_TEST32_REG_IMM(block, REG_EAX, T_FLAG);
+        fail_offset[5] = host_x86_JNZ_long(block);
+        host_x86_TEST32_REG_IMM(block, REG_EAX, I_FLAG);
+        branch_offset = host_x86_JZ_short(block);
+        host_x86_MOV64_REG_IMM(block, REG_RCX, (uintptr_t)&pic.int_pending);
+        host_x86_MOV32_REG_BASE_OFFSET(block, REG_ECX, REG_RCX, 0);
+        host_x86_TEST32_REG_IMM(block, REG_ECX, 0xff);
+        fail_offset[6] = host_x86_JNZ_long(block);
+        *branch_offset = (uint8_t)((uintptr_t)&block_write_data[block_pos] - (uintptr_t)branch_offset) - 1;
+
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &cpu_state.pc);
+        host_x86_RET(block);
+
+        for (c = 0; c < 7; c++)
+                *fail_offset[c] = (uintptr_t)&block_write_data[block_pos] - (uintptr_t)&fail_offset[c][1];
+        host_x86_ADD64_REG_IMM(block, REG_RSP, 8);
+        host_x86_JMP(block, codegen_link_exit);
+}
+
 void codegen_backend_init()
 {
         codeblock_t *block;
+        uint8_t *branch_offset;
+        void *routines[16];
         int c;
 #if defined(__linux__) || defined(__APPLE__)
 	void *start;
@@ -326,7 +414,15 @@ void codegen_backend_init()
 #endif
 	/* host_x86_CALL(block, (uintptr_t)x86gpf); */
 	host_x86_CALL(block, (void *)x86gpf);
+        /*All blocks leave through here. exec386_dynarec_link() returns the
+          next block to run, or NULL to return to the dispatcher. Blocks leaving
+          through their link exits enter at codegen_link_exit, with the block
+          number stored in codegen_link.block*/
         codegen_exit_rout = &codeblock[block_current].data[block_pos];
+        host_x86_MOV64_REG_IMM(block, REG_RDX, (uintptr_t)&codegen_link);
+        host_x86_MOV32_BASE_OFFSET_IMM(block, REG_RDX, offsetof(codegen_link_state_t, block), 0);
+        codegen_link_exit = &codeblock[block_current].data[block_pos];
+        host_x86_CALL(block, (void *)exec386_dynarec_link);
         host_x86_ADD64_REG_IMM(block, REG_RSP, 0x38);
         host_x86_POP(block, REG_R15);
         host_x86_POP(block, REG_R14);
@@ -335,11 +431,35 @@ void codegen_backend_init()
         host_x86_POP(block, REG_RDI);
         host_x86_POP(block, REG_RSI);
         host_x86_POP(block, REG_RBP);
-        host_x86_POP(block, REG_RDX);
+        host_x86_POP(block, REG_RBX);
+        host_x86_TEST64_REG(block, REG_RAX, REG_RAX);
+        branch_offset = host_x86_JZ_short(block);
+        host_x86_JMP_REG(block, REG_RAX);
+        *branch_offset = (uint8_t)((uintptr_t)&block_write_data[block_pos] - (uintptr_t)branch_offset) - 1;
         host_x86_RET(block);
 
+        build_link_routine(block);
+
         block_write_data = NULL;
 
+        routines[0] = codegen_mem_load_byte;
+        routines[1] = codegen_mem_load_word;
+        routines[2] = codegen_mem_load_long;
+        routines[3] = codegen_mem_load_quad;
+        routines[4] = codegen_mem_load_single;
+        routines[5] = codegen_mem_load_double;
+        routines[6] = codegen_mem_store_byte;
+        routines[7] = codegen_mem_store_word;
+        routines[8] = codegen_mem_store_long;
+        routines[9] = codegen_mem_store_quad;
+        routines[10] = codegen_mem_store_single;
+        routines[11] = codegen_mem_store_double;
+        routines[12] = codegen_gpf_rout;
+        routines[13] = codegen_exit_rout;
+        routines[14] = codegen_link_exit;
+        routines[15] = codegen_link_rout;
+        codegen_reloc_init(routines, 16);
+
         asm(
                 "stmxcsr %0\n"
                 : "=m" (cpu_state.old_fp_control)
@@ -364,7 +484,11 @@ void codegen_backend_prologue(codeblock_t *block)
         host_x86_PUSH(block, REG_R14);
         host_x86_PUSH(block, REG_R15);
         host_x86_SUB64_REG_IMM(block, REG_RSP, 0x38);
-        host_x86_MOV64_REG_IMM(block, REG_RBP, ((uintptr_t)&cpu_state) + 128);
+#ifndef RELEASE_BUILD
+        if (block_pos != BLOCK_LINK_START)
+                fatal("codegen_backend_prologue - link start %i\n", block_pos);
+#endif
+        host_x86_MOV64_REG_PTR(block, REG_RBP, (void *)(((uintptr_t)&cpu_state) + 128));
         if (block->flags & CODEBLOCK_HAS_FPU)
         {
                 host_x86_MOV32_REG_ABS(block, REG_EAX, &cpu_state.TOP);
@@ -372,20 +496,44 @@ void codegen_backend_prologue(codeblock_t *block)
                 host_x86_MOV32_BASE_OFFSET_REG(block, REG_RSP, IREG_TOP_diff_stack_offset, REG_EAX);
         }
         if (block->flags & CODEBLOCK_NO_IMMEDIATES)
-            host_x86_MOV64_REG_IMM(block, REG_R12, (uintptr_t)ram);
+            host_x86_MOV64_REG_PTR(block, REG_R12, ram);
 }
 
 void codegen_backend_epilogue(codeblock_t *block)
 {
-        host_x86_ADD64_REG_IMM(block, REG_RSP, 0x38);
-        host_x86_POP(block, REG_R15);
-        host_x86_POP(block, REG_R14);
-        host_x86_POP(block, REG_R13);
-        host_x86_POP(block, REG_R12);
-        host_x86_POP(block, REG_RDI);
-        host_x86_POP(block, REG_RSI);
-        host_x86_POP(block, REG_RBP);
-        host_x86_POP(block, REG_RDX);
-        host_x86_RET(block);
+        int c;
+
+        host_x86_MOV32_REG_IMM(block, REG_EAX, get_block_nr(block));
+        codegen_reloc(block, RELOC_BLOCK_NR, &block_write_data[block_pos - 4], NULL);
+        host_x86_CALL(block, codegen_link_rout);
+
+        codegen_alloc_bytes(block, LINK_EXIT_SIZE * CODEBLOCK_LINKS + 5);
+        block->link_exit = &block_write_data[block_pos];
+        for (c = 0; c < CODEBLOCK_LINKS; c++)
+        {
+                codegen_addbyte(block, 0x3d); /*CMP EAX, pc*/
+                codegen_addlong(block, 0);
+                codegen_addbyte2(block, 0x75, 5); /*JNZ next exit*/
+                codegen_addbyte(block, 0xe9); /*JMP codegen_link_exit*/
+                codegen_addlong(block, (uintptr_t)codegen_link_exit - (uintptr_t)&block_write_data[block_pos + 4]);
+                codegen_reloc(block, RELOC_REL32, &block_write_data[block_pos - 4], codegen_link_exit);
+        }
+        codegen_addbyte(block, 0xe9); /*JMP codegen_link_exit*/
+        codegen_addlong(block, (uintptr_t)codegen_link_exit - (uintptr_t)&block_write_data[block_pos + 4]);
+        codegen_reloc(block, RELOC_REL32, &block_write_data[block_pos - 4], codegen_link_exit);
+        codegen_reloc_end(block, &block_write_data[block_pos]);
+}
+
+void codegen_backend_link(codeblock_t *block, int nr, codeblock_t *next)
+{
+        uint8_t *link_exit = &block->link_exit[nr * LINK_EXIT_SIZE];
+        uintptr_t dest = next ? (uintptr_t)&next->data[BLOCK_LINK_START] : (uintptr_t)codegen_link_exit;
+        int64_t offset = dest - (uintptr_t)&link_exit[LINK_EXIT_SIZE];
+
+        if (offset < INT32_MIN || offset > INT32_MAX)
+                fatal("codegen_backend_link - out of range %p\n", (void *)dest);
+
+        *(uint32_t *)&link_exit[1] = next ? (next->pc - next->_cs) : 0;
+        *(uint32_t *)&link_exit[8] = (uint32_t)offset;
 }
 #endif
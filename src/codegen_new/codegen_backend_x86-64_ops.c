@@ -36,12 +36,14 @@ static inline void call(codeblock_t *block, uintptr_t func)
 	{
 	        codegen_addbyte(block, 0xE8); /*CALL*/
 	        codegen_addlong(block, (uint32_t)diff);
+	        codegen_reloc(block, RELOC_REL32, &block_write_data[block_pos - 4], (void *)func);
 	}
 	else
 	{
                 codegen_alloc_bytes(block, 13);
 		codegen_addbyte2(block, 0x49, 0xb9); /*MOV R9, func*/
 		codegen_addquad(block, func);
+		codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], (void *)func);
 		codegen_addbyte3(block, 0x41, 0xff, 0xd1); /*CALL R9*/
 	}
 }
@@ -57,12 +59,14 @@ static inline void jmp(codeblock_t *block, uintptr_t func)
 	{
 	        codegen_addbyte(block, 0xe9); /*JMP*/
 	        codegen_addlong(block, (uint32_t)diff);
+	        codegen_reloc(block, RELOC_REL32, &block_write_data[block_pos - 4], (void *)func);
 	}
 	else
 	{
                 codegen_alloc_bytes(block, 13);
 		codegen_addbyte2(block, 0x49, 0xb9); /*MOV R9, func*/
 		codegen_addquad(block, func);
+		codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], (void *)func);
 		codegen_addbyte3(block, 0x41, 0xff, 0xe1); /*JMP R9*/
 	}
 }
@@ -330,18 +334,33 @@ void host_x86_JMP(codeblock_t *block, void *p)
 {
         jmp(block, (uintptr_t)p);
 }
+void host_x86_JMP_REG(codeblock_t *block, int src_reg)
+{
+        if (src_reg & 8)
+        {
+                codegen_alloc_bytes(block, 3);
+                codegen_addbyte3(block, 0x41, 0xff, 0xe0 | (src_reg & 7)); /*JMP src_reg*/
+        }
+        else
+        {
+                codegen_alloc_bytes(block, 2);
+                codegen_addbyte2(block, 0xff, 0xe0 | src_reg); /*JMP src_reg*/
+        }
+}
 
 void host_x86_JNZ(codeblock_t *block, void *p)
 {
         codegen_alloc_bytes(block, 6);
         codegen_addbyte2(block, 0x0f, 0x85); /*JNZ*/
         codegen_addlong(block, (uintptr_t)p - (uintptr_t)&block_write_data[block_pos + 4]);
+        codegen_reloc(block, RELOC_REL32, &block_write_data[block_pos - 4], p);
 }
 void host_x86_JZ(codeblock_t *block, void *p)
 {
         codegen_alloc_bytes(block, 6);
         codegen_addbyte2(block, 0x0f, 0x84); /*JZ*/
         codegen_addlong(block, (uintptr_t)p - (uintptr_t)&block_write_data[block_pos + 4]);
+        codegen_reloc(block, RELOC_REL32, &block_write_data[block_pos - 4], p);
 }
 
 uint8_t *host_x86_JNZ_short(codeblock_t *block)
@@ -507,6 +526,7 @@ void host_x86_MOV8_ABS_IMM(codeblock_t *block, void *p, uint32_t imm_data)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte3(block, 0xc6, 0x45, offset); /*MOVB offset[RBP], imm_data*/
                 codegen_addbyte(block, imm_data);
@@ -515,6 +535,7 @@ void host_x86_MOV8_ABS_IMM(codeblock_t *block, void *p, uint32_t imm_data)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV8_ABS_IMM - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 8);
                 codegen_addbyte3(block, 0xc6, 0x04, 0x25); /*MOVB p, imm_data*/
                 codegen_addlong(block, (uint32_t)(uintptr_t)p);
@@ -527,6 +548,7 @@ void host_x86_MOV16_ABS_IMM(codeblock_t *block, void *p, uint16_t imm_data)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 6);
                 codegen_addbyte4(block, 0x66, 0xc7, 0x45, offset); /*MOV offset[RBP], imm_data*/
                 codegen_addword(block, imm_data);
@@ -535,6 +557,7 @@ void host_x86_MOV16_ABS_IMM(codeblock_t *block, void *p, uint16_t imm_data)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV32_ABS_IMM - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 10);
                 codegen_addbyte4(block, 0x66, 0xc7, 0x04, 0x25); /*MOV p, imm_data*/
                 codegen_addlong(block, (uint32_t)(uintptr_t)p);
@@ -547,6 +570,7 @@ void host_x86_MOV32_ABS_IMM(codeblock_t *block, void *p, uint32_t imm_data)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 7);
                 codegen_addbyte3(block, 0xc7, 0x45, offset); /*MOV offset[RBP], imm_data*/
                 codegen_addlong(block, imm_data);
@@ -555,6 +579,7 @@ void host_x86_MOV32_ABS_IMM(codeblock_t *block, void *p, uint32_t imm_data)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV32_ABS_IMM - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 11);
                 codegen_addbyte3(block, 0xc7, 0x04, 0x25); /*MOV p, imm_data*/
                 codegen_addlong(block, (uint32_t)(uintptr_t)p);
@@ -571,6 +596,7 @@ void host_x86_MOV8_ABS_REG(codeblock_t *block, void *p, int src_reg)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 3);
                 codegen_addbyte3(block, 0x88, 0x45 | ((src_reg & 7) << 3), offset); /*MOVB offset[RBP], src_reg*/
         }
@@ -578,6 +604,7 @@ void host_x86_MOV8_ABS_REG(codeblock_t *block, void *p, int src_reg)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV8_ABS_REG - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 6);
                 codegen_addbyte(block, 0x88); /*MOVB [p], src_reg*/
                 codegen_addbyte(block, 0x05 | ((src_reg & 7) << 3));
@@ -593,11 +620,13 @@ void host_x86_MOV16_ABS_REG(codeblock_t *block, void *p, int src_reg)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x66, 0x89, 0x45 | ((src_reg & 7) << 3), offset); /*MOV offset[RBP], src_reg*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 7);
                 codegen_addbyte3(block, 0x66, 0x89, 0x85 | ((src_reg & 7) << 3)); /*MOV offset[RBP], src_reg*/
                 codegen_addlong(block, offset);
@@ -606,6 +635,7 @@ void host_x86_MOV16_ABS_REG(codeblock_t *block, void *p, int src_reg)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV32_ABS_REG - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
         }
 }
 void host_x86_MOV32_ABS_REG(codeblock_t *block, void *p, int src_reg)
@@ -617,11 +647,13 @@ void host_x86_MOV32_ABS_REG(codeblock_t *block, void *p, int src_reg)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 3);
                 codegen_addbyte3(block, 0x89, 0x45 | ((src_reg & 7) << 3), offset); /*MOV offset[RBP], src_reg*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 6);
                 codegen_addbyte2(block, 0x89, 0x85 | ((src_reg & 7) << 3)); /*MOV offset[RBP], src_reg*/
                 codegen_addlong(block, offset);
@@ -630,6 +662,7 @@ void host_x86_MOV32_ABS_REG(codeblock_t *block, void *p, int src_reg)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV32_ABS_REG - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 6);
                 codegen_addbyte(block, 0x89); /*MOV [p], src_reg*/
                 codegen_addbyte(block, 0x05 | ((src_reg & 7) << 3));
@@ -645,6 +678,7 @@ void host_x86_MOV64_ABS_REG(codeblock_t *block, void *p, int src_reg)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x48, 0x89, 0x45 | ((src_reg & 7) << 3), offset); /*MOV offset[RBP], src_reg*/
         }
@@ -652,6 +686,7 @@ void host_x86_MOV64_ABS_REG(codeblock_t *block, void *p, int src_reg)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOV64_ABS_REG - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 8);
                 codegen_addbyte4(block, 0x48, 0x89, 0x04 | ((src_reg & 7) << 3), 0x25); /*MOV [p], src_reg*/
                 codegen_addlong(block, (uint32_t)(uintptr_t)p);
@@ -707,11 +742,13 @@ void host_x86_MOV8_REG_ABS(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 3);
                 codegen_addbyte3(block, 0x8a, 0x45 | ((dst_reg & 7) << 3), offset); /*MOV dst_reg, offset[RBP]*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 6);
                 codegen_addbyte2(block, 0x8a, 0x85 | ((dst_reg & 7) << 3)); /*MOV dst_reg, offset[RBP]*/
                 codegen_addlong(block, offset);
@@ -737,11 +774,13 @@ void host_x86_MOV16_REG_ABS(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x66, 0x8b, 0x45 | ((dst_reg & 7) << 3), offset); /*MOV dst_reg, offset[RBP]*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 7);
                 codegen_addbyte3(block, 0x66, 0x8b, 0x85 | ((dst_reg & 7) << 3)); /*MOV dst_reg, offset[RBP]*/
                 codegen_addlong(block, offset);
@@ -759,6 +798,7 @@ void host_x86_MOV16_REG_ABS(codeblock_t *block, int dst_reg, void *p)
                 codegen_alloc_bytes(block, 10);
 		codegen_addbyte2(block, 0x49, 0xb9); /*MOV R9, p*/
 		codegen_addquad(block, (uintptr_t)p);
+		codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], p);
                 codegen_alloc_bytes(block, 1);
                 codegen_addbyte4(block, 0x66, 0x41, 0x8b, 0x01 | ((dst_reg & 7) << 3)); /*MOV dst_reg, [r9]*/
         }
@@ -773,11 +813,13 @@ void host_x86_MOV32_REG_ABS(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 3);
                 codegen_addbyte3(block, 0x8b, 0x45 | ((dst_reg & 7) << 3), offset); /*MOV dst_reg, offset[RBP]*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 6);
                 codegen_addbyte2(block, 0x8b, 0x85 | ((dst_reg & 7) << 3)); /*MOV dst_reg, offset[RBP]*/
                 codegen_addlong(block, offset);
@@ -806,11 +848,13 @@ void host_x86_MOV64_REG_ABS(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x48, 0x8b, 0x45 | ((dst_reg & 7) << 3), offset); /*MOV dst_reg, offset[RBP]*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 7);
                 codegen_addbyte3(block, 0x48, 0x8b, 0x85 | ((dst_reg & 7) << 3)); /*MOV dst_reg, offset[RBP]*/
                 codegen_addlong(block, offset);
@@ -1029,6 +1073,13 @@ void host_x86_MOV64_REG_IMM(codeblock_t *block, int reg, uint64_t imm_data)
         }
 }
 
+/*MOV64_REG_IMM of a pointer, relocated if the block is saved*/
+void host_x86_MOV64_REG_PTR(codeblock_t *block, int reg, void *p)
+{
+        host_x86_MOV64_REG_IMM(block, reg, (uint64_t)(uintptr_t)p);
+        codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], p);
+}
+
 void host_x86_MOV8_REG_REG(codeblock_t *block, int dst_reg, int src_reg)
 {
         if ((dst_reg & 8) || (src_reg & 8))
@@ -1145,6 +1196,7 @@ void host_x86_MOVZX_REG_ABS_16_8(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 5);
                 codegen_addbyte(block, 0x66);
                 codegen_addbyte4(block, 0x0f, 0xb6, 0x45 | ((dst_reg & 7) << 3), offset); /*MOVZX dst_reg, offset[RBP]*/
@@ -1161,6 +1213,7 @@ void host_x86_MOVZX_REG_ABS_16_8(codeblock_t *block, int dst_reg, void *p)
                 codegen_alloc_bytes(block, 10);
 		codegen_addbyte2(block, 0x49, 0xb9); /*MOV R9, p*/
 		codegen_addquad(block, (uintptr_t)p);
+		codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], p);
                 codegen_alloc_bytes(block, 5);
                 codegen_addbyte(block, 0x66);
                 codegen_addbyte4(block, 0x41, 0x0f, 0xb6, 0x01 | ((dst_reg & 7) << 3)); /*MOVZX dst_reg, [r9]*/
@@ -1176,6 +1229,7 @@ void host_x86_MOVZX_REG_ABS_32_8(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 if (dst_reg & 8)
                 {
                         codegen_alloc_bytes(block, 5);
@@ -1206,6 +1260,7 @@ void host_x86_MOVZX_REG_ABS_32_8(codeblock_t *block, int dst_reg, void *p)
                 codegen_alloc_bytes(block, 10);
 		codegen_addbyte2(block, 0x49, 0xb9); /*MOV R9, p*/
 		codegen_addquad(block, (uintptr_t)p);
+		codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x41, 0x0f, 0xb6, 0x01 | ((dst_reg & 7) << 3)); /*MOVZX dst_reg, [r9]*/
         }
@@ -1220,6 +1275,7 @@ void host_x86_MOVZX_REG_ABS_32_16(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x0f, 0xb7, 0x45 | ((dst_reg & 7) << 3), offset); /*MOVZX dst_reg, offset[RBP]*/
         }
@@ -1235,6 +1291,7 @@ void host_x86_MOVZX_REG_ABS_32_16(codeblock_t *block, int dst_reg, void *p)
                 codegen_alloc_bytes(block, 10);
 		codegen_addbyte2(block, 0x49, 0xb9); /*MOV R9, p*/
 		codegen_addquad(block, (uintptr_t)p);
+		codegen_reloc(block, RELOC_ABS64, &block_write_data[block_pos - 8], p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x41, 0x0f, 0xb7, 0x01 | ((dst_reg & 7) << 3)); /*MOVZX dst_reg, [r9]*/
         }
@@ -1723,6 +1780,14 @@ void host_x86_TEST32_REG(codeblock_t *block, int src_reg, int dst_reg)
         codegen_alloc_bytes(block, 2);
         codegen_addbyte2(block, 0x85, MODRM_MOD_REG(dst_reg, src_reg)); /*TEST dst_host_reg, src_host_reg*/
 }
+void host_x86_TEST64_REG(codeblock_t *block, int src_reg, int dst_reg)
+{
+        if ((dst_reg & 8) || (src_reg & 8))
+                fatal("host_x86_TEST64_REG - bad reg\n");
+
+        codegen_alloc_bytes(block, 3);
+        codegen_addbyte3(block, 0x48, 0x85, MODRM_MOD_REG(dst_reg, src_reg)); /*TEST dst_host_reg, src_host_reg*/
+}
 void host_x86_TEST32_REG_IMM(codeblock_t *block, int dst_reg, uint32_t imm_data)
 {
         if (dst_reg & 8)
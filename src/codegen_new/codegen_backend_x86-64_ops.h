@@ -26,6 +26,7 @@ void host_x86_CMP16_REG_REG(codeblock_t *block, int src_reg_a, int src_reg_b);
 void host_x86_CMP32_REG_REG(codeblock_t *block, int src_reg_a, int src_reg_b);
 
 void host_x86_JMP(codeblock_t *block, void *p);
+void host_x86_JMP_REG(codeblock_t *block, int src_reg);
 
 void host_x86_JNZ(codeblock_t *block, void *p);
 void host_x86_JZ(codeblock_t *block, void *p);
@@ -95,6 +96,7 @@ void host_x86_MOV16_REG_IMM(codeblock_t *block, int reg, uint16_t imm_data);
 void host_x86_MOV32_REG_IMM(codeblock_t *block, int reg, uint32_t imm_data);
 
 void host_x86_MOV64_REG_IMM(codeblock_t *block, int reg, uint64_t imm_data);
+void host_x86_MOV64_REG_PTR(codeblock_t *block, int reg, void *p);
 
 void host_x86_MOV8_REG_REG(codeblock_t *block, int dst_reg, int src_reg);
 void host_x86_MOV16_REG_REG(codeblock_t *block, int dst_reg, int src_reg);
@@ -186,6 +188,7 @@ void host_x86_TEST8_REG(codeblock_t *block, int src_host_reg, int dst_host_reg);
 void host_x86_TEST16_REG(codeblock_t *block, int src_host_reg, int dst_host_reg);
 void host_x86_TEST32_REG(codeblock_t *block, int src_reg, int dst_reg);
 void host_x86_TEST32_REG_IMM(codeblock_t *block, int dst_reg, uint32_t imm_data);
+void host_x86_TEST64_REG(codeblock_t *block, int src_reg, int dst_reg);
 
 void host_x86_XOR8_REG_IMM(codeblock_t *block, int dst_reg, uint8_t imm_data);
 void host_x86_XOR16_REG_IMM(codeblock_t *block, int dst_reg, uint16_t imm_data);
@@ -109,11 +109,13 @@ void host_x86_LDMXCSR(codeblock_t *block, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 4);
                 codegen_addbyte4(block, 0x0f, 0xae, 0x50 | REG_EBP, offset); /*LDMXCSR offset[EBP]*/
         }
         else if (offset < (1ull << 32))
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 7);
                 codegen_addbyte3(block, 0x0f, 0xae, 0x90 | REG_EBP); /*LDMXCSR offset[EBP]*/
                 codegen_addlong(block, offset);
@@ -162,6 +164,7 @@ void host_x86_MOVQ_ABS_XREG(codeblock_t *block, void *p, int src_reg)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 5);
                 codegen_addbyte4(block, 0x66, 0x0f, 0xd6, 0x45 | (src_reg << 3)); /*MOVQ offset[EBP], src_reg*/
                 codegen_addbyte(block, offset);
@@ -170,6 +173,7 @@ void host_x86_MOVQ_ABS_XREG(codeblock_t *block, void *p, int src_reg)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOVQ_ABS_REG - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 9);
                 codegen_addbyte4(block, 0x66, 0x0f, 0xd6, 0x04 | (src_reg << 3)); /*MOVQ [p], src_reg*/
                 codegen_addbyte(block, 0x25);
@@ -232,6 +236,7 @@ void host_x86_MOVQ_XREG_ABS(codeblock_t *block, int dst_reg, void *p)
 
         if (offset >= -128 && offset < 127)
         {
+                codegen_reloc(block, RELOC_BASE, NULL, p);
                 codegen_alloc_bytes(block, 5);
                 codegen_addbyte4(block, 0xf3, 0x0f, 0x7e, 0x45 | (dst_reg << 3)); /*MOVQ offset[EBP], src_reg*/
                 codegen_addbyte(block, offset);
@@ -240,6 +245,7 @@ void host_x86_MOVQ_XREG_ABS(codeblock_t *block, int dst_reg, void *p)
         {
                 if ((uintptr_t)p >> 32)
                         fatal("host_x86_MOVQ_REG_ABS - out of range %p\n", p);
+                codegen_reloc(block, RELOC_FIXED, NULL, p);
                 codegen_alloc_bytes(block, 9);
                 codegen_addbyte4(block, 0xf3, 0x0f, 0x7e, 0x04 | (dst_reg << 3)); /*MOVQ [p], src_reg*/
                 codegen_addbyte(block, 0x25);
@@ -297,6 +297,7 @@ static int codegen_CMP_JB(codeblock_t *block, uop_t *uop)
 #endif
         jump_p = host_x86_JB_long(block);
         *jump_p = (uintptr_t)uop->p - ((uintptr_t)jump_p + 4);
+        codegen_reloc(block, RELOC_REL32, jump_p, uop->p);
 
         return 0;
 }
@@ -316,6 +317,7 @@ static int codegen_CMP_JNBE(codeblock_t *block, uop_t *uop)
 #endif
         jump_p = host_x86_JNBE_long(block);
         *jump_p = (uintptr_t)uop->p - ((uintptr_t)jump_p + 4);
+        codegen_reloc(block, RELOC_REL32, jump_p, uop->p);
 
         return 0;
 }
@@ -930,10 +932,10 @@ static int codegen_LOAD_SEG(codeblock_t *block, uop_t *uop)
 #endif
 #if WIN64
         host_x86_MOV16_REG_REG(block, REG_CX, src_reg);
-        host_x86_MOV64_REG_IMM(block, REG_EDX, (uint64_t)uop->p);
+        host_x86_MOV64_REG_PTR(block, REG_EDX, uop->p);
 #else
         host_x86_MOV16_REG_REG(block, REG_DI, src_reg);
-        host_x86_MOV64_REG_IMM(block, REG_ESI, (uint64_t)uop->p);
+        host_x86_MOV64_REG_PTR(block, REG_ESI, uop->p);
 #endif
         host_x86_CALL(block, (void *)loadseg);
         host_x86_TEST32_REG(block, REG_EAX, REG_EAX);
@@ -1270,7 +1272,7 @@ static int codegen_MOV_IMM(codeblock_t *block, uop_t *uop)
 }
 static int codegen_MOV_PTR(codeblock_t *block, uop_t *uop)
 {
-        host_x86_MOV64_REG_IMM(block, uop->dest_reg_a_real, (uint64_t)uop->p);
+        host_x86_MOV64_REG_PTR(block, uop->dest_reg_a_real, uop->p);
         return 0;
 }
 static int codegen_MOV_REG_PTR(codeblock_t *block, uop_t *uop)
@@ -1499,19 +1501,25 @@ static int codegen_OR(codeblock_t *block, uop_t *uop)
 }
 static int codegen_OR_IMM(codeblock_t *block, uop_t *uop)
 {
-        int dest_reg = HOST_REG_GET(uop->dest_reg_a_real)/*, src_reg = HOST_REG_GET(uop->src_reg_a_real)*/;
+        int dest_reg = HOST_REG_GET(uop->dest_reg_a_real), src_reg = HOST_REG_GET(uop->src_reg_a_real);
         int dest_size = IREG_GET_SIZE(uop->dest_reg_a_real), src_size = IREG_GET_SIZE(uop->src_reg_a_real);
 
         if (REG_IS_L(dest_size) && REG_IS_L(src_size))
         {
+                if (dest_reg != src_reg)
+                        host_x86_MOV32_REG_REG(block, dest_reg, src_reg);
                 host_x86_OR32_REG_IMM(block, dest_reg, uop->imm_data);
         }
         else if (REG_IS_W(dest_size) && REG_IS_W(src_size))
         {
+                if (dest_reg != src_reg)
+                        host_x86_MOV16_REG_REG(block, dest_reg, src_reg);
                 host_x86_OR16_REG_IMM(block, dest_reg, uop->imm_data);
         }
         else if (REG_IS_B(dest_size) && REG_IS_B(src_size))
         {
+                if (dest_reg != src_reg)
+                        host_x86_MOV8_REG_REG(block, dest_reg, src_reg);
                 host_x86_OR8_REG_IMM(block, dest_reg, uop->imm_data);
         }
 #ifdef RECOMPILER_DEBUG
@@ -2797,19 +2805,25 @@ static int codegen_XOR(codeblock_t *block, uop_t *uop)
 }
 static int codegen_XOR_IMM(codeblock_t *block, uop_t *uop)
 {
-        int dest_reg = HOST_REG_GET(uop->dest_reg_a_real)/*, src_reg = HOST_REG_GET(uop->src_reg_a_real)*/;
+        int dest_reg = HOST_REG_GET(uop->dest_reg_a_real), src_reg = HOST_REG_GET(uop->src_reg_a_real);
         int dest_size = IREG_GET_SIZE(uop->dest_reg_a_real), src_size = IREG_GET_SIZE(uop->src_reg_a_real);
 
         if (REG_IS_L(dest_size) && REG_IS_L(src_size))
         {
+                if (dest_reg != src_reg)
+                        host_x86_MOV32_REG_REG(block, dest_reg, src_reg);
                 host_x86_XOR32_REG_IMM(block, dest_reg, uop->imm_data);
         }
         else if (REG_IS_W(dest_size) && REG_IS_W(src_size))
         {
+                if (dest_reg != src_reg)
+                        host_x86_MOV16_REG_REG(block, dest_reg, src_reg);
                 host_x86_XOR16_REG_IMM(block, dest_reg, uop->imm_data);
         }
         else if (REG_IS_B(dest_size) && REG_IS_B(src_size))
         {
+                if (dest_reg != src_reg)
+                        host_x86_MOV8_REG_REG(block, dest_reg, src_reg);
                 host_x86_XOR8_REG_IMM(block, dest_reg, uop->imm_data);
         }
 #ifdef RECOMPILER_DEBUG
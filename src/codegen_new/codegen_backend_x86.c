@@ -6,6 +6,9 @@
 #include <86box/86box.h>
 #include "cpu.h"
 #include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include <86box/timer.h>
 
 #include "codegen.h"
 #include "codegen_allocator.h"
@@ -13,6 +16,7 @@
 #include "codegen_backend_x86_defs.h"
 #include "codegen_backend_x86_ops.h"
 #include "codegen_backend_x86_ops_sse.h"
+#include "codegen_backend_x86_ops_helpers.h"
 #include "codegen_reg.h"
 #include "x86.h"
 
@@ -40,6 +44,15 @@ void *codegen_mem_store_double;
 
 void *codegen_gpf_rout;
 void *codegen_exit_rout;
+static void *codegen_link_exit;
+static void *codegen_link_rout;
+
+/*Link exits start after the prologue has pushed the host registers and set up
+  the stack frame, which the block jumping there has already done*/
+#define BLOCK_LINK_START 7
+
+/*CMP EAX, pc ; JNZ next exit ; JMP block*/
+#define LINK_EXIT_SIZE 12
 
 host_reg_def_t codegen_host_reg_list[CODEGEN_HOST_REGS] =
 {
@@ -263,9 +276,76 @@ static void build_loadstore_routines(codeblock_t *block)
         build_store_routine(block, 8, 1);
 }
 
+/*Called by the epilogue of every block, with EAX = block number. Returns with
+  EAX = EIP if the block can go on to a linked block directly, otherwise leaves
+  through codegen_link_exit. This makes the same checks exec386_dynarec_link()
+  makes between blocks*/
+static void build_link_routine(codeblock_t *block)
+{
+        uint32_t *fail_offset[7];
+        uint8_t *branch_offset;
+        int c;
+
+        codegen_link_rout = &block_write_data[block_pos];
+        host_x86_MOV32_ABS_REG(block, &codegen_link.block, REG_EAX);
+
+        /*No timer due*/
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &cycles);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &codegen_link.cycle_limit);
+        host_x86_CMP32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[0] = host_x86_JLE_long(block);
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &timer_target);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &codegen_link.timer);
+        host_x86_CMP32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[1] = host_x86_JNZ_long(block);
+
+        /*Same CS and CPU status as the linked blocks were compiled with*/
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &cs);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &codegen_link.cs_base);
+        host_x86_CMP32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[2] = host_x86_JNZ_long(block);
+        host_x86_MOV16_REG_ABS(block, REG_EAX, &cpu_cur_status);
+        host_x86_MOV16_REG_ABS(block, REG_ECX, &codegen_link.status);
+        host_x86_CMP16_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[3] = host_x86_JNZ_long(block);
+
+        /*No abort, SMI or NMI, cache on*/
+        host_x86_MOVZX_REG_ABS_32_8(block, REG_EAX, &cpu_state.abrt);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &smi_line);
+        host_x86_OR32_REG_REG(block, REG_EAX, REG_ECX);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &nmi);
+        host_x86_OR32_REG_REG(block, REG_EAX, REG_ECX);
+        host_x86_MOV32_REG_ABS(block, REG_ECX, &cr0);
+        host_x86_AND32_REG_IMM(block, REG_ECX, 1 << 30);
+        host_x86_OR32_REG_REG(block, REG_EAX, REG_ECX);
+        fail_offset[4] = host_x86_JNZ_long(block);
+
+        /*No single step, and no interrupt to take*/
+        host_x86_MOVZX_REG_ABS_32_16(block, REG_EAX, &cpu_state.flags);
+        host_x86_TEST32_REG_IMM(block, REG_EAX, T_FLAG);
+        fail_offset[5] = host_x86_JNZ_long(block);
+        host_x86_TEST32_REG_IMM(block, REG_EAX, I_FLAG);
+        codegen_alloc_bytes(block, 32);
+        branch_offset = host_x86_JZ_short(block);
+        host_x86_MOVZX_REG_ABS_32_8(block, REG_ECX, &pic.int_pending);
+        host_x86_TEST32_REG(block, REG_ECX, REG_ECX);
+        fail_offset[6] = host_x86_JNZ_long(block);
+        *branch_offset = (uint8_t)((uintptr_t)&block_write_data[block_pos] - (uintptr_t)branch_offset) - 1;
+
+        host_x86_MOV32_REG_ABS(block, REG_EAX, &cpu_state.pc);
+        host_x86_RET(block);
+
+        codegen_alloc_bytes(block, 8);
+        for (c = 0; c < 7; c++)
+                *fail_offset[c] = (uintptr_t)&block_write_data[block_pos] - (uintptr_t)&fail_offset[c][1];
+        host_x86_ADD32_REG_IMM(block, REG_ESP, 4);
+        host_x86_JMP(block, codegen_link_exit);
+}
+
 void codegen_backend_init()
 {
         codeblock_t *block;
+        uint8_t *branch_offset;
         int c;
 #if defined(__linux__) || defined(__APPLE__)
 	void *start;
@@ -294,13 +374,27 @@ void codegen_backend_init()
         host_x86_MOV32_STACK_IMM(block, STACK_ARG0, 0);
         host_x86_MOV32_STACK_IMM(block, STACK_ARG1, 0);
         host_x86_CALL(block, (void *)x86gpf);
+        /*All blocks leave through here. exec386_dynarec_link() returns the
+          next block to run, or NULL to return to the dispatcher. Blocks leaving
+          through their link exits enter at codegen_link_exit, with the block
+          number stored in codegen_link.block*/
         codegen_exit_rout = &codeblock[block_current].data[block_pos];
+        host_x86_MOV32_ABS_IMM(block, &codegen_link.block, 0);
+        codegen_link_exit = &codeblock[block_current].data[block_pos];
+        host_x86_CALL(block, (void *)exec386_dynarec_link);
         host_x86_ADD32_REG_IMM(block, REG_ESP, 64);
         host_x86_POP(block, REG_EDI);
         host_x86_POP(block, REG_ESI);
         host_x86_POP(block, REG_EBP);
-        host_x86_POP(block, REG_EDX);
+        host_x86_POP(block, REG_EBX);
+        host_x86_TEST32_REG(block, REG_EAX, REG_EAX);
+        branch_offset = host_x86_JZ_short(block);
+        host_x86_JMP_REG(block, REG_EAX);
+        *branch_offset = (uint8_t)((uintptr_t)&block_write_data[block_pos] - (uintptr_t)branch_offset) - 1;
         host_x86_RET(block);
+
+        build_link_routine(block);
+
         block_write_data = NULL;
 
         cpu_state.old_fp_control = 0;
@@ -337,6 +431,10 @@ void codegen_backend_prologue(codeblock_t *block)
         host_x86_PUSH(block, REG_ESI);
         host_x86_PUSH(block, REG_EDI);
         host_x86_SUB32_REG_IMM(block, REG_ESP, 64);
+#ifndef RELEASE_BUILD
+        if (block_pos != BLOCK_LINK_START)
+                fatal("codegen_backend_prologue - link start %i\n", block_pos);
+#endif
         host_x86_MOV32_REG_IMM(block, REG_EBP, ((uintptr_t)&cpu_state) + 128);
         if (block->flags & CODEBLOCK_HAS_FPU)
         {
@@ -348,12 +446,32 @@ void codegen_backend_prologue(codeblock_t *block)
 
 void codegen_backend_epilogue(codeblock_t *block)
 {
-        host_x86_ADD32_REG_IMM(block, REG_ESP, 64);
-        host_x86_POP(block, REG_EDI);
-        host_x86_POP(block, REG_ESI);
-        host_x86_POP(block, REG_EBP);
-        host_x86_POP(block, REG_EDX);
-        host_x86_RET(block);
+        int c;
+
+        host_x86_MOV32_REG_IMM(block, REG_EAX, get_block_nr(block));
+        host_x86_CALL(block, codegen_link_rout);
+
+        codegen_alloc_bytes(block, LINK_EXIT_SIZE * CODEBLOCK_LINKS + 5);
+        block->link_exit = &block_write_data[block_pos];
+        for (c = 0; c < CODEBLOCK_LINKS; c++)
+        {
+                codegen_addbyte(block, 0x3d); /*CMP EAX, pc*/
+                codegen_addlong(block, 0);
+                codegen_addbyte2(block, 0x75, 5); /*JNZ next exit*/
+                codegen_addbyte(block, 0xe9); /*JMP codegen_link_exit*/
+                codegen_addlong(block, (uintptr_t)codegen_link_exit - (uintptr_t)&block_write_data[block_pos + 4]);
+        }
+        codegen_addbyte(block, 0xe9); /*JMP codegen_link_exit*/
+        codegen_addlong(block, (uintptr_t)codegen_link_exit - (uintptr_t)&block_write_data[block_pos + 4]);
+}
+
+void codegen_backend_link(codeblock_t *block, int nr, codeblock_t *next)
+{
+        uint8_t *link_exit = &block->link_exit[nr * LINK_EXIT_SIZE];
+        uintptr_t dest = next ? (uintptr_t)&next->data[BLOCK_LINK_START] : (uintptr_t)codegen_link_exit;
+
+        *(uint32_t *)&link_exit[1] = next ? (next->pc - next->_cs) : 0;
+        *(uint32_t *)&link_exit[8] = dest - (uintptr_t)&link_exit[LINK_EXIT_SIZE];
 }
 
 #endif
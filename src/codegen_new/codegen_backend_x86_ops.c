@@ -268,6 +268,12 @@ uint32_t *host_x86_JMP_long(codeblock_t *block)
         return (uint32_t *)&block_write_data[block_pos-4];
 }
 
+void host_x86_JMP_REG(codeblock_t *block, int src_reg)
+{
+        codegen_alloc_bytes(block, 2);
+        codegen_addbyte2(block, 0xff, 0xe0 | src_reg); /*JMP src_reg*/
+}
+
 void host_x86_JNZ(codeblock_t *block, void *p)
 {
         codegen_alloc_bytes(block, 6);
@@ -1491,18 +1491,24 @@ static int codegen_OR(codeblock_t *block, uop_t *uop)
 static int codegen_OR_IMM(codeblock_t *block, uop_t *uop)
 {
         int dest_reg = HOST_REG_GET(uop->dest_reg_a_real), src_reg = HOST_REG_GET(uop->src_reg_a_real);
-        int dest_size = IREG_GET_SIZE(uop->dest_reg_a_real);
+        int dest_size = IREG_GET_SIZE(uop->dest_reg_a_real), src_size = IREG_GET_SIZE(uop->src_reg_a_real);
 
-        if (REG_IS_L(dest_size) && dest_reg == src_reg)
+        if (REG_IS_L(dest_size) && REG_IS_L(src_size))
         {
+                if (uop->dest_reg_a_real != uop->src_reg_a_real)
+                        host_x86_MOV32_REG_REG(block, dest_reg, src_reg);
                 host_x86_OR32_REG_IMM(block, dest_reg, uop->imm_data);
         }
-        else if (REG_IS_W(dest_size) && dest_reg == src_reg)
+        else if (REG_IS_W(dest_size) && REG_IS_W(src_size))
         {
+                if (uop->dest_reg_a_real != uop->src_reg_a_real)
+                        host_x86_MOV16_REG_REG(block, dest_reg, src_reg);
                 host_x86_OR16_REG_IMM(block, dest_reg, uop->imm_data);
         }
-        else if (REG_IS_B(dest_size) && dest_reg == src_reg)
+        else if (REG_IS_B(dest_size) && REG_IS_B(src_size))
         {
+                if (uop->dest_reg_a_real != uop->src_reg_a_real)
+                        host_x86_MOV8_REG_REG(block, dest_reg, src_reg);
                 host_x86_OR8_REG_IMM(block, dest_reg, uop->imm_data);
         }
 #ifdef RECOMPILER_DEBUG
@@ -2788,19 +2794,25 @@ static int codegen_XOR(codeblock_t *block, uop_t *uop)
 }
 static int codegen_XOR_IMM(codeblock_t *block, uop_t *uop)
 {
-        int dest_reg = HOST_REG_GET(uop->dest_reg_a_real);
+        int dest_reg = HOST_REG_GET(uop->dest_reg_a_real), src_reg = HOST_REG_GET(uop->src_reg_a_real);
         int dest_size = IREG_GET_SIZE(uop->dest_reg_a_real), src_size = IREG_GET_SIZE(uop->src_reg_a_real);
 
-        if (REG_IS_L(dest_size) && REG_IS_L(src_size) && uop->dest_reg_a_real == uop->src_reg_a_real)
+        if (REG_IS_L(dest_size) && REG_IS_L(src_size))
         {
+                if (uop->dest_reg_a_real != uop->src_reg_a_real)
+                        host_x86_MOV32_REG_REG(block, dest_reg, src_reg);
                 host_x86_XOR32_REG_IMM(block, dest_reg, uop->imm_data);
         }
-        else if (REG_IS_W(dest_size) && REG_IS_W(src_size) && uop->dest_reg_a_real == uop->src_reg_a_real)
+        else if (REG_IS_W(dest_size) && REG_IS_W(src_size))
         {
+                if (uop->dest_reg_a_real != uop->src_reg_a_real)
+                        host_x86_MOV16_REG_REG(block, dest_reg, src_reg);
                 host_x86_XOR16_REG_IMM(block, dest_reg, uop->imm_data);
         }
-        else if (REG_IS_B(dest_size) && REG_IS_B(src_size) && uop->dest_reg_a_real == uop->src_reg_a_real)
+        else if (REG_IS_B(dest_size) && REG_IS_B(src_size))
         {
+                if (uop->dest_reg_a_real != uop->src_reg_a_real)
+                        host_x86_MOV8_REG_REG(block, dest_reg, src_reg);
                 host_x86_XOR8_REG_IMM(block, dest_reg, uop->imm_data);
         }
 #ifdef RECOMPILER_DEBUG
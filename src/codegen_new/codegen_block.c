@@ -1,9 +1,13 @@
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
 #include <86box/86box.h>
 #include "cpu.h"
 #include <86box/mem.h>
+#include <86box/plat.h>
 
 #include "x86.h"
 #include "x86_flags.h"
@@ -52,7 +56,45 @@ uint32_t instr_counts[256*256];
 #endif
 
 static uint16_t block_free_list;
+static uint16_t block_hand = 1; /*Next code block looked at by the eviction clock*/
 static void delete_block(codeblock_t *block);
+
+/*Recently evicted blocks, in a direct mapped table of hashed physical address
+  and PC. A new block found here is code that has been evicted and then
+  translated again, which suggests the code cache is too small*/
+#define EVICTED_SIZE 4096
+static uint32_t evicted[EVICTED_SIZE];
+static uint32_t evictions, retranslations;
+
+#ifdef ENABLE_CODEGEN_BLOCK_LOG
+int codegen_block_do_log = ENABLE_CODEGEN_BLOCK_LOG;
+
+
+static void
+codegen_block_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (codegen_block_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define codegen_block_log(fmt, ...)
+#endif
+
+static inline uint32_t evicted_key(uint32_t phys, uint32_t pc)
+{
+        return ((phys * 0x9e3779b1) ^ pc) | 1;
+}
+
+static inline uint32_t *evicted_slot(uint32_t key)
+{
+        return &evicted[(key >> 1) & (EVICTED_SIZE - 1)];
+}
+static void codegen_compile_finish();
 static void delete_dirty_block(codeblock_t *block);
 
 /*Temporary list of code blocks that have recently been evicted. This allows for
@@ -200,7 +242,7 @@ static codeblock_t *block_free_list_get()
                 }
                 /*Free list is empty - free up a block*/
                 if (!codegen_purge_purgable_list())
-                        codegen_delete_random_block(0);
+                        codegen_evict_cold_block(0);
         }
 
         block = &codeblock[block_free_list];
@@ -225,10 +267,16 @@ void codegen_init()
 #ifdef DEBUG_EXTRA
         memset(instr_counts, 0, sizeof(instr_counts));
 #endif
+        codegen_cache_load();
+        codegen_profile_init();
 }
 
 void codegen_close()
 {
+        codegen_compile_finish();
+        codegen_cache_save();
+        if (codegen_profile_enabled)
+                codegen_profile_dump();
 #ifdef DEBUG_EXTRA
         pclog("Instruction counts :\n");
         while (1)
@@ -260,18 +308,24 @@ void codegen_reset()
 {
         int c;
 
+        codegen_compile_finish();
+
         for (c = 1; c < BLOCK_SIZE; c++)
         {
                 codeblock_t *block = &codeblock[c];
                 
                 if (block->pc != BLOCK_PC_INVALID)
                 {
+                        if (codegen_profile_enabled)
+                                codegen_profile_retire(block);
                         block->phys = 0;
                         block->phys_2 = 0;
                         delete_block(block);
                 }
         }
 
+        codegen_flush();
+
         memset(codeblock, 0, BLOCK_SIZE * sizeof(codeblock_t));
         memset(codeblock_hash, 0, HASH_SIZE * sizeof(uint16_t));
         mem_reset_page_blocks();
@@ -405,14 +459,20 @@ static void invalidate_block(codeblock_t *block)
 {
         uint32_t old_pc = block->pc;
 
+        if (block->flags & CODEBLOCK_IN_COMPILE)
+                codegen_compile_finish();
+
 #ifndef RELEASE_BUILD
         if (block->flags & CODEBLOCK_IN_DIRTY_LIST)
                 fatal("invalidate_block: already in dirty list\n");
         if (block->pc == BLOCK_PC_INVALID)
                 fatal("Invalidating deleted block\n");
 #endif
+        if (codegen_profile_enabled)
+                codegen_profile_invalidate(block);
         remove_from_block_list(block, old_pc);
         block_dirty_list_add(block);
+        codegen_block_unlink(block);
         if (block->head_mem_block)
                 codegen_allocator_free(block->head_mem_block);
         block->head_mem_block = NULL;
@@ -422,6 +482,9 @@ static void delete_block(codeblock_t *block)
 {
         uint32_t old_pc = block->pc;
 
+        if (block->flags & CODEBLOCK_IN_COMPILE)
+                codegen_compile_finish();
+
         if (block == &codeblock[codeblock_hash[HASH(block->phys)]])
                 codeblock_hash[HASH(block->phys)] = BLOCK_INVALID;
 
@@ -429,7 +492,10 @@ static void delete_block(codeblock_t *block)
         if (block->pc == BLOCK_PC_INVALID)
                 fatal("Deleting deleted block\n");
 #endif
+        if (codegen_profile_enabled)
+                codegen_profile_retire(block);
         block->pc = BLOCK_PC_INVALID;
+        codegen_block_unlink(block);
 
         codeblock_tree_delete(block);
         if (block->flags & CODEBLOCK_IN_DIRTY_LIST)
@@ -451,7 +517,10 @@ static void delete_dirty_block(codeblock_t *block)
         if (block->pc == BLOCK_PC_INVALID)
                 fatal("Deleting deleted block\n");
 #endif
+        if (codegen_profile_enabled)
+                codegen_profile_retire(block);
         block->pc = BLOCK_PC_INVALID;
+        codegen_block_unlink(block);
 
         codeblock_tree_delete(block);
         block_free_list_add(block);
@@ -463,26 +532,51 @@ void codegen_delete_block(codeblock_t *block)
                 delete_block(block);
 }
 
-void codegen_delete_random_block(int required_mem_block)
+void codegen_evict_block(codeblock_t *block)
+{
+        uint32_t key;
+
+        if (block->pc == BLOCK_PC_INVALID)
+                return;
+
+        key = evicted_key(block->phys, block->pc);
+        *evicted_slot(key) = key;
+        evictions++;
+        delete_block(block);
+}
+
+void codegen_evict_cold_block(int required_mem_block)
 {
-        int block_nr = rand() & BLOCK_MASK;
-        
         while (1)
         {
-                if (block_nr && block_nr != block_current)
-                {
-                        codeblock_t *block = &codeblock[block_nr];
+                int block_nr = block_hand;
+                codeblock_t *block = &codeblock[block_nr];
 
-                        if (block->pc != BLOCK_PC_INVALID && (!required_mem_block || block->head_mem_block))
-                        {
-                                delete_block(block);
-                                return;
-                        }
+                block_hand = (block_hand + 1) & BLOCK_MASK;
+
+                if (!block_nr || block_nr == block_current || block->pc == BLOCK_PC_INVALID)
+                        continue;
+                if (required_mem_block && !block->head_mem_block)
+                        continue;
+
+                if (block->usage)
+                        block->usage >>= 1;
+                else
+                {
+                        codegen_evict_block(block);
+                        return;
                 }
-                block_nr = (block_nr + 1) & BLOCK_MASK;
         }
 }
 
+void codegen_block_stats_reset(void)
+{
+        codegen_block_log("Code cache: %i/%i memory blocks used, %u evictions, %u re-translations\n",
+                          codegen_allocator_usage, codegen_allocator_nr, evictions, retranslations);
+
+        evictions = retranslations = 0;
+}
+
 void codegen_check_flush(page_t *page, uint64_t mask, uint32_t phys_addr)
 {
         uint16_t block_nr = page->block;
@@ -543,6 +637,13 @@ void codegen_block_init(uint32_t phys_addr)
 {
         codeblock_t *block;
         page_t *page = &pages[phys_addr >> 12];
+        uint32_t key = evicted_key(phys_addr, cs+cpu_state.pc);
+
+        if (*evicted_slot(key) == key)
+        {
+                *evicted_slot(key) = 0;
+                retranslations++;
+        }
 
         if (!page->block)
                 mem_flush_write_page(phys_addr, cs+cpu_state.pc);
@@ -567,13 +668,42 @@ void codegen_block_init(uint32_t phys_addr)
         block->page_mask = block->page_mask2 = 0;
         block->flags = CODEBLOCK_STATIC_TOP;
         block->status = cpu_cur_status;
+        block->usage = 1;
         
         recomp_page = block->phys & ~0xfff;
         codeblock_tree_add(block);
 }
 
+/*Start a block that the code cache says was compiled in an earlier session.
+  It is registered as a marked block would be, over the guest bytes it covered
+  then, so that it can be recompiled straight away*/
+codeblock_t *codegen_block_init_hinted(uint32_t phys_addr, int flags, uint32_t endpc)
+{
+        codeblock_t *block;
+
+        codegen_block_init(phys_addr);
+        block = &codeblock[block_current];
+
+        codegen_endpc = endpc;
+        codegen_block_end();
+        block->flags |= (flags & (CODEBLOCK_BYTE_MASK | CODEBLOCK_NO_IMMEDIATES));
+
+        return block;
+}
+
 static ir_data_t *ir_data;
 
+/*Background compilation, see codegen.h*/
+#define COMPILE_RESERVE_SIZE 16
+
+int codegen_async_compile = 0;
+
+static mutex_t *compile_mutex;
+static event_t *compile_event, *compile_done_event;
+static int compile_block = BLOCK_INVALID; /*Block owned by the compile thread*/
+static int compile_done;
+static uint64_t compile_time; /*Host time taken, for the profiler*/
+
 ir_data_t *codegen_get_ir_data()
 {
         return ir_data;
@@ -594,6 +724,9 @@ void codegen_block_start_recompile(codeblock_t *block)
                 fatal("Recompile to used block!\n");
 #endif
 
+        /*Exits of the old code, if there was any, can't be patched any more*/
+        codegen_block_unlink(block);
+
         block->head_mem_block = codegen_allocator_allocate(NULL, block_current);
         block->data = codeblock_allocator_get_ptr(block->head_mem_block);
 
@@ -721,6 +854,46 @@ void codegen_block_generate_end_mask_recompile()
         recomp_page = -1;
 }
 
+/*Start a block with code saved by the code cache in an earlier session. It is
+  registered over the guest bytes it covered then and given memory for the
+  code, which the caller copies in and relocates before marking the block as
+  compiled*/
+codeblock_t *codegen_block_init_cached(uint32_t phys_addr, int flags, uint64_t page_mask, uint64_t page_mask2, uint32_t endpc)
+{
+        page_t *page = &pages[phys_addr >> 12];
+        codeblock_t *block;
+
+        /*The guest bytes have just been checked against the saved hash, so
+          writes to the pages since they were last checked don't matter. Flush
+          them now, or the new block would be invalidated as soon as it is run*/
+        if (page->dirty_mask)
+                codegen_check_flush(page, page->dirty_mask, phys_addr);
+        if (page_mask2)
+        {
+                uint32_t phys_2 = get_phys_noabrt(endpc);
+
+                if (phys_2 != -1 && pages[phys_2 >> 12].dirty_mask)
+                        codegen_check_flush(&pages[phys_2 >> 12], pages[phys_2 >> 12].dirty_mask, phys_2);
+        }
+
+        codegen_block_init(phys_addr);
+        block = &codeblock[block_current];
+
+        block->flags = flags;
+        if (flags & CODEBLOCK_BYTE_MASK)
+                block->dirty_mask = &page->byte_dirty_mask[(phys_addr >> PAGE_BYTE_MASK_SHIFT) & PAGE_BYTE_MASK_OFFSET_MASK];
+        block->page_mask = page_mask;
+        block->page_mask2 = page_mask2;
+        codegen_endpc = endpc;
+        codegen_block_generate_end_mask_recompile();
+        add_to_block_list(block);
+
+        block->head_mem_block = codegen_allocator_allocate(NULL, block_current);
+        block->data = codeblock_allocator_get_ptr(block->head_mem_block);
+
+        return block;
+}
+
 void codegen_block_generate_end_mask_mark()
 {
         codeblock_t *block = &codeblock[block_current];
@@ -807,6 +980,121 @@ void codegen_block_end()
         add_to_block_list(block);
 }
 
+static void codegen_compile_thread(void *param)
+{
+        while (1)
+        {
+                uint64_t start_time;
+
+                thread_wait_event(compile_event, -1);
+
+                start_time = plat_timer_read();
+                codegen_ir_compile(ir_data, &codeblock[compile_block]);
+                compile_time = plat_timer_read() - start_time;
+
+                thread_wait_mutex(compile_mutex);
+                compile_done = 1;
+                thread_release_mutex(compile_mutex);
+                thread_set_event(compile_done_event);
+        }
+}
+
+/*Hand block to the compile thread. The IR and register allocator state belong
+  to the compile thread until the block is published*/
+static void codegen_compile_start(codeblock_t *block)
+{
+        if (!compile_mutex)
+        {
+                compile_mutex = thread_create_mutex();
+                compile_event = thread_create_event();
+                compile_done_event = thread_create_event();
+                thread_create(codegen_compile_thread, NULL);
+        }
+
+        codegen_allocator_reserve(COMPILE_RESERVE_SIZE, get_block_nr(block));
+        codegen_allocator_use_reserve = 1;
+
+        block->flags = (block->flags & ~CODEBLOCK_WAS_RECOMPILED) | CODEBLOCK_IN_COMPILE;
+        compile_block = get_block_nr(block);
+        compile_done = 0;
+
+        thread_set_event(compile_event);
+}
+
+static void codegen_compile_publish()
+{
+        codeblock_t *block = &codeblock[compile_block];
+
+        compile_block = BLOCK_INVALID;
+        codegen_allocator_use_reserve = 0;
+        block->flags &= ~CODEBLOCK_IN_COMPILE;
+
+        if (codegen_profile_enabled)
+                codegen_profile_compile(block, ir_data->wr_pos, compile_time);
+
+        if (codegen_allocator_overflow)
+        {
+                /*Generated code did not fit in the reserve. Throw it away, the
+                  block will be compiled on this thread next time around*/
+                codegen_allocator_overflow = 0;
+                codegen_allocator_free(block->head_mem_block);
+                block->head_mem_block = NULL;
+                block->flags |= CODEBLOCK_SYNC_COMPILE;
+                return;
+        }
+
+        /*The compile thread has cleaned the caches, but this core may still
+          need its instruction fetch synchronised*/
+        codegen_allocator_clean_blocks(block->head_mem_block);
+        block->flags |= CODEBLOCK_WAS_RECOMPILED;
+        codegen_ir_opt_account(ir_data);
+}
+
+/*Publish the block being compiled if the compile thread has finished with it*/
+void codegen_compile_poll()
+{
+        int done;
+
+        if (compile_block == BLOCK_INVALID)
+                return;
+
+        thread_wait_mutex(compile_mutex);
+        done = compile_done;
+        thread_release_mutex(compile_mutex);
+
+        if (done)
+                codegen_compile_publish();
+}
+
+/*Is a block being compiled? If so, the IR can not be used for another one*/
+int codegen_compile_busy()
+{
+        return (compile_block != BLOCK_INVALID);
+}
+
+/*Wait for the compile thread and publish the block being compiled*/
+static void codegen_compile_finish()
+{
+        int done;
+
+        if (compile_block == BLOCK_INVALID)
+                return;
+
+        while (1)
+        {
+                thread_wait_mutex(compile_mutex);
+                done = compile_done;
+                thread_release_mutex(compile_mutex);
+
+                if (done)
+                        break;
+
+                thread_wait_event(compile_done_event, -1);
+        }
+
+        codegen_compile_publish();
+}
+
 void codegen_block_end_recompile(codeblock_t *block)
 {
         codegen_timing_block_end();
@@ -825,12 +1113,21 @@ void codegen_block_end_recompile(codeblock_t *block)
                 block->flags &= ~CODEBLOCK_STATIC_TOP;
 
         codegen_accumulate_flush(ir_data);
-        codegen_ir_compile(ir_data, block);
-}
+        if (codegen_async_compile && !(block->flags & CODEBLOCK_SYNC_COMPILE))
+                codegen_compile_start(block);
+        else if (codegen_profile_enabled)
+        {
+                uint64_t start_time = plat_timer_read();
 
-void codegen_flush()
-{
-        return;
+                codegen_ir_compile(ir_data, block);
+                codegen_profile_compile(block, ir_data->wr_pos, plat_timer_read() - start_time);
+                codegen_ir_opt_account(ir_data);
+        }
+        else
+        {
+                codegen_ir_compile(ir_data, block);
+                codegen_ir_opt_account(ir_data);
+        }
 }
 
 void codegen_mark_code_present_multibyte(codeblock_t *block, uint32_t start_pc, int len)
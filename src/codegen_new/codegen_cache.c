@@ -0,0 +1,829 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#if defined WIN32 || defined _WIN32
+#include <windows.h>
+#endif
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+#include <86box/machine.h>
+#include <86box/plat.h>
+
+#include "codegen.h"
+#include "codegen_allocator.h"
+#include "codegen_backend.h"
+#include "codegen_public.h"
+
+/*Persistent code cache, see codegen.h.
+
+  The file holds a header, the entries, the saved code of the entries that have
+  any, and their relocations. Code is only saved for blocks that fit in one
+  memory block and whose every address was reported through codegen_reloc()
+  and can be expressed as one of :
+
+  - a backend routine, by its index in the table given to codegen_reloc_init()
+  - static data or code in the executable image, by offset from cpu_state
+  - guest RAM, by offset from ram
+
+  Addresses in the image only stay the same relative to each other for the same
+  executable, so code is only used if the executable hashes the same as the one
+  that saved it. Otherwise, and for blocks that can't be saved, the entries are
+  compile hints only.
+
+  A stale entry can at worst compile a block that would otherwise have been
+  interpreted once, as the guest bytes are hashed before any entry is used.*/
+
+int codegen_cache_enabled = 0;
+int codegen_reloc_enabled = 0;
+
+#define CACHE_MAGIC   "86BoxDRC"
+#define CACHE_VERSION 2
+#define CACHE_MAX     65536
+
+#define CACHE_ROUTINES_MAX 32
+/*Relocation fields are at least 4 bytes long, so there can't be more than this
+  in a block*/
+#define CACHE_BLOCK_RELOCS_MAX (BLOCK_MAX / 4)
+
+typedef struct cache_entry_t
+{
+        uint32_t phys, phys_2;
+        uint32_t pc, _cs;
+        uint64_t page_mask, page_mask2;
+        uint32_t hash;
+        uint16_t status, flags;
+        uint32_t code_offset, reloc_offset;
+        uint16_t code_size, nr_relocs; /*code_size is 0 for a hint*/
+        uint16_t link_exit;
+        uint8_t TOP, pad;
+} cache_entry_t;
+
+typedef struct cache_header_t
+{
+        char magic[8];
+        uint32_t version, entry_size;
+        char machine[32], cpu_family[32];
+        uint32_t cpu, mem_size;
+        /*Fields from here on are not compared when loading*/
+        uint64_t exe_hash;
+        uint32_t nr_entries, code_size;
+        uint32_t nr_relocs, pad;
+} cache_header_t;
+
+enum
+{
+        TARGET_NONE = 0,
+        TARGET_ROUTINE,
+        TARGET_IMAGE,
+        TARGET_RAM
+};
+
+typedef struct cache_reloc_t
+{
+        int32_t value;
+        uint16_t offset;
+        uint8_t type, target;
+} cache_reloc_t;
+
+/*Relocations of the blocks in the code cache, by block number. Filled in on
+  whichever thread compiles the block*/
+typedef struct cache_block_t
+{
+        cache_reloc_t *relocs;
+        uint16_t nr_relocs, max_relocs;
+        uint16_t size; /*0 if the block can't be saved*/
+        uint8_t failed;
+} cache_block_t;
+
+enum
+{
+        ENTRY_UNUSED = 0,
+        ENTRY_REUSED,
+        ENTRY_STALE,
+        ENTRY_SAVED
+};
+
+static cache_entry_t *entries;
+static uint8_t *entry_state;
+static int nr_entries;
+static uint8_t *entry_code;
+static uint32_t entry_code_size;
+static cache_reloc_t *entry_relocs;
+static uint32_t entry_nr_relocs;
+static int entry_code_usable; /*Saved by this executable, and relocation is enabled*/
+
+/*Open addressed hash of entries by physical address, holds entry index + 1*/
+static uint32_t *entry_hash;
+static uint32_t entry_hash_mask;
+
+static cache_block_t *cache_blocks;
+
+static void *routines[CACHE_ROUTINES_MAX];
+static int nr_routines;
+static uintptr_t image_start, image_end;
+static uint64_t exe_hash;
+
+static int cache_loaded, cache_reused_code, cache_reused_hint, cache_stale;
+
+#ifdef ENABLE_CODEGEN_CACHE_LOG
+int codegen_cache_do_log = ENABLE_CODEGEN_CACHE_LOG;
+
+
+static void
+codegen_cache_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (codegen_cache_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define codegen_cache_log(fmt, ...)
+#endif
+
+#if defined WIN32 || defined _WIN32
+extern IMAGE_DOS_HEADER __ImageBase;
+
+static int cache_image_range()
+{
+        IMAGE_NT_HEADERS *nt_headers = (IMAGE_NT_HEADERS *)((uint8_t *)&__ImageBase + __ImageBase.e_lfanew);
+
+        image_start = (uintptr_t)&__ImageBase;
+        image_end = image_start + nt_headers->OptionalHeader.SizeOfImage;
+        return 1;
+}
+#elif defined(__linux__) || defined(__FreeBSD__)
+extern char __executable_start[], _end[];
+
+static int cache_image_range()
+{
+        image_start = (uintptr_t)__executable_start;
+        image_end = (uintptr_t)_end;
+        return 1;
+}
+#else
+/*The extent of the executable image isn't known, so no code can be saved*/
+static int cache_image_range()
+{
+        image_start = image_end = 0;
+        return 0;
+}
+#endif
+
+/*FNV-1a hash of the executable, 0 if it can't be read*/
+static uint64_t cache_exe_hash()
+{
+        static uint8_t buf[65536];
+        wchar_t path[1024];
+        uint64_t hash = 14695981039346656037ull;
+        size_t len;
+        FILE *f;
+
+        plat_get_exe_name(path, sizeof(path) / sizeof(wchar_t));
+        f = plat_fopen(path, L"rb");
+        if (f == NULL)
+                return 0;
+
+        while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        {
+                size_t c;
+
+                for (c = 0; c < len; c++)
+                {
+                        hash ^= buf[c];
+                        hash *= 1099511628211ull;
+                }
+        }
+        fclose(f);
+
+        return hash;
+}
+
+static inline int cache_in_image(void *p)
+{
+        return ((uintptr_t)p >= image_start) && ((uintptr_t)p < image_end);
+}
+
+static inline uint32_t cache_ram_size()
+{
+        return (mem_size >= (1 << 20)) ? (1 << 30) : (mem_size << 10);
+}
+
+void codegen_reloc_init(void **routine_list, int nr)
+{
+        if (nr > CACHE_ROUTINES_MAX)
+                fatal("codegen_reloc_init - %i routines\n", nr);
+
+        memcpy(routines, routine_list, nr * sizeof(void *));
+        nr_routines = nr;
+}
+
+void codegen_reloc_start(codeblock_t *block)
+{
+        cache_block_t *cache_block;
+
+        if (!codegen_reloc_enabled)
+                return;
+
+        cache_block = &cache_blocks[get_block_nr(block)];
+        cache_block->nr_relocs = 0;
+        cache_block->size = 0;
+        cache_block->failed = 0;
+}
+
+void codegen_reloc_add(codeblock_t *block, int type, void *site, void *target)
+{
+        cache_block_t *cache_block = &cache_blocks[get_block_nr(block)];
+        intptr_t offset = (uint8_t *)site - block->data;
+        int size = (type == RELOC_ABS64) ? 8 : 4;
+        cache_reloc_t *reloc;
+        int c;
+
+        if (cache_block->failed)
+                return;
+
+        if (type == RELOC_FIXED)
+        {
+                cache_block->failed = 1;
+                return;
+        }
+        if (type == RELOC_BASE)
+        {
+                if (!cache_in_image(target))
+                        cache_block->failed = 1;
+                return;
+        }
+
+        /*Fields outside the first memory block are in code that is chained on*/
+        if (offset < 0 || offset > (BLOCK_MAX - size))
+        {
+                cache_block->failed = 1;
+                return;
+        }
+        if (type == RELOC_REL32 && (uint8_t *)target >= block->data && (uint8_t *)target <= &block->data[BLOCK_MAX])
+                return;
+
+        if (cache_block->nr_relocs == cache_block->max_relocs)
+        {
+                cache_block->max_relocs = cache_block->max_relocs ? (cache_block->max_relocs * 2) : 16;
+                cache_block->relocs = realloc(cache_block->relocs, cache_block->max_relocs * sizeof(cache_reloc_t));
+        }
+        reloc = &cache_block->relocs[cache_block->nr_relocs];
+        reloc->offset = offset;
+        reloc->type = type;
+        reloc->target = TARGET_NONE;
+        reloc->value = 0;
+
+        if (type != RELOC_BLOCK_NR)
+        {
+                for (c = 0; c < nr_routines; c++)
+                {
+                        if (target == routines[c])
+                                break;
+                }
+
+                if (c < nr_routines)
+                {
+                        reloc->target = TARGET_ROUTINE;
+                        reloc->value = c;
+                }
+                else if (cache_in_image(target))
+                {
+                        reloc->target = TARGET_IMAGE;
+                        reloc->value = (intptr_t)target - (intptr_t)&cpu_state;
+                }
+                else if (ram && ((uintptr_t)target - (uintptr_t)ram) < cache_ram_size())
+                {
+                        reloc->target = TARGET_RAM;
+                        reloc->value = (uintptr_t)target - (uintptr_t)ram;
+                }
+                else
+                {
+                        cache_block->failed = 1;
+                        return;
+                }
+        }
+
+        cache_block->nr_relocs++;
+}
+
+void codegen_reloc_end(codeblock_t *block, void *end)
+{
+        cache_block_t *cache_block;
+        intptr_t size;
+
+        if (!codegen_reloc_enabled)
+                return;
+
+        cache_block = &cache_blocks[get_block_nr(block)];
+        size = (uint8_t *)end - block->data;
+        if (!cache_block->failed && size > 0 && size <= BLOCK_MAX)
+                cache_block->size = size;
+}
+
+/*Apply relocs to the code just copied to block, false if an address is now out
+  of range*/
+static int cache_relocate(codeblock_t *block, cache_reloc_t *relocs, int nr)
+{
+        int c;
+
+        for (c = 0; c < nr; c++)
+        {
+                cache_reloc_t *reloc = &relocs[c];
+                uint8_t *site = &block->data[reloc->offset];
+                uintptr_t target = 0;
+                int64_t offset;
+
+                switch (reloc->target)
+                {
+                        case TARGET_NONE:
+                        break;
+                        case TARGET_ROUTINE:
+                        if (reloc->value < 0 || reloc->value >= nr_routines)
+                                return 0;
+                        target = (uintptr_t)routines[reloc->value];
+                        break;
+                        case TARGET_IMAGE:
+                        target = (uintptr_t)&cpu_state + reloc->value;
+                        break;
+                        case TARGET_RAM:
+                        if (reloc->value < 0 || reloc->value >= cache_ram_size())
+                                return 0;
+                        target = (uintptr_t)ram + reloc->value;
+                        break;
+                        default:
+                        return 0;
+                }
+
+                switch (reloc->type)
+                {
+                        case RELOC_REL32:
+                        offset = target - (uintptr_t)&site[4];
+                        if (offset < INT32_MIN || offset > INT32_MAX)
+                                return 0;
+                        *(uint32_t *)site = (uint32_t)offset;
+                        break;
+                        case RELOC_ABS64:
+                        *(uint64_t *)site = target;
+                        break;
+                        case RELOC_BLOCK_NR:
+                        *(uint32_t *)site = get_block_nr(block);
+                        break;
+                        default:
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
+static wchar_t *cache_path()
+{
+        static wchar_t temp[1024];
+
+        plat_append_filename(temp, usr_path, L"dynarec.cache");
+        return temp;
+}
+
+static void cache_header_init(cache_header_t *header)
+{
+        memset(header, 0, sizeof(cache_header_t));
+        memcpy(header->magic, CACHE_MAGIC, 8);
+        header->version = CACHE_VERSION;
+        header->entry_size = sizeof(cache_entry_t);
+        strncpy(header->machine, machine_get_internal_name(), sizeof(header->machine) - 1);
+        strncpy(header->cpu_family, cpu_f->internal_name, sizeof(header->cpu_family) - 1);
+        header->cpu = cpu;
+        header->mem_size = mem_size;
+        header->exe_hash = exe_hash;
+}
+
+static inline uint32_t cache_slot(uint32_t phys)
+{
+        return (phys * 0x9e3779b1) & entry_hash_mask;
+}
+
+static uint32_t cache_hash_range(uint32_t base, uint64_t mask, int granule, uint32_t hash)
+{
+        int c, d;
+
+        for (c = 0; c < 64; c++)
+        {
+                if (!(mask & ((uint64_t)1 << c)))
+                        continue;
+
+                for (d = 0; d < granule; d++)
+                {
+                        hash ^= mem_readb_phys(base + c * granule + d);
+                        hash *= 16777619;
+                }
+        }
+
+        return hash;
+}
+
+/*FNV-1a hash of the guest bytes covered by the block's code masks*/
+static uint32_t cache_hash_block(cache_entry_t *entry)
+{
+        uint32_t hash = 2166136261u;
+
+        if (entry->flags & CODEBLOCK_BYTE_MASK)
+        {
+                hash = cache_hash_range(entry->phys & ~0x3f, entry->page_mask, 1, hash);
+                if (entry->page_mask2)
+                        hash = cache_hash_range(entry->phys_2 & ~0x3f, entry->page_mask2, 1, hash);
+        }
+        else
+        {
+                hash = cache_hash_range(entry->phys & ~0xfff, entry->page_mask, 1 << PAGE_MASK_SHIFT, hash);
+                if (entry->page_mask2)
+                        hash = cache_hash_range(entry->phys_2 & ~0xfff, entry->page_mask2, 1 << PAGE_MASK_SHIFT, hash);
+        }
+
+        return hash;
+}
+
+static int cache_find(uint32_t phys, uint32_t pc, uint32_t _cs, uint16_t status)
+{
+        uint32_t slot;
+
+        if (!entry_hash)
+                return -1;
+
+        for (slot = cache_slot(phys); entry_hash[slot]; slot = (slot + 1) & entry_hash_mask)
+        {
+                int nr = entry_hash[slot] - 1;
+                cache_entry_t *entry = &entries[nr];
+
+                if (entry->phys == phys && entry->pc == pc && entry->_cs == _cs && entry->status == status)
+                        return nr;
+        }
+
+        return -1;
+}
+
+static void cache_free()
+{
+        free(entries);
+        free(entry_state);
+        free(entry_hash);
+        free(entry_code);
+        free(entry_relocs);
+        entries = NULL;
+        entry_state = NULL;
+        entry_hash = NULL;
+        entry_code = NULL;
+        entry_relocs = NULL;
+        nr_entries = 0;
+        entry_code_size = entry_nr_relocs = 0;
+}
+
+/*Is the saved code of entry within the file, and the right shape?*/
+static int cache_entry_valid(cache_entry_t *entry)
+{
+        if (!entry->code_size)
+                return 1;
+
+        return (entry->code_size <= BLOCK_MAX) && (entry->link_exit < entry->code_size) &&
+               (entry->code_offset <= entry_code_size) && (entry->code_size <= (entry_code_size - entry->code_offset)) &&
+               (entry->nr_relocs <= CACHE_BLOCK_RELOCS_MAX) &&
+               (entry->reloc_offset <= entry_nr_relocs) && (entry->nr_relocs <= (entry_nr_relocs - entry->reloc_offset));
+}
+
+void codegen_cache_load()
+{
+        cache_header_t header, file_header;
+        uint32_t size;
+        FILE *f;
+        int c;
+
+        cache_free();
+        cache_loaded = cache_reused_code = cache_reused_hint = cache_stale = 0;
+        codegen_reloc_enabled = 0;
+        entry_code_usable = 0;
+
+        if (!codegen_cache_enabled)
+                return;
+
+        if (!cache_blocks)
+                cache_blocks = calloc(BLOCK_SIZE, sizeof(cache_block_t));
+        exe_hash = 0;
+        if (nr_routines && cache_image_range())
+                exe_hash = cache_exe_hash();
+        codegen_reloc_enabled = (exe_hash != 0);
+
+        f = plat_fopen(cache_path(), L"rb");
+        if (f == NULL)
+                return;
+
+        if (fread(&file_header, sizeof(cache_header_t), 1, f) != 1)
+        {
+                fclose(f);
+                return;
+        }
+        cache_header_init(&header);
+        if (memcmp(&header, &file_header, offsetof(cache_header_t, exe_hash)) || file_header.nr_entries > CACHE_MAX ||
+            file_header.code_size > (CACHE_MAX * BLOCK_MAX) || file_header.nr_relocs > (CACHE_MAX * CACHE_BLOCK_RELOCS_MAX))
+        {
+                codegen_cache_log("Code cache: %ls is for a different configuration, ignored\n", cache_path());
+                fclose(f);
+                return;
+        }
+
+        nr_entries = file_header.nr_entries;
+        entry_code_size = file_header.code_size;
+        entry_nr_relocs = file_header.nr_relocs;
+        entries = malloc(nr_entries * sizeof(cache_entry_t));
+        entry_code = malloc(entry_code_size ? entry_code_size : 1);
+        entry_relocs = malloc(entry_nr_relocs ? (entry_nr_relocs * sizeof(cache_reloc_t)) : 1);
+        if (fread(entries, sizeof(cache_entry_t), nr_entries, f) != nr_entries ||
+            fread(entry_code, 1, entry_code_size, f) != entry_code_size ||
+            fread(entry_relocs, sizeof(cache_reloc_t), entry_nr_relocs, f) != entry_nr_relocs)
+        {
+                fclose(f);
+                cache_free();
+                return;
+        }
+        fclose(f);
+
+        for (c = 0; c < nr_entries; c++)
+        {
+                if (!cache_entry_valid(&entries[c]))
+                {
+                        cache_free();
+                        return;
+                }
+        }
+
+        /*Code from another build of the emulator is no use, but the entries
+          still say what was compiled*/
+        entry_code_usable = codegen_reloc_enabled && (file_header.exe_hash == exe_hash);
+
+        entry_state = calloc(nr_entries, 1);
+        for (size = 1; size < (nr_entries * 2); size <<= 1)
+                ;
+        entry_hash = calloc(size, sizeof(uint32_t));
+        entry_hash_mask = size - 1;
+
+        for (c = 0; c < nr_entries; c++)
+        {
+                uint32_t slot;
+
+                for (slot = cache_slot(entries[c].phys); entry_hash[slot]; slot = (slot + 1) & entry_hash_mask)
+                        ;
+                entry_hash[slot] = c + 1;
+        }
+
+        cache_loaded = nr_entries;
+        codegen_cache_log("Code cache: %i blocks loaded, code %s\n", cache_loaded, entry_code_usable ? "usable" : "not usable");
+}
+
+/*Linear address of the last guest byte a block covered, recovered from its
+  code masks. This is the end the block had when it was marked, rounded up to
+  the mask granularity. For byte mask blocks, page_mask covers the 64 byte
+  window holding pc and page_mask2 the window after it, which is usually in the
+  same page; otherwise the masks cover the page holding pc and the next page*/
+static uint32_t cache_block_end(cache_entry_t *entry)
+{
+        uint64_t mask = entry->page_mask2 ? entry->page_mask2 : entry->page_mask;
+        uint32_t base, mask_top;
+
+        for (mask_top = 63; mask_top && !(mask & ((uint64_t)1 << mask_top)); mask_top--)
+                ;
+
+        if (entry->flags & CODEBLOCK_BYTE_MASK)
+        {
+                base = entry->pc & ~0x3f;
+                if (entry->page_mask2)
+                        base += 0x40;
+                return base + mask_top;
+        }
+
+        base = entry->pc & ~0xfff;
+        if (entry->page_mask2)
+                base += 0x1000;
+        return base + (mask_top << PAGE_MASK_SHIFT) + ((1 << PAGE_MASK_SHIFT) - 1);
+}
+
+/*Can the saved code of entry be used for the block about to be run?*/
+static int cache_code_usable(cache_entry_t *entry, uint32_t endpc)
+{
+        if (!entry_code_usable || !entry->code_size)
+                return 0;
+        if ((entry->flags & CODEBLOCK_STATIC_TOP) && entry->TOP != (cpu_state.TOP & 7))
+                return 0;
+        if (entry->page_mask2)
+        {
+                uint32_t phys_2 = get_phys_noabrt(endpc);
+
+                /*The code was generated for the second page mapped where it
+                  was then*/
+                if (phys_2 == -1 || ((phys_2 ^ entry->phys_2) & ~0xfff))
+                        return 0;
+        }
+
+        return 1;
+}
+
+/*Install the saved code of entry as a new block, NULL if it can't be
+  relocated to where it ends up this time*/
+static codeblock_t *cache_install(cache_entry_t *entry, uint32_t phys_addr, uint32_t endpc)
+{
+        int flags = entry->flags & (CODEBLOCK_BYTE_MASK | CODEBLOCK_NO_IMMEDIATES | CODEBLOCK_HAS_FPU | CODEBLOCK_STATIC_TOP);
+        cache_reloc_t *relocs = &entry_relocs[entry->reloc_offset];
+        cache_block_t *cache_block;
+        codeblock_t *block;
+
+        block = codegen_block_init_cached(phys_addr, flags, entry->page_mask, entry->page_mask2, endpc);
+
+        memcpy(block->data, &entry_code[entry->code_offset], entry->code_size);
+        if (!cache_relocate(block, relocs, entry->nr_relocs))
+        {
+                codegen_block_remove();
+                return NULL;
+        }
+        block->link_exit = &block->data[entry->link_exit];
+        block->TOP = entry->TOP;
+        codegen_allocator_clean_blocks(block->head_mem_block);
+        block->flags |= CODEBLOCK_WAS_RECOMPILED;
+
+        /*Keep the relocations, so that the block can be saved again*/
+        cache_block = &cache_blocks[get_block_nr(block)];
+        if (cache_block->max_relocs < entry->nr_relocs)
+        {
+                cache_block->max_relocs = entry->nr_relocs;
+                cache_block->relocs = realloc(cache_block->relocs, cache_block->max_relocs * sizeof(cache_reloc_t));
+        }
+        memcpy(cache_block->relocs, relocs, entry->nr_relocs * sizeof(cache_reloc_t));
+        cache_block->nr_relocs = entry->nr_relocs;
+        cache_block->size = entry->code_size;
+        cache_block->failed = 0;
+
+        return block;
+}
+
+/*Look up the block about to be run at phys_addr in the code cache. Returns the
+  block, ready to run if its code could be used, or to be compiled straight away
+  if not, or NULL if it should be marked as usual*/
+codeblock_t *codegen_cache_lookup(uint32_t phys_addr)
+{
+        cache_entry_t *entry;
+        codeblock_t *block;
+        uint32_t endpc;
+        int nr;
+
+        nr = cache_find(phys_addr, cs + cpu_state.pc, cs, cpu_cur_status);
+        if (nr == -1 || entry_state[nr] == ENTRY_STALE)
+                return NULL;
+
+        entry = &entries[nr];
+        if (cache_hash_block(entry) != entry->hash)
+        {
+                entry_state[nr] = ENTRY_STALE;
+                cache_stale++;
+                return NULL;
+        }
+
+        entry_state[nr] = ENTRY_REUSED;
+        endpc = cache_block_end(entry);
+        if (cache_code_usable(entry, endpc))
+        {
+                block = cache_install(entry, phys_addr, endpc);
+                if (block)
+                {
+                        cache_reused_code++;
+                        return block;
+                }
+        }
+
+        cache_reused_hint++;
+        return codegen_block_init_hinted(phys_addr, entry->flags, endpc);
+}
+
+void codegen_cache_save()
+{
+        cache_header_t header;
+        cache_entry_t *list;
+        uint8_t *code;
+        cache_reloc_t *relocs;
+        uint32_t code_size = 0, nr_relocs = 0;
+        int not_relocatable = 0;
+        FILE *f;
+        int c, nr = 0;
+
+        if (!codegen_cache_enabled)
+                return;
+
+        list = malloc(CACHE_MAX * sizeof(cache_entry_t));
+        code = malloc(CACHE_MAX * BLOCK_MAX);
+        relocs = malloc(CACHE_MAX * CACHE_BLOCK_RELOCS_MAX * sizeof(cache_reloc_t));
+
+        /*Blocks compiled in this session*/
+        for (c = 1; c < BLOCK_SIZE && nr < CACHE_MAX; c++)
+        {
+                codeblock_t *block = &codeblock[c];
+                cache_entry_t *entry = &list[nr];
+                int old_nr;
+
+                if (block->pc == BLOCK_PC_INVALID || (block->flags & (CODEBLOCK_WAS_RECOMPILED | CODEBLOCK_IN_DIRTY_LIST)) != CODEBLOCK_WAS_RECOMPILED)
+                        continue;
+                /*Written to since it was last run, it may not match the guest
+                  bytes any more*/
+                if ((block->page_mask & *block->dirty_mask) || (block->page_mask2 && (block->page_mask2 & *block->dirty_mask2)))
+                        continue;
+
+                memset(entry, 0, sizeof(cache_entry_t));
+                entry->phys = block->phys;
+                entry->phys_2 = block->page_mask2 ? block->phys_2 : 0;
+                entry->pc = block->pc;
+                entry->_cs = block->_cs;
+                entry->page_mask = block->page_mask;
+                entry->page_mask2 = block->page_mask2;
+                entry->status = block->status;
+                entry->flags = block->flags & (CODEBLOCK_BYTE_MASK | CODEBLOCK_NO_IMMEDIATES | CODEBLOCK_HAS_FPU | CODEBLOCK_STATIC_TOP);
+                entry->hash = cache_hash_block(entry);
+
+                if (codegen_reloc_enabled && cache_blocks[c].size)
+                {
+                        cache_block_t *cache_block = &cache_blocks[c];
+
+                        /*Link exits have to be saved as generated*/
+                        codegen_block_unlink(block);
+
+                        entry->code_offset = code_size;
+                        entry->code_size = cache_block->size;
+                        entry->reloc_offset = nr_relocs;
+                        entry->nr_relocs = cache_block->nr_relocs;
+                        entry->link_exit = block->link_exit - block->data;
+                        entry->TOP = block->TOP;
+                        memcpy(&code[code_size], block->data, cache_block->size);
+                        memcpy(&relocs[nr_relocs], cache_block->relocs, cache_block->nr_relocs * sizeof(cache_reloc_t));
+                        code_size += cache_block->size;
+                        nr_relocs += cache_block->nr_relocs;
+                }
+                else
+                        not_relocatable++;
+                nr++;
+
+                old_nr = cache_find(entry->phys, entry->pc, entry->_cs, entry->status);
+                if (old_nr != -1)
+                        entry_state[old_nr] = ENTRY_SAVED;
+        }
+
+        /*Blocks from earlier sessions that were used again, but have since been
+          evicted. Entries that were not used this time are dropped*/
+        for (c = 0; c < nr_entries && nr < CACHE_MAX; c++)
+        {
+                cache_entry_t *entry = &list[nr];
+
+                if (entry_state[c] != ENTRY_REUSED)
+                        continue;
+
+                *entry = entries[c];
+                if (entry->code_size && entry_code_usable)
+                {
+                        memcpy(&code[code_size], &entry_code[entry->code_offset], entry->code_size);
+                        memcpy(&relocs[nr_relocs], &entry_relocs[entry->reloc_offset], entry->nr_relocs * sizeof(cache_reloc_t));
+                        entry->code_offset = code_size;
+                        entry->reloc_offset = nr_relocs;
+                        code_size += entry->code_size;
+                        nr_relocs += entry->nr_relocs;
+                }
+                else
+                {
+                        entry->code_size = entry->nr_relocs = 0;
+                        entry->code_offset = entry->reloc_offset = 0;
+                }
+                nr++;
+        }
+
+        codegen_cache_log("Code cache: %i blocks loaded, %i reused as code, %i reused as hints, %i stale, %i saved, %i of them as hints only\n",
+                          cache_loaded, cache_reused_code, cache_reused_hint, cache_stale, nr, not_relocatable);
+
+        f = plat_fopen(cache_path(), L"wb");
+        if (f != NULL)
+        {
+                cache_header_init(&header);
+                header.nr_entries = nr;
+                header.code_size = code_size;
+                header.nr_relocs = nr_relocs;
+                fwrite(&header, sizeof(cache_header_t), 1, f);
+                fwrite(list, sizeof(cache_entry_t), nr, f);
+                fwrite(code, 1, code_size, f);
+                fwrite(relocs, sizeof(cache_reloc_t), nr_relocs, f);
+                fclose(f);
+        }
+
+        free(relocs);
+        free(code);
+        free(list);
+}
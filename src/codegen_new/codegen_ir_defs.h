@@ -351,11 +351,18 @@ typedef struct uop_t
 
 #define UOP_NR_MAX 4096
 
+/*Number of optimisation passes in codegen_ir_opt.c*/
+#define IR_OPT_PASSES 4
+
 typedef struct ir_data_t
 {
         uop_t uops[UOP_NR_MAX];
         int wr_pos;
         struct codeblock_t *block;
+        /*uOPs removed by each optimisation pass while this block was compiled.
+          These are written by whichever thread compiles the block, and only
+          added to the totals once the block has been handed back.*/
+        uint32_t opt_removed[IR_OPT_PASSES];
 } ir_data_t;
 
 static inline uop_t *uop_alloc(ir_data_t *ir, uint32_t uop_type)
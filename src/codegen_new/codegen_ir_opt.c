@@ -0,0 +1,562 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+
+#include "codegen.h"
+#include "codegen_ir.h"
+#include "codegen_reg.h"
+#include "codegen_public.h"
+
+/*Optimisation passes run over the uOP list of a block before it is compiled.
+
+  Register versions are only meaningful between barriers - a BARRIER uOP may
+  call code that changes any emulated register without creating a new version,
+  and a jump destination can be reached with older versions in the registers.
+  Passes that reason about the value of a version therefore only look back as
+  far as the last barrier or jump destination.
+
+  Every pass keeps the register refcounts correct. When a refcount drops to
+  zero, the version (and the uOP that produced it) is removed if nothing can
+  observe it, ie it is overwritten before the next barrier, or it is a
+  temporary.*/
+
+int codegen_ir_opt = CODEGEN_IR_OPT_ALL;
+
+enum
+{
+        PASS_LOAD = 0,
+        PASS_COPY,
+        PASS_CONST,
+        PASS_FLAGS,
+        PASS_COUNT
+};
+
+static const char *pass_names[PASS_COUNT] =
+{
+        "load", "copy", "const", "flags"
+};
+
+static uint32_t opt_removed[PASS_COUNT];
+static uint32_t opt_uops;
+
+/*Number of (order) barriers and jump destinations before each uOP*/
+static uint16_t barrier_count[UOP_NR_MAX + 1];
+static uint16_t jump_dest_count[UOP_NR_MAX + 1];
+static uint8_t is_jump_dest[UOP_NR_MAX];
+
+#define LOAD_CACHE_SIZE 8
+
+#ifdef ENABLE_CODEGEN_IR_OPT_LOG
+int codegen_ir_opt_do_log = ENABLE_CODEGEN_IR_OPT_LOG;
+
+
+static void
+codegen_ir_opt_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (codegen_ir_opt_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define codegen_ir_opt_log(fmt, ...)
+#endif
+
+/*32-bit integer register accessed at its native size*/
+static inline int reg_is_dword(ir_reg_t ir_reg)
+{
+        return !ir_reg_is_invalid(ir_reg) && IREG_GET_SIZE(ir_reg.reg) == IREG_SIZE_L &&
+                IREG_GET_REG(ir_reg.reg) != IREG_ea_seg && reg_is_native_size(ir_reg);
+}
+
+static inline reg_version_t *get_version(ir_reg_t ir_reg)
+{
+        return &reg_version[IREG_GET_REG(ir_reg.reg)][ir_reg.version];
+}
+
+/*uOP that produced this version, if it is in the current barrier-free region
+  before uop_nr*/
+static uop_t *get_parent(ir_data_t *ir, ir_reg_t ir_reg, int region_start, int uop_nr)
+{
+        reg_version_t *regv = get_version(ir_reg);
+        uop_t *parent;
+
+        if (!ir_reg.version || (regv->flags & REG_FLAGS_DEAD))
+                return NULL;
+        if (regv->parent_uop < region_start || regv->parent_uop >= uop_nr)
+                return NULL;
+
+        parent = &ir->uops[regv->parent_uop];
+        if (IREG_GET_REG(parent->dest_reg_a.reg) != IREG_GET_REG(ir_reg.reg) || parent->dest_reg_a.version != ir_reg.version)
+                return NULL;
+        return parent;
+}
+
+/*Is this still the latest version of its register at uop_nr?*/
+static inline int version_is_current(ir_reg_t ir_reg, int uop_nr)
+{
+        int reg = IREG_GET_REG(ir_reg.reg);
+
+        return (ir_reg.version == reg_last_version[reg]) || (reg_version[reg][ir_reg.version + 1].parent_uop >= uop_nr);
+}
+
+static inline int no_barrier_between(int start, int end)
+{
+        return (barrier_count[end + 1] == barrier_count[start + 1]) && (jump_dest_count[end + 1] == jump_dest_count[start + 1]);
+}
+
+/*Can a version nobody reads any more be removed? It can if it is a temporary,
+  or if it is fully overwritten before anything outside the block could see it.*/
+static int version_is_dead(ir_data_t *ir, ir_reg_t ir_reg)
+{
+        int reg = IREG_GET_REG(ir_reg.reg);
+        reg_version_t *regv = get_version(ir_reg);
+        uop_t *parent;
+
+        if (reg <= IREG_EBX || !ir_reg.version || regv->refcount || (regv->flags & REG_FLAGS_DEAD))
+                return 0;
+
+        parent = &ir->uops[regv->parent_uop];
+        if ((parent->type & (UOP_TYPE_BARRIER | UOP_TYPE_ORDER_BARRIER)) || (parent->type & UOP_MASK) == UOP_INVALID)
+                return 0;
+        if (IREG_GET_REG(parent->dest_reg_a.reg) != reg || parent->dest_reg_a.version != ir_reg.version || !reg_is_native_size(parent->dest_reg_a))
+                return 0;
+
+        if (ir_reg.version == reg_last_version[reg])
+                return reg_is_volatile(reg);
+
+        /*A partial write of the next version still needs this one*/
+        if (!reg_is_native_size(ir->uops[reg_version[reg][ir_reg.version + 1].parent_uop].dest_reg_a))
+                return 0;
+        if (reg_is_volatile(reg))
+                return 1;
+        return no_barrier_between(regv->parent_uop, reg_version[reg][ir_reg.version + 1].parent_uop);
+}
+
+static void release_reg(ir_data_t *ir, ir_reg_t *ir_reg, int pass);
+
+static void remove_uop(ir_data_t *ir, uop_t *uop, int pass)
+{
+        get_version(uop->dest_reg_a)->flags |= REG_FLAGS_DEAD;
+        uop->type = UOP_INVALID;
+        ir->opt_removed[pass]++;
+
+        if (!ir_reg_is_invalid(uop->src_reg_a))
+                release_reg(ir, &uop->src_reg_a, pass);
+        if (!ir_reg_is_invalid(uop->src_reg_b))
+                release_reg(ir, &uop->src_reg_b, pass);
+        if (!ir_reg_is_invalid(uop->src_reg_c))
+                release_reg(ir, &uop->src_reg_c, pass);
+}
+
+/*Drop a read of a register version, removing its parent uOP if that was the
+  last use*/
+static void release_reg(ir_data_t *ir, ir_reg_t *ir_reg, int pass)
+{
+        ir_reg_t old_reg = *ir_reg;
+        reg_version_t *regv = get_version(old_reg);
+
+        *ir_reg = invalid_ir_reg;
+        regv->refcount--;
+        if (version_is_dead(ir, old_reg))
+                remove_uop(ir, &ir->uops[regv->parent_uop], pass);
+}
+
+/*Replace a read of one register version with another*/
+static int replace_reg(ir_data_t *ir, ir_reg_t *ir_reg, ir_reg_t new_reg, int pass)
+{
+        reg_version_t *regv = get_version(new_reg);
+
+        if (regv->refcount >= REG_REFCOUNT_MAX)
+                return 0;
+        regv->refcount++;
+        release_reg(ir, ir_reg, pass);
+        *ir_reg = new_reg;
+        return 1;
+}
+
+static void set_mov_imm(ir_data_t *ir, uop_t *uop, uint32_t imm_data, int pass)
+{
+        if (!ir_reg_is_invalid(uop->src_reg_a))
+                release_reg(ir, &uop->src_reg_a, pass);
+        if (!ir_reg_is_invalid(uop->src_reg_b))
+                release_reg(ir, &uop->src_reg_b, pass);
+        uop->type = UOP_MOV_IMM;
+        uop->imm_data = imm_data;
+}
+
+static void find_barriers(ir_data_t *ir)
+{
+        int c;
+
+        memset(is_jump_dest, 0, ir->wr_pos);
+        for (c = 0; c < ir->wr_pos; c++)
+        {
+                uop_t *uop = &ir->uops[c];
+
+                if ((uop->type & UOP_TYPE_JUMP) && uop->jump_dest_uop >= 0 && uop->jump_dest_uop < ir->wr_pos)
+                        is_jump_dest[uop->jump_dest_uop] = 1;
+        }
+
+        barrier_count[0] = jump_dest_count[0] = 0;
+        for (c = 0; c < ir->wr_pos; c++)
+        {
+                barrier_count[c + 1] = barrier_count[c] + ((ir->uops[c].type & (UOP_TYPE_BARRIER | UOP_TYPE_ORDER_BARRIER)) ? 1 : 0);
+                jump_dest_count[c + 1] = jump_dest_count[c] + is_jump_dest[c];
+        }
+}
+
+static inline int uop_writes_memory(uop_t *uop)
+{
+        switch (uop->type)
+        {
+                case UOP_MEM_STORE_ABS: case UOP_MEM_STORE_REG:
+                case UOP_MEM_STORE_IMM_8: case UOP_MEM_STORE_IMM_16: case UOP_MEM_STORE_IMM_32:
+                case UOP_MEM_STORE_SINGLE: case UOP_MEM_STORE_DOUBLE:
+                return 1;
+        }
+        return (uop->type & UOP_TYPE_BARRIER) ? 1 : 0;
+}
+
+/*Redundant load elimination. Instruction immediates are read from RAM with
+  MOV_REG_PTR/MOVZX_REG_PTR; a second load of the same location with nothing
+  in between that could write memory becomes a register move.*/
+static void opt_loads(ir_data_t *ir)
+{
+        int loads[LOAD_CACHE_SIZE];
+        int nr_loads = 0, next_load = 0;
+        int c, d;
+
+        for (c = 0; c < ir->wr_pos; c++)
+        {
+                uop_t *uop = &ir->uops[c];
+                uint32_t type = uop->type;
+
+                if (is_jump_dest[c] || uop_writes_memory(uop))
+                {
+                        nr_loads = next_load = 0;
+                        continue;
+                }
+                if ((type != UOP_MOV_REG_PTR && type != UOP_MOVZX_REG_PTR_8 && type != UOP_MOVZX_REG_PTR_16) || !reg_is_dword(uop->dest_reg_a))
+                        continue;
+
+                for (d = 0; d < nr_loads; d++)
+                {
+                        uop_t *prev = &ir->uops[loads[d]];
+
+                        if (prev->type == type && prev->p == uop->p && !(get_version(prev->dest_reg_a)->flags & REG_FLAGS_DEAD) &&
+                                        version_is_current(prev->dest_reg_a, c) && get_version(prev->dest_reg_a)->refcount < REG_REFCOUNT_MAX)
+                        {
+                                get_version(prev->dest_reg_a)->refcount++;
+                                uop->type = UOP_MOV;
+                                uop->src_reg_a = prev->dest_reg_a;
+                                ir->opt_removed[PASS_LOAD]++;
+                                break;
+                        }
+                }
+
+                if (d == nr_loads)
+                {
+                        loads[next_load] = c;
+                        next_load = (next_load + 1) % LOAD_CACHE_SIZE;
+                        if (nr_loads < LOAD_CACHE_SIZE)
+                                nr_loads++;
+                }
+        }
+}
+
+/*Copy propagation. Reads of the destination of a 32-bit MOV read the source
+  instead, as long as the source has not been overwritten. The MOV is then
+  removed if nothing else needs it.*/
+static void opt_copy(ir_data_t *ir)
+{
+        int region_start = 0;
+        int c;
+
+        for (c = 0; c < ir->wr_pos; c++)
+        {
+                uop_t *uop = &ir->uops[c];
+                ir_reg_t *src[3] = { &uop->src_reg_a, &uop->src_reg_b, &uop->src_reg_c };
+                int d;
+
+                if (is_jump_dest[c])
+                        region_start = c;
+                if (uop->type & UOP_TYPE_BARRIER)
+                {
+                        region_start = c + 1;
+                        continue;
+                }
+                if ((uop->type & UOP_MASK) == UOP_INVALID || !(uop->type & UOP_TYPE_PARAMS_REGS))
+                        continue;
+
+                for (d = 0; d < 3; d++)
+                {
+                        uop_t *parent;
+
+                        if (!reg_is_dword(*src[d]))
+                                continue;
+
+                        parent = get_parent(ir, *src[d], region_start, c);
+                        if (parent && parent->type == UOP_MOV && reg_is_dword(parent->src_reg_a) &&
+                                        version_is_current(parent->src_reg_a, c))
+                                replace_reg(ir, src[d], parent->src_reg_a, PASS_COPY);
+                }
+        }
+}
+
+static int get_const(ir_data_t *ir, ir_reg_t ir_reg, int region_start, int uop_nr, uint32_t *val)
+{
+        uop_t *parent;
+
+        if (!reg_is_dword(ir_reg))
+                return 0;
+
+        parent = get_parent(ir, ir_reg, region_start, uop_nr);
+        if (!parent || parent->type != UOP_MOV_IMM || !reg_is_dword(parent->dest_reg_a))
+                return 0;
+
+        *val = parent->imm_data;
+        return 1;
+}
+
+static uint32_t fold_op(uint32_t type, uint32_t a, uint32_t b)
+{
+        switch (type)
+        {
+                case UOP_ADD: case UOP_ADD_IMM:
+                return a + b;
+                case UOP_SUB: case UOP_SUB_IMM:
+                return a - b;
+                case UOP_AND: case UOP_AND_IMM:
+                return a & b;
+                case UOP_OR: case UOP_OR_IMM:
+                return a | b;
+                case UOP_XOR: case UOP_XOR_IMM:
+                return a ^ b;
+                case UOP_ANDN:
+                return ~a & b;
+                case UOP_SHL: case UOP_SHL_IMM:
+                return a << b;
+                case UOP_SHR: case UOP_SHR_IMM:
+                return a >> b;
+                case UOP_SAR: case UOP_SAR_IMM:
+                return (uint32_t)((int32_t)a >> b);
+                case UOP_ROL: case UOP_ROL_IMM:
+                return b ? ((a << b) | (a >> (32 - b))) : a;
+                case UOP_ROR: case UOP_ROR_IMM:
+                return b ? ((a >> b) | (a << (32 - b))) : a;
+        }
+        return 0;
+}
+
+static uint32_t imm_form(uint32_t type)
+{
+        switch (type)
+        {
+                case UOP_ADD: return UOP_ADD_IMM;
+                case UOP_SUB: return UOP_SUB_IMM;
+                case UOP_AND: return UOP_AND_IMM;
+                case UOP_OR:  return UOP_OR_IMM;
+                case UOP_XOR: return UOP_XOR_IMM;
+                case UOP_SHL: return UOP_SHL_IMM;
+                case UOP_SHR: return UOP_SHR_IMM;
+                case UOP_SAR: return UOP_SAR_IMM;
+                case UOP_ROL: return UOP_ROL_IMM;
+                case UOP_ROR: return UOP_ROR_IMM;
+        }
+        return 0;
+}
+
+static inline int is_shift(uint32_t type)
+{
+        switch (type)
+        {
+                case UOP_SHL: case UOP_SHR: case UOP_SAR: case UOP_ROL: case UOP_ROR:
+                case UOP_SHL_IMM: case UOP_SHR_IMM: case UOP_SAR_IMM: case UOP_ROL_IMM: case UOP_ROR_IMM:
+                return 1;
+        }
+        return 0;
+}
+
+/*Constant propagation and folding of 32-bit integer uOPs. Results computed
+  only from constants become MOV_IMM; a constant second operand turns a
+  register form into its immediate form.*/
+static void opt_const(ir_data_t *ir)
+{
+        int region_start = 0;
+        int c;
+
+        for (c = 0; c < ir->wr_pos; c++)
+        {
+                uop_t *uop = &ir->uops[c];
+                uint32_t type = uop->type;
+                uint32_t a, b;
+                int const_a, const_b;
+
+                if (is_jump_dest[c])
+                        region_start = c;
+                if (type & UOP_TYPE_BARRIER)
+                {
+                        region_start = c + 1;
+                        continue;
+                }
+                if (!reg_is_dword(uop->dest_reg_a))
+                        continue;
+
+                switch (type)
+                {
+                        case UOP_MOV:
+                        if (get_const(ir, uop->src_reg_a, region_start, c, &a))
+                                set_mov_imm(ir, uop, a, PASS_CONST);
+                        break;
+
+                        case UOP_ADD_IMM: case UOP_SUB_IMM: case UOP_AND_IMM: case UOP_OR_IMM: case UOP_XOR_IMM:
+                        case UOP_SHL_IMM: case UOP_SHR_IMM: case UOP_SAR_IMM: case UOP_ROL_IMM: case UOP_ROR_IMM:
+                        if (is_shift(type) && uop->imm_data > 31)
+                                break;
+                        if (reg_is_dword(uop->src_reg_a) && get_const(ir, uop->src_reg_a, region_start, c, &a))
+                                set_mov_imm(ir, uop, fold_op(type, a, uop->imm_data), PASS_CONST);
+                        break;
+
+                        case UOP_ADD: case UOP_SUB: case UOP_AND: case UOP_OR: case UOP_XOR: case UOP_ANDN:
+                        case UOP_SHL: case UOP_SHR: case UOP_SAR: case UOP_ROL: case UOP_ROR:
+                        if (!reg_is_dword(uop->src_reg_a) || !reg_is_dword(uop->src_reg_b))
+                                break;
+                        const_a = get_const(ir, uop->src_reg_a, region_start, c, &a);
+                        const_b = get_const(ir, uop->src_reg_b, region_start, c, &b);
+                        /*Backends differ on shift counts of 32 and over*/
+                        if (const_b && is_shift(type) && b > 31)
+                                break;
+
+                        if (const_a && const_b)
+                                set_mov_imm(ir, uop, fold_op(type, a, b), PASS_CONST);
+                        else if (const_b && imm_form(type) && !(is_shift(type) && !b))
+                        {
+                                release_reg(ir, &uop->src_reg_b, PASS_CONST);
+                                uop->type = imm_form(type);
+                                uop->imm_data = b;
+                        }
+                        else if (const_a && (type == UOP_ADD || type == UOP_AND || type == UOP_OR || type == UOP_XOR))
+                        {
+                                release_reg(ir, &uop->src_reg_a, PASS_CONST);
+                                uop->src_reg_a = uop->src_reg_b;
+                                uop->src_reg_b = invalid_ir_reg;
+                                uop->type = imm_form(type);
+                                uop->imm_data = a;
+                        }
+                        break;
+                }
+        }
+}
+
+/*Dead flag computation removal. 8 and 16-bit ALU ops write flags_res and
+  friends with a partial write, which keeps the previous 32-bit version alive
+  even though only the low bits are ever read back. When the partial version
+  is only read at its own size and is then overwritten by a full write, the
+  previous version is not needed.*/
+static void opt_flags(ir_data_t *ir)
+{
+        int reg;
+
+        for (reg = IREG_flags_res; reg <= IREG_flags_op2; reg++)
+        {
+                int version;
+
+                for (version = 1; version + 2 <= reg_last_version[reg]; version++)
+                {
+                        reg_version_t *regv = &reg_version[reg][version];
+                        int def = regv->parent_uop;
+                        int def_partial = reg_version[reg][version + 1].parent_uop;
+                        int def_next = reg_version[reg][version + 2].parent_uop;
+                        uop_t *partial = &ir->uops[def_partial];
+                        int size, c;
+
+                        if (regv->refcount || (regv->flags & REG_FLAGS_DEAD))
+                                continue;
+                        if ((partial->type & UOP_MASK) == UOP_INVALID || reg_is_native_size(partial->dest_reg_a) ||
+                                        !reg_is_native_size(ir->uops[def_next].dest_reg_a))
+                                continue;
+                        if (!no_barrier_between(def, def_next))
+                                continue;
+
+                        size = IREG_GET_SIZE(partial->dest_reg_a.reg);
+                        for (c = def_partial + 1; c <= def_next; c++)
+                        {
+                                uop_t *uop = &ir->uops[c];
+
+                                if ((uop->type & UOP_MASK) == UOP_INVALID)
+                                        continue;
+                                if ((IREG_GET_REG(uop->src_reg_a.reg) == reg && uop->src_reg_a.version == version + 1 && IREG_GET_SIZE(uop->src_reg_a.reg) != size) ||
+                                    (IREG_GET_REG(uop->src_reg_b.reg) == reg && uop->src_reg_b.version == version + 1 && IREG_GET_SIZE(uop->src_reg_b.reg) != size) ||
+                                    (IREG_GET_REG(uop->src_reg_c.reg) == reg && uop->src_reg_c.version == version + 1 && IREG_GET_SIZE(uop->src_reg_c.reg) != size))
+                                        break;
+                        }
+                        if (c <= def_next)
+                                continue;
+
+                        /*version_is_dead() won't accept this one because of the
+                          partial write, so remove it directly*/
+                        if (!(ir->uops[def].type & (UOP_TYPE_BARRIER | UOP_TYPE_ORDER_BARRIER)) && (ir->uops[def].type & UOP_MASK) != UOP_INVALID &&
+                                        IREG_GET_REG(ir->uops[def].dest_reg_a.reg) == reg && ir->uops[def].dest_reg_a.version == version)
+                                remove_uop(ir, &ir->uops[def], PASS_FLAGS);
+                }
+        }
+}
+
+void codegen_ir_optimise(ir_data_t *ir)
+{
+        memset(ir->opt_removed, 0, sizeof(ir->opt_removed));
+
+        if (!codegen_ir_opt)
+                return;
+
+        find_barriers(ir);
+
+        if (codegen_ir_opt & CODEGEN_IR_OPT_LOAD)
+                opt_loads(ir);
+        if (codegen_ir_opt & CODEGEN_IR_OPT_COPY)
+                opt_copy(ir);
+        if (codegen_ir_opt & CODEGEN_IR_OPT_CONST)
+                opt_const(ir);
+        if (codegen_ir_opt & CODEGEN_IR_OPT_FLAGS)
+                opt_flags(ir);
+}
+
+/*Add the counts from the last compile to the totals. Called on the emulation
+  thread once the compiled block has been handed back, so that the totals are
+  only ever touched by the thread that also resets them*/
+void codegen_ir_opt_account(ir_data_t *ir)
+{
+        int c;
+
+        if (!codegen_ir_opt)
+                return;
+
+        for (c = 0; c < PASS_COUNT; c++)
+                opt_removed[c] += ir->opt_removed[c];
+        opt_uops += ir->wr_pos;
+}
+
+void codegen_ir_opt_stats_reset(void)
+{
+        int c;
+
+        codegen_ir_opt_log("IR opt: %u uOPs", opt_uops);
+        for (c = 0; c < PASS_COUNT; c++)
+        {
+                codegen_ir_opt_log(", %s %u", pass_names[c], opt_removed[c]);
+                opt_removed[c] = 0;
+        }
+        codegen_ir_opt_log(" removed\n");
+
+        opt_uops = 0;
+}
@@ -0,0 +1,179 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+
+#include "codegen.h"
+#include "codegen_backend.h"
+#include "codegen_public.h"
+
+/*Patching of block link exits, see "Block linking" in codegen.h.
+
+  Exit nr of a block is patched to jump to the block in link[nr] when bit nr
+  of link_patched is set. It is then on the incoming list of that block, so it
+  can be patched back when the block goes away. Exits are identified on the
+  lists by block number * CODEBLOCK_LINKS + exit number, which is never 0 as
+  block 0 holds the backend routines.
+
+  Exits that leave the linear page of their block, or go to a block spanning
+  two pages, are also listed in link_far[] for codegen_flush(). Bit nr of
+  link_far is set while exit nr is in link_far[], so an exit is never listed
+  twice, and cleared only by codegen_flush().*/
+
+codegen_link_state_t codegen_link = {0, INT_MAX};
+
+static uint32_t link_far[BLOCK_SIZE * CODEBLOCK_LINKS];
+static int link_far_count;
+
+static inline uint32_t link_id(codeblock_t *block, int nr)
+{
+        return get_block_nr(block) * CODEBLOCK_LINKS + nr;
+}
+
+/*Whether block can jump straight to next. Both have to be compiled and
+  current, with the same CS and status, and nothing written to next since*/
+static int link_patchable(codeblock_t *block, codeblock_t *next)
+{
+        if ((block->flags | next->flags) & (CODEBLOCK_IN_COMPILE | CODEBLOCK_IN_DIRTY_LIST))
+                return 0;
+        if (!(block->flags & next->flags & CODEBLOCK_WAS_RECOMPILED))
+                return 0;
+        if ((next->flags & CODEBLOCK_STATIC_TOP) || (block->pc == BLOCK_PC_INVALID) || (next->pc == BLOCK_PC_INVALID))
+                return 0;
+        if ((block->_cs != next->_cs) || (block->status != next->status))
+                return 0;
+
+        if ((next->page_mask & *next->dirty_mask) || page_in_evict_list(&pages[next->phys >> 12]))
+                return 0;
+        if (next->page_mask2 && ((next->page_mask2 & *next->dirty_mask2) || page_in_evict_list(&pages[next->phys_2 >> 12])))
+                return 0;
+
+        return 1;
+}
+
+static void link_patch(codeblock_t *block, int nr, codeblock_t *next)
+{
+        block->link_patched |= (1 << nr);
+        block->link_in_next[nr] = next->link_in;
+        next->link_in = link_id(block, nr);
+
+        if (next->page_mask2 || ((block->pc ^ next->pc) & ~0xfff) || ((block->phys ^ next->phys) & ~0xfff))
+        {
+                if (!(block->link_far & (1 << nr)))
+                {
+                        block->link_far |= (1 << nr);
+                        link_far[link_far_count++] = link_id(block, nr);
+                }
+        }
+
+        codegen_backend_link(block, nr, next);
+}
+
+static void link_unpatch(codeblock_t *block, int nr)
+{
+        codeblock_t *next = &codeblock[block->link[nr]];
+        uint32_t id = link_id(block, nr);
+        uint32_t *p = &next->link_in;
+
+        while (*p != id)
+        {
+#ifndef RELEASE_BUILD
+                if (!*p)
+                        fatal("link_unpatch: exit %08x not on list of block %i\n", id, get_block_nr(next));
+#endif
+                p = &codeblock[*p / CODEBLOCK_LINKS].link_in_next[*p % CODEBLOCK_LINKS];
+        }
+        *p = block->link_in_next[nr];
+
+        block->link_patched &= ~(1 << nr);
+        codegen_backend_link(block, nr, NULL);
+}
+
+/*Patch back every exit jumping to block*/
+static void unlink_incoming(codeblock_t *block)
+{
+        while (block->link_in)
+        {
+                uint32_t id = block->link_in;
+
+                link_unpatch(&codeblock[id / CODEBLOCK_LINKS], id % CODEBLOCK_LINKS);
+        }
+}
+
+/*Remember that block exited to next, replacing the oldest link if all are in
+  use, and patch the exit to jump straight there if possible*/
+void codegen_block_link(codeblock_t *block, codeblock_t *next)
+{
+        uint16_t next_nr = get_block_nr(next);
+        int c;
+
+        for (c = 0; c < CODEBLOCK_LINKS; c++)
+        {
+                if (block->link[c] == next_nr)
+                        break;
+        }
+
+        if (c == CODEBLOCK_LINKS)
+        {
+                c = block->link_next;
+                if (block->link_patched & (1 << c))
+                        link_unpatch(block, c);
+                block->link[c] = next_nr;
+                block->link_next = (c + 1) % CODEBLOCK_LINKS;
+        }
+
+        if (!(block->link_patched & (1 << c)) && link_patchable(block, next))
+                link_patch(block, c, next);
+}
+
+/*Forget the links of a block that is being deleted, invalidated or
+  recompiled, and patch back the exits jumping to it*/
+void codegen_block_unlink(codeblock_t *block)
+{
+        int c;
+
+        for (c = 0; c < CODEBLOCK_LINKS; c++)
+        {
+                if (block->link_patched & (1 << c))
+                        link_unpatch(block, c);
+                block->link[c] = BLOCK_INVALID;
+        }
+        block->link_next = 0;
+
+        unlink_incoming(block);
+}
+
+/*Called when a write to code puts page in the evict list. The blocks on it may
+  be stale from now on, so they have to be entered through the checks in
+  exec386_dynarec() again*/
+void codegen_unlink_page(page_t *page)
+{
+        uint16_t block_nr;
+
+        for (block_nr = page->block; block_nr; block_nr = codeblock[block_nr].next)
+                unlink_incoming(&codeblock[block_nr]);
+        for (block_nr = page->block_2; block_nr; block_nr = codeblock[block_nr].next_2)
+                unlink_incoming(&codeblock[block_nr]);
+}
+
+/*The TLB has been flushed. Patch back the exits that rely on a mapping other
+  than that of the page they leave, and stop any chain of blocks being run*/
+void codegen_flush()
+{
+        int c;
+
+        for (c = 0; c < link_far_count; c++)
+        {
+                codeblock_t *block = &codeblock[link_far[c] / CODEBLOCK_LINKS];
+                int nr = link_far[c] % CODEBLOCK_LINKS;
+
+                block->link_far &= ~(1 << nr);
+                if (block->link_patched & (1 << nr))
+                        link_unpatch(block, nr);
+        }
+        link_far_count = 0;
+
+        codegen_link.cycle_limit = INT_MAX;
+}
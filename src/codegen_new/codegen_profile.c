@@ -0,0 +1,351 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+#include <86box/plat.h>
+
+#include "codegen.h"
+#include "codegen_backend.h"
+#include "codegen_public.h"
+
+/*Dynarec profiler.
+
+  While codegen_profile_enabled is set, every entry to a compiled block is
+  counted, and the host time and guest cycles spent in the block are added up.
+  Blocks chained together by exec386_dynarec_link() are accounted for
+  separately. Compiles and invalidations are counted too, along with the host
+  time spent in the backend.
+
+  Counters are kept per block number. When a block is deleted its counters are
+  folded into a table keyed by physical address and CS:EIP, so that the report
+  still covers code that has since been evicted.
+
+  codegen_profile_dump() writes two files to the user directory :
+  dynarec_profile.txt    - all blocks, sorted by host time spent executing them
+  dynarec_profile.folded - one "stack count" line per block and activity, as
+                           consumed by flamegraph.pl and compatible tools
+
+  The UI thread never touches the counters. It sets codegen_profile_toggle or
+  codegen_profile_dump_pending, which codegen_profile_poll() picks up between
+  blocks on the CPU thread.*/
+
+int codegen_profile_enabled = 0;
+volatile int codegen_profile_toggle = 0;
+volatile int codegen_profile_dump_pending = 0;
+
+#define PROFILE_RETIRED_MAX 65536
+
+typedef struct profile_t
+{
+        uint32_t phys, pc, _cs;
+        uint32_t exec_count, compile_count, invalidate_count;
+        uint16_t ins, uops;
+        uint64_t guest_cycles;
+        uint64_t exec_time, compile_time;
+} profile_t;
+
+static profile_t *block_profile;
+
+/*Block currently being executed, and when it was entered*/
+static int profile_block = BLOCK_INVALID;
+static uint64_t profile_start_time;
+static int profile_start_cycles;
+
+/*Counters of deleted blocks, in an open addressed hash holding entry index + 1*/
+static profile_t *retired;
+static uint32_t *retired_hash;
+static int nr_retired, retired_dropped;
+
+#ifdef ENABLE_CODEGEN_PROFILE_LOG
+int codegen_profile_do_log = ENABLE_CODEGEN_PROFILE_LOG;
+
+
+static void
+codegen_profile_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (codegen_profile_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define codegen_profile_log(fmt, ...)
+#endif
+
+static inline int profile_is_empty(profile_t *profile)
+{
+        return !profile->exec_count && !profile->compile_count && !profile->invalidate_count;
+}
+
+static inline uint32_t profile_slot(uint32_t phys, uint32_t pc)
+{
+        return ((phys ^ (pc << 7)) * 0x9e3779b1) & ((PROFILE_RETIRED_MAX * 2) - 1);
+}
+
+static void profile_add(profile_t *dest, profile_t *src)
+{
+        dest->exec_count += src->exec_count;
+        dest->compile_count += src->compile_count;
+        dest->invalidate_count += src->invalidate_count;
+        dest->guest_cycles += src->guest_cycles;
+        dest->exec_time += src->exec_time;
+        dest->compile_time += src->compile_time;
+        if (src->uops)
+        {
+                dest->ins = src->ins;
+                dest->uops = src->uops;
+        }
+}
+
+static void profile_clear()
+{
+        if (block_profile)
+                memset(block_profile, 0, BLOCK_SIZE * sizeof(profile_t));
+        free(retired);
+        free(retired_hash);
+        retired = NULL;
+        retired_hash = NULL;
+        nr_retired = retired_dropped = 0;
+        profile_block = BLOCK_INVALID;
+}
+
+void codegen_profile_init()
+{
+        if (!block_profile)
+                block_profile = malloc(BLOCK_SIZE * sizeof(profile_t));
+        profile_clear();
+}
+
+void codegen_profile_enter(int block_nr)
+{
+        block_profile[block_nr].exec_count++;
+        profile_block = block_nr;
+        profile_start_cycles = cycles;
+        profile_start_time = plat_timer_read();
+}
+
+void codegen_profile_leave()
+{
+        profile_t *profile;
+
+        if (profile_block == BLOCK_INVALID)
+                return;
+
+        profile = &block_profile[profile_block];
+        profile->exec_time += plat_timer_read() - profile_start_time;
+        if (profile_start_cycles > cycles)
+                profile->guest_cycles += profile_start_cycles - cycles;
+        profile_block = BLOCK_INVALID;
+}
+
+void codegen_profile_compile(codeblock_t *block, int uops, uint64_t time)
+{
+        profile_t *profile = &block_profile[get_block_nr(block)];
+
+        profile->compile_count++;
+        profile->compile_time += time;
+        profile->ins = block->ins;
+        profile->uops = uops;
+}
+
+void codegen_profile_invalidate(codeblock_t *block)
+{
+        block_profile[get_block_nr(block)].invalidate_count++;
+}
+
+/*Move the counters of a block that is about to be deleted to the retired table*/
+void codegen_profile_retire(codeblock_t *block)
+{
+        profile_t *profile = &block_profile[get_block_nr(block)];
+        uint32_t slot;
+
+        if (profile_is_empty(profile))
+                return;
+
+        if (get_block_nr(block) == profile_block)
+                codegen_profile_leave();
+
+        if (!retired)
+        {
+                retired = malloc(PROFILE_RETIRED_MAX * sizeof(profile_t));
+                retired_hash = calloc(PROFILE_RETIRED_MAX * 2, sizeof(uint32_t));
+        }
+
+        for (slot = profile_slot(block->phys, block->pc); retired_hash[slot]; slot = (slot + 1) & ((PROFILE_RETIRED_MAX * 2) - 1))
+        {
+                profile_t *old = &retired[retired_hash[slot] - 1];
+
+                if (old->phys == block->phys && old->pc == block->pc && old->_cs == block->_cs)
+                        break;
+        }
+
+        if (retired_hash[slot])
+                profile_add(&retired[retired_hash[slot] - 1], profile);
+        else if (nr_retired < PROFILE_RETIRED_MAX)
+        {
+                profile_t *new_profile = &retired[nr_retired++];
+
+                memset(new_profile, 0, sizeof(profile_t));
+                new_profile->phys = block->phys;
+                new_profile->pc = block->pc;
+                new_profile->_cs = block->_cs;
+                profile_add(new_profile, profile);
+                retired_hash[slot] = nr_retired;
+        }
+        else
+                retired_dropped++;
+
+        memset(profile, 0, sizeof(profile_t));
+}
+
+static int profile_compare_key(const void *p1, const void *p2)
+{
+        const profile_t *a = p1, *b = p2;
+
+        if (a->phys != b->phys)
+                return (a->phys < b->phys) ? -1 : 1;
+        if (a->_cs != b->_cs)
+                return (a->_cs < b->_cs) ? -1 : 1;
+        if (a->pc != b->pc)
+                return (a->pc < b->pc) ? -1 : 1;
+        return 0;
+}
+
+static int profile_compare_time(const void *p1, const void *p2)
+{
+        const profile_t *a = p1, *b = p2;
+
+        if (a->exec_time != b->exec_time)
+                return (a->exec_time > b->exec_time) ? -1 : 1;
+        if (a->exec_count != b->exec_count)
+                return (a->exec_count > b->exec_count) ? -1 : 1;
+        return profile_compare_key(p1, p2);
+}
+
+static uint64_t profile_us(uint64_t time)
+{
+        if (!timer_freq)
+                return time;
+        return (time * 1000000) / timer_freq;
+}
+
+void codegen_profile_dump()
+{
+        profile_t *list;
+        uint64_t exec_time = 0, compile_time = 0, exec_count = 0;
+        wchar_t path[1024];
+        FILE *f;
+        int c, nr = 0, nr_merged = 0;
+
+        codegen_profile_dump_pending = 0;
+
+        if (!block_profile)
+                return;
+
+        /*Gather retired and live blocks, then merge entries for the same code*/
+        list = malloc((nr_retired + BLOCK_SIZE) * sizeof(profile_t));
+        if (nr_retired)
+                memcpy(list, retired, nr_retired * sizeof(profile_t));
+        nr = nr_retired;
+        for (c = 1; c < BLOCK_SIZE; c++)
+        {
+                codeblock_t *block = &codeblock[c];
+
+                if (block->pc == BLOCK_PC_INVALID || profile_is_empty(&block_profile[c]))
+                        continue;
+
+                list[nr] = block_profile[c];
+                list[nr].phys = block->phys;
+                list[nr].pc = block->pc;
+                list[nr]._cs = block->_cs;
+                nr++;
+        }
+
+        qsort(list, nr, sizeof(profile_t), profile_compare_key);
+        for (c = 0; c < nr; c++)
+        {
+                if (nr_merged && !profile_compare_key(&list[nr_merged - 1], &list[c]))
+                        profile_add(&list[nr_merged - 1], &list[c]);
+                else
+                        list[nr_merged++] = list[c];
+        }
+        nr = nr_merged;
+        qsort(list, nr, sizeof(profile_t), profile_compare_time);
+
+        for (c = 0; c < nr; c++)
+        {
+                exec_time += list[c].exec_time;
+                compile_time += list[c].compile_time;
+                exec_count += list[c].exec_count;
+        }
+
+        plat_append_filename(path, usr_path, L"dynarec_profile.txt");
+        f = plat_fopen(path, L"wt");
+        if (f != NULL)
+        {
+                fprintf(f, "# %i blocks, %llu executions, %llu us executing, %llu us compiling\n",
+                        nr, (unsigned long long)exec_count, (unsigned long long)profile_us(exec_time), (unsigned long long)profile_us(compile_time));
+                if (retired_dropped)
+                        fprintf(f, "# %i deleted blocks not recorded, retired table full\n", retired_dropped);
+                fprintf(f, "#      CS base:EIP       phys   ins  uops      execs  compiles  invalids          cycles   exec_us  compile_us\n");
+                for (c = 0; c < nr; c++)
+                {
+                        profile_t *profile = &list[c];
+
+                        fprintf(f, "%08x:%08x %08x %5u %5u %10u %9u %9u %15llu %9llu %11llu\n",
+                                profile->_cs, profile->pc - profile->_cs, profile->phys,
+                                profile->ins, profile->uops, profile->exec_count, profile->compile_count, profile->invalidate_count,
+                                (unsigned long long)profile->guest_cycles, (unsigned long long)profile_us(profile->exec_time),
+                                (unsigned long long)profile_us(profile->compile_time));
+                }
+                fclose(f);
+        }
+
+        plat_append_filename(path, usr_path, L"dynarec_profile.folded");
+        f = plat_fopen(path, L"wt");
+        if (f != NULL)
+        {
+                for (c = 0; c < nr; c++)
+                {
+                        profile_t *profile = &list[c];
+                        uint64_t us;
+
+                        us = profile_us(profile->exec_time);
+                        if (us)
+                                fprintf(f, "dynarec;execute;%08x:%08x@%08x %llu\n", profile->_cs, profile->pc - profile->_cs, profile->phys, (unsigned long long)us);
+                        us = profile_us(profile->compile_time);
+                        if (us)
+                                fprintf(f, "dynarec;compile;%08x:%08x@%08x %llu\n", profile->_cs, profile->pc - profile->_cs, profile->phys, (unsigned long long)us);
+                }
+                fclose(f);
+        }
+
+        codegen_profile_log("Dynarec profile: %i blocks written to %ls\n", nr, usr_path);
+
+        free(list);
+}
+
+/*Act on requests from the UI thread. Turning the profiler on starts a new
+  profile*/
+void codegen_profile_poll()
+{
+        if (codegen_profile_toggle)
+        {
+                codegen_profile_toggle = 0;
+                codegen_profile_leave();
+                codegen_profile_enabled ^= 1;
+                if (codegen_profile_enabled)
+                        profile_clear();
+        }
+        if (codegen_profile_dump_pending)
+                codegen_profile_dump();
+}
@@ -224,6 +224,11 @@ int reg_is_native_size(ir_reg_t ir_reg)
         return 0;
 }
 
+int reg_is_volatile(int reg)
+{
+        return (ireg_data[reg].is_volatile == REG_VOLATILE);
+}
+
 void codegen_reg_reset()
 {
         int c;
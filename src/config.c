@@ -35,10 +35,14 @@
 #define HAVE_STDARG_H
 #include <86box/86box.h>
 #include "cpu.h"
+#ifdef USE_DYNAREC
+# include "codegen_public.h"
+#endif
 #include <86box/device.h>
 #include <86box/timer.h>
 #include <86box/nvr.h>
 #include <86box/config.h>
+#include <86box/mem.h>
 #include <86box/isamem.h>
 #include <86box/isartc.h>
 #include <86box/lpt.h>
@@ -646,6 +650,24 @@ load_machine(void)
 	mem_size = 2097152;
 
     cpu_use_dynarec = !!config_get_int(cat, "cpu_use_dynarec", 0);
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+    codegen_ir_opt = config_get_int(cat, "dynarec_ir_opt", CODEGEN_IR_OPT_ALL) & CODEGEN_IR_OPT_ALL;
+    codegen_async_compile = !!config_get_int(cat, "dynarec_async_compile", 0);
+    codegen_cache_enabled = !!config_get_int(cat, "dynarec_persistent_cache", 0);
+    codegen_profile_enabled = !!config_get_int(cat, "dynarec_profile", 0);
+    codegen_code_cache_size = config_get_int(cat, "dynarec_code_cache_size", 0);
+    if (codegen_code_cache_size < 0)
+	codegen_code_cache_size = 0;
+#endif
+
+    p = config_get_string(cat, "timer_engine", NULL);
+    if ((p != NULL) && !strcmp(p, "list"))
+	timer_engine = TIMER_ENGINE_LIST;
+    else
+	timer_engine = TIMER_ENGINE_HEAP;
+
+    mmu_tlb_size = config_get_int(cat, "tlb_size", TLB_SIZE_DEFAULT);
+    mmu_tlb_contexts = config_get_int(cat, "tlb_contexts", 0);
 
     p = config_get_string(cat, "time_sync", NULL);
     if (p != NULL) {        
@@ -786,6 +808,8 @@ load_sound(void)
 	sound_is_float = 1;
       else
 	sound_is_float = 0;
+
+    sound_workers = config_get_int(cat, "sound_workers", 0);
 }
 
 
@@ -940,6 +964,9 @@ load_hard_disks(void)
     uint32_t max_spt, max_hpc, max_tracks;
     uint32_t board = 0, dev = 0;
 
+    hdd_async_io = !!config_get_int(cat, "async_io", 0);
+    hdd_vhd_mmap = !!config_get_int(cat, "vhd_mmap", 0);
+
     memset(temp, '\0', sizeof(temp));
     for (c=0; c<HDD_NUM; c++) {
 	sprintf(temp, "hdd_%02i_parameters", c+1);
@@ -1039,6 +1066,14 @@ load_hard_disks(void)
 	} else
 		config_delete_var(cat, temp);
 
+	/* Copy-on-write overlay */
+	sprintf(temp, "hdd_%02i_overlay", c+1);
+	hdd[c].overlay = config_get_int(cat, temp, 0);
+	if (hdd[c].overlay > 2)
+		hdd[c].overlay = 0;
+	sprintf(temp, "hdd_%02i_overlay_commit", c+1);
+	hdd[c].overlay_commit = !!config_get_int(cat, temp, 0);
+
 	memset(hdd[c].fn, 0x00, sizeof(hdd[c].fn));
 	memset(hdd[c].prev_fn, 0x00, sizeof(hdd[c].prev_fn));
 	sprintf(temp, "hdd_%02i_fn", c+1);
@@ -1087,6 +1122,12 @@ load_hard_disks(void)
 		sprintf(temp, "hdd_%02i_scsi_id", c+1);
 		config_delete_var(cat, temp);
 
+		sprintf(temp, "hdd_%02i_overlay", c+1);
+		config_delete_var(cat, temp);
+
+		sprintf(temp, "hdd_%02i_overlay_commit", c+1);
+		config_delete_var(cat, temp);
+
 		sprintf(temp, "hdd_%02i_fn", c+1);
 		config_delete_var(cat, temp);
 	}
@@ -1175,6 +1216,13 @@ load_floppy_and_cdrom_drives(void)
     /* TODO: Backwards compatibility, get rid of this when enough time has passed. */
     backwards_compat = (find_section(cat) == NULL);
 
+    cdrom_read_ahead = config_get_int(cat, "cdrom_read_ahead", 64);
+    if (cdrom_read_ahead < 0)
+	cdrom_read_ahead = 0;
+    else if (cdrom_read_ahead > 16384)
+	cdrom_read_ahead = 16384;
+    cdrom_mmap = !!config_get_int(cat, "cdrom_mmap", 0);
+
     memset(temp, 0x00, sizeof(temp));
     for (c=0; c<FDD_NUM; c++) {
 	sprintf(temp, "fdd_%02i_type", c+1);
@@ -1935,6 +1983,48 @@ save_machine(void)
 
     config_set_int(cat, "cpu_use_dynarec", cpu_use_dynarec);
 
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+    if (codegen_ir_opt == CODEGEN_IR_OPT_ALL)
+	config_delete_var(cat, "dynarec_ir_opt");
+      else
+	config_set_int(cat, "dynarec_ir_opt", codegen_ir_opt);
+
+    if (!codegen_async_compile)
+	config_delete_var(cat, "dynarec_async_compile");
+      else
+	config_set_int(cat, "dynarec_async_compile", codegen_async_compile);
+
+    if (!codegen_cache_enabled)
+	config_delete_var(cat, "dynarec_persistent_cache");
+      else
+	config_set_int(cat, "dynarec_persistent_cache", codegen_cache_enabled);
+
+    if (!codegen_profile_enabled)
+	config_delete_var(cat, "dynarec_profile");
+      else
+	config_set_int(cat, "dynarec_profile", codegen_profile_enabled);
+
+    if (!codegen_code_cache_size)
+	config_delete_var(cat, "dynarec_code_cache_size");
+      else
+	config_set_int(cat, "dynarec_code_cache_size", codegen_code_cache_size);
+#endif
+
+    if (timer_engine == TIMER_ENGINE_HEAP)
+	config_delete_var(cat, "timer_engine");
+      else
+	config_set_string(cat, "timer_engine", "list");
+
+    if (mmu_tlb_size == TLB_SIZE_DEFAULT)
+	config_delete_var(cat, "tlb_size");
+      else
+	config_set_int(cat, "tlb_size", mmu_tlb_size);
+
+    if (mmu_tlb_contexts == 0)
+	config_delete_var(cat, "tlb_contexts");
+      else
+	config_set_int(cat, "tlb_contexts", mmu_tlb_contexts);
+
     if (time_sync & TIME_SYNC_ENABLED)
 	if (time_sync & TIME_SYNC_UTC)
 		config_set_string(cat, "time_sync", "utc");
@@ -2070,6 +2160,11 @@ save_sound(void)
       else
 	config_set_string(cat, "sound_type", (sound_is_float == 1) ? "float" : "int16");
 
+    if (sound_workers == 0)
+	config_delete_var(cat, "sound_workers");
+      else
+	config_set_int(cat, "sound_workers", sound_workers);
+
     delete_section_if_empty(cat);
 }
 
@@ -2223,6 +2318,16 @@ save_hard_disks(void)
     char *p;
     int c;
 
+    if (hdd_async_io)
+	config_set_int(cat, "async_io", hdd_async_io);
+      else
+	config_delete_var(cat, "async_io");
+
+    if (hdd_vhd_mmap)
+	config_set_int(cat, "vhd_mmap", hdd_vhd_mmap);
+      else
+	config_delete_var(cat, "vhd_mmap");
+
     memset(temp, 0x00, sizeof(temp));
     for (c=0; c<HDD_NUM; c++) {
 	sprintf(temp, "hdd_%02i_parameters", c+1);
@@ -2267,6 +2372,18 @@ save_hard_disks(void)
 	else
 		config_delete_var(cat, temp);
 
+	sprintf(temp, "hdd_%02i_overlay", c+1);
+	if (hdd_is_valid(c) && hdd[c].overlay)
+		config_set_int(cat, temp, hdd[c].overlay);
+	  else
+		config_delete_var(cat, temp);
+
+	sprintf(temp, "hdd_%02i_overlay_commit", c+1);
+	if (hdd_is_valid(c) && hdd[c].overlay && hdd[c].overlay_commit)
+		config_set_int(cat, temp, hdd[c].overlay_commit);
+	  else
+		config_delete_var(cat, temp);
+
 	sprintf(temp, "hdd_%02i_fn", c+1);
 	if (hdd_is_valid(c) && (wcslen(hdd[c].fn) != 0))
 		if (!wcsnicmp(hdd[c].fn, usr_path, wcslen(usr_path)))
@@ -2289,6 +2406,16 @@ save_floppy_and_cdrom_drives(void)
     char temp[512], tmp2[512];
     int c;
 
+    if (cdrom_read_ahead == 64)
+	config_delete_var(cat, "cdrom_read_ahead");
+      else
+	config_set_int(cat, "cdrom_read_ahead", cdrom_read_ahead);
+
+    if (cdrom_mmap)
+	config_set_int(cat, "cdrom_mmap", cdrom_mmap);
+      else
+	config_delete_var(cat, "cdrom_mmap");
+
     for (c=0; c<FDD_NUM; c++) {
 	sprintf(temp, "fdd_%02i_type", c+1);
 	if (fdd_get_type(c) == ((c < 2) ? 2 : 0))
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <wchar.h>
 #include <math.h>
+#include <limits.h>
 #ifndef INFINITY
 # define INFINITY   (__builtin_inff())
 #endif
@@ -278,6 +279,12 @@ static uint64_t tsc_old = 0;
 int acycs = 0;
 #endif
 
+#ifdef USE_NEW_DYNAREC
+static int link_from,				/* block to link the next one to */
+	   link_done;				/* work between blocks done */
+static uint32_t link_linked, link_dispatched;
+#endif
+
 
 void
 update_tsc(void)
@@ -308,6 +315,126 @@ update_tsc(void)
 }
 
 
+#ifdef USE_NEW_DYNAREC
+/* Whether block can be entered as it is at the current CS:EIP, without any
+   of the flushing or recompiling exec386_dynarec_dyn() may have to do. */
+static __inline int
+exec386_dynarec_link_valid(codeblock_t *block, uint32_t phys_addr)
+{
+    return (block->pc != BLOCK_PC_INVALID) && (block->pc == cs + cpu_state.pc) && (block->_cs == cs) &&
+	   (block->phys == phys_addr) && !((block->status ^ cpu_cur_status) & CPU_STATUS_FLAGS) &&
+	   ((block->status & cpu_cur_status & CPU_STATUS_MASK) == (cpu_cur_status & CPU_STATUS_MASK)) &&
+	   ((block->flags & (CODEBLOCK_WAS_RECOMPILED | CODEBLOCK_IN_DIRTY_LIST)) == CODEBLOCK_WAS_RECOMPILED) &&
+	   !(block->page_mask & *block->dirty_mask) &&
+	   !((block->flags & CODEBLOCK_STATIC_TOP) && (block->TOP != (cpu_state.TOP & 7))) &&
+	   (!block->page_mask2 || (!(block->page_mask2 & *block->dirty_mask2) &&
+	   !((block->phys_2 ^ get_phys_noabrt(block->pc + ((block->flags & CODEBLOCK_BYTE_MASK) ? 0x40 : 0x400))) & ~0xfff)));
+}
+
+
+/* Set up what the link exits of the block about to be entered check, so
+   that they go on to the next block only while the checks above and those
+   exec386_dynarec_link() makes would pass. */
+static __inline void
+exec386_dynarec_link_start(codeblock_t *block)
+{
+    int64_t limit = (int64_t)cycles_old - (int32_t)(timer_target - (uint32_t)tsc);
+
+    /* Chained blocks are not seen by the profiler, so don't chain. */
+    if (codegen_profile_enabled || (limit > INT_MAX))
+	codegen_link.cycle_limit = INT_MAX;
+    else if (limit < 0)
+	codegen_link.cycle_limit = 0;
+    else
+	codegen_link.cycle_limit = (int)limit;
+    codegen_link.timer = timer_target;
+    codegen_link.cs_base = cs;
+    codegen_link.status = cpu_cur_status;
+}
+
+
+/* Called by the exit code of a translated block. If there is no abort or
+   interrupt to take, do the work exec386_dynarec() does between two blocks,
+   and return the code of the next block if this one is linked to it. */
+void *
+exec386_dynarec_link(void)
+{
+    codeblock_t *block = &codeblock[codegen_link.block];
+    codeblock_t *next;
+    uint32_t addr, phys_addr;
+    uint64_t delta;
+    int c, cycdiff;
+
+    if (codegen_profile_enabled)
+	codegen_profile_leave();
+
+    if (cpu_state.abrt || smi_line || (nmi && nmi_enable && nmi_mask) ||
+	((cpu_state.flags & I_FLAG) && pic.int_pending))
+	return NULL;
+
+    inrecomp = 0;
+
+    cycdiff = cycles_old - cycles;
+    delta = tsc - tsc_old;
+    if (delta > 0) {
+	cycdiff -= delta;
+	if (cycdiff > 0)
+		tsc += cycdiff;
+    } else
+	tsc += cycdiff;
+
+    if (cycdiff > 0) {
+	if (TIMER_VAL_LESS_THAN_VAL(timer_target, (uint32_t) tsc))
+		timer_process_inline();
+    }
+
+    link_done = 1;
+
+    if ((cycles <= 0) || !CACHE_ON())
+	return NULL;
+
+    cycles_old = cycles;
+    tsc_old = tsc;
+
+    /* Leave anything that needs a page walk to the dispatcher, which
+       also takes the page fault if there is one. */
+    addr = cs + cpu_state.pc;
+    if (((addr ^ get_phys_virt) & ~0xfff) && (cr0 >> 31) && (((int) (readlookup2[addr >> 12])) == -1))
+	return NULL;
+    phys_addr = get_phys(addr);
+
+    for (c = 0; c < CODEBLOCK_LINKS; c++) {
+	next = &codeblock[block->link[c]];
+
+	if ((block->link[c] != BLOCK_INVALID) && exec386_dynarec_link_valid(next, phys_addr)) {
+		/* Patch the exit again if it was patched back. */
+		codegen_block_link(block, next);
+		link_done = 0;
+		link_linked++;
+		codegen_block_touch(next);
+		inrecomp = 1;
+		if (codegen_profile_enabled)
+			codegen_profile_enter(block->link[c]);
+		exec386_dynarec_link_start(next);
+		return &next->data[BLOCK_START];
+	}
+    }
+
+    link_from = codegen_link.block;
+    return NULL;
+}
+
+
+void
+exec386_dynarec_stats_reset(void)
+{
+    x386_dynarec_log("Dynarec: %u linked, %u dispatched block entries\n", link_linked, link_dispatched);
+
+    link_linked = link_dispatched = 0;
+}
+#endif
+
+
 static __inline void
 exec386_dynarec_int(void)
 {
@@ -387,6 +514,10 @@ exec386_dynarec_dyn(void)
     int hash = HASH(phys_addr);
 #ifdef USE_NEW_DYNAREC
     codeblock_t *block = &codeblock[codeblock_hash[hash]];
+    int from = link_from;
+
+    link_from = 0;
+    codegen_compile_poll();
 #else
     codeblock_t *block = codeblock_hash[hash];
 #endif
@@ -504,6 +635,18 @@ exec386_dynarec_dyn(void)
     }
 
 #ifdef USE_NEW_DYNAREC
+    /* A block compiled in an earlier session is taken from the persistent
+       code cache, or at least compiled the first time it is run instead of
+       being interpreted and marked first. */
+    if (!valid_block && !cpu_state.abrt && !codegen_compile_busy()) {
+	codeblock_t *cached = codegen_cache_lookup(phys_addr);
+
+	if (cached) {
+		block = cached;
+		valid_block = 1;
+	}
+    }
+
     if (valid_block && (block->flags & CODEBLOCK_WAS_RECOMPILED))
 #else
     if (valid_block && block->was_recompiled)
@@ -511,7 +654,16 @@ exec386_dynarec_dyn(void)
     {
 	void (*code)() = (void *)&block->data[BLOCK_START];
 
-#ifndef USE_NEW_DYNAREC
+#ifdef USE_NEW_DYNAREC
+	/* The previous block exited straight to this one, link them. */
+	if (from && (codeblock[from].pc != BLOCK_PC_INVALID))
+		codegen_block_link(&codeblock[from], block);
+	link_dispatched++;
+	codegen_block_touch(block);
+	if (codegen_profile_enabled)
+		codegen_profile_enter(get_block_nr(block));
+	exec386_dynarec_link_start(block);
+#else
 	codeblock_hash[hash] = block;
 #endif
 	inrecomp = 1;
@@ -520,9 +672,18 @@ exec386_dynarec_dyn(void)
 	acycs = 0;
 #endif
 	inrecomp = 0;
+#ifdef USE_NEW_DYNAREC
+	if (codegen_profile_enabled)
+		codegen_profile_leave();
+#endif
 
 #ifndef USE_NEW_DYNAREC
 	if (!use32) cpu_state.pc &= 0xffff;
+#endif
+#ifdef USE_NEW_DYNAREC
+    } else if (valid_block && !cpu_state.abrt && codegen_compile_busy()) {
+	/* The compile thread has the IR, interpret this block until it is done. */
+	exec386_dynarec_int();
 #endif
     } else if (valid_block && !cpu_state.abrt) {
 #ifdef USE_NEW_DYNAREC
@@ -719,13 +880,15 @@ exec386_dynarec(int cycs)
 {
     int vector, tempi;
     int cycdiff;
-    int oldcyc, oldcyc2;
-    uint64_t oldtsc, delta;
+    uint64_t delta;
 
     int cyc_period = cycs / 2000; /*5us*/
 
 #ifdef USE_ACYCS
     acycs = 0;
+#endif
+#ifdef USE_NEW_DYNAREC
+    codegen_profile_poll();
 #endif
     cycles_main += cycs;
     while (cycles_main > 0) {
@@ -743,9 +906,7 @@ exec386_dynarec(int cycs)
 
 		cycdiff = 0;
 #endif
-		oldcyc = oldcyc2 = cycles;
 		cycles_old = cycles;
-		oldtsc = tsc;
 		tsc_old = tsc;
 		if (!CACHE_ON()) /*Interpret block*/
 		{
@@ -756,6 +917,15 @@ exec386_dynarec(int cycs)
 			exec386_dynarec_dyn();
 		}
 
+#ifdef USE_NEW_DYNAREC
+		/* The last block exited through exec386_dynarec_link(), which has
+		   already done everything below. */
+		if (link_done) {
+			link_done = 0;
+			continue;
+		}
+#endif
+
 		if (cpu_state.abrt) {
 			flags_rebuild();
 			tempi = cpu_state.abrt & ABRT_MASK;
@@ -806,8 +976,8 @@ exec386_dynarec(int cycs)
 			}
 		}
 
-		cycdiff = oldcyc - cycles;
-		delta = tsc - oldtsc;
+		cycdiff = cycles_old - cycles;
+		delta = tsc - tsc_old;
 		if (delta > 0) {
 			/* TSC has changed, this means interim timer processing has happened,
 			   see how much we still need to add. */
@@ -980,7 +980,7 @@ reset_common(int hard)
 	makemod1table();
 	pfq_clear();
 	cpu_set_edx();
-	mmu_perm = 4;
+	mmu_perm = 6;
 	pfq_size = (is8086) ? 6 : 4;
     }
     x86seg_reset();
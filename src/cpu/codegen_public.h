@@ -61,4 +61,27 @@ extern void	codegen_flush();
 extern uint32_t	recomp_page;
 extern int codegen_in_recompile;
 
+#ifdef USE_NEW_DYNAREC
+/*IR optimisation passes, see codegen_ir_opt.c*/
+#define CODEGEN_IR_OPT_LOAD  (1 << 0) /*redundant immediate loads*/
+#define CODEGEN_IR_OPT_COPY  (1 << 1) /*copy propagation*/
+#define CODEGEN_IR_OPT_CONST (1 << 2) /*constant propagation and folding*/
+#define CODEGEN_IR_OPT_FLAGS (1 << 3) /*dead flag computations*/
+#define CODEGEN_IR_OPT_ALL   (CODEGEN_IR_OPT_LOAD | CODEGEN_IR_OPT_COPY | CODEGEN_IR_OPT_CONST | CODEGEN_IR_OPT_FLAGS)
+
+extern int codegen_ir_opt;
+extern int codegen_async_compile;
+extern int codegen_cache_enabled;
+extern int codegen_profile_enabled;
+extern int codegen_code_cache_size;
+extern volatile int codegen_profile_toggle, codegen_profile_dump_pending;
+
+/*Patch back block exits jumping into page, called when it enters the evict list*/
+struct page_t;
+extern void codegen_unlink_page(struct page_t *page);
+
+extern void codegen_ir_opt_stats_reset(void);
+extern void codegen_block_stats_reset(void);
+#endif
+
 #endif
@@ -532,6 +532,10 @@ extern void	enter_smm_check(int in_hlt);
 extern void	leave_smm(void);
 extern void	exec386(int cycs);
 extern void	exec386_dynarec(int cycs);
+#ifdef USE_NEW_DYNAREC
+extern void	*exec386_dynarec_link(void);
+extern void	exec386_dynarec_stats_reset(void);
+#endif
 extern int	idivl(int32_t val);
 #ifdef USE_NEW_DYNAREC
 extern void	loadcscall(uint16_t seg, uint32_t old_pc);
@@ -129,7 +129,7 @@ static int opMOV_CRx_r_a16(uint32_t fetchdat)
                 if (cpu_16bitbus)
                         cr0 |= 0x10;
                 if (!(cr0 & 0x80000000))
-                        mmu_perm=4;
+                        mmu_perm=6;
                 if (hascache && !(cr0 & (1 << 30)))
                         cpu_cache_int_enabled = 1;
 		else
@@ -145,8 +145,7 @@ static int opMOV_CRx_r_a16(uint32_t fetchdat)
                 cr2 = cpu_state.regs[cpu_rm].l;
                 break;
                 case 3:
-                cr3 = cpu_state.regs[cpu_rm].l;
-                flushmmucache();
+                mmu_load_cr3(cpu_state.regs[cpu_rm].l);
                 break;
                 case 4:
                 if (cpu_has_feature(CPU_FEATURE_CR4))
@@ -185,7 +184,7 @@ static int opMOV_CRx_r_a32(uint32_t fetchdat)
                 if (cpu_16bitbus)
                         cr0 |= 0x10;
                 if (!(cr0 & 0x80000000))
-                        mmu_perm=4;
+                        mmu_perm=6;
                 if (hascache && !(cr0 & (1 << 30)))
                         cpu_cache_int_enabled = 1;
                 else
@@ -201,8 +200,7 @@ static int opMOV_CRx_r_a32(uint32_t fetchdat)
                 cr2 = cpu_state.regs[cpu_rm].l;
                 break;
                 case 3:
-                cr3 = cpu_state.regs[cpu_rm].l;
-                flushmmucache();
+                mmu_load_cr3(cpu_state.regs[cpu_rm].l);
                 break;
                 case 4:
                 if (cpu_has_feature(CPU_FEATURE_CR4))
@@ -1,4 +1,120 @@
-#define REP_OPS(size, CNT_REG, SRC_REG, DEST_REG) \
+/*Page-span fast path for the REP string instructions. When D_FLAG is clear,
+  a run of elements that stays within one page on each side and is mapped as
+  plain RAM through readlookup2/writelookup2 is handled with one memmove,
+  memset or memchr instead of one readmem/writemem per element. Segment and
+  present checks have already been done for the first element by the caller.
+
+  writelookup2 is never filled for pages holding translated code (see
+  addwritelookup()), so span writes can not bypass dynarec dirty tracking any
+  more than the writemem fast path does.*/
+
+/*Number of elements, at most count, that can be accessed starting at seg:off
+  without crossing a page, the segment limit or the address size. Misaligned
+  runs are left to the slow path, which charges timing_misaligned for them*/
+static __inline uint32_t
+rep_span_len(x86seg *seg, uint32_t off, uint32_t count, int shift, uint32_t addr_mask)
+{
+        uint32_t addr = seg->base + off;
+        uint64_t limit = MIN(seg->limit_high, addr_mask);
+        uint32_t n = (0x1000 - (addr & 0xfff)) >> shift;
+
+        if (seg->base == 0xffffffff || off > limit || (addr & ((1 << shift) - 1)))
+                return 0;
+
+        n = MIN(n, (uint32_t)((limit - off + 1) >> shift));
+        return MIN(n, count);
+}
+
+static __inline uint8_t *
+rep_span_read_ptr(uint32_t addr)
+{
+        if (readlookup2[addr >> 12] == LOOKUP_INV)
+                return NULL;
+        return (uint8_t *)(readlookup2[addr >> 12] + (uintptr_t)addr);
+}
+
+static __inline uint8_t *
+rep_span_write_ptr(uint32_t addr)
+{
+        if (writelookup2[addr >> 12] == LOOKUP_INV)
+                return NULL;
+        return (uint8_t *)(writelookup2[addr >> 12] + (uintptr_t)addr);
+}
+
+/*Returns the number of elements copied, or 0 if the span can not be accessed
+  directly*/
+static __inline uint32_t
+rep_movs_span(uint32_t src, uint32_t dest, uint32_t n, int shift)
+{
+        uint8_t *s = rep_span_read_ptr(src);
+        uint8_t *d = rep_span_write_ptr(dest);
+        uint32_t bytes = n << shift;
+
+        if (!s || !d)
+                return 0;
+
+        /*A forward copy onto itself with dest above src repeats the source
+          pattern, so never copy more than the distance between the two*/
+        if (d > s && d < (s + bytes))
+                bytes = ((d - s) >> shift) << shift;
+
+        memmove(d, s, bytes);
+        return bytes >> shift;
+}
+
+static __inline uint32_t
+rep_stos_span(uint32_t dest, uint32_t n, int shift, uint32_t val)
+{
+        uint8_t *d = rep_span_write_ptr(dest);
+        uint32_t bytes = n << shift;
+        uint32_t filled;
+
+        if (!d)
+                return 0;
+
+        if (!shift)
+                memset(d, val, bytes);
+        else
+        {
+                memcpy(d, &val, 1 << shift);
+                for (filled = 1 << shift; filled < bytes; filled <<= 1)
+                        memcpy(d + filled, d, MIN(filled, bytes - filled));
+        }
+        return n;
+}
+
+/*Compares up to n bytes against val, stopping at the first byte that ends a
+  REPNE (equal) or REPE (not equal) SCASB. Returns the number of bytes
+  compared, with the last of them in *last*/
+static __inline uint32_t
+rep_scasb_span(uint32_t dest, uint32_t n, uint8_t val, int repe, uint8_t *last)
+{
+        uint8_t *d = rep_span_read_ptr(dest);
+        uint8_t *p;
+
+        if (!d)
+                return 0;
+
+        if (repe)
+        {
+                for (p = d; p < (d + n - 1) && *p == val; p++)
+                        ;
+        }
+        else
+        {
+                p = memchr(d, val, n);
+                if (!p)
+                        p = d + n - 1;
+        }
+        *last = *p;
+        return (p - d) + 1;
+}
+
+/*Elements of the given cost that fit in the remaining cycle budget of the
+  REP loop, matching the per-element break on cycles < cycles_end*/
+#define REP_SPAN_BUDGET(cost) ((uint32_t)((cycles - cycles_end) / (cost)) + 1)
+
+#define REP_OPS(size, CNT_REG, SRC_REG, DEST_REG, ADDR_MASK) \
 static int opREP_INSB_ ## size(uint32_t fetchdat)                               \
 {                                                                               \
         int reads = 0, writes = 0, total_cycles = 0;                            \
@@ -35,19 +151,37 @@ static int opREP_INSW_ ## size(uint32_t fetchdat)
         if (CNT_REG > 0)                                                        \
         {                                                                       \
                 uint16_t temp;                                                  \
+                uint32_t n = 0;                                                 \
+                uint8_t *p;                                                     \
                                                                                 \
 		SEG_CHECK_WRITE(&cpu_state.seg_es);                             \
                 check_io_perm(DX);                                              \
                 check_io_perm(DX+1);                                            \
                 CHECK_WRITE(&cpu_state.seg_es, DEST_REG, DEST_REG + 1);         \
-                temp = inw(DX);                                                 \
-                writememw(es, DEST_REG, temp); if (cpu_state.abrt) return 1;    \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        n = rep_span_len(&cpu_state.seg_es, DEST_REG, CNT_REG, 1, ADDR_MASK); \
+                        p = n ? rep_span_write_ptr(es + DEST_REG) : NULL;       \
+                        n = p ? io_inw_block(DX, p, n) : 0;                     \
+                }                                                               \
+                if (n)                                                          \
+                {                                                               \
+                        DEST_REG += n << 1;                                     \
+                        CNT_REG -= n;                                           \
+                        cycles -= 15 * n;                                       \
+                        reads += n; writes += n; total_cycles += 15 * n;        \
+                }                                                               \
+                else                                                            \
+                {                                                               \
+                        temp = inw(DX);                                         \
+                        writememw(es, DEST_REG, temp); if (cpu_state.abrt) return 1; \
                                                                                 \
-                if (cpu_state.flags & D_FLAG) DEST_REG -= 2;                    \
-                else                DEST_REG += 2;                              \
-                CNT_REG--;                                                      \
-                cycles -= 15;                                                   \
-                reads++; writes++; total_cycles += 15;                          \
+                        if (cpu_state.flags & D_FLAG) DEST_REG -= 2;            \
+                        else                DEST_REG += 2;                      \
+                        CNT_REG--;                                              \
+                        cycles -= 15;                                           \
+                        reads++; writes++; total_cycles += 15;                  \
+                }                                                               \
         }                                                                       \
         PREFETCH_RUN(total_cycles, 1, -1, reads, 0, writes, 0, 0);              \
         if (CNT_REG > 0)                                                        \
@@ -125,17 +259,37 @@ static int opREP_OUTSW_ ## size(uint32_t fetchdat)
         if (CNT_REG > 0)                                                        \
         {                                                                       \
                 uint16_t temp;                                                  \
+                uint32_t n = 0;                                                 \
+                uint8_t *p;                                                     \
                 SEG_CHECK_READ(cpu_state.ea_seg);                               \
                 CHECK_READ(cpu_state.ea_seg, SRC_REG, SRC_REG + 1);             \
-                temp = readmemw(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;   \
-                check_io_perm(DX);                                               \
-                check_io_perm(DX+1);                                             \
-                outw(DX, temp);                                                 \
-                if (cpu_state.flags & D_FLAG) SRC_REG -= 2;                               \
-                else                SRC_REG += 2;                               \
-                CNT_REG--;                                                      \
-                cycles -= 14;                                                   \
-                reads++; writes++; total_cycles += 14;                          \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        check_io_perm(DX);                                      \
+                        check_io_perm(DX+1);                                    \
+                        n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 1, ADDR_MASK); \
+                        p = n ? rep_span_read_ptr(cpu_state.ea_seg->base + SRC_REG) : NULL; \
+                        n = p ? io_outw_block(DX, p, n) : 0;                    \
+                }                                                               \
+                if (n)                                                          \
+                {                                                               \
+                        SRC_REG += n << 1;                                      \
+                        CNT_REG -= n;                                           \
+                        cycles -= 14 * n;                                       \
+                        reads += n; writes += n; total_cycles += 14 * n;        \
+                }                                                               \
+                else                                                            \
+                {                                                               \
+                        temp = readmemw(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1; \
+                        check_io_perm(DX);                                      \
+                        check_io_perm(DX+1);                                    \
+                        outw(DX, temp);                                         \
+                        if (cpu_state.flags & D_FLAG) SRC_REG -= 2;             \
+                        else                SRC_REG += 2;                       \
+                        CNT_REG--;                                              \
+                        cycles -= 14;                                           \
+                        reads++; writes++; total_cycles += 14;                  \
+                }                                                               \
         }                                                                       \
         PREFETCH_RUN(total_cycles, 1, -1, reads, 0, writes, 0, 0);              \
         if (CNT_REG > 0)                                                        \
@@ -194,6 +348,24 @@ static int opREP_MOVSB_ ## size(uint32_t fetchdat)
                                                                                 \
                 CHECK_READ_REP(cpu_state.ea_seg, SRC_REG, SRC_REG);             \
                 CHECK_WRITE_REP(&cpu_state.seg_es, DEST_REG, DEST_REG);         \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 0, ADDR_MASK); \
+                        n = rep_span_len(&cpu_state.seg_es, DEST_REG, n, 0, ADDR_MASK); \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 3 : 4));             \
+                        if (n)                                                  \
+                                n = rep_movs_span(cpu_state.ea_seg->base + SRC_REG, es + DEST_REG, n, 0); \
+                        if (n)                                                  \
+                        {                                                       \
+                                DEST_REG += n << 0; SRC_REG += n << 0;          \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 3 : 4) * n;                  \
+                                reads += n; writes += n; total_cycles += (is486 ? 3 : 4) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 temp = readmemb(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;    \
                 writememb(es, DEST_REG, temp); if (cpu_state.abrt) return 1;    \
                                                                                 \
@@ -231,6 +403,24 @@ static int opREP_MOVSW_ ## size(uint32_t fetchdat)
                                                                                 \
                 CHECK_READ_REP(cpu_state.ea_seg, SRC_REG, SRC_REG + 1);         \
                 CHECK_WRITE_REP(&cpu_state.seg_es, DEST_REG, DEST_REG + 1);     \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 1, ADDR_MASK); \
+                        n = rep_span_len(&cpu_state.seg_es, DEST_REG, n, 1, ADDR_MASK); \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 3 : 4));             \
+                        if (n)                                                  \
+                                n = rep_movs_span(cpu_state.ea_seg->base + SRC_REG, es + DEST_REG, n, 1); \
+                        if (n)                                                  \
+                        {                                                       \
+                                DEST_REG += n << 1; SRC_REG += n << 1;          \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 3 : 4) * n;                  \
+                                reads += n; writes += n; total_cycles += (is486 ? 3 : 4) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 temp = readmemw(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;    \
                 writememw(es, DEST_REG, temp); if (cpu_state.abrt) return 1;    \
                                                                                 \
@@ -268,6 +458,24 @@ static int opREP_MOVSL_ ## size(uint32_t fetchdat)
                                                                                 \
                 CHECK_READ_REP(cpu_state.ea_seg, SRC_REG, SRC_REG + 3);         \
                 CHECK_WRITE_REP(&cpu_state.seg_es, DEST_REG, DEST_REG + 3);     \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 2, ADDR_MASK); \
+                        n = rep_span_len(&cpu_state.seg_es, DEST_REG, n, 2, ADDR_MASK); \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 3 : 4));             \
+                        if (n)                                                  \
+                                n = rep_movs_span(cpu_state.ea_seg->base + SRC_REG, es + DEST_REG, n, 2); \
+                        if (n)                                                  \
+                        {                                                       \
+                                DEST_REG += n << 2; SRC_REG += n << 2;          \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 3 : 4) * n;                  \
+                                reads += n; writes += n; total_cycles += (is486 ? 3 : 4) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 temp = readmeml(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;    \
                 writememl(es, DEST_REG, temp); if (cpu_state.abrt) return 1;    \
                                                                                 \
@@ -301,6 +509,23 @@ static int opREP_STOSB_ ## size(uint32_t fetchdat)
         while (CNT_REG > 0)                                                     \
         {                                                                       \
                 CHECK_WRITE_REP(&cpu_state.seg_es, DEST_REG, DEST_REG);         \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(&cpu_state.seg_es, DEST_REG, CNT_REG, 0, ADDR_MASK); \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 4 : 5));             \
+                        if (n)                                                  \
+                                n = rep_stos_span(es + DEST_REG, n, 0, AL);     \
+                        if (n)                                                  \
+                        {                                                       \
+                                DEST_REG += n << 0;                             \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 4 : 5) * n;                  \
+                                writes += n; total_cycles += (is486 ? 4 : 5) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 writememb(es, DEST_REG, AL); if (cpu_state.abrt) return 1;      \
                 if (cpu_state.flags & D_FLAG) DEST_REG--;                       \
                 else                DEST_REG++;                                 \
@@ -330,6 +555,23 @@ static int opREP_STOSW_ ## size(uint32_t fetchdat)
         while (CNT_REG > 0)                                                     \
         {                                                                       \
                 CHECK_WRITE_REP(&cpu_state.seg_es, DEST_REG, DEST_REG + 1);     \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(&cpu_state.seg_es, DEST_REG, CNT_REG, 1, ADDR_MASK); \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 4 : 5));             \
+                        if (n)                                                  \
+                                n = rep_stos_span(es + DEST_REG, n, 1, AX);     \
+                        if (n)                                                  \
+                        {                                                       \
+                                DEST_REG += n << 1;                             \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 4 : 5) * n;                  \
+                                writes += n; total_cycles += (is486 ? 4 : 5) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 writememw(es, DEST_REG, AX); if (cpu_state.abrt) return 1;      \
                 if (cpu_state.flags & D_FLAG) DEST_REG -= 2;                    \
                 else                DEST_REG += 2;                              \
@@ -359,6 +601,23 @@ static int opREP_STOSL_ ## size(uint32_t fetchdat)
         while (CNT_REG > 0)                                                     \
         {                                                                       \
                 CHECK_WRITE_REP(&cpu_state.seg_es, DEST_REG, DEST_REG + 3);     \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(&cpu_state.seg_es, DEST_REG, CNT_REG, 2, ADDR_MASK); \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 4 : 5));             \
+                        if (n)                                                  \
+                                n = rep_stos_span(es + DEST_REG, n, 2, EAX);    \
+                        if (n)                                                  \
+                        {                                                       \
+                                DEST_REG += n << 2;                             \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 4 : 5) * n;                  \
+                                writes += n; total_cycles += (is486 ? 4 : 5) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 writememl(es, DEST_REG, EAX); if (cpu_state.abrt) return 1;     \
                 if (cpu_state.flags & D_FLAG) DEST_REG -= 4;                    \
                 else                DEST_REG += 4;                              \
@@ -389,6 +648,25 @@ static int opREP_LODSB_ ## size(uint32_t fetchdat)
         while (CNT_REG > 0)                                                     \
         {                                                                       \
                 CHECK_READ_REP(cpu_state.ea_seg, SRC_REG, SRC_REG);             \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 0, ADDR_MASK); \
+                        uint8_t *p = NULL;                                      \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 4 : 5));             \
+                        if (n)                                                  \
+                                p = rep_span_read_ptr(cpu_state.ea_seg->base + SRC_REG); \
+                        if (p)                                                  \
+                        {                                                       \
+                                AL = *(uint8_t *)(p + ((n - 1) << 0));          \
+                                SRC_REG += n << 0;                              \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 4 : 5) * n;                  \
+                                reads += n; total_cycles += (is486 ? 4 : 5) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 AL = readmemb(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;      \
                 if (cpu_state.flags & D_FLAG) SRC_REG--;                       \
                 else                SRC_REG++;                                  \
@@ -418,6 +696,25 @@ static int opREP_LODSW_ ## size(uint32_t fetchdat)
         while (CNT_REG > 0)                                                     \
         {                                                                       \
                 CHECK_READ_REP(cpu_state.ea_seg, SRC_REG, SRC_REG + 1);         \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 1, ADDR_MASK); \
+                        uint8_t *p = NULL;                                      \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 4 : 5));             \
+                        if (n)                                                  \
+                                p = rep_span_read_ptr(cpu_state.ea_seg->base + SRC_REG); \
+                        if (p)                                                  \
+                        {                                                       \
+                                AX = *(uint16_t *)(p + ((n - 1) << 1));         \
+                                SRC_REG += n << 1;                              \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 4 : 5) * n;                  \
+                                reads += n; total_cycles += (is486 ? 4 : 5) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 AX = readmemw(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;      \
                 if (cpu_state.flags & D_FLAG) SRC_REG -= 2;                     \
                 else                SRC_REG += 2;                               \
@@ -447,6 +744,25 @@ static int opREP_LODSL_ ## size(uint32_t fetchdat)
         while (CNT_REG > 0)                                                     \
         {                                                                       \
                 CHECK_READ_REP(cpu_state.ea_seg, SRC_REG, SRC_REG + 3);         \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(cpu_state.ea_seg, SRC_REG, CNT_REG, 2, ADDR_MASK); \
+                        uint8_t *p = NULL;                                      \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 4 : 5));             \
+                        if (n)                                                  \
+                                p = rep_span_read_ptr(cpu_state.ea_seg->base + SRC_REG); \
+                        if (p)                                                  \
+                        {                                                       \
+                                EAX = *(uint32_t *)(p + ((n - 1) << 2));        \
+                                SRC_REG += n << 2;                              \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 4 : 5) * n;                  \
+                                reads += n; total_cycles += (is486 ? 4 : 5) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 EAX = readmeml(cpu_state.ea_seg->base, SRC_REG); if (cpu_state.abrt) return 1;     \
                 if (cpu_state.flags & D_FLAG) SRC_REG -= 4;                     \
                 else                SRC_REG += 4;                               \
@@ -467,7 +783,7 @@ static int opREP_LODSL_ ## size(uint32_t fetchdat)
 }                                                                               \
 
 
-#define REP_OPS_CMPS_SCAS(size, CNT_REG, SRC_REG, DEST_REG, FV) \
+#define REP_OPS_CMPS_SCAS(size, CNT_REG, SRC_REG, DEST_REG, FV, ADDR_MASK) \
 static int opREP_CMPSB_ ## size(uint32_t fetchdat)                              \
 {                                                                               \
         int reads = 0, total_cycles = 0, tempz;                                 \
@@ -577,6 +893,26 @@ static int opREP_SCASB_ ## size(uint32_t fetchdat)
         while ((CNT_REG > 0) && (FV == tempz))                                  \
         {                                                                       \
                 CHECK_READ_REP(&cpu_state.seg_es, DEST_REG, DEST_REG);          \
+                if (!(cpu_state.flags & D_FLAG) && !trap)                       \
+                {                                                               \
+                        uint32_t n = rep_span_len(&cpu_state.seg_es, DEST_REG, CNT_REG, 0, ADDR_MASK); \
+                        uint8_t last;                                           \
+                        n = MIN(n, REP_SPAN_BUDGET(is486 ? 5 : 8));             \
+                        if (n)                                                  \
+                                n = rep_scasb_span(es + DEST_REG, n, AL, FV, &last); \
+                        if (n)                                                  \
+                        {                                                       \
+                                setsub8(AL, last);                              \
+                                tempz = (ZF_SET()) ? 1 : 0;                     \
+                                DEST_REG += n;                                  \
+                                CNT_REG -= n;                                   \
+                                cycles -= (is486 ? 5 : 8) * n;                  \
+                                reads += n; total_cycles += (is486 ? 5 : 8) * n; \
+                                if (cycles < cycles_end)                        \
+                                        break;                                  \
+                                continue;                                       \
+                        }                                                       \
+                }                                                               \
                 uint8_t temp = readmemb(es, DEST_REG); if (cpu_state.abrt) break;\
                 setsub8(AL, temp);                                              \
                 tempz = (ZF_SET()) ? 1 : 0;                                     \
@@ -662,12 +998,12 @@ static int opREP_SCASL_ ## size(uint32_t fetchdat)
         return cpu_state.abrt;                                                  \
 }
 
-REP_OPS(a16, CX, SI, DI)
-REP_OPS(a32, ECX, ESI, EDI)
-REP_OPS_CMPS_SCAS(a16_NE, CX, SI, DI, 0)
-REP_OPS_CMPS_SCAS(a16_E,  CX, SI, DI, 1)
-REP_OPS_CMPS_SCAS(a32_NE, ECX, ESI, EDI, 0)
-REP_OPS_CMPS_SCAS(a32_E,  ECX, ESI, EDI, 1)
+REP_OPS(a16, CX, SI, DI, 0xffff)
+REP_OPS(a32, ECX, ESI, EDI, 0xffffffff)
+REP_OPS_CMPS_SCAS(a16_NE, CX, SI, DI, 0, 0xffff)
+REP_OPS_CMPS_SCAS(a16_E,  CX, SI, DI, 1, 0xffff)
+REP_OPS_CMPS_SCAS(a32_NE, ECX, ESI, EDI, 0, 0xffffffff)
+REP_OPS_CMPS_SCAS(a32_E,  ECX, ESI, EDI, 1, 0xffffffff)
 
 static int opREPNE(uint32_t fetchdat)
 {
@@ -49,6 +49,8 @@
 #include <86box/device.h>
 #include <86box/machine.h>
 #include <86box/sound.h>
+#include <86box/timer.h>
+#include <86box/snapshot.h>
 
 
 #define DEVICE_MAX	256			/* max # of devices */
@@ -274,6 +276,68 @@ device_reset_all(void)
 }
 
 
+/* Hash of the attached device list, so that a snapshot is only ever
+   restored onto an identically configured machine. */
+uint32_t
+device_state_hash(void)
+{
+    uint32_t hash = 0x811c9dc5;
+    const char *p;
+    int c;
+
+    for (c = 0; c < DEVICE_MAX; c++) {
+	if ((devices[c] == NULL) || (devices[c]->name == NULL))
+		continue;
+	for (p = devices[c]->name; *p; p++)
+		hash = (hash ^ (uint8_t) *p) * 0x01000193;
+	hash = (hash ^ (uint32_t) c) * 0x01000193;
+    }
+
+    return(hash);
+}
+
+
+/* Name of the first attached device without a state hook, or NULL if
+   every attached device can be saved and restored. */
+const char *
+device_state_missing(void)
+{
+    int c;
+
+    for (c = 0; c < DEVICE_MAX; c++) {
+	if ((devices[c] != NULL) && (devices[c]->state == NULL))
+		return(devices[c]->name);
+    }
+
+    return(NULL);
+}
+
+
+/* Save or restore the state of all attached devices, one chunk each. */
+void
+device_state_all(snapshot_t *s)
+{
+    int c;
+
+    for (c = 0; c < DEVICE_MAX; c++) {
+	if (devices[c] == NULL)
+		continue;
+
+	if (! snapshot_chunk_begin(s, "DEV ")) {
+		device_log("Snapshot: missing state for device: \"%s\"\n", devices[c]->name);
+		return;
+	}
+	if (devices[c]->state == NULL) {
+		/* Callers check device_state_missing() first. */
+		s->error = 1;
+		return;
+	}
+	devices[c]->state(device_priv[c], s);
+	snapshot_chunk_end(s);
+    }
+}
+
+
 /* Reset all attached PCI devices - needed for PCI turbo reset control. */
 void
 device_reset_all_pci(void)
@@ -19,6 +19,7 @@
  *		Copyright 2017-2020 Fred N. van Kempen.
  */
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +44,7 @@
 #include <86box/snd_speaker.h>
 #include <86box/video.h>
 #include <86box/keyboard.h>
+#include <86box/snapshot.h>
 
 
 #define STAT_PARITY		0x80
@@ -2198,6 +2200,42 @@ kbd_close(void *priv)
 }
 
 
+static void
+kbd_state(void *priv, snapshot_t *s)
+{
+    atkbd_t *dev = (atkbd_t *)priv;
+
+    /* The vendor handlers are set up by kbd_init() and are kept. */
+    snapshot_var(s, dev, offsetof(atkbd_t, refresh_time));
+    snapshot_timer(s, &dev->refresh_time);
+    snapshot_timer(s, &dev->pulse_cb);
+    snapshot_timer(s, &dev->send_delay_timer);
+
+    snapshot_var(s, kbc_queue, sizeof(kbc_queue));
+    snapshot_item(s, kbc_queue_pos);
+    snapshot_var(s, channel_queue, sizeof(channel_queue));
+    snapshot_var(s, channel_queue_pos, sizeof(channel_queue_pos));
+    snapshot_item(s, kbd_last_scan_code);
+    snapshot_item(s, sc_or);
+
+    snapshot_item(s, keyboard_mode);
+    snapshot_var(s, keyboard_set3_flags, sizeof(keyboard_set3_flags));
+    snapshot_item(s, keyboard_set3_all_repeat);
+    snapshot_item(s, keyboard_set3_all_break);
+    snapshot_item(s, keyboard_scan);
+    snapshot_item(s, mouse_scan);
+
+    /* Port 61h. */
+    snapshot_item(s, ppi);
+    snapshot_item(s, speaker_gated);
+    snapshot_item(s, speaker_enable);
+    snapshot_item(s, was_speaker_enable);
+
+    if (s->loading && !s->error)
+	set_scancode_map(dev);
+}
+
+
 static void *
 kbd_init(const device_t *info)
 {
@@ -2268,7 +2306,8 @@ const device_t keyboard_at_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_at_ami_device = {
@@ -2278,7 +2317,8 @@ const device_t keyboard_at_ami_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_at_toshiba_device = {
@@ -2288,7 +2328,8 @@ const device_t keyboard_at_toshiba_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_device = {
@@ -2298,7 +2339,8 @@ const device_t keyboard_ps2_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_ps2_device = {
@@ -2308,7 +2350,8 @@ const device_t keyboard_ps2_ps2_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_ps1_device = {
@@ -2318,7 +2361,8 @@ const device_t keyboard_ps2_ps1_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_ps1_pci_device = {
@@ -2328,7 +2372,8 @@ const device_t keyboard_ps2_ps1_pci_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_xi8088_device = {
@@ -2338,7 +2383,8 @@ const device_t keyboard_ps2_xi8088_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_ami_device = {
@@ -2348,7 +2394,8 @@ const device_t keyboard_ps2_ami_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_mca_device = {
@@ -2358,7 +2405,8 @@ const device_t keyboard_ps2_mca_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_mca_2_device = {
@@ -2368,7 +2416,8 @@ const device_t keyboard_ps2_mca_2_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_quadtel_device = {
@@ -2378,7 +2427,8 @@ const device_t keyboard_ps2_quadtel_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_pci_device = {
@@ -2388,7 +2438,8 @@ const device_t keyboard_ps2_pci_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_ami_pci_device = {
@@ -2398,7 +2449,8 @@ const device_t keyboard_ps2_ami_pci_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_intel_ami_pci_device = {
@@ -2408,7 +2460,8 @@ const device_t keyboard_ps2_intel_ami_pci_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 const device_t keyboard_ps2_acer_pci_device = {
@@ -2418,7 +2471,8 @@ const device_t keyboard_ps2_acer_pci_device = {
     kbd_init,
     kbd_close,
     kbd_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    kbd_state
 };
 
 
@@ -22,6 +22,7 @@
  */
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +38,7 @@
 #include <86box/rom.h>
 #include <86box/serial.h>
 #include <86box/mouse.h>
+#include <86box/snapshot.h>
 
 
 enum
@@ -669,6 +671,23 @@ serial_close(void *priv)
 }
 
 
+static void
+serial_state(void *priv, snapshot_t *s)
+{
+    serial_t *dev = (serial_t *) priv;
+    uint16_t base = dev->base_address;
+
+    snapshot_var(s, dev, offsetof(serial_t, transmit_timer));
+    snapshot_timer(s, &dev->transmit_timer);
+    snapshot_timer(s, &dev->timeout_timer);
+    snapshot_item(s, dev->clock_src);
+    snapshot_item(s, dev->transmit_period);
+
+    /* Moving the I/O handlers is up to the Super I/O chip, if any. */
+    dev->base_address = base;
+}
+
+
 static void *
 serial_init(const device_t *info)
 {
@@ -740,7 +759,7 @@ const device_t i8250_device = {
     SERIAL_8250,
     serial_init, serial_close, NULL,
     { NULL }, serial_speed_changed, NULL,
-    NULL
+    NULL, serial_state
 };
 
 const device_t i8250_pcjr_device = {
@@ -749,7 +768,7 @@ const device_t i8250_pcjr_device = {
     SERIAL_8250_PCJR,
     serial_init, serial_close, NULL,
     { NULL }, serial_speed_changed, NULL,
-    NULL
+    NULL, serial_state
 };
 
 const device_t ns16450_device = {
@@ -758,7 +777,7 @@ const device_t ns16450_device = {
     SERIAL_NS16450,
     serial_init, serial_close, NULL,
     { NULL }, serial_speed_changed, NULL,
-    NULL
+    NULL, serial_state
 };
 
 const device_t ns16550_device = {
@@ -767,5 +786,5 @@ const device_t ns16550_device = {
     SERIAL_NS16550,
     serial_init, serial_close, NULL,
     { NULL }, serial_speed_changed, NULL,
-    NULL
+    NULL, serial_state
 };
@@ -22,6 +22,7 @@
 #define _LARGEFILE64_SOURCE
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +48,7 @@
 #include <86box/hdd.h>
 #include <86box/zip.h>
 #include <86box/version.h>
+#include <86box/snapshot.h>
 
 
 /* Bits of 'atastat' */
@@ -657,6 +659,15 @@ ide_get_sector(ide_t *ide)
 }
 
 
+/* Start reading the sectors of a PIO (READ SECTORS, READ MULTIPLE) or
+   DMA (READ DMA) read command from the image. */
+static void
+ide_prefetch(ide_t *ide)
+{
+    hdd_image_prefetch(ide->hdd_num, ide_get_sector(ide), ide->secount ? ide->secount : 256);
+}
+
+
 /**
  * Move to the next sector using CHS addressing
  */
@@ -1241,6 +1252,50 @@ ide_writew(uint16_t addr, uint16_t val, void *priv)
 }
 
 
+/* Block version of data port writes for REP OUTSW. The word that completes
+   a sector or ATAPI transfer is left to ide_writew(), so that its side
+   effects happen as usual. */
+static int
+ide_writew_block(uint16_t addr, uint8_t *buf, int count, void *priv)
+{
+    ide_board_t *dev = (ide_board_t *) priv;
+    ide_t *ide = ide_drives[dev->cur_dev];
+    scsi_common_t *sc = ide->sc;
+    int avail;
+
+    if (((addr & 0x7) != 0x0) || (ide->type == IDE_NONE))
+	return 0;
+
+    if (ide->command == WIN_PACKETCMD) {
+	if ((ide->type != IDE_ATAPI) || !sc || !sc->temp_buffer ||
+	    (sc->packet_status != PHASE_DATA_OUT) || (sc->pos & 1))
+		return 0;
+
+	avail = MIN((int) sc->max_transfer_len - sc->request_pos, (int) (sc->packet_len - sc->pos));
+	count = MIN(count, (avail - 1) >> 1);
+	if (count <= 0)
+		return 0;
+
+	memcpy(sc->temp_buffer + sc->pos, buf, count << 1);
+	sc->pos += (count << 1);
+	sc->request_pos += (count << 1);
+	ide->pos = 0;
+    } else {
+	if (!ide->buffer || (ide->pos & 1))
+		return 0;
+
+	count = MIN(count, ((512 - ide->pos) >> 1) - 1);
+	if (count <= 0)
+		return 0;
+
+	memcpy((uint8_t *) ide->buffer + ide->pos, buf, count << 1);
+	ide->pos += (count << 1);
+    }
+
+    return count;
+}
+
+
 static void
 ide_writel(uint16_t addr, uint32_t val, void *priv)
 {
@@ -1581,6 +1636,12 @@ ide_writeb(uint16_t addr, uint8_t val, void *priv)
 						ide_set_callback(ide, 200.0 * IDE_TIME);
 					else
 						ide_set_callback(ide, ide_get_period(ide, 512));
+
+					/* Let the image be read while the command is in progress;
+					   READ MULTIPLE without a block size is aborted instead. */
+					if ((ide->lba || ide->cfg_spt) &&
+					    ((val != WIN_READ_MULTIPLE) || ide->blocksize))
+						ide_prefetch(ide);
 				} else
 					ide_set_callback(ide, 200.0 * IDE_TIME);
 				ide->do_initial_read = 1;
@@ -1969,6 +2030,48 @@ ide_readw(uint16_t addr, void *priv)
 }
 
 
+/* Block version of data port reads for REP INSW, see ide_writew_block(). */
+static int
+ide_readw_block(uint16_t addr, uint8_t *buf, int count, void *priv)
+{
+    ide_board_t *dev = (ide_board_t *) priv;
+    ide_t *ide = ide_drives[dev->cur_dev];
+    scsi_common_t *sc = ide->sc;
+    int avail;
+
+    if (((addr & 0x7) != 0x0) || (ide->type == IDE_NONE) || !ide->buffer)
+	return 0;
+
+    if (ide->command == WIN_PACKETCMD) {
+	if ((ide->type != IDE_ATAPI) || !sc || !sc->temp_buffer ||
+	    (sc->packet_status != PHASE_DATA_IN) || (sc->pos & 1))
+		return 0;
+
+	avail = MIN((int) sc->max_transfer_len - sc->request_pos, (int) (sc->packet_len - sc->pos));
+	count = MIN(count, (avail - 1) >> 1);
+	if (count <= 0)
+		return 0;
+
+	memcpy(buf, sc->temp_buffer + sc->pos, count << 1);
+	sc->pos += (count << 1);
+	sc->request_pos += (count << 1);
+	ide->pos = 0;
+    } else {
+	if (ide->pos & 1)
+		return 0;
+
+	count = MIN(count, ((512 - ide->pos) >> 1) - 1);
+	if (count <= 0)
+		return 0;
+
+	memcpy(buf, (uint8_t *) ide->buffer + ide->pos, count << 1);
+	ide->pos += (count << 1);
+    }
+
+    return count;
+}
+
+
 static uint32_t
 ide_readl(uint16_t addr, void *priv)
 {
@@ -2039,6 +2142,18 @@ ide_callback(void *priv)
 
     ide_log("CALLBACK    %02X %i  %i\n", ide->command, ide->reset, ide->channel);
 
+    /* A write queued by an earlier command failed - report it as a write
+       fault on this one, like a drive with its write cache enabled. */
+    if ((ide->type == IDE_HDD) && (ide->command != WIN_SRST) &&
+	hdd_image_write_error(ide->hdd_num)) {
+	ide->command = 0;
+	ide->atastat = DRDY_STAT | DWF_STAT | ERR_STAT | DSC_STAT;
+	ide->error = ABRT_ERR;
+	ide->pos = 0;
+	ide_irq_raise(ide);
+	return;
+    }
+
     if (((ide->command >= WIN_RECAL) && (ide->command <= 0x1F)) ||
 	((ide->command >= WIN_SEEK) && (ide->command <= 0x7F))) {
 	if (ide->type != IDE_HDD)
@@ -2441,6 +2556,9 @@ ide_set_handlers(uint8_t board)
 		      ide_readb,           ide_readw,  ide_readl,
 		      ide_writeb,          ide_writew, ide_writel,
 		      ide_boards[board]);
+	io_set_block_handler(ide_boards[board]->base_main,
+			     ide_readw_block, ide_writew_block,
+			     ide_boards[board]);
     }
 
     if (ide_boards[board]->side_main) {
@@ -2691,6 +2809,57 @@ ide_board_init(int board, int irq, int base_main, int side_main, int type)
 }
 
 
+/* Hard disk contents are not part of the snapshot. ATAPI devices keep
+   most of their state in the SCSI layer, which cannot be saved yet. */
+static void
+ide_board_state(int board, snapshot_t *s)
+{
+    ide_board_t *dev = ide_boards[board];
+    uint16_t base_main, side_main;
+    uint8_t bufs, old_bufs;
+    ide_t *ide;
+    int d;
+
+    if ((dev == NULL) || !dev->inited)
+	return;
+
+    /* The I/O handlers stay where the chipset put them. */
+    base_main = dev->base_main;
+    side_main = dev->side_main;
+    snapshot_var(s, dev, offsetof(ide_board_t, timer));
+    snapshot_timer(s, &dev->timer);
+    dev->base_main = base_main;
+    dev->side_main = side_main;
+
+    for (d = 0; d < 2; d++) {
+	ide = ide_drives[(board << 1) + d];
+	if (ide == NULL)
+		continue;
+
+	if (ide->type == IDE_ATAPI) {
+		pclog("Snapshot: ATAPI devices cannot be saved or restored\n");
+		s->error = 1;
+		return;
+	}
+
+	snapshot_var(s, ide, offsetof(ide_t, buffer));
+	snapshot_timer(s, &ide->timer);
+	snapshot_item(s, ide->interrupt_drq);
+
+	bufs = old_bufs = (ide->buffer != NULL) | ((ide->sector_buffer != NULL) << 1);
+	snapshot_item(s, bufs);
+	if (bufs != old_bufs) {
+		s->error = 1;
+		return;
+	}
+	if (ide->buffer != NULL)
+		snapshot_var(s, ide->buffer, 65536 * sizeof(uint16_t));
+	if (ide->sector_buffer != NULL)
+		snapshot_var(s, ide->sector_buffer, 256 * 512);
+    }
+}
+
+
 static void *
 ide_ter_init(const device_t *info)
 {
@@ -2708,6 +2877,13 @@ ide_ter_close(void *priv)
 }
 
 
+static void
+ide_ter_state(void *priv, snapshot_t *s)
+{
+    ide_board_state(2, s);
+}
+
+
 static void *
 ide_qua_init(const device_t *info)
 {
@@ -2725,6 +2901,13 @@ ide_qua_close(void *priv)
 }
 
 
+static void
+ide_qua_state(void *priv, snapshot_t *s)
+{
+    ide_board_state(3, s);
+}
+
+
 void *
 ide_xtide_init(void)
 {
@@ -2844,12 +3027,21 @@ ide_close(void *priv)
 }
 
 
+static void
+ide_state(void *priv, snapshot_t *s)
+{
+    ide_board_state(0, s);
+    ide_board_state(1, s);
+}
+
+
 const device_t ide_isa_device = {
     "ISA PC/AT IDE Controller",
     DEVICE_ISA | DEVICE_AT,
     0,
     ide_init, ide_close, ide_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    ide_state
 };
 
 const device_t ide_isa_2ch_device = {
@@ -2857,7 +3049,8 @@ const device_t ide_isa_2ch_device = {
     DEVICE_ISA | DEVICE_AT,
     1,
     ide_init, ide_close, ide_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    ide_state
 };
 
 const device_t ide_vlb_device = {
@@ -2865,7 +3058,8 @@ const device_t ide_vlb_device = {
     DEVICE_VLB | DEVICE_AT,
     2,
     ide_init, ide_close, ide_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    ide_state
 };
 
 const device_t ide_vlb_2ch_device = {
@@ -2873,7 +3067,8 @@ const device_t ide_vlb_2ch_device = {
     DEVICE_VLB | DEVICE_AT,
     3,
     ide_init, ide_close, ide_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    ide_state
 };
 
 const device_t ide_pci_device = {
@@ -2881,7 +3076,8 @@ const device_t ide_pci_device = {
     DEVICE_PCI | DEVICE_AT,
     4,
     ide_init, ide_close, ide_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    ide_state
 };
 
 const device_t ide_pci_2ch_device = {
@@ -2889,7 +3085,8 @@ const device_t ide_pci_2ch_device = {
     DEVICE_PCI | DEVICE_AT,
     5,
     ide_init, ide_close, ide_reset,
-    { NULL }, NULL, NULL, NULL
+    { NULL }, NULL, NULL, NULL,
+    ide_state
 };
 
 static const device_config_t ide_ter_config[] =
@@ -2982,7 +3179,7 @@ const device_t ide_ter_device = {
     0,
     ide_ter_init, ide_ter_close, NULL,
     { NULL }, NULL, NULL,
-    ide_ter_config
+    ide_ter_config, ide_ter_state
 };
 
 const device_t ide_qua_device = {
@@ -2991,5 +3188,5 @@ const device_t ide_qua_device = {
     0,
     ide_qua_init, ide_qua_close, NULL,
     { NULL }, NULL, NULL,
-    ide_qua_config
+    ide_qua_config, ide_qua_state
 };
@@ -40,6 +40,20 @@
 #define HDD_IMAGE_HDX 2
 #define HDD_IMAGE_VHD 3
 
+#define HDD_ASYNC_READ		1
+#define HDD_ASYNC_WRITE		2
+
+#define HDD_PREFETCH_MAX	256		/* sectors, the largest ATA transfer */
+#define HDD_QUEUED_MAX		(4 << 20)	/* bytes of write data in flight */
+
+#define HDD_OVERLAY_NONE	0
+#define HDD_OVERLAY_RAM		1
+#define HDD_OVERLAY_FILE	2
+
+#define HDD_OVL_SHIFT		7		/* 64 KB overlay blocks */
+#define HDD_OVL_SECTORS		(1 << HDD_OVL_SHIFT)
+#define HDD_OVL_BYTES		(HDD_OVL_SECTORS << 9)
+
 typedef struct
 {
 	FILE *file; /* Used for HDD_IMAGE_RAW, HDD_IMAGE_HDI, and HDD_IMAGE_HDX. */ 
@@ -48,14 +62,48 @@ typedef struct
 	uint32_t pos, last_sector;
 	uint8_t type; /* HDD_IMAGE_RAW, HDD_IMAGE_HDI, HDD_IMAGE_HDX, or HDD_IMAGE_VHD */
 	uint8_t loaded;
+
+	/* Asynchronous I/O. The I/O thread owns the file and the prefetch
+	   buffer for as long as there are requests pending. */
+	uint8_t *pf_buf;
+	uint32_t pf_sector, pf_count;
+	int pending, queued;
+
+	/* A failed prefetch is redone in hdd_image_read(); a failed queued
+	   write is held until the controller collects it with
+	   hdd_image_write_error() and reports it to the guest. */
+	int pf_error, wr_error;
+	uint32_t wr_error_sector;
+
+	/* Copy-on-write overlay. ovl_map[] holds the overlay slot of each
+	   block plus one, or 0 while the block only exists in the image;
+	   slots live in ovl_ram[] or at slot * HDD_OVL_BYTES in ovl_file. */
+	uint8_t ovl_type;
+	uint32_t *ovl_map;
+	uint32_t ovl_blocks, ovl_used;
+	uint8_t **ovl_ram;
+	FILE *ovl_file;
+	wchar_t ovl_fn[1024];
 } hdd_image_t;
 
+typedef struct _hdd_request_
+{
+	uint8_t op, id;
+	uint32_t sector, count;
+	uint8_t *buffer;
+	struct _hdd_request_ *next;
+} hdd_request_t;
+
 
 hdd_image_t hdd_images[HDD_NUM];
 
 static char empty_sector[512];
 static char *empty_sector_1mb;
 
+static mutex_t *io_mutex;
+static event_t *io_event, *io_done_event;
+static hdd_request_t *io_head, *io_tail;
+
 #ifdef ENABLE_HDD_IMAGE_LOG
 int hdd_image_do_log = ENABLE_HDD_IMAGE_LOG;
 
@@ -255,8 +303,11 @@ hdd_image_init(void)
 		memset(&hdd_images[i], 0, sizeof(hdd_image_t));
 }
 
-int
-hdd_image_load(int id)
+static void	hdd_overlay_close(uint8_t id);
+
+
+static int
+hdd_image_load_base(int id)
 {
 	uint32_t sector_size = 512;
 	uint32_t zero = 0;
@@ -270,12 +321,14 @@ hdd_image_load(int id)
 	int is_hdx[2] = { 0, 0 };
 	int is_vhd[2] = { 0, 0 };   
 	int vhd_error = 0; 
+	int base_ro;
 
 	memset(empty_sector, 0, sizeof(empty_sector));
 
 	hdd_images[id].base = 0;
 
 	if (hdd_images[id].loaded) {
+		hdd_overlay_close(id);
 		if (hdd_images[id].file) {
 			fclose(hdd_images[id].file);
 			hdd_images[id].file = NULL;
@@ -301,7 +354,10 @@ hdd_image_load(int id)
 		memset(hdd[id].fn, 0, sizeof(hdd[id].fn));
 		return 0;
 	}
-	hdd_images[id].file = plat_fopen(fn, L"rb+");
+	/* With a discarded overlay, the image itself is never written. */
+	base_ro = hdd[id].overlay && !hdd[id].overlay_commit;
+
+	hdd_images[id].file = plat_fopen(fn, base_ro ? L"rb" : L"rb+");
 	if (hdd_images[id].file == NULL) {
 		/* Failed to open existing hard disk image */
 		if (errno == ENOENT) {
@@ -312,6 +368,11 @@ hdd_image_load(int id)
 				memset(hdd[id].fn, 0, sizeof(hdd[id].fn));
 				return 0;
 			}
+			if (base_ro) {
+				hdd_image_log("An image with a discarded overlay must exist\n");
+				memset(hdd[id].fn, 0, sizeof(hdd[id].fn));
+				return 0;
+			}
 
 			hdd_images[id].file = plat_fopen(fn, L"wb+");
 			if (hdd_images[id].file == NULL) {
@@ -364,6 +425,8 @@ hdd_image_load(int id)
 					hdd_images[id].vhd = mvhd_create_fixed(fn_multibyte_buf, geometry, &vhd_error, NULL);
 					if (hdd_images[id].vhd == NULL)
 						fatal("hdd_image_load(): VHD: Could not create VHD : %s\n", mvhd_strerr(vhd_error));
+					if (hdd_vhd_mmap)
+						mvhd_enable_mmap(hdd_images[id].vhd);
 
 					hdd_images[id].type = HDD_IMAGE_VHD;
 					return 1;
@@ -450,7 +513,7 @@ hdd_image_load(int id)
 			fclose(hdd_images[id].file);
 			hdd_images[id].file = NULL;
 			wcstombs(fn_multibyte_buf, fn, sizeof fn_multibyte_buf);
-			hdd_images[id].vhd = mvhd_open(fn_multibyte_buf, (bool)0, &vhd_error);
+			hdd_images[id].vhd = mvhd_open(fn_multibyte_buf, (bool)base_ro, &vhd_error);
 			if (hdd_images[id].vhd == NULL) {
 				if (vhd_error == MVHD_ERR_FILE)
 					fatal("hdd_image_load(): VHD: Error opening VHD file '%s': %s\n", fn_multibyte_buf, strerror(mvhd_errno));
@@ -461,6 +524,9 @@ hdd_image_load(int id)
 				fatal("hdd_image_load(): VHD: Parent/child timestamp mismatch for VHD file '%s'\n", fn_multibyte_buf);
 			}
 
+			if (hdd_vhd_mmap)
+				mvhd_enable_mmap(hdd_images[id].vhd);
+
 			hdd[id].tracks = hdd_images[id].vhd->footer.geom.cyl;
 			hdd[id].hpc = hdd_images[id].vhd->footer.geom.heads;
 			hdd[id].spt = hdd_images[id].vhd->footer.geom.spt;
@@ -485,7 +551,14 @@ hdd_image_load(int id)
 	if (fseeko64(hdd_images[id].file, 0, SEEK_END) == -1)
 		fatal("hdd_image_load(): Error seeking to the end of file\n");
 	s = ftello64(hdd_images[id].file);
-	if (s < (full_size + hdd_images[id].base))
+	if ((s < (full_size + hdd_images[id].base)) && base_ro) {
+		/* The image is opened read-only, so it can not be grown. */
+		hdd_image_log("Image with a discarded overlay is smaller than its geometry\n");
+		fclose(hdd_images[id].file);
+		hdd_images[id].file = NULL;
+		memset(hdd[id].fn, 0, sizeof(hdd[id].fn));
+		return 0;
+	} else if (s < (full_size + hdd_images[id].base))
 		ret = prepare_new_hard_disk(id, full_size);
 	else {
 		hdd_images[id].last_sector = (uint32_t) (full_size >> 9) - 1;
@@ -497,41 +570,611 @@ hdd_image_load(int id)
 }
 
 
-void
-hdd_image_seek(uint8_t id, uint32_t sector)
+/* Returns non-zero if the seek failed. */
+static int
+hdd_image_base_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
 {
-	off64_t addr = sector;
-	addr = (uint64_t)sector << 9LL;
+	if (hdd_images[id].type == HDD_IMAGE_VHD) {
+		int non_transferred_sectors = mvhd_read_sectors(hdd_images[id].vhd, sector, count, buffer);
+		hdd_images[id].pos = sector + count - non_transferred_sectors - 1;
+	} else {
+		int i;
 
-	hdd_images[id].pos = sector;
-	if (hdd_images[id].type != HDD_IMAGE_VHD) {
-		if (fseeko64(hdd_images[id].file, addr + hdd_images[id].base, SEEK_SET) == -1)
-			fatal("hdd_image_seek(): Error seeking\n");
+		if (fseeko64(hdd_images[id].file, ((uint64_t)(sector) << 9LL) + hdd_images[id].base, SEEK_SET) == -1)
+			return 1;
+
+		for (i = 0; i < count; i++) {
+			if (feof(hdd_images[id].file))
+				break;
+
+			hdd_images[id].pos = sector + i;
+			fread(buffer + (i << 9), 1, 512, hdd_images[id].file);
+		}
 	}
+
+	return 0;
 }
 
 
-void
-hdd_image_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+/* Returns non-zero if any sector could not be written. The file is
+   flushed, so that a full host disk is noticed here rather than on a
+   later write or on close. */
+static int
+hdd_image_base_write(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
 {
 	if (hdd_images[id].type == HDD_IMAGE_VHD) {
-		int non_transferred_sectors = mvhd_read_sectors(hdd_images[id].vhd, sector, count, buffer);
+		int non_transferred_sectors = mvhd_write_sectors(hdd_images[id].vhd, sector, count, buffer);
 		hdd_images[id].pos = sector + count - non_transferred_sectors - 1;
+		if (non_transferred_sectors)
+			return 1;
 	} else {
 		int i;
 
-		if (fseeko64(hdd_images[id].file, ((uint64_t)(sector) << 9LL) + hdd_images[id].base, SEEK_SET) == -1) {
-			fatal("Hard disk image %i: Read error during seek\n", id);
-			return;
-		}
+		if (fseeko64(hdd_images[id].file, ((uint64_t)(sector) << 9LL) + hdd_images[id].base, SEEK_SET) == -1)
+			return 1;
 
 		for (i = 0; i < count; i++) {
 			if (feof(hdd_images[id].file))
 				break;
 
 			hdd_images[id].pos = sector + i;
-			fread(buffer + (i << 9), 1, 512, hdd_images[id].file);
+			if (fwrite(buffer + (i << 9), 512, 1, hdd_images[id].file) != 1)
+				return 1;
+		}
+
+		if (fflush(hdd_images[id].file))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/* Copy sectors into and out of an overlay slot. */
+static void
+hdd_overlay_put(hdd_image_t *img, uint32_t slot, uint32_t off, uint32_t count, uint8_t *buffer)
+{
+	if (img->ovl_file == NULL) {
+		memcpy(img->ovl_ram[slot] + (off << 9), buffer, count << 9);
+		return;
+	}
+
+	if (fseeko64(img->ovl_file, ((uint64_t) slot * HDD_OVL_BYTES) + (off << 9), SEEK_SET) == -1)
+		fatal("Hard disk overlay: Error seeking\n");
+	if (fwrite(buffer, 1, count << 9, img->ovl_file) != (count << 9))
+		fatal("Hard disk overlay: Error writing\n");
+}
+
+
+static void
+hdd_overlay_get(hdd_image_t *img, uint32_t slot, uint32_t off, uint32_t count, uint8_t *buffer)
+{
+	if (img->ovl_file == NULL) {
+		memcpy(buffer, img->ovl_ram[slot] + (off << 9), count << 9);
+		return;
+	}
+
+	if (fseeko64(img->ovl_file, ((uint64_t) slot * HDD_OVL_BYTES) + (off << 9), SEEK_SET) == -1)
+		fatal("Hard disk overlay: Error seeking\n");
+	if (fread(buffer, 1, count << 9, img->ovl_file) != (count << 9))
+		fatal("Hard disk overlay: Error reading\n");
+}
+
+
+/* Number of image sectors in a block, which is less than a full block
+   only for the last one. */
+static uint32_t
+hdd_overlay_block_sectors(hdd_image_t *img, uint32_t blk)
+{
+	uint32_t first = blk << HDD_OVL_SHIFT;
+
+	if ((img->last_sector - first) < HDD_OVL_SECTORS)
+		return img->last_sector - first + 1;
+
+	return HDD_OVL_SECTORS;
+}
+
+
+/* Give a block its own overlay slot. Unless the caller is about to
+   overwrite all of it, the image's data is copied in through scratch. */
+static uint32_t
+hdd_overlay_alloc(uint8_t id, uint32_t blk, uint8_t *scratch)
+{
+	hdd_image_t *img = &hdd_images[id];
+	uint32_t slot = img->ovl_used;
+	uint8_t **ram;
+
+	if (img->ovl_file == NULL) {
+		ram = (uint8_t **) realloc(img->ovl_ram, (slot + 1) * sizeof(uint8_t *));
+		if (ram == NULL)
+			fatal("Hard disk overlay: Out of memory\n");
+		img->ovl_ram = ram;
+		img->ovl_ram[slot] = (uint8_t *) malloc(HDD_OVL_BYTES);
+		if (img->ovl_ram[slot] == NULL)
+			fatal("Hard disk overlay: Out of memory\n");
+	}
+
+	if (scratch != NULL) {
+		memset(scratch, 0x00, HDD_OVL_BYTES);
+		if (hdd_image_base_read(id, blk << HDD_OVL_SHIFT, hdd_overlay_block_sectors(img, blk), scratch))
+			fatal("Hard disk image %i: Read error during seek\n", id);
+		hdd_overlay_put(img, slot, 0, HDD_OVL_SECTORS, scratch);
+	}
+
+	img->ovl_used++;
+	img->ovl_map[blk] = slot + 1;
+
+	return slot;
+}
+
+
+/* Reads take blocks in the overlay from there and the rest from the
+   image, one request per run of blocks on the same side. */
+static void
+hdd_overlay_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+{
+	hdd_image_t *img = &hdd_images[id];
+	uint32_t blk, off, n;
+
+	while (count > 0) {
+		blk = sector >> HDD_OVL_SHIFT;
+		off = sector & (HDD_OVL_SECTORS - 1);
+		n = HDD_OVL_SECTORS - off;
+		if (img->ovl_map[blk]) {
+			if (n > count)
+				n = count;
+			hdd_overlay_get(img, img->ovl_map[blk] - 1, off, n, buffer);
+		} else {
+			while ((n < count) && !img->ovl_map[++blk])
+				n += HDD_OVL_SECTORS;
+			if (n > count)
+				n = count;
+			if (hdd_image_base_read(id, sector, n, buffer))
+				fatal("Hard disk image %i: Read error during seek\n", id);
+		}
+
+		sector += n;
+		count -= n;
+		buffer += (n << 9);
+	}
+}
+
+
+/* Writes only ever go to the overlay; a block is copied up from the
+   image the first time it is written. */
+static void
+hdd_overlay_write(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+{
+	hdd_image_t *img = &hdd_images[id];
+	uint8_t *scratch = NULL;
+	uint32_t blk, off, n, slot;
+
+	while (count > 0) {
+		blk = sector >> HDD_OVL_SHIFT;
+		off = sector & (HDD_OVL_SECTORS - 1);
+		n = HDD_OVL_SECTORS - off;
+		if (n > count)
+			n = count;
+
+		if (img->ovl_map[blk])
+			slot = img->ovl_map[blk] - 1;
+		else if (n == HDD_OVL_SECTORS)
+			slot = hdd_overlay_alloc(id, blk, NULL);
+		else {
+			if (scratch == NULL)
+				scratch = (uint8_t *) malloc(HDD_OVL_BYTES);
+			slot = hdd_overlay_alloc(id, blk, scratch);
+		}
+
+		hdd_overlay_put(img, slot, off, n, buffer);
+
+		sector += n;
+		count -= n;
+		buffer += (n << 9);
+	}
+
+	free(scratch);
+}
+
+
+/* Create the scratch file of a file overlay. It lives in the user data
+   directory under a unique name, so VMs sharing a base image never share
+   an overlay; failing that, an anonymous temporary file is used. */
+static FILE *
+hdd_overlay_create_file(uint8_t id, wchar_t *fn, size_t size)
+{
+	wchar_t prefix[16], temp[128];
+	char name[16];
+	FILE *f;
+
+	memset(fn, 0, size * sizeof(wchar_t));
+
+	sprintf(name, "hdd%02i", id);
+	mbstowcs(prefix, name, strlen(name) + 1);
+	plat_tempfile(temp, prefix, L".ovl");
+	if ((wcslen(usr_path) + wcslen(temp) + 2) <= size) {
+		plat_append_filename(fn, usr_path, temp);
+		/* Never take over a file that is already there. */
+		f = plat_fopen(fn, L"rb");
+		if (f == NULL) {
+			f = plat_fopen(fn, L"wb+");
+			if (f != NULL)
+				return f;
+		} else
+			fclose(f);
+	}
+
+	memset(fn, 0, size * sizeof(wchar_t));
+	return tmpfile();
+}
+
+
+/* Returns zero if the overlay could not be set up. */
+static int
+hdd_overlay_open(uint8_t id)
+{
+	hdd_image_t *img = &hdd_images[id];
+
+	img->ovl_type = hdd[id].overlay;
+	if (img->ovl_type == HDD_OVERLAY_NONE)
+		return 1;
+
+	img->ovl_blocks = (img->last_sector >> HDD_OVL_SHIFT) + 1;
+	img->ovl_map = (uint32_t *) calloc(img->ovl_blocks, sizeof(uint32_t));
+	if (img->ovl_map == NULL)
+		fatal("Hard disk overlay: Out of memory\n");
+	img->ovl_used = 0;
+	img->ovl_ram = NULL;
+	img->ovl_file = NULL;
+
+	if (img->ovl_type == HDD_OVERLAY_FILE) {
+		/* The overlay file is scratch space, its index is kept in memory. A
+		   file overlay is asked for when the disk is too big to shadow in RAM,
+		   so there is no falling back to RAM here. */
+		img->ovl_file = hdd_overlay_create_file(id, img->ovl_fn, sizeof_w(img->ovl_fn));
+		if (img->ovl_file == NULL) {
+			hdd_image_log("Hard disk image %i: Unable to create overlay file\n", id);
+			free(img->ovl_map);
+			img->ovl_map = NULL;
+			img->ovl_type = HDD_OVERLAY_NONE;
+			return 0;
+		}
+	}
+
+	hdd_image_log("Hard disk image %i: %s overlay, %i blocks\n", id,
+		      (img->ovl_type == HDD_OVERLAY_FILE) ? "file" : "RAM", img->ovl_blocks);
+
+	return 1;
+}
+
+
+/* Drop the overlay, first writing it back to the image if so configured. */
+static void
+hdd_overlay_close(uint8_t id)
+{
+	hdd_image_t *img = &hdd_images[id];
+	uint8_t *buf;
+	uint32_t blk, slot;
+
+	if (img->ovl_type == HDD_OVERLAY_NONE)
+		return;
+
+	if (hdd[id].overlay_commit && img->ovl_used) {
+		buf = (uint8_t *) malloc(HDD_OVL_BYTES);
+		for (blk = 0; blk < img->ovl_blocks; blk++) {
+			if (!img->ovl_map[blk])
+				continue;
+			slot = img->ovl_map[blk] - 1;
+			hdd_overlay_get(img, slot, 0, HDD_OVL_SECTORS, buf);
+			if (hdd_image_base_write(id, blk << HDD_OVL_SHIFT, hdd_overlay_block_sectors(img, blk), buf))
+				fatal("Hard disk image %i: Write error\n", id);
+		}
+		free(buf);
+		hdd_image_log("Hard disk image %i: Committed %i overlay blocks\n", id, img->ovl_used);
+	}
+
+	if (img->ovl_ram != NULL) {
+		for (slot = 0; slot < img->ovl_used; slot++)
+			free(img->ovl_ram[slot]);
+		free(img->ovl_ram);
+		img->ovl_ram = NULL;
+	}
+
+	if (img->ovl_file != NULL) {
+		fclose(img->ovl_file);
+		img->ovl_file = NULL;
+		/* An anonymous temporary file is gone once closed. */
+		if (img->ovl_fn[0] != L'\0')
+			plat_remove(img->ovl_fn);
+		memset(img->ovl_fn, 0, sizeof(img->ovl_fn));
+	}
+
+	free(img->ovl_map);
+	img->ovl_map = NULL;
+	img->ovl_blocks = img->ovl_used = 0;
+	img->ovl_type = HDD_OVERLAY_NONE;
+}
+
+
+int
+hdd_image_load(int id)
+{
+	if (!hdd_image_load_base(id))
+		return 0;
+
+	if (!hdd_overlay_open(id)) {
+		if (hdd_images[id].file != NULL) {
+			fclose(hdd_images[id].file);
+			hdd_images[id].file = NULL;
+		} else if (hdd_images[id].vhd != NULL) {
+			mvhd_close(hdd_images[id].vhd);
+			hdd_images[id].vhd = NULL;
 		}
+		hdd_images[id].loaded = 0;
+		memset(hdd[id].fn, 0, sizeof(hdd[id].fn));
+		return 0;
+	}
+
+	return 1;
+}
+
+
+static int
+hdd_image_do_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+{
+	if (hdd_images[id].ovl_type == HDD_OVERLAY_NONE)
+		return hdd_image_base_read(id, sector, count, buffer);
+
+	if (sector > hdd_images[id].last_sector)
+		return 0;
+	if (count > (hdd_images[id].last_sector - sector + 1))
+		count = hdd_images[id].last_sector - sector + 1;
+
+	hdd_overlay_read(id, sector, count, buffer);
+	hdd_images[id].pos = sector + count - 1;
+
+	return 0;
+}
+
+
+static int
+hdd_image_do_write(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+{
+	if (hdd_images[id].ovl_type == HDD_OVERLAY_NONE)
+		return hdd_image_base_write(id, sector, count, buffer);
+
+	if (sector > hdd_images[id].last_sector)
+		return 0;
+	if (count > (hdd_images[id].last_sector - sector + 1))
+		count = hdd_images[id].last_sector - sector + 1;
+
+	hdd_overlay_write(id, sector, count, buffer);
+	hdd_images[id].pos = sector + count - 1;
+
+	return 0;
+}
+
+
+static void
+hdd_image_thread(void *param)
+{
+	hdd_request_t *req;
+	int err;
+
+	while (1) {
+		thread_wait_event(io_event, -1);
+
+		while (1) {
+			thread_wait_mutex(io_mutex);
+			req = io_head;
+			if (req != NULL) {
+				io_head = req->next;
+				if (io_head == NULL)
+					io_tail = NULL;
+			}
+			thread_release_mutex(io_mutex);
+
+			if (req == NULL)
+				break;
+
+			if (req->op == HDD_ASYNC_WRITE)
+				err = hdd_image_do_write(req->id, req->sector, req->count, req->buffer);
+			else
+				err = hdd_image_do_read(req->id, req->sector, req->count, req->buffer);
+
+			thread_wait_mutex(io_mutex);
+			if (err && (req->op == HDD_ASYNC_WRITE)) {
+				if (!hdd_images[req->id].wr_error)
+					hdd_images[req->id].wr_error_sector = req->sector;
+				hdd_images[req->id].wr_error = 1;
+			} else if (err)
+				hdd_images[req->id].pf_error = 1;
+			if (req->op == HDD_ASYNC_WRITE)
+				hdd_images[req->id].queued -= (req->count << 9);
+			hdd_images[req->id].pending--;
+			thread_release_mutex(io_mutex);
+
+			if (req->op == HDD_ASYNC_WRITE)
+				free(req->buffer);
+			free(req);
+
+			thread_set_event(io_done_event);
+		}
+	}
+}
+
+
+/* Hand a request to the I/O thread, starting it if this is the first one. */
+static void
+hdd_image_submit(uint8_t op, uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+{
+	hdd_request_t *req;
+
+	if (io_mutex == NULL) {
+		io_mutex = thread_create_mutex();
+		io_event = thread_create_event();
+		io_done_event = thread_create_event();
+		thread_create(hdd_image_thread, NULL);
+		hdd_image_log("Hard disk image: started the I/O thread\n");
+	}
+
+	req = (hdd_request_t *) malloc(sizeof(hdd_request_t));
+	req->op = op;
+	req->id = id;
+	req->sector = sector;
+	req->count = count;
+	req->buffer = buffer;
+	req->next = NULL;
+
+	thread_wait_mutex(io_mutex);
+	hdd_images[id].pending++;
+	if (op == HDD_ASYNC_WRITE)
+		hdd_images[id].queued += (count << 9);
+	if (io_tail != NULL)
+		io_tail->next = req;
+	else
+		io_head = req;
+	io_tail = req;
+	thread_release_mutex(io_mutex);
+
+	thread_set_event(io_event);
+}
+
+
+/* Wait until the I/O thread is done with all requests for an image. */
+static void
+hdd_image_wait(uint8_t id)
+{
+	int pending;
+
+	if (io_mutex == NULL)
+		return;
+
+	while (1) {
+		thread_wait_mutex(io_mutex);
+		pending = hdd_images[id].pending;
+		thread_release_mutex(io_mutex);
+
+		if (!pending)
+			break;
+
+		thread_wait_event(io_done_event, -1);
+	}
+
+	/* Nothing is pending, so the I/O thread is not touching these. */
+	if (hdd_images[id].pf_error) {
+		hdd_image_log("Hard disk image %i: Prefetch failed, reading again\n", id);
+		hdd_images[id].pf_error = 0;
+		hdd_images[id].pf_count = 0;
+	}
+}
+
+
+/* Only the IDE and SCSI disks report failed queued writes to the guest
+   (see hdd_image_write_error()); the other controllers write synchronously
+   so that an error is raised by the write that caused it. */
+static int
+hdd_image_can_queue(uint8_t id)
+{
+	return (hdd[id].bus == HDD_BUS_IDE) || (hdd[id].bus == HDD_BUS_ATAPI) ||
+	       (hdd[id].bus == HDD_BUS_SCSI);
+}
+
+
+/* Returns non-zero, once, if a queued write failed after the command that
+   issued it had already completed. The controller reports this on its next
+   command, the way a drive with a write-back cache does. */
+int
+hdd_image_write_error(uint8_t id)
+{
+	int error;
+
+	if (io_mutex == NULL)
+		return 0;
+
+	thread_wait_mutex(io_mutex);
+	error = hdd_images[id].wr_error;
+	hdd_images[id].wr_error = 0;
+	thread_release_mutex(io_mutex);
+
+	if (error)
+		hdd_image_log("Hard disk image %i: Queued write to sector %i failed\n", id, hdd_images[id].wr_error_sector);
+
+	return error;
+}
+
+
+/* Forget read ahead data that overlaps sectors being changed. */
+static void
+hdd_image_prefetch_drop(uint8_t id, uint32_t sector, uint32_t count)
+{
+	hdd_image_t *img = &hdd_images[id];
+
+	if (img->pf_count && (sector < (img->pf_sector + img->pf_count)) && ((sector + count) > img->pf_sector))
+		img->pf_count = 0;
+}
+
+
+/* Start reading sectors on the I/O thread, so that they are ready by the
+   time the controller asks for them with hdd_image_read(). */
+void
+hdd_image_prefetch(uint8_t id, uint32_t sector, uint32_t count)
+{
+	hdd_image_t *img = &hdd_images[id];
+
+	if (!hdd_async_io || !img->loaded || (sector > img->last_sector))
+		return;
+
+	if (count > (img->last_sector - sector + 1))
+		count = img->last_sector - sector + 1;
+	if ((count == 0) || (count > HDD_PREFETCH_MAX))
+		return;
+
+	/* Already there, or on its way. */
+	if (img->pf_count && (sector >= img->pf_sector) &&
+	    ((sector + count) <= (img->pf_sector + img->pf_count)))
+		return;
+
+	if (img->pf_buf == NULL)
+		img->pf_buf = (uint8_t *) malloc(HDD_PREFETCH_MAX << 9);
+
+	img->pf_sector = sector;
+	img->pf_count = count;
+	hdd_image_submit(HDD_ASYNC_READ, id, sector, count, img->pf_buf);
+}
+
+
+void
+hdd_image_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
+{
+	hdd_image_t *img = &hdd_images[id];
+
+	hdd_image_wait(id);
+
+	if (img->pf_count && (sector >= img->pf_sector) &&
+	    ((sector + count) <= (img->pf_sector + img->pf_count))) {
+		memcpy(buffer, img->pf_buf + ((sector - img->pf_sector) << 9), count << 9);
+		img->pos = sector + count - 1;
+		return;
+	}
+
+	if (hdd_image_do_read(id, sector, count, buffer))
+		fatal("Hard disk image %i: Read error during seek\n", id);
+}
+
+
+void
+hdd_image_seek(uint8_t id, uint32_t sector)
+{
+	off64_t addr = sector;
+	addr = (uint64_t)sector << 9LL;
+
+	hdd_image_wait(id);
+
+	hdd_images[id].pos = sector;
+	if (hdd_images[id].type != HDD_IMAGE_VHD) {
+		if (fseeko64(hdd_images[id].file, addr + hdd_images[id].base, SEEK_SET) == -1)
+			fatal("hdd_image_seek(): Error seeking\n");
 	}
 }
 
@@ -567,28 +1210,29 @@ hdd_image_read_ex(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
 }
 
 
+/* With asynchronous I/O enabled, writes are copied and left to the I/O
+   thread; anything that needs to see them waits for it first. */
 void
 hdd_image_write(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
 {
-	if (hdd_images[id].type == HDD_IMAGE_VHD) {
-		int non_transferred_sectors = mvhd_write_sectors(hdd_images[id].vhd, sector, count, buffer);
-		hdd_images[id].pos = sector + count - non_transferred_sectors - 1;
-	} else {
-		int i;
+	uint8_t *data;
 
-		if (fseeko64(hdd_images[id].file, ((uint64_t)(sector) << 9LL) + hdd_images[id].base, SEEK_SET) == -1) {
-			fatal("Hard disk image %i: Write error during seek\n", id);
-			return;
-		}
+	hdd_image_prefetch_drop(id, sector, count);
 
-		for (i = 0; i < count; i++) {
-			if (feof(hdd_images[id].file))
-				break;
+	if (hdd_async_io && hdd_images[id].loaded && count && hdd_image_can_queue(id)) {
+		if (hdd_images[id].queued >= HDD_QUEUED_MAX)
+			hdd_image_wait(id);
 
-			hdd_images[id].pos = sector + i;
-			fwrite(buffer + (i << 9), 512, 1, hdd_images[id].file);
-		}
+		data = (uint8_t *) malloc(count << 9);
+		memcpy(data, buffer, count << 9);
+		hdd_image_submit(HDD_ASYNC_WRITE, id, sector, count, data);
+		return;
 	}
+
+	hdd_image_wait(id);
+
+	if (hdd_image_do_write(id, sector, count, buffer))
+		fatal("Hard disk image %i: Write error\n", id);
 }
 
 
@@ -612,7 +1256,22 @@ hdd_image_write_ex(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer)
 void
 hdd_image_zero(uint8_t id, uint32_t sector, uint32_t count)
 {
-	if (hdd_images[id].type == HDD_IMAGE_VHD) {
+	hdd_image_prefetch_drop(id, sector, count);
+	hdd_image_wait(id);
+
+	if (hdd_images[id].ovl_type != HDD_OVERLAY_NONE) {
+		uint32_t n;
+		uint8_t *zero = (uint8_t *) calloc(HDD_OVL_SECTORS, 512);
+
+		while (count > 0) {
+			n = (count > HDD_OVL_SECTORS) ? HDD_OVL_SECTORS : count;
+			hdd_image_do_write(id, sector, n, zero);
+			sector += n;
+			count -= n;
+		}
+
+		free(zero);
+	} else if (hdd_images[id].type == HDD_IMAGE_VHD) {
 		int non_transferred_sectors = mvhd_format_sectors(hdd_images[id].vhd, sector, count);
 		hdd_images[id].pos = sector + count - non_transferred_sectors - 1;
 	} else {
@@ -656,6 +1315,8 @@ hdd_image_zero_ex(uint8_t id, uint32_t sector, uint32_t count)
 uint32_t
 hdd_image_get_pos(uint8_t id)
 {
+	hdd_image_wait(id);
+
 	return hdd_images[id].pos;
 }
 
@@ -674,6 +1335,9 @@ hdd_image_unload(uint8_t id, int fn_preserve)
 		return;
 
 	if (hdd_images[id].loaded) {
+		hdd_image_wait(id);
+		hdd_overlay_close(id);
+
 		if (hdd_images[id].file != NULL) {
 			fclose(hdd_images[id].file);
 			hdd_images[id].file = NULL;
@@ -684,6 +1348,12 @@ hdd_image_unload(uint8_t id, int fn_preserve)
 		hdd_images[id].loaded = 0;
 	}
 
+	if (hdd_images[id].pf_buf != NULL) {
+		free(hdd_images[id].pf_buf);
+		hdd_images[id].pf_buf = NULL;
+	}
+	hdd_images[id].pf_count = 0;
+
 	hdd_images[id].last_sector = -1;
 
 	memset(hdd[id].prev_fn, 0, sizeof(hdd[id].prev_fn));
@@ -701,6 +1371,9 @@ hdd_image_close(uint8_t id)
 	if (!hdd_images[id].loaded)
 		return;
 
+	hdd_image_wait(id);
+	hdd_overlay_close(id);
+
 	if (hdd_images[id].file != NULL) {
 		fclose(hdd_images[id].file);
 		hdd_images[id].file = NULL;
@@ -709,6 +1382,9 @@ hdd_image_close(uint8_t id)
 		hdd_images[id].vhd = NULL;
 	}
 
+	if (hdd_images[id].pf_buf != NULL)
+		free(hdd_images[id].pf_buf);
+
 	memset(&hdd_images[id], 0, sizeof(hdd_image_t));
 	hdd_images[id].loaded = 0;
 }
@@ -171,6 +171,19 @@ MVHDMeta* mvhd_create_ex(MVHDCreationOptions options, int* err);
  */
 void mvhd_close(MVHDMeta* vhdm);
 
+/**
+ * \brief Memory-map fixed VHD images for sector I/O
+ * 
+ * Maps the data area of a fixed VHD image, and of any fixed parent further up a 
+ * differencing chain, so that sector reads and writes become memory copies. Images 
+ * that are not fixed, or that cannot be mapped, keep using normal file I/O.
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ * 
+ * \return the number of images in the chain that were mapped
+ */
+int mvhd_enable_mmap(MVHDMeta* vhdm);
+
 /**
  * \brief Calculate hard disk geometry from a provided size
  * 
@@ -27,6 +27,8 @@ typedef struct MVHDSectorBitmap {
     uint8_t* curr_bitmap;
     int sector_count;
     int curr_block;
+    uint8_t** cache;        /* Per-block bitmaps, loaded on first use */
+    uint8_t* spare_bitmap;  /* Used uncached if a cache entry can't be allocated */
 } MVHDSectorBitmap;
 
 typedef struct MVHDFooter {
@@ -91,6 +93,11 @@ struct MVHDMeta {
         uint8_t* zero_data;
         int sector_count;
     } format_buffer;
+    struct {
+        uint8_t* data;
+        void* handle;
+        uint64_t size;
+    } map;
 };
 
 #endif
\ No newline at end of file
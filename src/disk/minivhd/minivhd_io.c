@@ -23,6 +23,8 @@ static void mvhd_read_sect_bitmap(MVHDMeta* vhdm, int blk);
 static void mvhd_write_bat_entry(MVHDMeta* vhdm, int blk);
 static void mvhd_create_block(MVHDMeta* vhdm, int blk);
 static void mvhd_write_curr_sect_bitmap(MVHDMeta* vhdm);
+static int mvhd_bitmap_run(const uint8_t* bitmap, int sib, int end, bool* present);
+static void mvhd_read_blk_sectors(MVHDMeta* vhdm, int blk, int sib, int count, uint8_t* buff);
 
 /**
  * \brief Check that we will not be overflowing buffers
@@ -51,22 +53,82 @@ void mvhd_write_empty_sectors(FILE* f, int sector_count) {
 }
 
 /**
- * \brief Read the sector bitmap for a block.
+ * \brief Make the sector bitmap for a block the current one.
  * 
- * If the block is sparse, the sector bitmap in memory will be 
- * zeroed. Otherwise, the sector bitmap is read from the VHD file.
+ * Bitmaps are kept in memory once read, so this only touches the file the 
+ * first time a block is used. If the block is sparse, the sector bitmap in 
+ * memory will be zeroed. Otherwise, the sector bitmap is read from the VHD file.
+ * 
+ * The cached bitmap is the one the write functions update and write back, 
+ * so it never goes stale.
  * 
  * \param [in] vhdm MiniVHD data structure
  * \param [in] blk The block for which to read the sector bitmap from
  */
 static void mvhd_read_sect_bitmap(MVHDMeta* vhdm, int blk) {
+    size_t bm_size = (size_t)vhdm->bitmap.sector_count * MVHD_SECTOR_SIZE;
+    uint8_t* bitmap = vhdm->bitmap.cache[blk];
+    vhdm->bitmap.curr_block = blk;
+    if (bitmap != NULL) {
+        vhdm->bitmap.curr_bitmap = bitmap;
+        return;
+    }
+    bitmap = malloc(bm_size);
+    if (bitmap != NULL) {
+        vhdm->bitmap.cache[blk] = bitmap;
+    } else {
+        bitmap = vhdm->bitmap.spare_bitmap;
+    }
     if (vhdm->block_offset[blk] != MVHD_SPARSE_BLK) {
         mvhd_fseeko64(vhdm->f, (uint64_t)vhdm->block_offset[blk] * MVHD_SECTOR_SIZE, SEEK_SET);
-        fread(vhdm->bitmap.curr_bitmap, vhdm->bitmap.sector_count * MVHD_SECTOR_SIZE, 1, vhdm->f);
+        fread(bitmap, bm_size, 1, vhdm->f);
     } else {
-        memset(vhdm->bitmap.curr_bitmap, 0, vhdm->bitmap.sector_count * MVHD_SECTOR_SIZE);
+        memset(bitmap, 0, bm_size);
     }
-    vhdm->bitmap.curr_block = blk;
+    vhdm->bitmap.curr_bitmap = bitmap;
+}
+
+/**
+ * \brief Find how many sectors in a row share the state of a given sector
+ * 
+ * \param [in] bitmap The sector bitmap of the block
+ * \param [in] sib The sector in the block to start from
+ * \param [in] end The sector in the block to stop at (exclusive)
+ * \param [out] present Whether sector sib is set in the bitmap
+ * 
+ * \return the number of sectors from sib onwards with the same bitmap state
+ */
+static int mvhd_bitmap_run(const uint8_t* bitmap, int sib, int end, bool* present) {
+    uint8_t fill;
+    int s = sib + 1;
+    *present = VHD_TESTBIT(bitmap, sib) != 0;
+    fill = *present ? 0xff : 0x00;
+    while (s < end) {
+        /* Skip whole bytes at a time where we can */
+        if ((s % 8) == 0 && (end - s) >= 8 && bitmap[s / 8] == fill) {
+            s += 8;
+        } else if ((VHD_TESTBIT(bitmap, s) != 0) == *present) {
+            s++;
+        } else {
+            break;
+        }
+    }
+    return s - sib;
+}
+
+/**
+ * \brief Read a run of sectors from an allocated block with a single host read
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ * \param [in] blk The block to read from
+ * \param [in] sib The first sector in the block to read
+ * \param [in] count The number of sectors to read. Must not cross the end of the block
+ * \param [out] buff An output buffer to store read sectors
+ */
+static void mvhd_read_blk_sectors(MVHDMeta* vhdm, int blk, int sib, int count, uint8_t* buff) {
+    int64_t addr = ((int64_t)vhdm->block_offset[blk] + vhdm->bitmap.sector_count + sib) * MVHD_SECTOR_SIZE;
+    mvhd_fseeko64(vhdm->f, addr, SEEK_SET);
+    fread(buff, (size_t)count * MVHD_SECTOR_SIZE, 1, vhdm->f);
 }
 
 /**
@@ -154,36 +216,42 @@ int mvhd_fixed_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_
     return truncated_sectors;
 }
 
+int mvhd_fixed_map_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_buff) {
+    int transfer_sectors, truncated_sectors;
+    uint32_t total_sectors = (uint32_t)(vhdm->footer.curr_sz / MVHD_SECTOR_SIZE);
+    mvhd_check_sectors(offset, num_sectors, total_sectors, &transfer_sectors, &truncated_sectors);
+    memcpy(out_buff, vhdm->map.data + ((uint64_t)offset * MVHD_SECTOR_SIZE), (size_t)transfer_sectors * MVHD_SECTOR_SIZE);
+    return truncated_sectors;
+}
+
 int mvhd_sparse_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_buff) {
     int transfer_sectors, truncated_sectors;
     uint32_t total_sectors = (uint32_t)(vhdm->footer.curr_sz / MVHD_SECTOR_SIZE);
     mvhd_check_sectors(offset, num_sectors, total_sectors, &transfer_sectors, &truncated_sectors);
     uint8_t* buff = (uint8_t*)out_buff;
-    int64_t addr;
     uint32_t s, ls;
-    int blk, prev_blk, sib;
+    int blk, sib, end, run;
+    bool present;
     ls = offset + transfer_sectors;
-    prev_blk = -1;
-    for (s = offset; s < ls; s++) {
+    s = offset;
+    while (s < ls) {
         blk = s / vhdm->sect_per_block;
         sib = s % vhdm->sect_per_block;
-        if (blk != prev_blk) {
-            prev_blk = blk;
-            if (vhdm->bitmap.curr_block != blk) {
-                mvhd_read_sect_bitmap(vhdm, blk);
-                mvhd_fseeko64(vhdm->f, (uint64_t)sib * MVHD_SECTOR_SIZE, SEEK_CUR);
-            } else {
-                addr = ((int64_t)vhdm->block_offset[blk] + vhdm->bitmap.sector_count + sib) * MVHD_SECTOR_SIZE;
-                mvhd_fseeko64(vhdm->f, addr, SEEK_SET);
-            }
-        }        
-        if (VHD_TESTBIT(vhdm->bitmap.curr_bitmap, sib)) {
-            fread(buff, MVHD_SECTOR_SIZE, 1, vhdm->f);
+        end = vhdm->sect_per_block;
+        if ((ls - s) < (uint32_t)(end - sib)) {
+            end = sib + (int)(ls - s);
+        }
+        if (vhdm->bitmap.curr_block != blk) {
+            mvhd_read_sect_bitmap(vhdm, blk);
+        }
+        run = mvhd_bitmap_run(vhdm->bitmap.curr_bitmap, sib, end, &present);
+        if (present) {
+            mvhd_read_blk_sectors(vhdm, blk, sib, run, buff);
         } else {
-            memset(buff, 0, MVHD_SECTOR_SIZE);
-            mvhd_fseeko64(vhdm->f, MVHD_SECTOR_SIZE, SEEK_CUR);
+            memset(buff, 0, (size_t)run * MVHD_SECTOR_SIZE);
         }
-        buff += MVHD_SECTOR_SIZE;
+        s += run;
+        buff += (size_t)run * MVHD_SECTOR_SIZE;
     }
     return truncated_sectors;
 }
@@ -193,30 +261,31 @@ int mvhd_diff_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_b
     uint32_t total_sectors = (uint32_t)(vhdm->footer.curr_sz / MVHD_SECTOR_SIZE);
     mvhd_check_sectors(offset, num_sectors, total_sectors, &transfer_sectors, &truncated_sectors);
     uint8_t* buff = (uint8_t*)out_buff;
-    MVHDMeta* curr_vhdm = vhdm;
     uint32_t s, ls;
-    int blk, sib;
+    int blk, sib, end, run;
+    bool present;
     ls = offset + transfer_sectors;
-    for (s = offset; s < ls; s++) {
-        while (curr_vhdm->footer.disk_type == MVHD_TYPE_DIFF) {
-            blk = s / curr_vhdm->sect_per_block;
-            sib = s % curr_vhdm->sect_per_block;
-            if (curr_vhdm->bitmap.curr_block != blk) {
-                mvhd_read_sect_bitmap(curr_vhdm, blk);
-            }
-            if (!VHD_TESTBIT(curr_vhdm->bitmap.curr_bitmap, sib)) {
-                curr_vhdm = curr_vhdm->parent;
-            } else { break; }
+    s = offset;
+    while (s < ls) {
+        blk = s / vhdm->sect_per_block;
+        sib = s % vhdm->sect_per_block;
+        end = vhdm->sect_per_block;
+        if ((ls - s) < (uint32_t)(end - sib)) {
+            end = sib + (int)(ls - s);
+        }
+        if (vhdm->bitmap.curr_block != blk) {
+            mvhd_read_sect_bitmap(vhdm, blk);
         }
-        /* We handle actual sector reading using the fixed or sparse functions,
-           as a differencing VHD is also a sparse VHD */
-        if (curr_vhdm->footer.disk_type == MVHD_TYPE_DIFF || curr_vhdm->footer.disk_type == MVHD_TYPE_DYNAMIC) {
-            mvhd_sparse_read(curr_vhdm, s, 1, buff);
+        run = mvhd_bitmap_run(vhdm->bitmap.curr_bitmap, sib, end, &present);
+        if (present) {
+            mvhd_read_blk_sectors(vhdm, blk, sib, run, buff);
         } else {
-            mvhd_fixed_read(curr_vhdm, s, 1, buff);
+            /* Sectors not in this image come from the parent, whatever its type. 
+               A differencing parent handles its own parent in turn. */
+            vhdm->parent->read_sectors(vhdm->parent, s, run, buff);
         }
-        curr_vhdm = vhdm;
-        buff += MVHD_SECTOR_SIZE;
+        s += run;
+        buff += (size_t)run * MVHD_SECTOR_SIZE;
     }
     return truncated_sectors;
 }
@@ -228,7 +297,19 @@ int mvhd_fixed_write(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* in_
     mvhd_check_sectors(offset, num_sectors, total_sectors, &transfer_sectors, &truncated_sectors);
     addr = (int64_t)offset * MVHD_SECTOR_SIZE;
     mvhd_fseeko64(vhdm->f, addr, SEEK_SET);
-    fwrite(in_buff, transfer_sectors*MVHD_SECTOR_SIZE, 1, vhdm->f);
+    if (transfer_sectors > 0) {
+        if (fwrite(in_buff, transfer_sectors*MVHD_SECTOR_SIZE, 1, vhdm->f) != 1 || fflush(vhdm->f) != 0) {
+            return num_sectors;
+        }
+    }
+    return truncated_sectors;
+}
+
+int mvhd_fixed_map_write(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* in_buff) {
+    int transfer_sectors, truncated_sectors;
+    uint32_t total_sectors = (uint32_t)(vhdm->footer.curr_sz / MVHD_SECTOR_SIZE);
+    mvhd_check_sectors(offset, num_sectors, total_sectors, &transfer_sectors, &truncated_sectors);
+    memcpy(vhdm->map.data + ((uint64_t)offset * MVHD_SECTOR_SIZE), in_buff, (size_t)transfer_sectors * MVHD_SECTOR_SIZE);
     return truncated_sectors;
 }
 
@@ -239,38 +320,41 @@ int mvhd_sparse_diff_write(MVHDMeta* vhdm, uint32_t offset, int num_sectors, voi
     uint8_t* buff = (uint8_t*)in_buff;
     int64_t addr;
     uint32_t s, ls;
-    int blk, prev_blk, sib;
+    int blk, sib, run, i;
     ls = offset + transfer_sectors;
-    prev_blk = -1;
-    for (s = offset; s < ls; s++) {
+    s = offset;
+    while (s < ls) {
         blk = s / vhdm->sect_per_block;
         sib = s % vhdm->sect_per_block;
-        if (vhdm->bitmap.curr_block != blk && prev_blk >= 0) {            
-            /* Write the sector bitmap for the previous block, before we replace it. */
-            mvhd_write_curr_sect_bitmap(vhdm);
+        run = vhdm->sect_per_block - sib;
+        if ((ls - s) < (uint32_t)run) {
+            run = (int)(ls - s);
         }
-        if (vhdm->block_offset[blk] == MVHD_SPARSE_BLK) {
-            /* "read" the sector bitmap first, before creating a new block, as the bitmap will be
-               zero either way */
+        if (vhdm->bitmap.curr_block != blk) {
             mvhd_read_sect_bitmap(vhdm, blk);
+        }
+        if (vhdm->block_offset[blk] == MVHD_SPARSE_BLK) {
+            /* The sector bitmap of a sparse block is zero, which is also what
+               the new block starts out with */
             mvhd_create_block(vhdm, blk);
-        } 
-        if (blk != prev_blk) {
-            if (vhdm->bitmap.curr_block != blk) {                
-                mvhd_read_sect_bitmap(vhdm, blk);
-                mvhd_fseeko64(vhdm->f, (uint64_t)sib * MVHD_SECTOR_SIZE, SEEK_CUR);
-            } else {
-                addr = ((int64_t)vhdm->block_offset[blk] + vhdm->bitmap.sector_count + sib) * MVHD_SECTOR_SIZE;
-                mvhd_fseeko64(vhdm->f, addr, SEEK_SET);
-            }
-            prev_blk = blk;
         }
-        fwrite(buff, MVHD_SECTOR_SIZE, 1, vhdm->f);
-        VHD_SETBIT(vhdm->bitmap.curr_bitmap, sib);
-        buff += MVHD_SECTOR_SIZE;
+        addr = ((int64_t)vhdm->block_offset[blk] + vhdm->bitmap.sector_count + sib) * MVHD_SECTOR_SIZE;
+        mvhd_fseeko64(vhdm->f, addr, SEEK_SET);
+        if (fwrite(buff, (size_t)run * MVHD_SECTOR_SIZE, 1, vhdm->f) != 1) {
+            /* Report this run and the rest as not written */
+            return truncated_sectors + (int)(ls - s);
+        }
+        for (i = sib; i < sib + run; i++) {
+            VHD_SETBIT(vhdm->bitmap.curr_bitmap, i);
+        }
+        /* Write the sector bitmap for this block to disk before moving on */
+        mvhd_write_curr_sect_bitmap(vhdm);
+        s += run;
+        buff += (size_t)run * MVHD_SECTOR_SIZE;
+    }
+    if (transfer_sectors > 0 && fflush(vhdm->f) != 0) {
+        return num_sectors;
     }
-    /* And write the sector bitmap for the last block we visited to disk */
-    mvhd_write_curr_sect_bitmap(vhdm);
     return truncated_sectors;
 }
 
@@ -30,6 +30,22 @@ void mvhd_write_empty_sectors(FILE* f, int sector_count);
  */
 int mvhd_fixed_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_buff);
 
+/**
+ * \brief Read a memory-mapped fixed VHD image
+ * 
+ * Used instead of mvhd_fixed_read() once mvhd_enable_mmap() has mapped the image.
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ * \param [in] offset Sector offset to read from
+ * \param [in] num_sectors The desired number of sectors to read
+ * \param [out] out_buff An output buffer to store read sectors. Must be 
+ * large enough to hold num_sectors worth of sectors.
+ * 
+ * \retval 0 num_sectors were read from file
+ * \retval >0 < num_sectors were read from file
+ */
+int mvhd_fixed_map_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_buff);
+
 /**
  * \brief Read a sparse VHD image
  * 
@@ -90,6 +106,22 @@ int mvhd_diff_read(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* out_b
  */
 int mvhd_fixed_write(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* in_buff);
 
+/**
+ * \brief Write to a memory-mapped fixed VHD image
+ * 
+ * Used instead of mvhd_fixed_write() once mvhd_enable_mmap() has mapped the image.
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ * \param [in] offset Sector offset to write to
+ * \param [in] num_sectors The desired number of sectors to write
+ * \param [in] in_buff A source buffer to write sectors from. Must be 
+ * large enough to hold num_sectors worth of sectors.
+ * 
+ * \retval 0 num_sectors were written to file
+ * \retval >0 < num_sectors were written to file
+ */
+int mvhd_fixed_map_write(MVHDMeta* vhdm, uint32_t offset, int num_sectors, void* in_buff);
+
 /**
  * \brief Write to a sparse or differencing VHD image
  * 
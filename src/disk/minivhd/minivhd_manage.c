@@ -10,6 +10,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
 #include "cwalk.h"
 #include "libxml2_encoding.h"
 #include "minivhd_internal.h"
@@ -36,6 +42,9 @@ static bool mvhd_sparse_checksum_valid(MVHDMeta* vhdm);
 static int mvhd_read_bat(MVHDMeta *vhdm, MVHDError* err);
 static void mvhd_calc_sparse_values(MVHDMeta* vhdm);
 static int mvhd_init_sector_bitmap(MVHDMeta* vhdm, MVHDError* err);
+static void mvhd_free_sector_bitmap(MVHDMeta* vhdm);
+static bool mvhd_map_fixed(MVHDMeta* vhdm);
+static void mvhd_unmap_fixed(MVHDMeta* vhdm);
 
 /**
  * \brief Populate data stuctures with content from a VHD footer
@@ -131,6 +140,9 @@ static void mvhd_calc_sparse_values(MVHDMeta* vhdm) {
  * is considered 'clean' or 'dirty' (for sparse VHD images), or whether to read from the parent or current 
  * image (for differencing images).
  * 
+ * Bitmaps are cached per block once read, so this allocates the (initially empty) cache table 
+ * and one spare bitmap to fall back on if a cache entry cannot be allocated later.
+ * 
  * \param [in] vhdm MiniVHD data structure
  * \param [out] err this is populated with MVHD_ERR_MEM if the calloc fails
  * 
@@ -138,15 +150,107 @@ static void mvhd_calc_sparse_values(MVHDMeta* vhdm) {
  * \retval 0 if the function call succeeds
  */
 static int mvhd_init_sector_bitmap(MVHDMeta* vhdm, MVHDError* err) {
-    vhdm->bitmap.curr_bitmap = calloc(vhdm->bitmap.sector_count, MVHD_SECTOR_SIZE);
-    if (vhdm->bitmap.curr_bitmap == NULL) {
+    vhdm->bitmap.cache = calloc(vhdm->sparse.max_bat_ent, sizeof *vhdm->bitmap.cache);
+    vhdm->bitmap.spare_bitmap = calloc(vhdm->bitmap.sector_count, MVHD_SECTOR_SIZE);
+    if (vhdm->bitmap.cache == NULL || vhdm->bitmap.spare_bitmap == NULL) {
+        mvhd_free_sector_bitmap(vhdm);
         *err = MVHD_ERR_MEM;
         return -1;
     }
+    vhdm->bitmap.curr_bitmap = vhdm->bitmap.spare_bitmap;
     vhdm->bitmap.curr_block = -1;
     return 0;
 }
 
+/**
+ * \brief Free the sector bitmap cache
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ */
+static void mvhd_free_sector_bitmap(MVHDMeta* vhdm) {
+    if (vhdm->bitmap.cache != NULL) {
+        for (uint32_t i = 0; i < vhdm->sparse.max_bat_ent; i++) {
+            free(vhdm->bitmap.cache[i]);
+        }
+        free(vhdm->bitmap.cache);
+        vhdm->bitmap.cache = NULL;
+    }
+    free(vhdm->bitmap.spare_bitmap);
+    vhdm->bitmap.spare_bitmap = NULL;
+    vhdm->bitmap.curr_bitmap = NULL;
+    vhdm->bitmap.curr_block = -1;
+}
+
+/**
+ * \brief Map the data area of a fixed VHD image into memory
+ * 
+ * The mapping is shared with the file, and writable unless the image was opened 
+ * read-only. On success the read/write function pointers are switched to the 
+ * mapped variants.
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ * 
+ * \retval true if the image is mapped
+ * \retval false if it could not be mapped, and still uses file I/O
+ */
+static bool mvhd_map_fixed(MVHDMeta* vhdm) {
+    uint64_t size = vhdm->footer.curr_sz;
+    if (vhdm->map.data != NULL) {
+        return true;
+    }
+    if (size == 0 || (uint64_t)(size_t)size != size) {
+        return false;
+    }
+    /* Anything still buffered must reach the file before we bypass stdio */
+    fflush(vhdm->f);
+#ifdef _WIN32
+    HANDLE h = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(vhdm->f)), NULL,
+                                 vhdm->readonly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, NULL);
+    if (h == NULL) {
+        return false;
+    }
+    vhdm->map.data = MapViewOfFile(h, vhdm->readonly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    if (vhdm->map.data == NULL) {
+        CloseHandle(h);
+        return false;
+    }
+    vhdm->map.handle = h;
+#else
+    void* p = mmap(NULL, (size_t)size, vhdm->readonly ? PROT_READ : (PROT_READ | PROT_WRITE),
+                   MAP_SHARED, fileno(vhdm->f), 0);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    vhdm->map.data = p;
+#endif
+    vhdm->map.size = size;
+    vhdm->read_sectors = mvhd_fixed_map_read;
+    if (!vhdm->readonly) {
+        vhdm->write_sectors = mvhd_fixed_map_write;
+    }
+    return true;
+}
+
+/**
+ * \brief Undo mvhd_map_fixed()
+ * 
+ * \param [in] vhdm MiniVHD data structure
+ */
+static void mvhd_unmap_fixed(MVHDMeta* vhdm) {
+    if (vhdm->map.data == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(vhdm->map.data);
+    CloseHandle((HANDLE)vhdm->map.handle);
+    vhdm->map.handle = NULL;
+#else
+    munmap(vhdm->map.data, (size_t)vhdm->map.size);
+#endif
+    vhdm->map.data = NULL;
+    vhdm->map.size = 0;
+}
+
 /**
  * \brief Check if the path for a given platform code exists
  * 
@@ -449,8 +553,7 @@ cleanup_format_buff:
     free(vhdm->format_buffer.zero_data);
     vhdm->format_buffer.zero_data = NULL;
 cleanup_bitmap:
-    free(vhdm->bitmap.curr_bitmap);
-    vhdm->bitmap.curr_bitmap = NULL;
+    mvhd_free_sector_bitmap(vhdm);
 cleanup_bat:
     free(vhdm->block_offset);
     vhdm->block_offset = NULL;
@@ -469,15 +572,13 @@ void mvhd_close(MVHDMeta* vhdm) {
         if (vhdm->parent != NULL) {
             mvhd_close(vhdm->parent);
         }
+        mvhd_unmap_fixed(vhdm);
         fclose(vhdm->f);
         if (vhdm->block_offset != NULL) {
             free(vhdm->block_offset);
             vhdm->block_offset = NULL;
         }
-        if (vhdm->bitmap.curr_bitmap != NULL) {
-            free(vhdm->bitmap.curr_bitmap);
-            vhdm->bitmap.curr_bitmap = NULL;
-        }
+        mvhd_free_sector_bitmap(vhdm);
         if (vhdm->format_buffer.zero_data != NULL) {
             free(vhdm->format_buffer.zero_data);
             vhdm->format_buffer.zero_data = NULL;
@@ -487,6 +588,16 @@ void mvhd_close(MVHDMeta* vhdm) {
     }
 }
 
+int mvhd_enable_mmap(MVHDMeta* vhdm) {
+    int mapped = 0;
+    for (; vhdm != NULL; vhdm = vhdm->parent) {
+        if (vhdm->footer.disk_type == MVHD_TYPE_FIXED && mvhd_map_fixed(vhdm)) {
+            mapped++;
+        }
+    }
+    return mapped;
+}
+
 int mvhd_diff_update_par_timestamp(MVHDMeta* vhdm, int* err) {
     uint8_t sparse_buff[1024];
     if (vhdm == NULL || err == NULL) {
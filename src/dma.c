@@ -31,6 +31,8 @@
 #include <86box/io.h>
 #include <86box/pic.h>
 #include <86box/dma.h>
+#include <86box/timer.h>
+#include <86box/snapshot.h>
 
 
 dma_t		dma[8];
@@ -1620,16 +1622,21 @@ dma_mode(int channel)
 void
 dma_bm_read(uint32_t PhysAddress, uint8_t *DataRead, uint32_t TotalSize, int TransferSize)
 {
-    uint32_t i = 0, n, n2;
+    uint32_t i = 0, n, n2, len, done;
     uint8_t bytes[4] = { 0, 0, 0, 0 };
 
     n = TotalSize & ~(TransferSize - 1);
     n2 = TotalSize - n;
 
-    /* Do the divisible block, if there is one. */
-    if (n) {
-	for (i = 0; i < n; i += TransferSize)
+    /* Do the divisible block, if there is one. Whatever lies in plain RAM is
+       copied a page at a time, everything else goes through the mappings. */
+    for (i = 0; i < n; i += done) {
+	len = MIN(n - i, 4096 - ((PhysAddress + i) & 0xfff)) & ~(TransferSize - 1);
+	done = len ? mem_read_phys_ram((void *) &(DataRead[i]), PhysAddress + i, len) : 0;
+	if (done == 0) {
 		mem_read_phys((void *) &(DataRead[i]), PhysAddress + i, TransferSize);
+		done = TransferSize;
+	}
     }
 
     /* Do the non-divisible block, if there is one. */
@@ -1643,16 +1650,21 @@ dma_bm_read(uint32_t PhysAddress, uint8_t *DataRead, uint32_t TotalSize, int Tra
 void
 dma_bm_write(uint32_t PhysAddress, const uint8_t *DataWrite, uint32_t TotalSize, int TransferSize)
 {
-    uint32_t i = 0, n, n2;
+    uint32_t i = 0, n, n2, len, done;
     uint8_t bytes[4] = { 0, 0, 0, 0 };
 
     n = TotalSize & ~(TransferSize - 1);
     n2 = TotalSize - n;
 
-    /* Do the divisible block, if there is one. */
-    if (n) {
-	for (i = 0; i < n; i += TransferSize)
+    /* Do the divisible block, if there is one. Whatever lies in plain RAM is
+       copied a page at a time, everything else goes through the mappings. */
+    for (i = 0; i < n; i += done) {
+	len = MIN(n - i, 4096 - ((PhysAddress + i) & 0xfff)) & ~(TransferSize - 1);
+	done = len ? mem_write_phys_ram((void *) &(DataWrite[i]), PhysAddress + i, len) : 0;
+	if (done == 0) {
 		mem_write_phys((void *) &(DataWrite[i]), PhysAddress + i, TransferSize);
+		done = TransferSize;
+	}
     }
 
     /* Do the non-divisible block, if there is one. */
@@ -1662,3 +1674,25 @@ dma_bm_write(uint32_t PhysAddress, const uint8_t *DataWrite, uint32_t TotalSize,
 	mem_write_phys((void *) bytes, PhysAddress + n, TransferSize);
     }
 }
+
+
+/* Save or restore the DMA controllers. The bounce buffers are only valid
+   within a single transfer, so they are not included. */
+void
+dma_state(snapshot_t *s)
+{
+    snapshot_var(s, dma, sizeof(dma));
+    snapshot_item(s, dma_e);
+    snapshot_var(s, dmaregs, sizeof(dmaregs));
+    snapshot_var(s, dma_wp, sizeof(dma_wp));
+    snapshot_item(s, dma_m);
+    snapshot_item(s, dma_stat);
+    snapshot_item(s, dma_stat_rq);
+    snapshot_item(s, dma_stat_rq_pc);
+    snapshot_var(s, dma_command, sizeof(dma_command));
+    snapshot_item(s, dma_req_is_soft);
+    snapshot_item(s, dma_advanced);
+    snapshot_item(s, dma_sg_base);
+    snapshot_item(s, dma_mask);
+    snapshot_item(s, dma_ps2);
+}
@@ -37,6 +37,7 @@
 #include <86box/fdd_mfm.h>
 #include <86box/fdd_td0.h>
 #include <86box/fdc.h>
+#include <86box/snapshot.h>
 
 
 /* Flags:
@@ -634,6 +635,40 @@ fdd_reset(void)
 }
 
 
+/* The image contents are not part of the snapshot, and the 86F engine is
+   not either, so a sector transfer in progress cannot be saved. */
+void
+fdd_state(snapshot_t *s)
+{
+    int i;
+
+    for (i = 0; i < FDD_NUM; i++) {
+	if (!s->loading && d86f_busy(i)) {
+		pclog("Snapshot: floppy drive %i is busy, try again later\n", i);
+		s->error = 1;
+		return;
+	}
+    }
+
+    for (i = 0; i < FDD_NUM; i++) {
+	if (s->loading)
+		fdd_stop(i);
+
+	snapshot_item(s, fdd[i].track);
+	snapshot_item(s, fdd[i].densel);
+	snapshot_item(s, fdd[i].head);
+	snapshot_item(s, motoron[i]);
+	snapshot_item(s, fdd_changed[i]);
+	snapshot_timer(s, &fdd_poll_time[i]);
+
+	/* Bring the image's track buffer in line with the head. */
+	if (s->loading && !s->error && !drive_empty[i])
+		fdd_do_seek(i, fdd[i].track);
+    }
+    snapshot_item(s, fdd_notfound);
+}
+
+
 void
 fdd_readsector(int drive, int sector, int track, int side, int density, int sector_size)
 {
@@ -3184,6 +3184,15 @@ d86f_stop(int drive)
 }
 
 
+int
+d86f_busy(int drive)
+{
+    d86f_t *dev = d86f[drive];
+
+    return (dev != NULL) && (dev->state != STATE_IDLE);
+}
+
+
 int
 d86f_common_command(int drive, int sector, int track, int side, int rate, int sector_size)
 {
@@ -50,6 +50,7 @@
 #include <86box/joystick_standard.h>
 #include <86box/joystick_sw_pad.h>
 #include <86box/joystick_tm_fcs.h>
+#include <86box/snapshot.h>
 
 
 typedef struct {
@@ -299,6 +300,19 @@ gameport_201_init(const device_t *info)
 }
 
 
+/* The joystick itself is host input and is not saved. */
+static void
+gameport_state(void *priv, snapshot_t *s)
+{
+    gameport_t *p = (gameport_t *)priv;
+    int i;
+
+    snapshot_item(s, p->state);
+    for (i = 0; i < 4; i++)
+	snapshot_timer(s, &p->axis[i].timer);
+}
+
+
 static void
 gameport_close(void *priv)
 {
@@ -320,7 +334,7 @@ const device_t gameport_device = {
     gameport_init,
     gameport_close,
     NULL, { NULL }, NULL,
-    NULL
+    NULL, NULL, gameport_state
 };
 
 const device_t gameport_201_device = {
@@ -329,5 +343,5 @@ const device_t gameport_201_device = {
     gameport_201_init,
     gameport_close,
     NULL, { NULL }, NULL,
-    NULL
+    NULL, NULL, gameport_state
 };
@@ -68,6 +68,8 @@ extern int	video_fps;			/* (O) render speed in fps */
 #endif
 extern int	settings_only;			/* (O) show only the settings dialog */
 extern int	confirm_exit_cmdl;		/* (O) do not ask for confirmation on quit if set to 0 */
+extern int	unthrottled;			/* (O) run as fast as possible */
+extern int	headless;			/* (O) run without the UI window */
 #ifdef _WIN32
 extern uint64_t	unique_id;
 extern uint64_t	source_hwnd;
@@ -97,6 +99,7 @@ extern int	serial_enabled[],		/* (C) enable serial ports */
 		isamem_type[],			/* (C) enable ISA mem cards */
 		isartc_type;			/* (C) enable ISA RTC card */
 extern int	sound_is_float,			/* (C) sound uses FP values */
+		sound_workers,			/* (C) sound synthesis threads */
 		GAMEBLASTER,			/* (C) sound option */
 		GUS, GUSMAX,			/* (C) sound option */
 		SSI2001,			/* (C) sound option */
@@ -110,6 +113,10 @@ extern int	network_type;			/* (C) net provider type */
 extern int	network_card;			/* (C) net interface num */
 extern char	network_host[522];		/* (C) host network intf */
 extern int	hdd_format_type;		/* (C) hard disk file format */
+extern int	hdd_async_io;			/* (C) hard disk I/O thread */
+extern int	hdd_vhd_mmap;			/* (C) memory-map fixed VHDs */
+extern int	cdrom_read_ahead,		/* (C) CD-ROM image read-ahead (KB) */
+		cdrom_mmap;			/* (C) memory-map CD-ROM images */
 extern int	confirm_reset,			/* (C) enable reset confirmation */
 		confirm_exit,			/* (C) enable exit confirmation */
 		confirm_save;			/* (C) enable save confirmation */
@@ -85,6 +85,7 @@ typedef struct {
     void	(*get_subchannel)(struct cdrom *dev, uint32_t lba, subchannel_t *subc);
     int		(*sector_size)(struct cdrom *dev, uint32_t lba);
     int		(*read_sector)(struct cdrom *dev, int type, uint8_t *b, uint32_t lba);
+    int		(*read_sectors)(struct cdrom *dev, uint8_t *b, uint32_t lba, uint32_t num);
     int		(*track_type)(struct cdrom *dev, uint32_t lba);
     void	(*exit)(struct cdrom *dev);
 } cdrom_ops_t;
@@ -145,6 +146,7 @@ extern uint8_t	cdrom_get_current_subchannel(cdrom_t *dev, uint8_t *b, int msf);
 extern uint8_t	cdrom_get_current_subcodeq_playstatus(cdrom_t *dev, uint8_t *b);
 extern int	cdrom_read_toc(cdrom_t *dev, unsigned char *b, int type,
 			       unsigned char start_track, int msf, int max_len);
+extern int	cdrom_read_data_blocks(cdrom_t *dev, uint8_t *buffer, uint32_t lba, uint32_t num);
 extern int	cdrom_readsector_raw(cdrom_t *dev, uint8_t *buffer, int sector, int ismsf,
 				     int cdrom_sector_type, int cdrom_sector_flags, int *len);
 extern void 	cdrom_read_disc_info_toc(cdrom_t *dev, unsigned char *b, unsigned char track, int type);
@@ -54,6 +54,16 @@ typedef struct {
 
     wchar_t		fn[260];
     FILE		*file;
+    void		*mutex;		/* Guards file and ra_buf. */
+
+    uint64_t		length;		/* File length, for the mapping. */
+    uint8_t		*map;		/* Whole file, if memory-mapped. */
+    void		*map_handle;
+
+    uint8_t		*ra_buf;	/* Read-ahead buffer. */
+    uint64_t		ra_pos;		/* File offset of ra_buf[0]. */
+    size_t		ra_len,		/* Valid bytes in ra_buf. */
+			ra_size;
 } track_file_t;
 
 typedef struct {
@@ -91,6 +91,8 @@ typedef struct {
     const device_config_selection_t selection[16];
 } device_config_t;
 
+struct _snapshot_;
+
 typedef struct _device_ {
     const char	*name;
     uint32_t	flags;		/* system flags */
@@ -108,6 +110,8 @@ typedef struct _device_ {
     void	(*force_redraw)(void *priv);
 
     const device_config_t *config;
+
+    void	(*state)(void *priv, struct _snapshot_ *s);	/* save/load state */
 } device_t;
 
 typedef struct {
@@ -142,6 +146,9 @@ extern int		device_poll(const device_t *d, int x, int y, int z, int b);
 extern void		device_register_pci_slot(const device_t *d, int device, int type, int inta, int intb, int intc, int intd);
 extern void		device_speed_changed(void);
 extern void		device_force_redraw(void);
+extern uint32_t		device_state_hash(void);
+extern const char	*device_state_missing(void);
+extern void		device_state_all(struct _snapshot_ *s);
 extern void		device_get_name(const device_t *d, int bus, char *name);
 
 extern int		device_is_valid(const device_t *, int machine_flags);
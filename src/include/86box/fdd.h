@@ -114,6 +114,9 @@ extern int	fdd_hole(int drive);
 extern void	fdd_stop(int drive);
 extern void	fdd_do_writeback(int drive);
 
+struct _snapshot_;
+extern void	fdd_state(struct _snapshot_ *s);
+
 extern int	motorspin;
 extern uint64_t	motoron[FDD_NUM];
 
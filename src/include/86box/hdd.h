@@ -89,6 +89,8 @@ typedef struct {
 		res;			/* Reserved for bus mode */
     uint8_t	wp;			/* Disk has been mounted READ-ONLY */
     uint8_t	pad, pad0;
+    uint8_t	overlay,		/* Copy-on-write overlay: 0 = none, 1 = RAM, 2 = file */
+		overlay_commit;		/* Write the overlay back to the image on close */
 
     void	*priv;
 
@@ -114,10 +116,12 @@ extern int	hdd_is_valid(int c);
 extern void	hdd_image_init(void);
 extern int	hdd_image_load(int id);
 extern void	hdd_image_seek(uint8_t id, uint32_t sector);
+extern void	hdd_image_prefetch(uint8_t id, uint32_t sector, uint32_t count);
 extern void	hdd_image_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer);
 extern int	hdd_image_read_ex(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer);
 extern void	hdd_image_write(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer);
 extern int	hdd_image_write_ex(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer);
+extern int	hdd_image_write_error(uint8_t id);
 extern void	hdd_image_zero(uint8_t id, uint32_t sector, uint32_t count);
 extern int	hdd_image_zero_ex(uint8_t id, uint32_t sector, uint32_t count);
 extern uint32_t	hdd_image_get_last_sector(uint8_t id);
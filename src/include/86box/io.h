@@ -70,12 +70,23 @@ extern void	io_removehandler_interleaved(uint16_t base, int size,
 			void *priv);
 #endif
 
+extern void	io_set_block_handler(uint16_t port,
+			int (*inw_block)(uint16_t addr, uint8_t *buf, int count, void *priv),
+			int (*outw_block)(uint16_t addr, uint8_t *buf, int count, void *priv),
+			void *priv);
+
+extern void	io_get_counts(uint16_t port, uint32_t *reads, uint32_t *writes);
+extern void	io_clear_counts(void);
+extern void	io_log_counts(void);
+
 extern uint8_t	inb(uint16_t port);
 extern void	outb(uint16_t port, uint8_t  val);
 extern uint16_t	inw(uint16_t port);
 extern void	outw(uint16_t port, uint16_t val);
 extern uint32_t	inl(uint16_t port);
 extern void	outl(uint16_t port, uint32_t val);
+extern int	io_inw_block(uint16_t port, uint8_t *buf, int count);
+extern int	io_outw_block(uint16_t port, uint8_t *buf, int count);
 
 
 #endif	/*EMU_IO_H*/
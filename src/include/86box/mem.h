@@ -164,6 +164,31 @@ page_in_evict_list(page_t *p)
 }
 void page_remove_from_evict_list(page_t *p);
 void page_add_to_evict_list(page_t *p);
+
+/* Mark len bytes from addr, which must stay within the page, as written
+   in the byte masks used by blocks compiled with CODEBLOCK_BYTE_MASK. */
+static inline void
+page_invalidate_bytes(page_t *p, uint32_t addr, uint32_t len)
+{
+    uint32_t off = addr & 0xfff, end = off + len, bit, n;
+    uint64_t mask;
+    int byte_offset;
+
+    while (off < end) {
+	byte_offset = (off >> PAGE_BYTE_MASK_SHIFT) & PAGE_BYTE_MASK_OFFSET_MASK;
+	bit = off & PAGE_BYTE_MASK_MASK;
+	n = 64 - bit;
+	if (n > (end - off))
+		n = end - off;
+	mask = (n == 64) ? ~(uint64_t)0 : ((((uint64_t)1 << n) - 1) << bit);
+
+	p->byte_dirty_mask[byte_offset] |= mask;
+	if ((p->byte_code_present_mask[byte_offset] & mask) && !page_in_evict_list(p))
+		page_add_to_evict_list(p);
+
+	off += n;
+    }
+}
 #else
 typedef struct _page_ {
     void	(*write_b)(uint32_t addr, uint8_t val, struct _page_ *p);
@@ -182,6 +207,21 @@ typedef struct _page_ {
 } page_t;
 #endif
 
+#define TLB_SIZE_DEFAULT	256
+#define TLB_SIZE_MAX		16384
+#define TLB_WAYS		4
+#define TLB_CONTEXTS_MAX	16
+
+typedef struct {
+    uint32_t	read_fills, write_fills,	/* TLB misses that installed an entry */
+		evictions,			/* valid entries displaced by a fill */
+		flushes, invalidations,		/* full flushes, INVLPG */
+		cpl3_flushes,			/* supervisor entries dropped */
+		ctx_hits, ctx_misses,		/* CR3 loads with/without a saved context */
+		ctx_entries,			/* entries brought back from saved contexts */
+		ctx_drops;			/* saved contexts thrown away */
+} mmu_tlb_stats_t;
+
 
 extern uint8_t		*ram, *ram2;
 extern uint32_t		rammask;
@@ -189,14 +229,8 @@ extern uint32_t		rammask;
 extern uint8_t		*rom;
 extern uint32_t		biosmask, biosaddr;
 
-extern int		readlookup[256],
-			readlookupp[256];
 extern uintptr_t *	readlookup2;
-extern int		readlnext;
-extern int		writelookup[256],
-			writelookupp[256];
 extern uintptr_t *	writelookup2;
-extern int		writelnext;
 extern uint32_t		ram_mapped_addr[64];
 
 extern mem_mapping_t	ram_low_mapping,
@@ -226,10 +260,18 @@ extern int		memspeed[11];
 extern int		mmu_perm,
 			use_phys_exec;
 
+extern int		mmu_tlb_size,
+			mmu_tlb_contexts;
+extern mmu_tlb_stats_t	mmu_tlb_stats;
+
 extern int		mem_a20_state,
 			mem_a20_alt,
 			mem_a20_key;
 
+extern uint8_t		*ram_dirty_map;		/* 1 bit per 4K RAM page */
+extern uint32_t		ram_dirty_pages;
+extern uint8_t		*mmu_pt_map;		/* 1 bit per 4K page used as page table */
+
 
 extern uint8_t	read_mem_b(uint32_t addr);
 extern uint16_t	read_mem_w(uint32_t addr);
@@ -297,6 +339,8 @@ extern void	mem_writeb_phys(uint32_t addr, uint8_t val);
 extern void	mem_writew_phys(uint32_t addr, uint16_t val);
 extern void	mem_writel_phys(uint32_t addr, uint32_t val);
 extern void	mem_write_phys(void *src, uint32_t addr, int tranfer_size);
+extern uint32_t	mem_read_phys_ram(void *dest, uint32_t addr, uint32_t len);
+extern uint32_t	mem_write_phys_ram(const void *src, uint32_t addr, uint32_t len);
 
 extern uint8_t	mem_read_ram(uint32_t addr, void *priv);
 extern uint16_t	mem_read_ramw(uint32_t addr, void *priv);
@@ -332,7 +376,11 @@ extern void	mem_reset_page_blocks(void);
 extern void     flushmmucache(void);
 extern void     flushmmucache_cr3(void);
 extern void	flushmmucache_nopc(void);
+extern void	flushmmucache_cpl3(void);
 extern void     mmu_invalidate(uint32_t addr);
+extern void	mmu_load_cr3(uint32_t val);
+extern void	mmu_pt_write(uint32_t addr);
+extern void	mmu_tlb_stats_reset(void);
 
 extern void	mem_a20_init(void);
 extern void	mem_a20_recalc(void);
@@ -342,6 +390,27 @@ extern void	mem_close(void);
 extern void	mem_reset(void);
 extern void	mem_remap_top(int kb);
 
+struct _snapshot_;
+extern uint8_t	*mem_ram_page(uint32_t page);
+extern void	mem_dirty_clear(void);
+extern void	mem_state(struct _snapshot_ *s);
+
+
+/* Mark a physical RAM page as written since the last snapshot. */
+static __inline void
+mem_dirty_set(uint32_t addr)
+{
+    uint32_t page = addr >> 12;
+
+    if (page < ram_dirty_pages)
+	ram_dirty_map[page >> 3] |= (1 << (page & 7));
+
+    /* Every write that does not go through the lookup tables comes here,
+       which is what lets the TLB notice page table updates. */
+    if ((mmu_pt_map != NULL) && (mmu_pt_map[page >> 3] & (1 << (page & 7))))
+	mmu_pt_write(addr);
+}
+
 
 #ifdef EMU_CPU_H
 static __inline uint32_t get_phys(uint32_t addr)
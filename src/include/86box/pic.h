@@ -53,5 +53,8 @@ extern int	picinterrupt(void);
 
 extern uint8_t	pic_irq_ack(void);
 
+struct _snapshot_;
+extern void	pic_state(struct _snapshot_ *s);
+
 
 #endif	/*EMU_PIC_H*/
@@ -157,6 +157,8 @@ extern void	thread_close_mutex(mutex_t *arg);
 extern int	thread_wait_mutex(mutex_t *arg);
 extern int	thread_release_mutex(mutex_t *mutex);
 
+extern int	thread_get_cpu_count(void);
+
 
 /* Other stuff. */
 extern void	startblit(void);
@@ -287,10 +287,16 @@
 #define IDM_ACTION_EXIT		40014
 #define IDM_ACTION_CTRL_ALT_ESC 40015
 #define IDM_ACTION_PAUSE	40016
+#define IDM_ACTION_SNAPSHOT_SAVE	40017
+#define IDM_ACTION_SNAPSHOT_LOAD	40018
 #define IDM_CONFIG		40020
 #define IDM_CONFIG_LOAD		40021
 #define IDM_CONFIG_SAVE		40022
 #define IDM_UPDATE_ICONS	40030
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+#define IDM_DYNAREC_PROFILE	40031
+#define IDM_DYNAREC_PROFILE_DUMP	40032
+#endif
 #define IDM_VID_RESIZE		40040
 #define IDM_VID_REMEMBER	40041
 #define IDM_VID_SDL_SW		40050
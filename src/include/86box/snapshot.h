@@ -0,0 +1,64 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Definitions for the machine snapshot (save state) module.
+ *
+ *		A snapshot file consists of a fixed header, the guest RAM
+ *		image at a fixed offset, and a stream of tagged state chunks
+ *		(CPU, memory mappings, PIC, DMA and one chunk per device).
+ *		Saving again to the file that was last saved or loaded only
+ *		rewrites the RAM pages that were dirtied since.
+ */
+#ifndef EMU_SNAPSHOT_H
+# define EMU_SNAPSHOT_H
+
+
+#define SNAPSHOT_FILE		L"86box.snp"
+
+#define SNAPSHOT_NONE		0
+#define SNAPSHOT_SAVE		1
+#define SNAPSHOT_LOAD		2
+
+
+typedef struct _snapshot_ {
+    int		loading,		/* stream direction */
+		error;			/* set on overrun or mismatch */
+
+    uint8_t	*buf;
+    uint32_t	pos, size,
+		chunk, end;		/* current chunk start/end */
+} snapshot_t;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern wchar_t	snapshot_path[1024];
+
+/* Symmetric (de)serialisation helpers for the state hooks. */
+extern void	snapshot_var(snapshot_t *s, void *p, uint32_t len);
+#define snapshot_item(s, v)	snapshot_var((s), &(v), sizeof(v))
+extern void	snapshot_timer(snapshot_t *s, pc_timer_t *timer);
+
+extern int	snapshot_chunk_begin(snapshot_t *s, const char *tag);
+extern void	snapshot_chunk_end(snapshot_t *s);
+
+extern int	snapshot_save(wchar_t *fn);
+extern int	snapshot_load(wchar_t *fn);
+
+/* Called from the UI; the request is executed by the emulation thread. */
+extern void	snapshot_request(int op, wchar_t *fn);
+extern void	snapshot_process(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif	/*EMU_SNAPSHOT_H*/
@@ -27,7 +27,7 @@ typedef struct {
 #else
     void	*opl;
 #endif
-    int8_t	flags, pad;
+    int8_t	flags, newm;
 
     uint16_t	port;
     uint8_t	status, timer_ctrl;
@@ -36,12 +36,15 @@ typedef struct {
 
     pc_timer_t	timers[2];
 
+    struct _sound_worker_ *worker;	/* synthesis runs on a worker thread */
+
     int		pos;
     int32_t	buffer[SOUNDBUFLEN * 2];
 } opl_t;
 
 
 extern void	opl_set_do_cycles(opl_t *dev, int8_t do_cycles);
+extern void	opl_close(opl_t *dev);
 
 extern uint8_t	opl2_read(uint16_t port, void *);
 extern void	opl2_write(uint16_t port, uint8_t val, void *);
@@ -0,0 +1,62 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Definitions for the sound synthesis worker threads.
+ *
+ *		A sound generator registered here no longer renders on the
+ *		emulation thread: its register writes are queued together
+ *		with the sample position they happened at, and at the end
+ *		of each period the queue is handed to a worker thread which
+ *		replays it while rendering. The rendered block is collected
+ *		at the end of the next period, so the output runs exactly
+ *		one SOUNDBUFLEN behind.
+ *
+ *		This only suits generators whose synthesis state the guest
+ *		never reads back, which currently means the OPL2/OPL3 (its
+ *		timers and status stay on the emulation thread). EMU8K and
+ *		GUS report their current voice addresses and raise wave
+ *		IRQs, and the SID returns its oscillator 3 and envelope 3
+ *		outputs, so all of these have to render in step with the
+ *		CPU. MT-32 already renders on its own thread, see
+ *		midi_mt32.c.
+ */
+#ifndef SOUND_WORKER_H
+# define SOUND_WORKER_H
+
+
+typedef struct {
+    uint16_t	pos, reg;
+    uint8_t	val;
+} sound_worker_write_t;
+
+typedef struct _sound_worker_ {
+    void	(*write)(void *priv, uint16_t reg, uint8_t val);
+    void	(*generate)(void *priv, int32_t *buffer, int len);
+    void	*priv;
+
+    int		cur, job,		/* queue being filled, queue being played */
+		posted;			/* a block is being rendered */
+    int		nwrites[2], size[2];
+    sound_worker_write_t *writes[2];
+
+    event_t	*done;
+    struct _sound_worker_ *next;	/* pending job list */
+
+    int32_t	buffer[SOUNDBUFLEN * 2];
+} sound_worker_t;
+
+
+extern sound_worker_t	*sound_worker_add(void (*write)(void *priv, uint16_t reg, uint8_t val),
+					  void (*generate)(void *priv, int32_t *buffer, int len),
+					  void *priv);
+extern void		sound_worker_close(sound_worker_t *dev);
+extern void		sound_worker_write(sound_worker_t *dev, uint16_t reg, uint8_t val);
+extern void		sound_worker_get(sound_worker_t *dev, int32_t *buffer);
+
+
+#endif	/*SOUND_WORKER_H*/
@@ -48,6 +48,14 @@ extern void	sound_add_handler(void (*get_buffer)(int32_t *buffer, \
 extern void	sound_set_cd_audio_filter(void (*filter)(int channel, \
 					  double *buffer, void *p), void *p);
 
+/* Mixing and conversion kernels, lengths are in samples. */
+extern void	sound_mix_init(void);
+extern void	sound_mix_add(int32_t *dst, const int32_t *src, int len);
+extern void	sound_mix_add_16(int32_t *dst, const int16_t *src, int len);
+extern void	sound_mix_add_16_half(int32_t *dst, const int16_t *src, int len);
+extern void	sound_mix_to_float(float *dst, const int32_t *src, int len);
+extern void	sound_mix_to_int16(int16_t *dst, const int32_t *src, int len);
+
 extern int	sound_card_available(int card);
 #ifdef EMU_DEVICE_H
 extern const device_t	*sound_card_getdevice(int card);
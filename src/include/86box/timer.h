@@ -10,6 +10,10 @@
 #define TIMER_SPLIT	2
 #define TIMER_ENABLED	1
 
+/* Timer queue engines, selectable at timer_init() time. */
+#define TIMER_ENGINE_LIST	0	/* sorted doubly-linked list, O(n) insert */
+#define TIMER_ENGINE_HEAP	1	/* binary min-heap, O(log n) insert */
+
 
 #pragma pack(push,1)
 typedef struct
@@ -54,8 +58,23 @@ typedef struct pc_timer_t
     void	*p;
 
     struct	pc_timer_t *prev, *next;
+
+    uint32_t	seq;			/* Insertion order, breaks timestamp ties. */
+    int		heap_idx;		/* Slot in the heap, heap engine only. */
 } pc_timer_t;
 
+/*Queue statistics, so that the list and heap engines can be compared on the
+  same configuration. A "step" is a list node visited on insertion, or a heap
+  level moved through when sifting.*/
+typedef struct
+{
+    uint64_t	inserts, steps;
+    uint32_t	max_steps;
+} timer_stats_t;
+
+/*Queue engine, only read by timer_init()*/
+extern int	timer_engine;
+
 /*Timestamp of nearest enabled timer. CPU emulation must call timer_process()
   when TSC matches or exceeds this.*/
 extern uint32_t	timer_target;
@@ -72,6 +91,12 @@ extern void	timer_process(void);
 extern void	timer_close(void);
 extern void	timer_init(void);
 
+/*Move all enabled timers by delta TSC cycles*/
+extern void	timer_shift(int64_t delta);
+
+/*Queue statistics since the last timer_init()*/
+extern void	timer_get_stats(timer_stats_t *stats);
+
 /*Add new timer. If start_timer is set, timer will be enabled with a zero
   timestamp - this is useful for permanently enabled timers*/
 extern void	timer_add(pc_timer_t *timer, void (*callback)(void *p), void *p, int start_timer);
@@ -192,6 +217,7 @@ extern void	timer_remove_head(void);
 
 extern pc_timer_t *	timer_head;
 extern int		timer_inited;
+extern int		timer_engine_cur;
 
 
 static __inline void
@@ -199,6 +225,11 @@ timer_remove_head_inline(void)
 {
     pc_timer_t *timer;
 
+    if (timer_engine_cur != TIMER_ENGINE_LIST) {
+	timer_remove_head();
+	return;
+    }
+
     if (timer_inited && timer_head) {
 	timer = timer_head;
 	timer_head = timer->next;
@@ -148,6 +148,8 @@ typedef struct svga_t
 } svga_t;
 
 
+struct _snapshot_;
+
 extern int	svga_init(const device_t *info, svga_t *svga, void *p, int memsize, 
 			  void (*recalctimings_ex)(struct svga_t *svga),
 			  uint8_t (*video_in) (uint16_t addr, void *p),
@@ -155,6 +157,7 @@ extern int	svga_init(const device_t *info, svga_t *svga, void *p, int memsize,
 			  void (*hwcursor_draw)(struct svga_t *svga, int displine),
 			  void (*overlay_draw)(struct svga_t *svga, int displine));
 extern void	svga_recalctimings(svga_t *svga);
+extern void	svga_state(svga_t *svga, struct _snapshot_ *s);
 extern void	svga_close(svga_t *svga);
 
 uint8_t		svga_read(uint32_t addr, void *p);
@@ -0,0 +1,1034 @@
+/*ARM64 (AArch64) backend for the Voodoo pixel pipeline.
+
+  Blocks are keyed on the same registers as the x86 backends :
+
+  alphaMode
+  fbzMode
+  fogMode
+  fbzColorPath
+  textureMode / tLOD
+
+  The generated code draws one span, specialised on the above. Depth, colour
+  combine, fog, alpha test, alpha blend, dither and framebuffer writes are
+  generated inline; texture sampling calls the C samplers.
+
+  Register usage :
+  X19 = state, X20 = params, W21 = real_y, W22 = x, W23 = new_depth,
+  W24 = w_depth, X25 = voodoo, W26 = x_tiled, W27 = 0xff
+  W4-W7 = src RGBA, W8-W10 = clocal RGB, W11 = alocal, W12 = aother,
+  W13-W15 = multiplier / fog / dest RGB, W0-W3 and X16 scratch*/
+
+#if defined(_WIN32)
+#define BITMAP windows_BITMAP
+#include <windows.h>
+#undef BITMAP
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#define BLOCK_NUM 8
+#define BLOCK_MASK (BLOCK_NUM-1)
+#define BLOCK_SIZE 8192
+
+#define LOD_MASK (LOD_TMIRROR_S | LOD_TMIRROR_T)
+
+typedef struct voodoo_arm64_data_t
+{
+        uint8_t code_block[BLOCK_SIZE];
+        int xdir;
+        uint32_t alphaMode;
+        uint32_t fbzMode;
+        uint32_t fogMode;
+        uint32_t fbzColorPath;
+        uint32_t textureMode[2];
+        uint32_t tLOD[2];
+        uint32_t trexInit1;
+        int is_tiled;
+} voodoo_arm64_data_t;
+
+static int last_block[RENDER_THREADS_MAX];
+static int next_block_to_write[RENDER_THREADS_MAX];
+
+#define addlong(val)                                            \
+        do {                                                    \
+                *(uint32_t *)&code_block[block_pos] = val;      \
+                block_pos += 4;                                 \
+                if (block_pos >= BLOCK_SIZE)                    \
+                        fatal("Over!\n");                       \
+        } while (0)
+
+#define REG_STATE   19
+#define REG_PARAMS  20
+#define REG_REAL_Y  21
+#define REG_X       22
+#define REG_DEPTH   23
+#define REG_W_DEPTH 24
+#define REG_VOODOO  25
+#define REG_X_TILED 26
+#define REG_FF      27
+#define REG_XZR     31
+#define REG_SP      31
+
+#define COND_EQ 0x0
+#define COND_NE 0x1
+#define COND_CS 0x2
+#define COND_CC 0x3
+#define COND_HI 0x8
+#define COND_LS 0x9
+#define COND_GE 0xa
+#define COND_LT 0xb
+#define COND_GT 0xc
+#define COND_LE 0xd
+
+#define SHIFT_LSL 0
+#define SHIFT_LSR 1
+#define SHIFT_ASR 2
+
+#define ARM64_ADD_IMM_W(d, n, imm)    (0x11000000 | ((imm) << 10) | ((n) << 5) | (d))
+#define ARM64_ADD_IMM_X(d, n, imm)    (0x91000000 | ((imm) << 10) | ((n) << 5) | (d))
+#define ARM64_SUB_IMM_W(d, n, imm)    (0x51000000 | ((imm) << 10) | ((n) << 5) | (d))
+#define ARM64_CMP_IMM_W(n, imm)       (0x71000000 | ((imm) << 10) | ((n) << 5) | REG_XZR)
+
+#define ARM64_ADD_REG_W(d, n, m, type, amount) (0x0b000000 | ((type) << 22) | ((m) << 16) | ((amount) << 10) | ((n) << 5) | (d))
+#define ARM64_ADD_REG_X(d, n, m, type, amount) (0x8b000000 | ((type) << 22) | ((m) << 16) | ((amount) << 10) | ((n) << 5) | (d))
+#define ARM64_SUB_REG_W(d, n, m)      (0x4b000000 | ((m) << 16) | ((n) << 5) | (d))
+#define ARM64_SUB_REG_X(d, n, m)      (0xcb000000 | ((m) << 16) | ((n) << 5) | (d))
+#define ARM64_CMP_REG_W(n, m)         (0x6b000000 | ((m) << 16) | ((n) << 5) | REG_XZR)
+#define ARM64_ORR_REG_W(d, n, m, type, amount) (0x2a000000 | ((type) << 22) | ((m) << 16) | ((amount) << 10) | ((n) << 5) | (d))
+#define ARM64_BIC_REG_W(d, n, m, type, amount) (0x0a200000 | ((type) << 22) | ((m) << 16) | ((amount) << 10) | ((n) << 5) | (d))
+#define ARM64_MVN_W(d, m)             (0x2a2003e0 | ((m) << 16) | (d))
+#define ARM64_MOV_REG_W(d, m)         (0x2a0003e0 | ((m) << 16) | (d))
+#define ARM64_MOV_REG_X(d, m)         (0xaa0003e0 | ((m) << 16) | (d))
+
+/*Logical immediates are given as rotate/size pairs. A run of len ones starting
+  at bit lsb is immr = (32 - lsb) & 31, imms = len - 1*/
+#define ARM64_AND_IMM_W(d, n, immr, imms) (0x12000000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | (d))
+#define ARM64_EOR_IMM_W(d, n, immr, imms) (0x52000000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | (d))
+#define ARM64_TST_IMM_W(n, immr, imms)    (0x72000000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | REG_XZR)
+#define ARM64_TST_IMM_X(n, immr, imms)    (0xf2400000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | REG_XZR)
+
+#define ARM64_MOVZ_W(d, imm)          (0x52800000 | ((imm) << 5) | (d))
+#define ARM64_MOVN_W(d, imm)          (0x12800000 | ((imm) << 5) | (d))
+#define ARM64_MOVZ_X(d, imm, hw)      (0xd2800000 | ((hw) << 21) | ((imm) << 5) | (d))
+#define ARM64_MOVK_X(d, imm, hw)      (0xf2800000 | ((hw) << 21) | ((imm) << 5) | (d))
+
+#define ARM64_UBFM_W(d, n, immr, imms) (0x53000000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | (d))
+#define ARM64_SBFM_W(d, n, immr, imms) (0x13000000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | (d))
+#define ARM64_UBFM_X(d, n, immr, imms) (0xd3400000 | ((immr) << 16) | ((imms) << 10) | ((n) << 5) | (d))
+#define ARM64_LSL_IMM_W(d, n, sh)     ARM64_UBFM_W(d, n, (32 - (sh)) & 31, 31 - (sh))
+#define ARM64_LSR_IMM_W(d, n, sh)     ARM64_UBFM_W(d, n, sh, 31)
+#define ARM64_ASR_IMM_W(d, n, sh)     ARM64_SBFM_W(d, n, sh, 31)
+#define ARM64_UBFX_W(d, n, lsb, width) ARM64_UBFM_W(d, n, lsb, (lsb) + (width) - 1)
+#define ARM64_UBFX_X(d, n, lsb, width) ARM64_UBFM_X(d, n, lsb, (lsb) + (width) - 1)
+
+#define ARM64_LSRV_W(d, n, m)         (0x1ac02400 | ((m) << 16) | ((n) << 5) | (d))
+#define ARM64_MUL_W(d, n, m)          (0x1b007c00 | ((m) << 16) | ((n) << 5) | (d))
+#define ARM64_SDIV_W(d, n, m)         (0x1ac00c00 | ((m) << 16) | ((n) << 5) | (d))
+#define ARM64_CSEL_W(d, n, m, cond)   (0x1a800000 | ((m) << 16) | ((cond) << 12) | ((n) << 5) | (d))
+#define ARM64_CLZ_W(d, n)             (0x5ac01000 | ((n) << 5) | (d))
+
+#define ARM64_LDR_W(t, n, offset)     (0xb9400000 | (((offset) >> 2) << 10) | ((n) << 5) | (t))
+#define ARM64_LDR_X(t, n, offset)     (0xf9400000 | (((offset) >> 3) << 10) | ((n) << 5) | (t))
+#define ARM64_LDRH(t, n, offset)      (0x79400000 | (((offset) >> 1) << 10) | ((n) << 5) | (t))
+#define ARM64_LDRSH_W(t, n, offset)   (0x79c00000 | (((offset) >> 1) << 10) | ((n) << 5) | (t))
+#define ARM64_LDRB(t, n, offset)      (0x39400000 | ((offset) << 10) | ((n) << 5) | (t))
+#define ARM64_STR_W(t, n, offset)     (0xb9000000 | (((offset) >> 2) << 10) | ((n) << 5) | (t))
+#define ARM64_STR_X(t, n, offset)     (0xf9000000 | (((offset) >> 3) << 10) | ((n) << 5) | (t))
+#define ARM64_LDRH_UXTW(t, n, m)      (0x78605800 | ((m) << 16) | ((n) << 5) | (t)) /*LDRH t, [n, m, UXTW #1]*/
+#define ARM64_STRH_UXTW(t, n, m)      (0x78205800 | ((m) << 16) | ((n) << 5) | (t)) /*STRH t, [n, m, UXTW #1]*/
+#define ARM64_LDRB_REG(t, n, m)       (0x38606800 | ((m) << 16) | ((n) << 5) | (t))
+#define ARM64_STP_PREIDX_X(t1, t2, n, offset)  (0xa9800000 | ((((offset) >> 3) & 0x7f) << 15) | ((t2) << 10) | ((n) << 5) | (t1))
+#define ARM64_STP_X(t1, t2, n, offset)         (0xa9000000 | ((((offset) >> 3) & 0x7f) << 15) | ((t2) << 10) | ((n) << 5) | (t1))
+#define ARM64_LDP_X(t1, t2, n, offset)         (0xa9400000 | ((((offset) >> 3) & 0x7f) << 15) | ((t2) << 10) | ((n) << 5) | (t1))
+#define ARM64_LDP_POSTIDX_X(t1, t2, n, offset) (0xa8c00000 | ((((offset) >> 3) & 0x7f) << 15) | ((t2) << 10) | ((n) << 5) | (t1))
+
+/*Branch offsets are filled in by arm64_patch_branch()*/
+#define ARM64_B                       (0x14000000)
+#define ARM64_BCOND(cond)             (0x54000000 | (cond))
+#define ARM64_CBZ_W(t)                (0x34000000 | (t))
+#define ARM64_BLR(n)                  (0xd63f0000 | ((n) << 5))
+#define ARM64_RET                     (0xd65f03c0)
+
+static inline void arm64_patch_branch(uint8_t *code_block, int pos, int dest)
+{
+        uint32_t *p = (uint32_t *)&code_block[pos];
+        int offset = (dest - pos) >> 2;
+
+        if ((*p & 0xfc000000) == ARM64_B)
+                *p |= offset & 0x3ffffff;
+        else
+                *p |= (offset & 0x7ffff) << 5;
+}
+
+static inline int arm64_mov_imm64(uint8_t *code_block, int block_pos, int reg, uint64_t val)
+{
+        addlong(ARM64_MOVZ_X(reg, val & 0xffff, 0));
+        addlong(ARM64_MOVK_X(reg, (val >> 16) & 0xffff, 1));
+        addlong(ARM64_MOVK_X(reg, (val >> 32) & 0xffff, 2));
+        addlong(ARM64_MOVK_X(reg, (val >> 48) & 0xffff, 3));
+
+        return block_pos;
+}
+
+/*reg = CLAMP(reg)*/
+static inline int arm64_clamp8(uint8_t *code_block, int block_pos, int reg)
+{
+        addlong(ARM64_BIC_REG_W(reg, reg, reg, SHIFT_ASR, 31));
+        addlong(ARM64_CMP_REG_W(reg, REG_FF));
+        addlong(ARM64_CSEL_W(reg, REG_FF, reg, COND_GT));
+
+        return block_pos;
+}
+
+/*reg = CLAMP16(reg), using W3*/
+static inline int arm64_clamp16(uint8_t *code_block, int block_pos, int reg)
+{
+        addlong(ARM64_MOVZ_W(3, 0xffff));
+        addlong(ARM64_BIC_REG_W(reg, reg, reg, SHIFT_ASR, 31));
+        addlong(ARM64_CMP_REG_W(reg, 3));
+        addlong(ARM64_CSEL_W(reg, 3, reg, COND_GT));
+
+        return block_pos;
+}
+
+/*reg = CLAMP(state->offset >> shift)*/
+static inline int arm64_load_iter(uint8_t *code_block, int block_pos, int reg, int offset, int shift)
+{
+        addlong(ARM64_LDR_W(reg, REG_STATE, offset));
+        addlong(ARM64_ASR_IMM_W(reg, reg, shift));
+        return arm64_clamp8(code_block, block_pos, reg);
+}
+
+/*reg /= 255, for 0 <= reg <= 255*255, using W2*/
+static inline int arm64_div255(uint8_t *code_block, int block_pos, int reg)
+{
+        addlong(ARM64_ADD_IMM_W(2, reg, 1));
+        addlong(ARM64_ADD_REG_W(2, 2, reg, SHIFT_LSR, 8));
+        addlong(ARM64_LSR_IMM_W(reg, 2, 8));
+
+        return block_pos;
+}
+
+/*d = (n * m) / 255, using W2*/
+static inline int arm64_mul_div255(uint8_t *code_block, int block_pos, int d, int n, int m)
+{
+        addlong(ARM64_MUL_W(d, n, m));
+        return arm64_div255(code_block, block_pos, d);
+}
+
+/*Load an RGB888 value from params into three registers*/
+static inline int arm64_load_rgb(uint8_t *code_block, int block_pos, int r, int g, int b, int offset)
+{
+        addlong(ARM64_LDRB(r, REG_PARAMS, offset + 2));
+        addlong(ARM64_LDRB(g, REG_PARAMS, offset + 1));
+        addlong(ARM64_LDRB(b, REG_PARAMS, offset));
+
+        return block_pos;
+}
+
+static inline int arm64_load_tex_rgb(uint8_t *code_block, int block_pos, int r, int g, int b)
+{
+        addlong(ARM64_LDR_W(r, REG_STATE, offsetof(voodoo_state_t, tex_r[0])));
+        addlong(ARM64_LDR_W(g, REG_STATE, offsetof(voodoo_state_t, tex_g[0])));
+        addlong(ARM64_LDR_W(b, REG_STATE, offsetof(voodoo_state_t, tex_b[0])));
+
+        return block_pos;
+}
+
+static inline int arm64_step_32(uint8_t *code_block, int block_pos, int xdir, int state_offset, int params_offset)
+{
+        addlong(ARM64_LDR_W(0, REG_STATE, state_offset));
+        addlong(ARM64_LDR_W(1, REG_PARAMS, params_offset));
+        if (xdir > 0)
+                addlong(ARM64_ADD_REG_W(0, 0, 1, SHIFT_LSL, 0));
+        else
+                addlong(ARM64_SUB_REG_W(0, 0, 1));
+        addlong(ARM64_STR_W(0, REG_STATE, state_offset));
+
+        return block_pos;
+}
+
+static inline int arm64_step_64(uint8_t *code_block, int block_pos, int xdir, int state_offset, int params_offset)
+{
+        addlong(ARM64_LDR_X(0, REG_STATE, state_offset));
+        addlong(ARM64_LDR_X(1, REG_PARAMS, params_offset));
+        if (xdir > 0)
+                addlong(ARM64_ADD_REG_X(0, 0, 1, SHIFT_LSL, 0));
+        else
+                addlong(ARM64_SUB_REG_X(0, 0, 1));
+        addlong(ARM64_STR_X(0, REG_STATE, state_offset));
+
+        return block_pos;
+}
+
+static inline void voodoo_generate(uint8_t *code_block, voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int depthop)
+{
+        int block_pos = 0;
+        int skip_pos[8];
+        int nr_skip = 0;
+        int loop_jump_pos;
+        int fb_index = params->col_tiled ? REG_X_TILED : REG_X;
+        int aux_index = params->aux_tiled ? REG_X_TILED : REG_X;
+        int c;
+
+        addlong(ARM64_STP_PREIDX_X(29, 30, REG_SP, -96));
+        addlong(ARM64_ADD_IMM_X(29, REG_SP, 0)); /*MOV X29, SP*/
+        addlong(ARM64_STP_X(19, 20, REG_SP, 16));
+        addlong(ARM64_STP_X(21, 22, REG_SP, 32));
+        addlong(ARM64_STP_X(23, 24, REG_SP, 48));
+        addlong(ARM64_STP_X(25, 26, REG_SP, 64));
+        addlong(ARM64_STP_X(27, 28, REG_SP, 80));
+
+        addlong(ARM64_MOV_REG_X(REG_STATE, 0));
+        addlong(ARM64_MOV_REG_X(REG_PARAMS, 1));
+        addlong(ARM64_MOV_REG_W(REG_X, 2));
+        addlong(ARM64_MOV_REG_W(REG_REAL_Y, 3));
+        block_pos = arm64_mov_imm64(code_block, block_pos, REG_VOODOO, (uintptr_t)voodoo);
+        addlong(ARM64_MOVZ_W(REG_FF, 0xff));
+
+        loop_jump_pos = block_pos;
+
+        if (params->col_tiled || params->aux_tiled)
+        {
+                addlong(ARM64_AND_IMM_W(0, REG_X, 0, 5)); /*AND W0, W22, #63*/
+                addlong(ARM64_LSR_IMM_W(1, REG_X, 6));
+                addlong(ARM64_ADD_REG_W(REG_X_TILED, 0, 1, SHIFT_LSL, 11)); /*tile is 128*32, << 12, div 2 because word index*/
+        }
+
+        if ((params->fbzMode & FBZ_W_BUFFER) || (params->fogMode & (FOG_ENABLE|FOG_CONSTANT|FOG_Z|FOG_ALPHA)) == FOG_ENABLE)
+        {
+                int depth_jump_pos, depth_jump_pos2;
+
+                addlong(ARM64_LDR_X(0, REG_STATE, offsetof(voodoo_state_t, w)));
+                addlong(ARM64_MOVZ_W(REG_W_DEPTH, 0));
+                addlong(ARM64_TST_IMM_X(0, 32, 15)); /*TST X0, #0xffff00000000*/
+                depth_jump_pos = block_pos;
+                addlong(ARM64_BCOND(COND_NE));
+                addlong(ARM64_MOVZ_W(REG_W_DEPTH, 0xf001));
+                addlong(ARM64_LSR_IMM_W(1, 0, 16));
+                depth_jump_pos2 = block_pos;
+                addlong(ARM64_CBZ_W(1));
+                addlong(ARM64_CLZ_W(2, 1));
+                addlong(ARM64_SUB_IMM_W(2, 2, 16)); /*W2 = exp*/
+                addlong(ARM64_MOVZ_W(3, 19));
+                addlong(ARM64_SUB_REG_W(3, 3, 2));
+                addlong(ARM64_MVN_W(1, 0));
+                addlong(ARM64_LSRV_W(1, 1, 3));
+                addlong(ARM64_AND_IMM_W(1, 1, 0, 11)); /*AND W1, W1, #0xfff - W1 = mant*/
+                addlong(ARM64_ADD_REG_W(REG_W_DEPTH, 1, 2, SHIFT_LSL, 12));
+                addlong(ARM64_ADD_IMM_W(REG_W_DEPTH, REG_W_DEPTH, 1));
+                addlong(ARM64_MOVZ_W(3, 0xffff));
+                addlong(ARM64_CMP_REG_W(REG_W_DEPTH, 3));
+                addlong(ARM64_CSEL_W(REG_W_DEPTH, 3, REG_W_DEPTH, COND_HI));
+
+                arm64_patch_branch(code_block, depth_jump_pos, block_pos);
+                arm64_patch_branch(code_block, depth_jump_pos2, block_pos);
+        }
+
+        if (params->fbzMode & FBZ_W_BUFFER)
+                addlong(ARM64_MOV_REG_W(REG_DEPTH, REG_W_DEPTH));
+        else
+        {
+                addlong(ARM64_LDR_W(REG_DEPTH, REG_STATE, offsetof(voodoo_state_t, z)));
+                addlong(ARM64_ASR_IMM_W(REG_DEPTH, REG_DEPTH, 12));
+                block_pos = arm64_clamp16(code_block, block_pos, REG_DEPTH);
+        }
+
+        if (params->fbzMode & FBZ_DEPTH_BIAS)
+        {
+                addlong(ARM64_LDRSH_W(0, REG_PARAMS, offsetof(voodoo_params_t, zaColor)));
+                addlong(ARM64_ADD_REG_W(REG_DEPTH, REG_DEPTH, 0, SHIFT_LSL, 0));
+                block_pos = arm64_clamp16(code_block, block_pos, REG_DEPTH);
+        }
+
+        if ((params->fbzMode & FBZ_DEPTH_ENABLE) && depthop == DEPTHOP_NEVER)
+        {
+                skip_pos[nr_skip++] = block_pos;
+                addlong(ARM64_B);
+        }
+        else if ((params->fbzMode & FBZ_DEPTH_ENABLE) && depthop != DEPTHOP_ALWAYS)
+        {
+                int comp_depth = REG_DEPTH;
+                int fail_cond;
+
+                addlong(ARM64_LDR_X(0, REG_STATE, offsetof(voodoo_state_t, aux_mem)));
+                addlong(ARM64_LDRH_UXTW(1, 0, aux_index));
+                if (params->fbzMode & FBZ_DEPTH_SOURCE)
+                {
+                        addlong(ARM64_LDRH(2, REG_PARAMS, offsetof(voodoo_params_t, zaColor)));
+                        comp_depth = 2;
+                }
+                addlong(ARM64_CMP_REG_W(comp_depth, 1));
+                switch (depthop)
+                {
+                        case DEPTHOP_LESSTHAN:
+                        fail_cond = COND_CS;
+                        break;
+                        case DEPTHOP_EQUAL:
+                        fail_cond = COND_NE;
+                        break;
+                        case DEPTHOP_LESSTHANEQUAL:
+                        fail_cond = COND_HI;
+                        break;
+                        case DEPTHOP_GREATERTHAN:
+                        fail_cond = COND_LS;
+                        break;
+                        case DEPTHOP_NOTEQUAL:
+                        fail_cond = COND_EQ;
+                        break;
+                        case DEPTHOP_GREATERTHANEQUAL:
+                        fail_cond = COND_CC;
+                        break;
+                        default:
+                        fatal("Bad depth_op\n");
+                        fail_cond = COND_NE;
+                        break;
+                }
+                skip_pos[nr_skip++] = block_pos;
+                addlong(ARM64_BCOND(fail_cond));
+        }
+
+        if (params->fbzColorPath & FBZCP_TEXTURE_ENABLED)
+        {
+                addlong(ARM64_MOV_REG_X(0, REG_VOODOO));
+                addlong(ARM64_MOV_REG_X(1, REG_PARAMS));
+                addlong(ARM64_MOV_REG_X(2, REG_STATE));
+                if ((params->textureMode[0] & TEXTUREMODE_LOCAL_MASK) == TEXTUREMODE_LOCAL || !voodoo->dual_tmus)
+                {
+                        /*TMU0 only sampling local colour or only one TMU, only sample TMU0*/
+                        addlong(ARM64_MOVZ_W(3, 0));
+                        addlong(ARM64_MOV_REG_W(4, REG_X));
+                        block_pos = arm64_mov_imm64(code_block, block_pos, 16, (uintptr_t)voodoo_tmu_fetch);
+                        addlong(ARM64_BLR(16));
+                }
+                else if ((params->textureMode[0] & TEXTUREMODE_MASK) == TEXTUREMODE_PASSTHROUGH)
+                {
+                        /*TMU0 in pass-through mode, only sample TMU1*/
+                        addlong(ARM64_MOVZ_W(3, 1));
+                        addlong(ARM64_MOV_REG_W(4, REG_X));
+                        block_pos = arm64_mov_imm64(code_block, block_pos, 16, (uintptr_t)voodoo_tmu_fetch);
+                        addlong(ARM64_BLR(16));
+
+                        addlong(ARM64_LDR_W(0, REG_STATE, offsetof(voodoo_state_t, tex_r[1])));
+                        addlong(ARM64_LDR_W(1, REG_STATE, offsetof(voodoo_state_t, tex_g[1])));
+                        addlong(ARM64_LDR_W(2, REG_STATE, offsetof(voodoo_state_t, tex_b[1])));
+                        addlong(ARM64_LDR_W(3, REG_STATE, offsetof(voodoo_state_t, tex_a[1])));
+                        addlong(ARM64_STR_W(0, REG_STATE, offsetof(voodoo_state_t, tex_r[0])));
+                        addlong(ARM64_STR_W(1, REG_STATE, offsetof(voodoo_state_t, tex_g[0])));
+                        addlong(ARM64_STR_W(2, REG_STATE, offsetof(voodoo_state_t, tex_b[0])));
+                        addlong(ARM64_STR_W(3, REG_STATE, offsetof(voodoo_state_t, tex_a[0])));
+                }
+                else
+                {
+                        addlong(ARM64_MOV_REG_W(3, REG_X));
+                        block_pos = arm64_mov_imm64(code_block, block_pos, 16, (uintptr_t)voodoo_tmu_fetch_and_blend);
+                        addlong(ARM64_BLR(16));
+                }
+
+                if (params->fbzMode & FBZ_CHROMAKEY)
+                {
+                        int chroma_pos, chroma_pos2;
+
+                        block_pos = arm64_load_tex_rgb(code_block, block_pos, 0, 1, 2);
+                        addlong(ARM64_LDR_W(3, REG_PARAMS, offsetof(voodoo_params_t, chromaKey_r)));
+                        addlong(ARM64_CMP_REG_W(0, 3));
+                        chroma_pos = block_pos;
+                        addlong(ARM64_BCOND(COND_NE));
+                        addlong(ARM64_LDR_W(3, REG_PARAMS, offsetof(voodoo_params_t, chromaKey_g)));
+                        addlong(ARM64_CMP_REG_W(1, 3));
+                        chroma_pos2 = block_pos;
+                        addlong(ARM64_BCOND(COND_NE));
+                        addlong(ARM64_LDR_W(3, REG_PARAMS, offsetof(voodoo_params_t, chromaKey_b)));
+                        addlong(ARM64_CMP_REG_W(2, 3));
+                        skip_pos[nr_skip++] = block_pos;
+                        addlong(ARM64_BCOND(COND_EQ));
+                        arm64_patch_branch(code_block, chroma_pos, block_pos);
+                        arm64_patch_branch(code_block, chroma_pos2, block_pos);
+                }
+        }
+
+        if (voodoo->trexInit1[0] & (1 << 18))
+        {
+                addlong(ARM64_STR_W(REG_XZR, REG_STATE, offsetof(voodoo_state_t, tex_r[0])));
+                addlong(ARM64_STR_W(REG_XZR, REG_STATE, offsetof(voodoo_state_t, tex_g[0])));
+                addlong(ARM64_LDR_W(0, REG_VOODOO, offsetof(voodoo_t, tmuConfig)));
+                addlong(ARM64_STR_W(0, REG_STATE, offsetof(voodoo_state_t, tex_b[0])));
+        }
+
+        /*Colour combine*/
+        if (cc_localselect_override || !cc_localselect)
+        {
+                block_pos = arm64_load_iter(code_block, block_pos, 8, offsetof(voodoo_state_t, ir), 12);
+                block_pos = arm64_load_iter(code_block, block_pos, 9, offsetof(voodoo_state_t, ig), 12);
+                block_pos = arm64_load_iter(code_block, block_pos, 10, offsetof(voodoo_state_t, ib), 12);
+        }
+        if (cc_localselect_override)
+        {
+                block_pos = arm64_load_rgb(code_block, block_pos, 0, 1, 2, offsetof(voodoo_params_t, color0));
+                addlong(ARM64_LDR_W(3, REG_STATE, offsetof(voodoo_state_t, tex_a[0])));
+                addlong(ARM64_TST_IMM_W(3, 25, 0)); /*TST W3, #0x80*/
+                addlong(ARM64_CSEL_W(8, 0, 8, COND_NE));
+                addlong(ARM64_CSEL_W(9, 1, 9, COND_NE));
+                addlong(ARM64_CSEL_W(10, 2, 10, COND_NE));
+        }
+        else if (cc_localselect)
+                block_pos = arm64_load_rgb(code_block, block_pos, 8, 9, 10, offsetof(voodoo_params_t, color0));
+
+        switch (cca_localselect)
+        {
+                case CCA_LOCALSELECT_ITER_A:
+                block_pos = arm64_load_iter(code_block, block_pos, 11, offsetof(voodoo_state_t, ia), 12);
+                break;
+                case CCA_LOCALSELECT_COLOR0:
+                addlong(ARM64_LDRB(11, REG_PARAMS, offsetof(voodoo_params_t, color0) + 3));
+                break;
+                case CCA_LOCALSELECT_ITER_Z:
+                block_pos = arm64_load_iter(code_block, block_pos, 11, offsetof(voodoo_state_t, z), 20);
+                break;
+                default:
+                addlong(ARM64_MOV_REG_W(11, REG_FF));
+                break;
+        }
+
+        switch (a_sel)
+        {
+                case A_SEL_ITER_A:
+                block_pos = arm64_load_iter(code_block, block_pos, 12, offsetof(voodoo_state_t, ia), 12);
+                break;
+                case A_SEL_TEX:
+                addlong(ARM64_LDR_W(12, REG_STATE, offsetof(voodoo_state_t, tex_a[0])));
+                break;
+                case A_SEL_COLOR1:
+                addlong(ARM64_LDRB(12, REG_PARAMS, offsetof(voodoo_params_t, color1) + 3));
+                break;
+                default:
+                addlong(ARM64_MOVZ_W(12, 0));
+                break;
+        }
+
+        if (cc_zero_other || _rgb_sel == CC_LOCALSELECT_LFB)
+        {
+                addlong(ARM64_MOVZ_W(4, 0));
+                addlong(ARM64_MOVZ_W(5, 0));
+                addlong(ARM64_MOVZ_W(6, 0));
+        }
+        else if (_rgb_sel == CC_LOCALSELECT_ITER_RGB)
+        {
+                block_pos = arm64_load_iter(code_block, block_pos, 4, offsetof(voodoo_state_t, ir), 12);
+                block_pos = arm64_load_iter(code_block, block_pos, 5, offsetof(voodoo_state_t, ig), 12);
+                block_pos = arm64_load_iter(code_block, block_pos, 6, offsetof(voodoo_state_t, ib), 12);
+        }
+        else if (_rgb_sel == CC_LOCALSELECT_TEX)
+        {
+                block_pos = arm64_load_tex_rgb(code_block, block_pos, 4, 5, 6);
+                if (voodoo->trexInit1[0] & (1 << 18))
+                        addlong(ARM64_AND_IMM_W(6, 6, 0, 7)); /*AND W6, W6, #0xff - tmuConfig, cother is a byte*/
+        }
+        else /*CC_LOCALSELECT_COLOR1*/
+                block_pos = arm64_load_rgb(code_block, block_pos, 4, 5, 6, offsetof(voodoo_params_t, color1));
+
+        if (cca_zero_other)
+                addlong(ARM64_MOVZ_W(7, 0));
+        else
+                addlong(ARM64_MOV_REG_W(7, 12));
+
+        if (cc_sub_clocal)
+        {
+                addlong(ARM64_SUB_REG_W(4, 4, 8));
+                addlong(ARM64_SUB_REG_W(5, 5, 9));
+                addlong(ARM64_SUB_REG_W(6, 6, 10));
+        }
+        if (cca_sub_clocal)
+                addlong(ARM64_SUB_REG_W(7, 7, 11));
+
+        switch (cc_mselect)
+        {
+                case CC_MSELECT_CLOCAL:
+                addlong(ARM64_MOV_REG_W(13, 8));
+                addlong(ARM64_MOV_REG_W(14, 9));
+                addlong(ARM64_MOV_REG_W(15, 10));
+                break;
+                case CC_MSELECT_AOTHER:
+                addlong(ARM64_MOV_REG_W(13, 12));
+                addlong(ARM64_MOV_REG_W(14, 12));
+                addlong(ARM64_MOV_REG_W(15, 12));
+                break;
+                case CC_MSELECT_ALOCAL:
+                addlong(ARM64_MOV_REG_W(13, 11));
+                addlong(ARM64_MOV_REG_W(14, 11));
+                addlong(ARM64_MOV_REG_W(15, 11));
+                break;
+                case CC_MSELECT_TEX:
+                addlong(ARM64_LDR_W(13, REG_STATE, offsetof(voodoo_state_t, tex_a[0])));
+                addlong(ARM64_MOV_REG_W(14, 13));
+                addlong(ARM64_MOV_REG_W(15, 13));
+                break;
+                case CC_MSELECT_TEXRGB:
+                block_pos = arm64_load_tex_rgb(code_block, block_pos, 13, 14, 15);
+                break;
+                default: /*CC_MSELECT_ZERO*/
+                addlong(ARM64_MOVZ_W(13, 0));
+                addlong(ARM64_MOVZ_W(14, 0));
+                addlong(ARM64_MOVZ_W(15, 0));
+                break;
+        }
+
+        switch (cca_mselect)
+        {
+                case CCA_MSELECT_ALOCAL:
+                case CCA_MSELECT_ALOCAL2:
+                addlong(ARM64_MOV_REG_W(3, 11));
+                break;
+                case CCA_MSELECT_AOTHER:
+                addlong(ARM64_MOV_REG_W(3, 12));
+                break;
+                case CCA_MSELECT_TEX:
+                addlong(ARM64_LDR_W(3, REG_STATE, offsetof(voodoo_state_t, tex_a[0])));
+                break;
+                default: /*CCA_MSELECT_ZERO*/
+                addlong(ARM64_MOVZ_W(3, 0));
+                break;
+        }
+
+        if (!cc_reverse_blend)
+        {
+                addlong(ARM64_EOR_IMM_W(13, 13, 0, 7)); /*EOR W13, W13, #0xff*/
+                addlong(ARM64_EOR_IMM_W(14, 14, 0, 7));
+                addlong(ARM64_EOR_IMM_W(15, 15, 0, 7));
+        }
+        if (!cca_reverse_blend)
+                addlong(ARM64_EOR_IMM_W(3, 3, 0, 7));
+        addlong(ARM64_ADD_IMM_W(3, 3, 1));
+        addlong(ARM64_MUL_W(7, 7, 3));
+        addlong(ARM64_ASR_IMM_W(7, 7, 8));
+        for (c = 0; c < 3; c++)
+        {
+                addlong(ARM64_ADD_IMM_W(13 + c, 13 + c, 1));
+                addlong(ARM64_MUL_W(4 + c, 4 + c, 13 + c));
+                addlong(ARM64_ASR_IMM_W(4 + c, 4 + c, 8));
+        }
+
+        if (cc_add == CC_ADD_CLOCAL)
+        {
+                addlong(ARM64_ADD_REG_W(4, 4, 8, SHIFT_LSL, 0));
+                addlong(ARM64_ADD_REG_W(5, 5, 9, SHIFT_LSL, 0));
+                addlong(ARM64_ADD_REG_W(6, 6, 10, SHIFT_LSL, 0));
+        }
+        else if (cc_add == CC_ADD_ALOCAL)
+        {
+                addlong(ARM64_ADD_REG_W(4, 4, 11, SHIFT_LSL, 0));
+                addlong(ARM64_ADD_REG_W(5, 5, 11, SHIFT_LSL, 0));
+                addlong(ARM64_ADD_REG_W(6, 6, 11, SHIFT_LSL, 0));
+        }
+        if (cca_add)
+                addlong(ARM64_ADD_REG_W(7, 7, 11, SHIFT_LSL, 0));
+
+        for (c = 4; c < 8; c++)
+                block_pos = arm64_clamp8(code_block, block_pos, c);
+
+        if (cc_invert_output)
+        {
+                addlong(ARM64_EOR_IMM_W(4, 4, 0, 7));
+                addlong(ARM64_EOR_IMM_W(5, 5, 0, 7));
+                addlong(ARM64_EOR_IMM_W(6, 6, 0, 7));
+        }
+        if (cca_invert_output)
+                addlong(ARM64_EOR_IMM_W(7, 7, 0, 7));
+
+        if (params->fogMode & FOG_ENABLE)
+        {
+                if (params->fogMode & FOG_CONSTANT)
+                {
+                        block_pos = arm64_load_rgb(code_block, block_pos, 13, 14, 15, offsetof(voodoo_params_t, fogColor));
+                        addlong(ARM64_ADD_REG_W(4, 4, 13, SHIFT_LSL, 0));
+                        addlong(ARM64_ADD_REG_W(5, 5, 14, SHIFT_LSL, 0));
+                        addlong(ARM64_ADD_REG_W(6, 6, 15, SHIFT_LSL, 0));
+                }
+                else
+                {
+                        if (!(params->fogMode & FOG_ADD))
+                                block_pos = arm64_load_rgb(code_block, block_pos, 13, 14, 15, offsetof(voodoo_params_t, fogColor));
+                        else
+                        {
+                                addlong(ARM64_MOVZ_W(13, 0));
+                                addlong(ARM64_MOVZ_W(14, 0));
+                                addlong(ARM64_MOVZ_W(15, 0));
+                        }
+
+                        if (!(params->fogMode & FOG_MULT))
+                        {
+                                addlong(ARM64_SUB_REG_W(13, 13, 4));
+                                addlong(ARM64_SUB_REG_W(14, 14, 5));
+                                addlong(ARM64_SUB_REG_W(15, 15, 6));
+                        }
+
+                        switch (params->fogMode & (FOG_Z|FOG_ALPHA))
+                        {
+                                case 0:
+                                addlong(ARM64_UBFX_W(1, REG_W_DEPTH, 10, 6)); /*fog_idx*/
+                                addlong(ARM64_ADD_REG_X(16, REG_PARAMS, 1, SHIFT_LSL, 1));
+                                addlong(ARM64_LDRB(0, 16, offsetof(voodoo_params_t, fogTable[0].fog)));
+                                addlong(ARM64_LDRB(1, 16, offsetof(voodoo_params_t, fogTable[0].dfog)));
+                                addlong(ARM64_UBFX_W(2, REG_W_DEPTH, 2, 8));
+                                addlong(ARM64_MUL_W(1, 1, 2));
+                                addlong(ARM64_ADD_REG_W(0, 0, 1, SHIFT_ASR, 10));
+                                break;
+                                case FOG_Z:
+                                addlong(ARM64_LDR_W(0, REG_STATE, offsetof(voodoo_state_t, z)));
+                                addlong(ARM64_UBFX_W(0, 0, 20, 8));
+                                break;
+                                case FOG_ALPHA:
+                                block_pos = arm64_load_iter(code_block, block_pos, 0, offsetof(voodoo_state_t, ia), 12);
+                                break;
+                                case FOG_W:
+                                addlong(ARM64_LDR_X(0, REG_STATE, offsetof(voodoo_state_t, w)));
+                                addlong(ARM64_UBFX_X(0, 0, 32, 8));
+                                break;
+                        }
+                        addlong(ARM64_ADD_IMM_W(0, 0, 1));
+
+                        for (c = 13; c < 16; c++)
+                        {
+                                addlong(ARM64_MUL_W(c, c, 0));
+                                addlong(ARM64_ASR_IMM_W(c, c, 8));
+                        }
+
+                        if (params->fogMode & FOG_MULT)
+                        {
+                                addlong(ARM64_MOV_REG_W(4, 13));
+                                addlong(ARM64_MOV_REG_W(5, 14));
+                                addlong(ARM64_MOV_REG_W(6, 15));
+                        }
+                        else
+                        {
+                                addlong(ARM64_ADD_REG_W(4, 4, 13, SHIFT_LSL, 0));
+                                addlong(ARM64_ADD_REG_W(5, 5, 14, SHIFT_LSL, 0));
+                                addlong(ARM64_ADD_REG_W(6, 6, 15, SHIFT_LSL, 0));
+                        }
+                }
+
+                for (c = 4; c < 7; c++)
+                        block_pos = arm64_clamp8(code_block, block_pos, c);
+        }
+
+        if (params->alphaMode & 1)
+        {
+                int fail_cond = -1;
+
+                switch (alpha_func)
+                {
+                        case AFUNC_NEVER:
+                        skip_pos[nr_skip++] = block_pos;
+                        addlong(ARM64_B);
+                        break;
+                        case AFUNC_LESSTHAN:
+                        fail_cond = COND_GE;
+                        break;
+                        case AFUNC_EQUAL:
+                        fail_cond = COND_NE;
+                        break;
+                        case AFUNC_LESSTHANEQUAL:
+                        fail_cond = COND_GT;
+                        break;
+                        case AFUNC_GREATERTHAN:
+                        fail_cond = COND_LE;
+                        break;
+                        case AFUNC_NOTEQUAL:
+                        fail_cond = COND_EQ;
+                        break;
+                        case AFUNC_GREATERTHANEQUAL:
+                        fail_cond = COND_LT;
+                        break;
+                }
+                if (fail_cond != -1)
+                {
+                        addlong(ARM64_CMP_IMM_W(7, a_ref));
+                        skip_pos[nr_skip++] = block_pos;
+                        addlong(ARM64_BCOND(fail_cond));
+                }
+        }
+
+        if (params->alphaMode & (1 << 4))
+        {
+                /*W13-W15 = dest RGB, W8-W10 = new dest. Destination alpha is always 0xff*/
+                addlong(ARM64_LDR_X(0, REG_STATE, offsetof(voodoo_state_t, fb_mem)));
+                addlong(ARM64_LDRH_UXTW(1, 0, fb_index));
+                addlong(ARM64_UBFX_W(13, 1, 11, 5));
+                addlong(ARM64_UBFX_W(14, 1, 5, 6));
+                addlong(ARM64_UBFX_W(15, 1, 0, 5));
+                addlong(ARM64_LSL_IMM_W(13, 13, 3));
+                addlong(ARM64_LSL_IMM_W(14, 14, 2));
+                addlong(ARM64_LSL_IMM_W(15, 15, 3));
+                addlong(ARM64_ORR_REG_W(13, 13, 13, SHIFT_LSR, 5));
+                addlong(ARM64_ORR_REG_W(14, 14, 14, SHIFT_LSR, 6));
+                addlong(ARM64_ORR_REG_W(15, 15, 15, SHIFT_LSR, 5));
+
+                switch (dest_afunc)
+                {
+                        case AFUNC_ASRC_ALPHA:
+                        for (c = 0; c < 3; c++)
+                                block_pos = arm64_mul_div255(code_block, block_pos, 8 + c, 13 + c, 7);
+                        break;
+                        case AFUNC_A_COLOR:
+                        for (c = 0; c < 3; c++)
+                                block_pos = arm64_mul_div255(code_block, block_pos, 8 + c, 13 + c, 4 + c);
+                        break;
+                        case AFUNC_ADST_ALPHA:
+                        case AFUNC_AONE:
+                        for (c = 0; c < 3; c++)
+                                addlong(ARM64_MOV_REG_W(8 + c, 13 + c));
+                        break;
+                        case AFUNC_AOMSRC_ALPHA:
+                        addlong(ARM64_SUB_REG_W(3, REG_FF, 7));
+                        for (c = 0; c < 3; c++)
+                                block_pos = arm64_mul_div255(code_block, block_pos, 8 + c, 13 + c, 3);
+                        break;
+                        case AFUNC_AOM_COLOR:
+                        for (c = 0; c < 3; c++)
+                        {
+                                addlong(ARM64_SUB_REG_W(3, REG_FF, 4 + c));
+                                block_pos = arm64_mul_div255(code_block, block_pos, 8 + c, 13 + c, 3);
+                        }
+                        break;
+                        case AFUNC_ASATURATE:
+                        addlong(ARM64_MOVN_W(3, 253)); /*MOV W3, #-254 - MIN(src_a, 1 - dest_a)*/
+                        for (c = 0; c < 3; c++)
+                        {
+                                addlong(ARM64_MUL_W(8 + c, 13 + c, 3));
+                                addlong(ARM64_SDIV_W(8 + c, 8 + c, REG_FF));
+                        }
+                        break;
+                        default: /*AFUNC_AZERO, AFUNC_AOMDST_ALPHA*/
+                        for (c = 0; c < 3; c++)
+                                addlong(ARM64_MOVZ_W(8 + c, 0));
+                        break;
+                }
+
+                switch (src_afunc)
+                {
+                        case AFUNC_AZERO:
+                        case AFUNC_AOMDST_ALPHA:
+                        for (c = 0; c < 3; c++)
+                                addlong(ARM64_MOVZ_W(4 + c, 0));
+                        break;
+                        case AFUNC_ASRC_ALPHA:
+                        for (c = 0; c < 3; c++)
+                                block_pos = arm64_mul_div255(code_block, block_pos, 4 + c, 4 + c, 7);
+                        break;
+                        case AFUNC_A_COLOR:
+                        for (c = 0; c < 3; c++)
+                                block_pos = arm64_mul_div255(code_block, block_pos, 4 + c, 4 + c, 13 + c);
+                        break;
+                        case AFUNC_AOMSRC_ALPHA:
+                        addlong(ARM64_SUB_REG_W(3, REG_FF, 7));
+                        for (c = 0; c < 3; c++)
+                                block_pos = arm64_mul_div255(code_block, block_pos, 4 + c, 4 + c, 3);
+                        break;
+                        case AFUNC_AOM_COLOR:
+                        for (c = 0; c < 3; c++)
+                        {
+                                addlong(ARM64_SUB_REG_W(3, REG_FF, 13 + c));
+                                block_pos = arm64_mul_div255(code_block, block_pos, 4 + c, 4 + c, 3);
+                        }
+                        break;
+                        default: /*AFUNC_ADST_ALPHA, AFUNC_AONE*/
+                        break;
+                }
+
+                for (c = 0; c < 3; c++)
+                {
+                        addlong(ARM64_ADD_REG_W(4 + c, 4 + c, 8 + c, SHIFT_LSL, 0));
+                        block_pos = arm64_clamp8(code_block, block_pos, 4 + c);
+                }
+        }
+
+        if (params->fbzMode & FBZ_RGB_WMASK)
+        {
+                if (dither)
+                {
+                        const uint8_t *dither_table_rb = dither2x2 ? &dither_rb2x2[0][0][0] : &dither_rb[0][0][0];
+                        const uint8_t *dither_table_g = dither2x2 ? &dither_g2x2[0][0][0] : &dither_g[0][0][0];
+                        int shift = dither2x2 ? 2 : 4;
+
+                        /*W1 = dither table offset within entry*/
+                        if (dither2x2)
+                        {
+                                addlong(ARM64_AND_IMM_W(1, REG_REAL_Y, 0, 0)); /*AND W1, W21, #1*/
+                                addlong(ARM64_AND_IMM_W(2, REG_X, 0, 0));
+                                addlong(ARM64_ADD_REG_W(1, 2, 1, SHIFT_LSL, 1));
+                        }
+                        else
+                        {
+                                addlong(ARM64_AND_IMM_W(1, REG_REAL_Y, 0, 1)); /*AND W1, W21, #3*/
+                                addlong(ARM64_AND_IMM_W(2, REG_X, 0, 1));
+                                addlong(ARM64_ADD_REG_W(1, 2, 1, SHIFT_LSL, 2));
+                        }
+                        block_pos = arm64_mov_imm64(code_block, block_pos, 16, (uintptr_t)dither_table_rb);
+                        addlong(ARM64_ADD_REG_X(0, 16, 4, SHIFT_LSL, shift));
+                        addlong(ARM64_LDRB_REG(4, 0, 1));
+                        addlong(ARM64_ADD_REG_X(0, 16, 6, SHIFT_LSL, shift));
+                        addlong(ARM64_LDRB_REG(6, 0, 1));
+                        block_pos = arm64_mov_imm64(code_block, block_pos, 16, (uintptr_t)dither_table_g);
+                        addlong(ARM64_ADD_REG_X(0, 16, 5, SHIFT_LSL, shift));
+                        addlong(ARM64_LDRB_REG(5, 0, 1));
+                }
+                else
+                {
+                        addlong(ARM64_LSR_IMM_W(4, 4, 3));
+                        addlong(ARM64_LSR_IMM_W(5, 5, 2));
+                        addlong(ARM64_LSR_IMM_W(6, 6, 3));
+                }
+
+                addlong(ARM64_ORR_REG_W(0, 6, 5, SHIFT_LSL, 5));
+                addlong(ARM64_ORR_REG_W(0, 0, 4, SHIFT_LSL, 11));
+                addlong(ARM64_LDR_X(1, REG_STATE, offsetof(voodoo_state_t, fb_mem)));
+                addlong(ARM64_STRH_UXTW(0, 1, fb_index));
+        }
+
+        if ((params->fbzMode & (FBZ_DEPTH_WMASK | FBZ_DEPTH_ENABLE)) == (FBZ_DEPTH_WMASK | FBZ_DEPTH_ENABLE))
+        {
+                addlong(ARM64_LDR_X(1, REG_STATE, offsetof(voodoo_state_t, aux_mem)));
+                addlong(ARM64_STRH_UXTW(REG_DEPTH, 1, aux_index));
+        }
+
+        for (c = 0; c < nr_skip; c++)
+                arm64_patch_branch(code_block, skip_pos[c], block_pos);
+
+        block_pos = arm64_step_32(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, ib), offsetof(voodoo_params_t, dBdX));
+        block_pos = arm64_step_32(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, ig), offsetof(voodoo_params_t, dGdX));
+        block_pos = arm64_step_32(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, ir), offsetof(voodoo_params_t, dRdX));
+        block_pos = arm64_step_32(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, ia), offsetof(voodoo_params_t, dAdX));
+        block_pos = arm64_step_32(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, z), offsetof(voodoo_params_t, dZdX));
+        block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, tmu0_s), offsetof(voodoo_params_t, tmu[0].dSdX));
+        block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, tmu0_t), offsetof(voodoo_params_t, tmu[0].dTdX));
+        block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, tmu0_w), offsetof(voodoo_params_t, tmu[0].dWdX));
+        if (voodoo->dual_tmus)
+        {
+                block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, tmu1_s), offsetof(voodoo_params_t, tmu[1].dSdX));
+                block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, tmu1_t), offsetof(voodoo_params_t, tmu[1].dTdX));
+                block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, tmu1_w), offsetof(voodoo_params_t, tmu[1].dWdX));
+        }
+        block_pos = arm64_step_64(code_block, block_pos, state->xdir, offsetof(voodoo_state_t, w), offsetof(voodoo_params_t, dWdX));
+
+        addlong(ARM64_LDR_W(0, REG_STATE, offsetof(voodoo_state_t, pixel_count)));
+        addlong(ARM64_ADD_IMM_W(0, 0, 1));
+        addlong(ARM64_STR_W(0, REG_STATE, offsetof(voodoo_state_t, pixel_count)));
+
+        if (params->fbzColorPath & FBZCP_TEXTURE_ENABLED)
+        {
+                addlong(ARM64_LDR_W(0, REG_STATE, offsetof(voodoo_state_t, texel_count)));
+                if ((params->textureMode[0] & TEXTUREMODE_MASK) == TEXTUREMODE_PASSTHROUGH ||
+                    (params->textureMode[0] & TEXTUREMODE_LOCAL_MASK) == TEXTUREMODE_LOCAL)
+                        addlong(ARM64_ADD_IMM_W(0, 0, 1));
+                else
+                        addlong(ARM64_ADD_IMM_W(0, 0, 2));
+                addlong(ARM64_STR_W(0, REG_STATE, offsetof(voodoo_state_t, texel_count)));
+        }
+
+        addlong(ARM64_MOV_REG_W(0, REG_X));
+        if (state->xdir > 0)
+                addlong(ARM64_ADD_IMM_W(REG_X, REG_X, 1));
+        else
+                addlong(ARM64_SUB_IMM_W(REG_X, REG_X, 1));
+        addlong(ARM64_STR_W(REG_X, REG_STATE, offsetof(voodoo_state_t, x)));
+        addlong(ARM64_LDR_W(1, REG_STATE, offsetof(voodoo_state_t, x2)));
+        addlong(ARM64_CMP_REG_W(0, 1));
+        c = block_pos;
+        addlong(ARM64_BCOND(COND_NE));
+        arm64_patch_branch(code_block, c, loop_jump_pos);
+
+        addlong(ARM64_LDP_X(27, 28, REG_SP, 80));
+        addlong(ARM64_LDP_X(25, 26, REG_SP, 64));
+        addlong(ARM64_LDP_X(23, 24, REG_SP, 48));
+        addlong(ARM64_LDP_X(21, 22, REG_SP, 32));
+        addlong(ARM64_LDP_X(19, 20, REG_SP, 16));
+        addlong(ARM64_LDP_POSTIDX_X(29, 30, REG_SP, 96));
+        addlong(ARM64_RET);
+}
+int voodoo_recomp = 0;
+static inline void *voodoo_get_block(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int odd_even)
+{
+        int c;
+        int b = last_block[odd_even];
+        voodoo_arm64_data_t *voodoo_arm64_data = voodoo->codegen_data;
+        voodoo_arm64_data_t *data;
+
+        for (c = 0; c < 8; c++)
+        {
+                data = &voodoo_arm64_data[odd_even + b*RENDER_THREADS_MAX];
+
+                if (state->xdir == data->xdir &&
+                    params->alphaMode == data->alphaMode &&
+                    params->fbzMode == data->fbzMode &&
+                    params->fogMode == data->fogMode &&
+                    params->fbzColorPath == data->fbzColorPath &&
+                    (voodoo->trexInit1[0] & (1 << 18)) == data->trexInit1 &&
+                    params->textureMode[0] == data->textureMode[0] &&
+                    params->textureMode[1] == data->textureMode[1] &&
+                    (params->tLOD[0] & LOD_MASK) == data->tLOD[0] &&
+                    (params->tLOD[1] & LOD_MASK) == data->tLOD[1] &&
+                    (params->col_tiled | (params->aux_tiled << 1)) == data->is_tiled)
+                {
+                        last_block[odd_even] = b;
+                        return data->code_block;
+                }
+
+                b = (b + 1) & 7;
+        }
+        voodoo_recomp++;
+        data = &voodoo_arm64_data[odd_even + next_block_to_write[odd_even]*RENDER_THREADS_MAX];
+
+#if defined(__APPLE__)
+        pthread_jit_write_protect_np(0);
+#endif
+        voodoo_generate(data->code_block, voodoo, params, state, depth_op);
+#if defined(__APPLE__)
+        pthread_jit_write_protect_np(1);
+#endif
+#if defined(_WIN32)
+        FlushInstructionCache(GetCurrentProcess(), data->code_block, BLOCK_SIZE);
+#else
+        __builtin___clear_cache((char *)data->code_block, (char *)&data->code_block[BLOCK_SIZE]);
+#endif
+
+        data->xdir = state->xdir;
+        data->alphaMode = params->alphaMode;
+        data->fbzMode = params->fbzMode;
+        data->fogMode = params->fogMode;
+        data->fbzColorPath = params->fbzColorPath;
+        data->trexInit1 = voodoo->trexInit1[0] & (1 << 18);
+        data->textureMode[0] = params->textureMode[0];
+        data->textureMode[1] = params->textureMode[1];
+        data->tLOD[0] = params->tLOD[0] & LOD_MASK;
+        data->tLOD[1] = params->tLOD[1] & LOD_MASK;
+        data->is_tiled = params->col_tiled | (params->aux_tiled << 1);
+
+        next_block_to_write[odd_even] = (next_block_to_write[odd_even] + 1) & 7;
+
+        return data->code_block;
+}
+
+void voodoo_codegen_init(voodoo_t *voodoo)
+{
+#if defined(_WIN32)
+        voodoo->codegen_data = VirtualAlloc(NULL, sizeof(voodoo_arm64_data_t) * BLOCK_NUM * RENDER_THREADS_MAX, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#elif defined(__APPLE__)
+        /*Blocks are written with pthread_jit_write_protect_np() turned off*/
+        voodoo->codegen_data = mmap(0, sizeof(voodoo_arm64_data_t) * BLOCK_NUM*RENDER_THREADS_MAX, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_ANON|MAP_PRIVATE|MAP_JIT, -1, 0);
+#else
+        voodoo->codegen_data = mmap(0, sizeof(voodoo_arm64_data_t) * BLOCK_NUM*RENDER_THREADS_MAX, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_ANON|MAP_PRIVATE, -1, 0);
+#endif
+}
+
+void voodoo_codegen_close(voodoo_t *voodoo)
+{
+#if defined(_WIN32)
+        VirtualFree(voodoo->codegen_data, 0, MEM_RELEASE);
+#else
+        munmap(voodoo->codegen_data, sizeof(voodoo_arm64_data_t) * BLOCK_NUM*RENDER_THREADS_MAX);
+#endif
+}
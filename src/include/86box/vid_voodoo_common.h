@@ -28,7 +28,14 @@
 
 #define TEX_DIRTY_SHIFT 10
 
-#define TEX_CACHE_MAX 64
+#define TEX_CACHE_MAX 256
+#define TEX_CACHE_DEFAULT 64
+#define TEX_HASH_SIZE 1024
+
+/*Texture memory is split into 64kB regions for the cache's address range
+  index, giving 256 regions for the largest (16MB) texture memory*/
+#define TEX_RANGE_SHIFT 16
+#define TEX_RANGE_NR 256
 
 enum
 {
@@ -93,6 +100,8 @@ enum
 #define PARAM_FULL(x)    ((voodoo->params_write_idx - voodoo->params_read_idx[x]) >= PARAM_SIZE)
 #define PARAM_EMPTY(x)   (voodoo->params_read_idx[x] == voodoo->params_write_idx)
 
+#define RENDER_THREADS_MAX 16
+
 typedef struct
 {
         uint32_t addr_type;
@@ -182,6 +191,7 @@ typedef struct texture_t
         int is16;
         uint32_t palette_checksum;
         uint32_t addr_start[4], addr_end[4];
+        int hash_next;
         uint32_t *data;
 } texture_t;
 
@@ -285,9 +295,11 @@ typedef struct voodoo_t
 
         int render_threads;
         int odd_even_mask;
+        int render_tiled;
+        struct voodoo_tiles_t *tiles;
 
-        int pixel_count[4], texel_count[4], tri_count, frame_count;
-        int pixel_count_old[4], texel_count_old[4];
+        int pixel_count[RENDER_THREADS_MAX], texel_count[RENDER_THREADS_MAX], tri_count, frame_count;
+        int pixel_count_old[RENDER_THREADS_MAX], texel_count_old[RENDER_THREADS_MAX];
         int wr_count, rd_count, tex_count;
 
         int retrace_count;
@@ -479,15 +491,21 @@ typedef struct voodoo_t
         uint8_t thefilterb[256][256];
         uint16_t purpleline[256][3];
 
-        texture_t texture_cache[2][TEX_CACHE_MAX];
-        uint8_t texture_present[2][16384];
+        texture_t *texture_cache[2];
+        int texture_cache_size;
+        int texture_hash[2][TEX_HASH_SIZE];
+        uint64_t texture_range[2][TEX_RANGE_NR][TEX_CACHE_MAX / 64];
+        uint16_t texture_present[2][16384];
         int texture_last_removed;
 
+        uint32_t tex_cache_hits[2], tex_cache_misses[2], tex_cache_flushes[2];
+        uint64_t tex_decode_time[2];
+
         uint32_t palette_checksum[2];
         int palette_dirty[2];
 
         uint64_t time;
-        int render_time[4];
+        int render_time[RENDER_THREADS_MAX];
 
         int use_recompiler;
         void *codegen_data;
@@ -1,4 +1,4 @@
-#if !(defined i386 || defined __i386 || defined __i386__ || defined _X86_ || defined WIN32 || defined _WIN32 || defined _WIN32) && !(defined __amd64__)
+#if !(defined i386 || defined __i386 || defined __i386__ || defined _X86_ || defined WIN32 || defined _WIN32 || defined _WIN32) && !(defined __amd64__) && !(defined __aarch64__)
 #define NO_CODEGEN
 #endif
 
@@ -16,42 +16,42 @@ void voodoo_codegen_close(voodoo_t *voodoo);
                         voodoo->fbiZFuncFail++;         \
                         goto skip_pixel;                \
                         case DEPTHOP_LESSTHAN:          \
-                        if (!(comp_depth < old_depth))  \
+                        if (!((comp_depth) < old_depth)) \
                         {                               \
                                 voodoo->fbiZFuncFail++; \
                                 goto skip_pixel;        \
                         }                               \
                         break;                          \
                         case DEPTHOP_EQUAL:             \
-                        if (!(comp_depth == old_depth)) \
+                        if (!((comp_depth) == old_depth)) \
                         {                               \
                                 voodoo->fbiZFuncFail++; \
                                 goto skip_pixel;        \
                         }                               \
                         break;                          \
                         case DEPTHOP_LESSTHANEQUAL:     \
-                        if (!(comp_depth <= old_depth)) \
+                        if (!((comp_depth) <= old_depth)) \
                         {                               \
                                 voodoo->fbiZFuncFail++; \
                                 goto skip_pixel;        \
                         }                               \
                         break;                          \
                         case DEPTHOP_GREATERTHAN:       \
-                        if (!(comp_depth > old_depth))  \
+                        if (!((comp_depth) > old_depth)) \
                         {                               \
                                 voodoo->fbiZFuncFail++; \
                                 goto skip_pixel;        \
                         }                               \
                         break;                          \
                         case DEPTHOP_NOTEQUAL:          \
-                        if (!(comp_depth != old_depth)) \
+                        if (!((comp_depth) != old_depth)) \
                         {                               \
                                 voodoo->fbiZFuncFail++; \
                                 goto skip_pixel;        \
                         }                               \
                         break;                          \
                         case DEPTHOP_GREATERTHANEQUAL:  \
-                        if (!(comp_depth >= old_depth)) \
+                        if (!((comp_depth) >= old_depth)) \
                         {                               \
                                 voodoo->fbiZFuncFail++; \
                                 goto skip_pixel;        \
@@ -303,11 +303,21 @@ void voodoo_render_thread_3(void *param);
 void voodoo_render_thread_4(void *param);
 void voodoo_queue_triangle(voodoo_t *voodoo, voodoo_params_t *params);
 
+void voodoo_tile_init(voodoo_t *voodoo);
+void voodoo_tile_close(voodoo_t *voodoo);
+void voodoo_tile_flush(voodoo_t *voodoo);
+
 extern int voodoo_recomp;
 extern int tris;
 
 static __inline void voodoo_wake_render_thread(voodoo_t *voodoo)
 {
+        if (voodoo->render_tiled)
+        {
+                voodoo_tile_flush(voodoo); /*Hand queued tiles to the workers*/
+                return;
+        }
+
         thread_set_event(voodoo->wake_render_thread[0]); /*Wake up render thread if moving from idle*/
         if (voodoo->render_threads >= 2)
                 thread_set_event(voodoo->wake_render_thread[1]); /*Wake up render thread if moving from idle*/
@@ -320,6 +330,17 @@ static __inline void voodoo_wake_render_thread(voodoo_t *voodoo)
 
 static __inline void voodoo_wait_for_render_thread_idle(voodoo_t *voodoo)
 {
+        if (voodoo->render_tiled)
+        {
+                voodoo_tile_flush(voodoo);
+                while (!PARAM_EMPTY(0))
+                {
+                        thread_wait_event(voodoo->render_not_full_event[0], 1);
+                        voodoo_tile_flush(voodoo);
+                }
+                return;
+        }
+
         while (!PARAM_EMPTY(0) || (voodoo->render_threads >= 2 && !PARAM_EMPTY(1)) ||
                 (voodoo->render_threads == 4 && (!PARAM_EMPTY(2) || !PARAM_EMPTY(3))) ||
                 voodoo->render_voodoo_busy[0] || (voodoo->render_threads >= 2 && voodoo->render_voodoo_busy[1]) ||
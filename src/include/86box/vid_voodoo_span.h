@@ -0,0 +1,1019 @@
+/*Span renderer for when the recompiler isn't used.
+
+  Pixels are processed SPAN_LANES at a time. A first pass over the pixels
+  steps the iterators and gathers what needs a per-pixel memory access or a
+  table : the new and old depth, the destination pixel, the fog table entry and
+  the dither matrix entry. The depth test then runs on all lanes at once. The
+  pixels that pass have their texture coordinates and LOD worked out and their
+  2x2 texels gathered one at a time, and the bilinear filter, chroma key,
+  colour and alpha combine, fog, alpha test, alpha blend, dither and 565
+  packing run on all lanes at once on 16-bit vectors. Only the stores to the
+  frame and depth buffers are done per pixel again.
+
+  All vector arithmetic gives the same results as the scalar path :
+  - (a * b) >> 8 for a signed 9 bit a is done as the high half of
+    (a << 7) * (b << 1)
+  - x / 255 for 0 <= x <= 255*255 is done as (x + 1 + (x >> 8)) >> 8
+  - the bilinear sum of four texels times weights adding up to 256 is at most
+    0xff00, so it is done modulo 0x10000
+  - the dither tables are ((c << 1) - (c >> 4) + (c >> 7) + m) >> 4 for red and
+    blue and ((c << 2) - (c >> 4) + (c >> 6) + m) >> 4 for green, m being the
+    entry in the dither matrix
+  - depth values are compared as signed after flipping the top bit
+
+  Textures blended from both TMUs are filtered per pixel, by the scalar code,
+  and put in the lanes as they are. Modes the scalar path treats as fatal, the
+  saturate alpha blend functions and the tmuConfig passthrough are left to the
+  scalar path.*/
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define SPAN_LANES 16
+
+typedef __m256i span_vec_t;
+
+#define SPAN_SET1(x)      _mm256_set1_epi16(x)
+#define SPAN_LOAD(p)      _mm256_loadu_si256((const __m256i *)(p))
+#define SPAN_STORE(p, a)  _mm256_storeu_si256((__m256i *)(p), a)
+#define SPAN_ADD(a, b)    _mm256_add_epi16(a, b)
+#define SPAN_SUB(a, b)    _mm256_sub_epi16(a, b)
+#define SPAN_MULLO(a, b)  _mm256_mullo_epi16(a, b)
+#define SPAN_MULHI(a, b)  _mm256_mulhi_epi16(a, b)
+#define SPAN_MIN(a, b)    _mm256_min_epi16(a, b)
+#define SPAN_MAX(a, b)    _mm256_max_epi16(a, b)
+#define SPAN_AND(a, b)    _mm256_and_si256(a, b)
+#define SPAN_OR(a, b)     _mm256_or_si256(a, b)
+#define SPAN_XOR(a, b)    _mm256_xor_si256(a, b)
+#define SPAN_ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define SPAN_CMPEQ(a, b)  _mm256_cmpeq_epi16(a, b)
+#define SPAN_CMPGT(a, b)  _mm256_cmpgt_epi16(a, b)
+#define SPAN_SRLI(a, n)   _mm256_srli_epi16(a, n)
+#define SPAN_SLLI(a, n)   _mm256_slli_epi16(a, n)
+
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+
+#define SPAN_LANES 8
+
+typedef __m128i span_vec_t;
+
+#define SPAN_SET1(x)      _mm_set1_epi16(x)
+#define SPAN_LOAD(p)      _mm_loadu_si128((const __m128i *)(p))
+#define SPAN_STORE(p, a)  _mm_storeu_si128((__m128i *)(p), a)
+#define SPAN_ADD(a, b)    _mm_add_epi16(a, b)
+#define SPAN_SUB(a, b)    _mm_sub_epi16(a, b)
+#define SPAN_MULLO(a, b)  _mm_mullo_epi16(a, b)
+#define SPAN_MULHI(a, b)  _mm_mulhi_epi16(a, b)
+#define SPAN_MIN(a, b)    _mm_min_epi16(a, b)
+#define SPAN_MAX(a, b)    _mm_max_epi16(a, b)
+#define SPAN_AND(a, b)    _mm_and_si128(a, b)
+#define SPAN_OR(a, b)     _mm_or_si128(a, b)
+#define SPAN_XOR(a, b)    _mm_xor_si128(a, b)
+#define SPAN_ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define SPAN_CMPEQ(a, b)  _mm_cmpeq_epi16(a, b)
+#define SPAN_CMPGT(a, b)  _mm_cmpgt_epi16(a, b)
+#define SPAN_SRLI(a, n)   _mm_srli_epi16(a, n)
+#define SPAN_SLLI(a, n)   _mm_slli_epi16(a, n)
+
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#define SPAN_LANES 8
+
+typedef int16x8_t span_vec_t;
+
+static inline int16x8_t span_mulhi(int16x8_t a, int16x8_t b)
+{
+        int32x4_t lo = vmull_s16(vget_low_s16(a), vget_low_s16(b));
+        int32x4_t hi = vmull_s16(vget_high_s16(a), vget_high_s16(b));
+
+        return vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16));
+}
+
+#define SPAN_SET1(x)      vdupq_n_s16(x)
+#define SPAN_LOAD(p)      vld1q_s16(p)
+#define SPAN_STORE(p, a)  vst1q_s16(p, a)
+#define SPAN_ADD(a, b)    vaddq_s16(a, b)
+#define SPAN_SUB(a, b)    vsubq_s16(a, b)
+#define SPAN_MULLO(a, b)  vmulq_s16(a, b)
+#define SPAN_MULHI(a, b)  span_mulhi(a, b)
+#define SPAN_MIN(a, b)    vminq_s16(a, b)
+#define SPAN_MAX(a, b)    vmaxq_s16(a, b)
+#define SPAN_AND(a, b)    vandq_s16(a, b)
+#define SPAN_OR(a, b)     vorrq_s16(a, b)
+#define SPAN_XOR(a, b)    veorq_s16(a, b)
+#define SPAN_ANDNOT(a, b) vbicq_s16(b, a)
+#define SPAN_CMPEQ(a, b)  vreinterpretq_s16_u16(vceqq_s16(a, b))
+#define SPAN_CMPGT(a, b)  vreinterpretq_s16_u16(vcgtq_s16(a, b))
+#define SPAN_SRLI(a, n)   vreinterpretq_s16_u16(vshrq_n_u16(vreinterpretq_u16_s16(a), n))
+#define SPAN_SLLI(a, n)   vshlq_n_s16(a, n)
+
+#else
+/*Plain C, for hosts with neither. Compilers will often vectorise this anyway*/
+#define SPAN_LANES 8
+
+typedef struct span_vec_t
+{
+        int16_t v[SPAN_LANES];
+} span_vec_t;
+
+#define SPAN_OP(name, expr)                                             \
+static inline span_vec_t name(span_vec_t a, span_vec_t b)              \
+{                                                                       \
+        span_vec_t r;                                                   \
+        int c;                                                          \
+        for (c = 0; c < SPAN_LANES; c++)                                \
+                r.v[c] = (int16_t)(expr);                               \
+        return r;                                                       \
+}
+
+SPAN_OP(span_add,    a.v[c] + b.v[c])
+SPAN_OP(span_sub,    a.v[c] - b.v[c])
+SPAN_OP(span_mullo,  a.v[c] * b.v[c])
+SPAN_OP(span_mulhi,  ((int32_t)a.v[c] * b.v[c]) >> 16)
+SPAN_OP(span_min,    MIN(a.v[c], b.v[c]))
+SPAN_OP(span_max,    MAX(a.v[c], b.v[c]))
+SPAN_OP(span_and,    a.v[c] & b.v[c])
+SPAN_OP(span_or,     a.v[c] | b.v[c])
+SPAN_OP(span_xor,    a.v[c] ^ b.v[c])
+SPAN_OP(span_andnot, ~a.v[c] & b.v[c])
+SPAN_OP(span_cmpeq,  (a.v[c] == b.v[c]) ? -1 : 0)
+SPAN_OP(span_cmpgt,  (a.v[c] > b.v[c]) ? -1 : 0)
+
+static inline span_vec_t span_set1(int x)
+{
+        span_vec_t r;
+        int c;
+
+        for (c = 0; c < SPAN_LANES; c++)
+                r.v[c] = x;
+        return r;
+}
+static inline span_vec_t span_load(const int16_t *p)
+{
+        span_vec_t r;
+
+        memcpy(r.v, p, sizeof(r.v));
+        return r;
+}
+static inline span_vec_t span_srli(span_vec_t a, int n)
+{
+        int c;
+
+        for (c = 0; c < SPAN_LANES; c++)
+                a.v[c] = (int16_t)((uint16_t)a.v[c] >> n);
+        return a;
+}
+static inline span_vec_t span_slli(span_vec_t a, int n)
+{
+        int c;
+
+        for (c = 0; c < SPAN_LANES; c++)
+                a.v[c] = (int16_t)((uint16_t)a.v[c] << n);
+        return a;
+}
+
+#define SPAN_SET1(x)      span_set1(x)
+#define SPAN_LOAD(p)      span_load(p)
+#define SPAN_STORE(p, a)  memcpy(p, (a).v, sizeof((a).v))
+#define SPAN_ADD(a, b)    span_add(a, b)
+#define SPAN_SUB(a, b)    span_sub(a, b)
+#define SPAN_MULLO(a, b)  span_mullo(a, b)
+#define SPAN_MULHI(a, b)  span_mulhi(a, b)
+#define SPAN_MIN(a, b)    span_min(a, b)
+#define SPAN_MAX(a, b)    span_max(a, b)
+#define SPAN_AND(a, b)    span_and(a, b)
+#define SPAN_OR(a, b)     span_or(a, b)
+#define SPAN_XOR(a, b)    span_xor(a, b)
+#define SPAN_ANDNOT(a, b) span_andnot(a, b)
+#define SPAN_CMPEQ(a, b)  span_cmpeq(a, b)
+#define SPAN_CMPGT(a, b)  span_cmpgt(a, b)
+#define SPAN_SRLI(a, n)   span_srli(a, n)
+#define SPAN_SLLI(a, n)   span_slli(a, n)
+#endif
+
+typedef struct voodoo_span_t
+{
+        int16_t iter_r[SPAN_LANES], iter_g[SPAN_LANES], iter_b[SPAN_LANES], iter_a[SPAN_LANES];
+        int16_t iter_z[SPAN_LANES];
+        int16_t tex_r[SPAN_LANES], tex_g[SPAN_LANES], tex_b[SPAN_LANES], tex_a[SPAN_LANES];
+        int16_t dest[SPAN_LANES];
+        int16_t fog_a[SPAN_LANES];
+        int16_t dither_m[SPAN_LANES];
+
+        /*2x2 texels and their bilinear weights. Point sampled and TMU
+          blended textures have all the weight on the first one*/
+        int16_t texel_r[4][SPAN_LANES], texel_g[4][SPAN_LANES], texel_b[4][SPAN_LANES], texel_a[4][SPAN_LANES];
+        int16_t texel_d[4][SPAN_LANES];
+
+        int16_t src_r[SPAN_LANES], src_g[SPAN_LANES], src_b[SPAN_LANES], src_a[SPAN_LANES];
+        int16_t pixel[SPAN_LANES];
+
+        int16_t live[SPAN_LANES]; /*-1 if the pixel is still to be written*/
+        int16_t new_depth[SPAN_LANES], old_depth[SPAN_LANES];
+        int x[SPAN_LANES];
+        int64_t tmu0_s[SPAN_LANES], tmu0_t[SPAN_LANES], tmu0_w[SPAN_LANES];
+        int64_t tmu1_s[SPAN_LANES], tmu1_t[SPAN_LANES], tmu1_w[SPAN_LANES];
+} voodoo_span_t;
+
+static inline span_vec_t span_select(span_vec_t mask, span_vec_t a, span_vec_t b)
+{
+        return SPAN_OR(SPAN_AND(mask, a), SPAN_ANDNOT(mask, b));
+}
+
+static inline span_vec_t span_clamp(span_vec_t a)
+{
+        return SPAN_MIN(SPAN_MAX(a, SPAN_SET1(0)), SPAN_SET1(0xff));
+}
+
+/*(a * b) >> 8, for -255 <= a <= 255 and 0 <= b < 16384*/
+static inline span_vec_t span_mul8(span_vec_t a, span_vec_t b)
+{
+        return SPAN_MULHI(SPAN_SLLI(a, 7), SPAN_SLLI(b, 1));
+}
+
+/*(a * b) / 255, for 0 <= a, b <= 255*/
+static inline span_vec_t span_mul_div255(span_vec_t a, span_vec_t b)
+{
+        span_vec_t x = SPAN_MULLO(a, b);
+
+        return SPAN_SRLI(SPAN_ADD(SPAN_ADD(x, SPAN_SET1(1)), SPAN_SRLI(x, 8)), 8);
+}
+
+/*Number of lanes set in a mask*/
+static inline int span_count(span_vec_t mask)
+{
+        int16_t lanes[SPAN_LANES];
+        int c, n = 0;
+
+        SPAN_STORE(lanes, mask);
+        for (c = 0; c < SPAN_LANES; c++)
+        {
+                if (lanes[c])
+                        n++;
+        }
+        return n;
+}
+
+/*(t0 * d0 + t1 * d1 + t2 * d2 + t3 * d3) >> 8, for texels t and weights d
+  adding up to 256*/
+static inline span_vec_t span_bilinear(int16_t texel[4][SPAN_LANES], int16_t d[4][SPAN_LANES])
+{
+        span_vec_t sum = SPAN_MULLO(SPAN_LOAD(texel[0]), SPAN_LOAD(d[0]));
+
+        sum = SPAN_ADD(sum, SPAN_MULLO(SPAN_LOAD(texel[1]), SPAN_LOAD(d[1])));
+        sum = SPAN_ADD(sum, SPAN_MULLO(SPAN_LOAD(texel[2]), SPAN_LOAD(d[2])));
+        sum = SPAN_ADD(sum, SPAN_MULLO(SPAN_LOAD(texel[3]), SPAN_LOAD(d[3])));
+
+        return SPAN_SRLI(sum, 8);
+}
+
+/*The dither tables in vid_voodoo_dither.h hold these, m being the entry in
+  the dither matrix. The shifts are immediates for NEON, hence two functions*/
+static inline span_vec_t span_dither_rb(span_vec_t c, span_vec_t m)
+{
+        span_vec_t x = SPAN_SUB(SPAN_SLLI(c, 1), SPAN_SRLI(c, 4));
+
+        return SPAN_SRLI(SPAN_ADD(SPAN_ADD(x, SPAN_SRLI(c, 7)), m), 4);
+}
+static inline span_vec_t span_dither_g(span_vec_t c, span_vec_t m)
+{
+        span_vec_t x = SPAN_SUB(SPAN_SLLI(c, 2), SPAN_SRLI(c, 4));
+
+        return SPAN_SRLI(SPAN_ADD(SPAN_ADD(x, SPAN_SRLI(c, 6)), m), 4);
+}
+
+/*Dither matrices the tables in vid_voodoo_dither.h are built from*/
+static const int16_t span_dither_4x4[4][4] =
+{
+        { 0,  8,  2, 10},
+        {12,  4, 14,  6},
+        { 3, 11,  1,  9},
+        {15,  7, 13,  5}
+};
+static const int16_t span_dither_2x2[2][2] =
+{
+        { 2, 10},
+        {14,  6}
+};
+
+static inline int voodoo_span_supported(voodoo_t *voodoo, voodoo_params_t *params)
+{
+        /*tmuConfig replaces the texel blue with a full word, which is wider
+          than a lane*/
+        if (voodoo->trexInit1[0] & (1 << 18))
+                return 0;
+        if (a_sel == A_SEL_LFB || cca_localselect > CCA_LOCALSELECT_ITER_Z ||
+            cc_mselect > CC_MSELECT_TEXRGB || cca_mselect > CCA_MSELECT_TEX || cc_add > CC_ADD_ALOCAL)
+                return 0;
+        if ((params->alphaMode & (1 << 4)) && (dest_afunc == AFUNC_ASATURATE || src_afunc == AFUNC_ACOLORBEFOREFOG))
+                return 0;
+        return 1;
+}
+
+/*Colour combine, fog, alpha test and alpha blend on all lanes*/
+static void voodoo_span_shade(voodoo_t *voodoo, voodoo_params_t *params, voodoo_span_t *span)
+{
+        span_vec_t zero = SPAN_SET1(0);
+        span_vec_t ff = SPAN_SET1(0xff);
+        span_vec_t iter_r = SPAN_LOAD(span->iter_r);
+        span_vec_t iter_g = SPAN_LOAD(span->iter_g);
+        span_vec_t iter_b = SPAN_LOAD(span->iter_b);
+        span_vec_t iter_a = SPAN_LOAD(span->iter_a);
+        span_vec_t tex_r = SPAN_LOAD(span->tex_r);
+        span_vec_t tex_g = SPAN_LOAD(span->tex_g);
+        span_vec_t tex_b = SPAN_LOAD(span->tex_b);
+        span_vec_t tex_a = SPAN_LOAD(span->tex_a);
+        span_vec_t live = SPAN_LOAD(span->live);
+        span_vec_t clocal_r, clocal_g, clocal_b, alocal;
+        span_vec_t cother_r, cother_g, cother_b, aother;
+        span_vec_t src_r, src_g, src_b, src_a;
+        span_vec_t msel_r, msel_g, msel_b, msel_a;
+
+        if (cc_localselect_override || cc_localselect)
+        {
+                span_vec_t color0_r = SPAN_SET1((params->color0 >> 16) & 0xff);
+                span_vec_t color0_g = SPAN_SET1((params->color0 >> 8) & 0xff);
+                span_vec_t color0_b = SPAN_SET1(params->color0 & 0xff);
+
+                if (cc_localselect_override)
+                {
+                        span_vec_t sel = SPAN_CMPEQ(SPAN_AND(tex_a, SPAN_SET1(0x80)), SPAN_SET1(0x80));
+
+                        clocal_r = span_select(sel, color0_r, iter_r);
+                        clocal_g = span_select(sel, color0_g, iter_g);
+                        clocal_b = span_select(sel, color0_b, iter_b);
+                }
+                else
+                {
+                        clocal_r = color0_r;
+                        clocal_g = color0_g;
+                        clocal_b = color0_b;
+                }
+        }
+        else
+        {
+                clocal_r = iter_r;
+                clocal_g = iter_g;
+                clocal_b = iter_b;
+        }
+
+        switch (_rgb_sel)
+        {
+                case CC_LOCALSELECT_ITER_RGB:
+                cother_r = iter_r;
+                cother_g = iter_g;
+                cother_b = iter_b;
+                break;
+                case CC_LOCALSELECT_TEX:
+                cother_r = tex_r;
+                cother_g = tex_g;
+                cother_b = tex_b;
+                break;
+                case CC_LOCALSELECT_COLOR1:
+                cother_r = SPAN_SET1((params->color1 >> 16) & 0xff);
+                cother_g = SPAN_SET1((params->color1 >> 8) & 0xff);
+                cother_b = SPAN_SET1(params->color1 & 0xff);
+                break;
+                default: /*CC_LOCALSELECT_LFB*/
+                cother_r = cother_g = cother_b = zero;
+                break;
+        }
+
+        switch (cca_localselect)
+        {
+                case CCA_LOCALSELECT_ITER_A:
+                alocal = iter_a;
+                break;
+                case CCA_LOCALSELECT_COLOR0:
+                alocal = SPAN_SET1((params->color0 >> 24) & 0xff);
+                break;
+                default: /*CCA_LOCALSELECT_ITER_Z*/
+                alocal = SPAN_LOAD(span->iter_z);
+                break;
+        }
+
+        switch (a_sel)
+        {
+                case A_SEL_ITER_A:
+                aother = iter_a;
+                break;
+                case A_SEL_TEX:
+                aother = tex_a;
+                break;
+                default: /*A_SEL_COLOR1*/
+                aother = SPAN_SET1((params->color1 >> 24) & 0xff);
+                break;
+        }
+
+        if (cc_zero_other)
+                src_r = src_g = src_b = zero;
+        else
+        {
+                src_r = cother_r;
+                src_g = cother_g;
+                src_b = cother_b;
+        }
+        src_a = cca_zero_other ? zero : aother;
+
+        if (cc_sub_clocal)
+        {
+                src_r = SPAN_SUB(src_r, clocal_r);
+                src_g = SPAN_SUB(src_g, clocal_g);
+                src_b = SPAN_SUB(src_b, clocal_b);
+        }
+        if (cca_sub_clocal)
+                src_a = SPAN_SUB(src_a, alocal);
+
+        switch (cc_mselect)
+        {
+                case CC_MSELECT_ZERO:
+                msel_r = msel_g = msel_b = zero;
+                break;
+                case CC_MSELECT_CLOCAL:
+                msel_r = clocal_r;
+                msel_g = clocal_g;
+                msel_b = clocal_b;
+                break;
+                case CC_MSELECT_AOTHER:
+                msel_r = msel_g = msel_b = aother;
+                break;
+                case CC_MSELECT_ALOCAL:
+                msel_r = msel_g = msel_b = alocal;
+                break;
+                case CC_MSELECT_TEX:
+                msel_r = msel_g = msel_b = tex_a;
+                break;
+                default: /*CC_MSELECT_TEXRGB*/
+                msel_r = tex_r;
+                msel_g = tex_g;
+                msel_b = tex_b;
+                break;
+        }
+
+        switch (cca_mselect)
+        {
+                case CCA_MSELECT_ZERO:
+                msel_a = zero;
+                break;
+                case CCA_MSELECT_AOTHER:
+                msel_a = aother;
+                break;
+                case CCA_MSELECT_TEX:
+                msel_a = tex_a;
+                break;
+                default: /*CCA_MSELECT_ALOCAL, CCA_MSELECT_ALOCAL2*/
+                msel_a = alocal;
+                break;
+        }
+
+        if (!cc_reverse_blend)
+        {
+                msel_r = SPAN_XOR(msel_r, ff);
+                msel_g = SPAN_XOR(msel_g, ff);
+                msel_b = SPAN_XOR(msel_b, ff);
+        }
+        if (!cca_reverse_blend)
+                msel_a = SPAN_XOR(msel_a, ff);
+
+        src_r = span_mul8(src_r, SPAN_ADD(msel_r, SPAN_SET1(1)));
+        src_g = span_mul8(src_g, SPAN_ADD(msel_g, SPAN_SET1(1)));
+        src_b = span_mul8(src_b, SPAN_ADD(msel_b, SPAN_SET1(1)));
+        src_a = span_mul8(src_a, SPAN_ADD(msel_a, SPAN_SET1(1)));
+
+        if (cc_add == CC_ADD_CLOCAL)
+        {
+                src_r = SPAN_ADD(src_r, clocal_r);
+                src_g = SPAN_ADD(src_g, clocal_g);
+                src_b = SPAN_ADD(src_b, clocal_b);
+        }
+        else if (cc_add == CC_ADD_ALOCAL)
+        {
+                src_r = SPAN_ADD(src_r, alocal);
+                src_g = SPAN_ADD(src_g, alocal);
+                src_b = SPAN_ADD(src_b, alocal);
+        }
+        if (cca_add)
+                src_a = SPAN_ADD(src_a, alocal);
+
+        src_r = span_clamp(src_r);
+        src_g = span_clamp(src_g);
+        src_b = span_clamp(src_b);
+        src_a = span_clamp(src_a);
+
+        if (cc_invert_output)
+        {
+                src_r = SPAN_XOR(src_r, ff);
+                src_g = SPAN_XOR(src_g, ff);
+                src_b = SPAN_XOR(src_b, ff);
+        }
+        if (cca_invert_output)
+                src_a = SPAN_XOR(src_a, ff);
+
+        if (params->fogMode & FOG_ENABLE)
+        {
+                if (params->fogMode & FOG_CONSTANT)
+                {
+                        src_r = SPAN_ADD(src_r, SPAN_SET1(params->fogColor.r));
+                        src_g = SPAN_ADD(src_g, SPAN_SET1(params->fogColor.g));
+                        src_b = SPAN_ADD(src_b, SPAN_SET1(params->fogColor.b));
+                }
+                else
+                {
+                        span_vec_t fog_r, fog_g, fog_b;
+                        span_vec_t fog_a = SPAN_ADD(SPAN_LOAD(span->fog_a), SPAN_SET1(1));
+
+                        if (!(params->fogMode & FOG_ADD))
+                        {
+                                fog_r = SPAN_SET1(params->fogColor.r);
+                                fog_g = SPAN_SET1(params->fogColor.g);
+                                fog_b = SPAN_SET1(params->fogColor.b);
+                        }
+                        else
+                                fog_r = fog_g = fog_b = zero;
+
+                        if (!(params->fogMode & FOG_MULT))
+                        {
+                                fog_r = SPAN_SUB(fog_r, src_r);
+                                fog_g = SPAN_SUB(fog_g, src_g);
+                                fog_b = SPAN_SUB(fog_b, src_b);
+                        }
+
+                        fog_r = span_mul8(fog_r, fog_a);
+                        fog_g = span_mul8(fog_g, fog_a);
+                        fog_b = span_mul8(fog_b, fog_a);
+
+                        if (params->fogMode & FOG_MULT)
+                        {
+                                src_r = fog_r;
+                                src_g = fog_g;
+                                src_b = fog_b;
+                        }
+                        else
+                        {
+                                src_r = SPAN_ADD(src_r, fog_r);
+                                src_g = SPAN_ADD(src_g, fog_g);
+                                src_b = SPAN_ADD(src_b, fog_b);
+                        }
+                }
+
+                src_r = span_clamp(src_r);
+                src_g = span_clamp(src_g);
+                src_b = span_clamp(src_b);
+        }
+
+        if (params->alphaMode & 1)
+        {
+                span_vec_t ref = SPAN_SET1(a_ref);
+                span_vec_t ones = SPAN_CMPEQ(zero, zero);
+                span_vec_t pass;
+
+                switch (alpha_func)
+                {
+                        case AFUNC_NEVER:
+                        pass = zero;
+                        break;
+                        case AFUNC_LESSTHAN:
+                        pass = SPAN_CMPGT(ref, src_a);
+                        break;
+                        case AFUNC_EQUAL:
+                        pass = SPAN_CMPEQ(src_a, ref);
+                        break;
+                        case AFUNC_LESSTHANEQUAL:
+                        pass = SPAN_XOR(SPAN_CMPGT(src_a, ref), ones);
+                        break;
+                        case AFUNC_GREATERTHAN:
+                        pass = SPAN_CMPGT(src_a, ref);
+                        break;
+                        case AFUNC_NOTEQUAL:
+                        pass = SPAN_XOR(SPAN_CMPEQ(src_a, ref), ones);
+                        break;
+                        case AFUNC_GREATERTHANEQUAL:
+                        pass = SPAN_XOR(SPAN_CMPGT(ref, src_a), ones);
+                        break;
+                        default: /*AFUNC_ALWAYS*/
+                        pass = ones;
+                        break;
+                }
+
+                voodoo->fbiAFuncFail += span_count(SPAN_ANDNOT(pass, live));
+                live = SPAN_AND(live, pass);
+        }
+
+        if (params->alphaMode & (1 << 4))
+        {
+                span_vec_t dest = SPAN_LOAD(span->dest);
+                span_vec_t dest_r = SPAN_AND(SPAN_SRLI(dest, 8), SPAN_SET1(0xf8));
+                span_vec_t dest_g = SPAN_AND(SPAN_SRLI(dest, 3), SPAN_SET1(0xfc));
+                span_vec_t dest_b = SPAN_AND(SPAN_SLLI(dest, 3), SPAN_SET1(0xf8));
+                span_vec_t newdest_r, newdest_g, newdest_b;
+
+                dest_r = SPAN_OR(dest_r, SPAN_SRLI(dest_r, 5));
+                dest_g = SPAN_OR(dest_g, SPAN_SRLI(dest_g, 6));
+                dest_b = SPAN_OR(dest_b, SPAN_SRLI(dest_b, 5));
+
+                /*Destination alpha is always 0xff*/
+                switch (dest_afunc)
+                {
+                        case AFUNC_ASRC_ALPHA:
+                        newdest_r = span_mul_div255(dest_r, src_a);
+                        newdest_g = span_mul_div255(dest_g, src_a);
+                        newdest_b = span_mul_div255(dest_b, src_a);
+                        break;
+                        case AFUNC_A_COLOR:
+                        newdest_r = span_mul_div255(dest_r, src_r);
+                        newdest_g = span_mul_div255(dest_g, src_g);
+                        newdest_b = span_mul_div255(dest_b, src_b);
+                        break;
+                        case AFUNC_ADST_ALPHA:
+                        case AFUNC_AONE:
+                        newdest_r = dest_r;
+                        newdest_g = dest_g;
+                        newdest_b = dest_b;
+                        break;
+                        case AFUNC_AOMSRC_ALPHA:
+                        newdest_r = span_mul_div255(dest_r, SPAN_SUB(ff, src_a));
+                        newdest_g = span_mul_div255(dest_g, SPAN_SUB(ff, src_a));
+                        newdest_b = span_mul_div255(dest_b, SPAN_SUB(ff, src_a));
+                        break;
+                        case AFUNC_AOM_COLOR:
+                        newdest_r = span_mul_div255(dest_r, SPAN_SUB(ff, src_r));
+                        newdest_g = span_mul_div255(dest_g, SPAN_SUB(ff, src_g));
+                        newdest_b = span_mul_div255(dest_b, SPAN_SUB(ff, src_b));
+                        break;
+                        default: /*AFUNC_AZERO, AFUNC_AOMDST_ALPHA*/
+                        newdest_r = newdest_g = newdest_b = zero;
+                        break;
+                }
+
+                switch (src_afunc)
+                {
+                        case AFUNC_AZERO:
+                        case AFUNC_AOMDST_ALPHA:
+                        src_r = src_g = src_b = zero;
+                        break;
+                        case AFUNC_ASRC_ALPHA:
+                        src_r = span_mul_div255(src_r, src_a);
+                        src_g = span_mul_div255(src_g, src_a);
+                        src_b = span_mul_div255(src_b, src_a);
+                        break;
+                        case AFUNC_A_COLOR:
+                        src_r = span_mul_div255(src_r, dest_r);
+                        src_g = span_mul_div255(src_g, dest_g);
+                        src_b = span_mul_div255(src_b, dest_b);
+                        break;
+                        case AFUNC_AOMSRC_ALPHA:
+                        src_r = span_mul_div255(src_r, SPAN_SUB(ff, src_a));
+                        src_g = span_mul_div255(src_g, SPAN_SUB(ff, src_a));
+                        src_b = span_mul_div255(src_b, SPAN_SUB(ff, src_a));
+                        break;
+                        case AFUNC_AOM_COLOR:
+                        src_r = span_mul_div255(src_r, SPAN_SUB(ff, dest_r));
+                        src_g = span_mul_div255(src_g, SPAN_SUB(ff, dest_g));
+                        src_b = span_mul_div255(src_b, SPAN_SUB(ff, dest_b));
+                        break;
+                        default: /*AFUNC_ADST_ALPHA, AFUNC_AONE*/
+                        break;
+                }
+
+                src_r = SPAN_MIN(SPAN_ADD(src_r, newdest_r), ff);
+                src_g = SPAN_MIN(SPAN_ADD(src_g, newdest_g), ff);
+                src_b = SPAN_MIN(SPAN_ADD(src_b, newdest_b), ff);
+        }
+
+        SPAN_STORE(span->src_r, src_r);
+        SPAN_STORE(span->src_g, src_g);
+        SPAN_STORE(span->src_b, src_b);
+        SPAN_STORE(span->src_a, src_a);
+        SPAN_STORE(span->live, live);
+}
+
+/*Texels and bilinear weights for the pixel in lane c, from one TMU*/
+static inline void voodoo_span_fetch(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, voodoo_span_t *span, int tmu, int c)
+{
+        voodoo_texture_state_t texture_state;
+        rgba_u dat[4];
+        int d[4];
+        int s, t, k;
+
+        voodoo_tmu_lod(voodoo, params, state, tmu);
+        if (voodoo_tex_coords(voodoo, params, state, tmu, &texture_state, &s, &t, d))
+                tex_fetch_4(state, &texture_state, s, t, tmu, dat);
+        else
+        {
+                dat[0].u = tex_fetch(state, &texture_state, tmu);
+                dat[1].u = dat[2].u = dat[3].u = 0;
+                d[0] = 256;
+                d[1] = d[2] = d[3] = 0;
+        }
+
+        for (k = 0; k < 4; k++)
+        {
+                span->texel_r[k][c] = dat[k].rgba.r;
+                span->texel_g[k][c] = dat[k].rgba.g;
+                span->texel_b[k][c] = dat[k].rgba.b;
+                span->texel_a[k][c] = dat[k].rgba.a;
+                span->texel_d[k][c] = d[k];
+        }
+}
+
+/*Depth test on all lanes, returns the lanes that pass*/
+static inline span_vec_t voodoo_span_depth_test(voodoo_t *voodoo, voodoo_params_t *params, voodoo_span_t *span, span_vec_t live)
+{
+        span_vec_t sign = SPAN_SET1(-0x8000);
+        span_vec_t ones = SPAN_CMPEQ(sign, sign);
+        span_vec_t old_depth = SPAN_XOR(SPAN_LOAD(span->old_depth), sign);
+        span_vec_t new_depth, pass;
+
+        if (params->fbzMode & FBZ_DEPTH_SOURCE)
+                new_depth = SPAN_XOR(SPAN_SET1(params->zaColor & 0xffff), sign);
+        else
+                new_depth = SPAN_XOR(SPAN_LOAD(span->new_depth), sign);
+
+        switch (depth_op)
+        {
+                case DEPTHOP_NEVER:
+                pass = SPAN_SET1(0);
+                break;
+                case DEPTHOP_LESSTHAN:
+                pass = SPAN_CMPGT(old_depth, new_depth);
+                break;
+                case DEPTHOP_EQUAL:
+                pass = SPAN_CMPEQ(new_depth, old_depth);
+                break;
+                case DEPTHOP_LESSTHANEQUAL:
+                pass = SPAN_XOR(SPAN_CMPGT(new_depth, old_depth), ones);
+                break;
+                case DEPTHOP_GREATERTHAN:
+                pass = SPAN_CMPGT(new_depth, old_depth);
+                break;
+                case DEPTHOP_NOTEQUAL:
+                pass = SPAN_XOR(SPAN_CMPEQ(new_depth, old_depth), ones);
+                break;
+                case DEPTHOP_GREATERTHANEQUAL:
+                pass = SPAN_XOR(SPAN_CMPGT(old_depth, new_depth), ones);
+                break;
+                default: /*DEPTHOP_ALWAYS*/
+                pass = ones;
+                break;
+        }
+
+        voodoo->fbiZFuncFail += span_count(SPAN_ANDNOT(pass, live));
+        return SPAN_AND(live, pass);
+}
+
+/*Dither the colour on all lanes and pack it to 565*/
+static inline void voodoo_span_pack(voodoo_params_t *params, voodoo_span_t *span)
+{
+        span_vec_t src_r = SPAN_LOAD(span->src_r);
+        span_vec_t src_g = SPAN_LOAD(span->src_g);
+        span_vec_t src_b = SPAN_LOAD(span->src_b);
+
+        if (dither)
+        {
+                span_vec_t m = SPAN_LOAD(span->dither_m);
+
+                src_r = span_dither_rb(src_r, m);
+                src_g = span_dither_g(src_g, m);
+                src_b = span_dither_rb(src_b, m);
+        }
+        else
+        {
+                src_r = SPAN_SRLI(src_r, 3);
+                src_g = SPAN_SRLI(src_g, 2);
+                src_b = SPAN_SRLI(src_b, 3);
+        }
+
+        SPAN_STORE(span->pixel, SPAN_OR(SPAN_OR(src_b, SPAN_SLLI(src_g, 5)), SPAN_SLLI(src_r, 11)));
+}
+
+static void voodoo_span_draw(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, uint16_t *fb_mem, uint16_t *aux_mem, int x, int x2, int real_y, int odd_even, int texels)
+{
+        voodoo_span_t span;
+        int count = (x2 - x) * state->xdir + 1;
+
+        memset(&span, 0, sizeof(voodoo_span_t));
+
+        voodoo->pixel_count[odd_even] += count;
+        voodoo->texel_count[odd_even] += count * texels;
+        voodoo->fbiPixelsIn += count;
+
+        while (count > 0)
+        {
+                int nr = MIN(count, SPAN_LANES);
+                span_vec_t live;
+                int c;
+
+                for (c = 0; c < nr; c++)
+                {
+                        int x_tiled = (x & 63) | ((x >> 6) * 128*32/2);
+                        int32_t new_depth, w_depth;
+
+                        span.x[c] = x;
+                        span.live[c] = -1;
+                        state->x = x;
+
+                        if (state->w & 0xffff00000000)
+                                w_depth = 0;
+                        else if (!(state->w & 0xffff0000))
+                                w_depth = 0xf001;
+                        else
+                        {
+                                int exp = voodoo_fls((uint16_t)((uint32_t)state->w >> 16));
+                                int mant = ((~(uint32_t)state->w >> (19 - exp))) & 0xfff;
+                                w_depth = (exp << 12) + mant + 1;
+                                if (w_depth > 0xffff)
+                                        w_depth = 0xffff;
+                        }
+
+                        if (params->fbzMode & FBZ_W_BUFFER)
+                                new_depth = w_depth;
+                        else
+                                new_depth = CLAMP16(state->z >> 12);
+
+                        if (params->fbzMode & FBZ_DEPTH_BIAS)
+                                new_depth = CLAMP16(new_depth + (int16_t)params->zaColor);
+
+                        span.new_depth[c] = new_depth;
+                        if (params->fbzMode & FBZ_DEPTH_ENABLE)
+                                span.old_depth[c] = voodoo->params.aux_tiled ? aux_mem[x_tiled] : aux_mem[x];
+                        span.dest[c] = voodoo->params.col_tiled ? fb_mem[x_tiled] : fb_mem[x];
+
+                        span.iter_r[c] = CLAMP(state->ir >> 12);
+                        span.iter_g[c] = CLAMP(state->ig >> 12);
+                        span.iter_b[c] = CLAMP(state->ib >> 12);
+                        span.iter_a[c] = CLAMP(state->ia >> 12);
+                        span.iter_z[c] = CLAMP(state->z >> 20);
+
+                        if ((params->fogMode & (FOG_ENABLE | FOG_CONSTANT)) == FOG_ENABLE)
+                        {
+                                int fog_idx;
+
+                                switch (params->fogMode & (FOG_Z|FOG_ALPHA))
+                                {
+                                        case 0:
+                                        fog_idx = (w_depth >> 10) & 0x3f;
+
+                                        span.fog_a[c] = params->fogTable[fog_idx].fog;
+                                        span.fog_a[c] += (params->fogTable[fog_idx].dfog * ((w_depth >> 2) & 0xff)) >> 10;
+                                        break;
+                                        case FOG_Z:
+                                        span.fog_a[c] = (state->z >> 20) & 0xff;
+                                        break;
+                                        case FOG_ALPHA:
+                                        span.fog_a[c] = CLAMP(state->ia >> 12);
+                                        break;
+                                        case FOG_W:
+                                        span.fog_a[c] = CLAMP((state->w >> 32) & 0xff);
+                                        break;
+                                }
+                        }
+
+                        if (dither)
+                                span.dither_m[c] = dither2x2 ? span_dither_2x2[real_y & 1][x & 1] : span_dither_4x4[real_y & 3][x & 3];
+
+                        /*The texture coordinates are only needed for the pixels
+                          that pass the depth test*/
+                        span.tmu0_s[c] = state->tmu0_s;
+                        span.tmu0_t[c] = state->tmu0_t;
+                        span.tmu0_w[c] = state->tmu0_w;
+                        span.tmu1_s[c] = state->tmu1_s;
+                        span.tmu1_t[c] = state->tmu1_t;
+                        span.tmu1_w[c] = state->tmu1_w;
+
+                        voodoo_step_x(params, state, state->xdir);
+                        x += state->xdir;
+                }
+                for (; c < SPAN_LANES; c++)
+                        span.live[c] = 0;
+                live = SPAN_LOAD(span.live);
+
+                if (params->fbzMode & FBZ_DEPTH_ENABLE)
+                        live = voodoo_span_depth_test(voodoo, params, &span, live);
+
+                if (params->fbzColorPath & FBZCP_TEXTURE_ENABLED)
+                {
+                        int64_t tmu0_s = state->tmu0_s, tmu0_t = state->tmu0_t, tmu0_w = state->tmu0_w;
+                        int64_t tmu1_s = state->tmu1_s, tmu1_t = state->tmu1_t, tmu1_w = state->tmu1_w;
+                        span_vec_t tex_r, tex_g, tex_b, tex_a;
+                        int last = -1;
+
+                        SPAN_STORE(span.live, live);
+                        for (c = 0; c < nr; c++)
+                        {
+                                if (!span.live[c])
+                                        continue;
+
+                                state->x = span.x[c];
+                                state->tmu0_s = span.tmu0_s[c];
+                                state->tmu0_t = span.tmu0_t[c];
+                                state->tmu0_w = span.tmu0_w[c];
+                                state->tmu1_s = span.tmu1_s[c];
+                                state->tmu1_t = span.tmu1_t[c];
+                                state->tmu1_w = span.tmu1_w[c];
+
+                                if ((params->textureMode[0] & TEXTUREMODE_LOCAL_MASK) == TEXTUREMODE_LOCAL || !voodoo->dual_tmus)
+                                {
+                                        /*TMU0 only sampling local colour or only one TMU, only sample TMU0*/
+                                        voodoo_span_fetch(voodoo, params, state, &span, 0, c);
+                                }
+                                else if ((params->textureMode[0] & TEXTUREMODE_MASK) == TEXTUREMODE_PASSTHROUGH)
+                                {
+                                        /*TMU0 in pass-through mode, only sample TMU1*/
+                                        voodoo_span_fetch(voodoo, params, state, &span, 1, c);
+                                }
+                                else
+                                {
+                                        int k;
+
+                                        voodoo_tmu_fetch_and_blend(voodoo, params, state, span.x[c]);
+
+                                        span.texel_r[0][c] = state->tex_r[0];
+                                        span.texel_g[0][c] = state->tex_g[0];
+                                        span.texel_b[0][c] = state->tex_b[0];
+                                        span.texel_a[0][c] = state->tex_a[0];
+                                        span.texel_d[0][c] = 256;
+                                        for (k = 1; k < 4; k++)
+                                                span.texel_d[k][c] = 0;
+                                }
+                                last = c;
+                        }
+
+                        state->tmu0_s = tmu0_s;
+                        state->tmu0_t = tmu0_t;
+                        state->tmu0_w = tmu0_w;
+                        state->tmu1_s = tmu1_s;
+                        state->tmu1_t = tmu1_t;
+                        state->tmu1_w = tmu1_w;
+
+                        tex_r = span_bilinear(span.texel_r, span.texel_d);
+                        tex_g = span_bilinear(span.texel_g, span.texel_d);
+                        tex_b = span_bilinear(span.texel_b, span.texel_d);
+                        tex_a = span_bilinear(span.texel_a, span.texel_d);
+                        SPAN_STORE(span.tex_r, tex_r);
+                        SPAN_STORE(span.tex_g, tex_g);
+                        SPAN_STORE(span.tex_b, tex_b);
+                        SPAN_STORE(span.tex_a, tex_a);
+
+                        /*Leave the last texel in the state, as the scalar path does*/
+                        if (last >= 0)
+                        {
+                                state->tex_r[0] = span.tex_r[last];
+                                state->tex_g[0] = span.tex_g[last];
+                                state->tex_b[0] = span.tex_b[last];
+                                state->tex_a[0] = span.tex_a[last];
+                        }
+
+                        if (params->fbzMode & FBZ_CHROMAKEY)
+                        {
+                                span_vec_t key = SPAN_AND(SPAN_AND(SPAN_CMPEQ(tex_r, SPAN_SET1(params->chromaKey_r)),
+                                                                   SPAN_CMPEQ(tex_g, SPAN_SET1(params->chromaKey_g))),
+                                                          SPAN_CMPEQ(tex_b, SPAN_SET1(params->chromaKey_b)));
+
+                                voodoo->fbiChromaFail += span_count(SPAN_AND(key, live));
+                                live = SPAN_ANDNOT(key, live);
+                        }
+                }
+                else
+                {
+                        /*The combine may still select the texture, which is then
+                          whatever the last textured pixel left in the state*/
+                        SPAN_STORE(span.tex_r, SPAN_SET1(state->tex_r[0]));
+                        SPAN_STORE(span.tex_g, SPAN_SET1(state->tex_g[0]));
+                        SPAN_STORE(span.tex_b, SPAN_SET1(state->tex_b[0]));
+                        SPAN_STORE(span.tex_a, SPAN_SET1(state->tex_a[0]));
+                }
+                SPAN_STORE(span.live, live);
+
+                voodoo_span_shade(voodoo, params, &span);
+                voodoo_span_pack(params, &span);
+
+                for (c = 0; c < nr; c++)
+                {
+                        int px = span.x[c];
+                        int x_tiled = (px & 63) | ((px >> 6) * 128*32/2);
+
+                        if (!span.live[c])
+                                continue;
+
+                        if (params->fbzMode & FBZ_RGB_WMASK)
+                        {
+                                if (voodoo->params.col_tiled)
+                                        fb_mem[x_tiled] = span.pixel[c];
+                                else
+                                        fb_mem[px] = span.pixel[c];
+                        }
+                        if ((params->fbzMode & (FBZ_DEPTH_WMASK | FBZ_DEPTH_ENABLE)) == (FBZ_DEPTH_WMASK | FBZ_DEPTH_ENABLE))
+                        {
+                                if (voodoo->params.aux_tiled)
+                                        aux_mem[x_tiled] = span.new_depth[c];
+                                else
+                                        aux_mem[px] = span.new_depth[c];
+                        }
+                        voodoo->fbiPixelsOut++;
+                }
+
+                count -= nr;
+        }
+}
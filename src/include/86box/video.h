@@ -69,6 +69,10 @@ typedef struct {
     uint32_t	*line[2112];
 } bitmap_t;
 
+typedef struct {
+    int		x, y, w, h;
+} video_rect_t;
+
 typedef struct {
     uint8_t	r, g, b;
 } rgb_t;
@@ -80,6 +84,9 @@ typedef struct {
 typedef rgb_t PALETTE[256];
 
 
+#define VIDEO_RECTS_MAX	64		/* max dirty rectangles per blit */
+
+
 extern int	egareads,
 		egawrites;
 extern int	changeframecount;
@@ -156,6 +163,8 @@ extern void	video_blend(int x, int y);
 extern void	video_blit_memtoscreen_8(int x, int y, int y1, int y2, int w, int h);
 extern void	video_blit_memtoscreen(int x, int y, int y1, int y2, int w, int h);
 extern void	video_blit_complete(void);
+extern int	video_blit_rects(const video_rect_t **rects);
+extern void	video_blit_invalidate(void);
 extern void	video_wait_for_blit(void);
 extern void	video_wait_for_buffer(void);
 
@@ -43,13 +43,31 @@ typedef struct _io_ {
 	void     (*outw)(uint16_t addr, uint16_t val, void *priv);
 	void     (*outl)(uint16_t addr, uint32_t val, void *priv);
 
+	/* Optional block transfers for REP INSW/OUTSW, see io_set_block_handler(). */
+	int	 (*inw_block)(uint16_t addr, uint8_t *buf, int count, void *priv);
+	int	 (*outw_block)(uint16_t addr, uint8_t *buf, int count, void *priv);
+
 	void	*priv;
 
 	struct _io_ *prev, *next;
 } io_t;
 
+/* The handlers an access can be sent to directly, or NULL if the access has
+   to walk the handler lists: more than one handler takes part in it, or it
+   has to be split into narrower accesses. */
+typedef struct {
+	io_t	*inb, *inw, *inl,
+		*outb, *outw, *outl;
+
+	uint8_t	inw_split, outw_split;	/* word access goes to the byte handlers
+					   of this port and the next one */
+
+	uint32_t reads, writes;		/* access counters for profiling */
+} io_fast_t;
+
 int initialized = 0;
 io_t *io[NPORTS], *io_last[NPORTS];
+static io_fast_t io_fast[NPORTS];
 
 
 #ifdef ENABLE_IO_LOG
@@ -72,6 +90,151 @@ io_log(const char *fmt, ...)
 #endif
 
 
+/* Callbacks of a handler as a mask: bits 0-2 are inb/w/l, 3-5 outb/w/l. */
+static int
+io_mask(io_t *p)
+{
+    return((p->inb ? 0x01 : 0) | (p->inw ? 0x02 : 0) | (p->inl ? 0x04 : 0) |
+	   (p->outb ? 0x08 : 0) | (p->outw ? 0x10 : 0) | (p->outl ? 0x20 : 0));
+}
+
+
+/* Find the one handler of a port with the callback, NULL if there are none
+   or more than one. */
+static io_t *
+io_single(uint16_t port, int bit)
+{
+    io_t *p, *ret = NULL;
+
+    for (p = io[port]; p != NULL; p = p->next) {
+	if (io_mask(p) & bit) {
+		if (ret != NULL)
+			return(NULL);
+		ret = p;
+	}
+    }
+
+    return(ret);
+}
+
+
+/* Check whether a port has a handler with exactly the callbacks val among
+   those in mask, ie. one that would get a wide access split up. */
+static int
+io_split(uint16_t port, int mask, int val)
+{
+    io_t *p;
+
+    for (p = io[port]; p != NULL; p = p->next) {
+	if ((io_mask(p) & mask) == val)
+		return(1);
+    }
+
+    return(0);
+}
+
+
+/* Work out the direct handlers of a port, they have to give the same result
+   as the list walks in the access functions below. */
+static void
+io_fast_update(uint16_t port)
+{
+    io_fast_t *f = &io_fast[port];
+    uint16_t p1 = port + 1, p2 = port + 2, p3 = port + 3;
+    io_t *lo, *hi;
+
+    f->inb = io_single(port, 0x01);
+    f->inw = io_single(port, 0x02);
+    f->inl = io_single(port, 0x04);
+
+    if (io_split(port, 0x03, 0x01) || io_split(p1, 0x03, 0x01))
+	f->inw = NULL;
+    lo = io_single(port, 0x01);
+    hi = io_single(p1, 0x01);
+    f->inw_split = !io_split(port, 0x02, 0x02) && lo && hi && !hi->inw;
+    if (io_split(port, 0x06, 0x02) || io_split(p2, 0x06, 0x02) ||
+	io_split(port, 0x07, 0x01) || io_split(p1, 0x07, 0x01) ||
+	io_split(p2, 0x07, 0x01) || io_split(p3, 0x07, 0x01))
+	f->inl = NULL;
+
+    f->outb = io_single(port, 0x08);
+    f->outw = io_single(port, 0x10);
+    f->outl = io_single(port, 0x20);
+
+    if (io_split(port, 0x18, 0x08) || io_split(p1, 0x18, 0x08))
+	f->outw = NULL;
+    lo = io_single(port, 0x08);
+    hi = io_single(p1, 0x08);
+    f->outw_split = !io_split(port, 0x10, 0x10) && lo && hi && !hi->outw;
+    if (io_split(port, 0x30, 0x10) || io_split(p2, 0x30, 0x10) ||
+	io_split(port, 0x38, 0x08) || io_split(p1, 0x38, 0x08) ||
+	io_split(p2, 0x38, 0x08) || io_split(p3, 0x38, 0x08))
+	f->outl = NULL;
+}
+
+
+/* A change to ports base to base + size - 1 also affects the wide accesses
+   that start up to three ports below. */
+static void
+io_fast_update_range(uint16_t base, int size)
+{
+    int c;
+
+    for (c = -3; c < size; c++)
+	io_fast_update((uint16_t) (base + c));
+}
+
+
+void
+io_get_counts(uint16_t port, uint32_t *reads, uint32_t *writes)
+{
+    *reads = io_fast[port].reads;
+    *writes = io_fast[port].writes;
+}
+
+
+void
+io_clear_counts(void)
+{
+    int c;
+
+    for (c = 0; c < NPORTS; c++)
+	io_fast[c].reads = io_fast[c].writes = 0;
+}
+
+
+/* Log the busiest ports, for finding out what a guest spends its I/O on. */
+void
+io_log_counts(void)
+{
+    uint32_t total, best_total;
+    int c, i, best;
+    uint8_t *done;
+
+    done = (uint8_t *) malloc(NPORTS);
+    memset(done, 0x00, NPORTS);
+
+    for (i = 0; i < 16; i++) {
+	best = -1;
+	best_total = 0;
+	for (c = 0; c < NPORTS; c++) {
+		total = io_fast[c].reads + io_fast[c].writes;
+		if (!done[c] && (total > best_total)) {
+			best = c;
+			best_total = total;
+		}
+	}
+	if (best == -1)
+		break;
+
+	io_log("I/O port %04X: %u reads, %u writes\n", best, io_fast[best].reads, io_fast[best].writes);
+	done[best] = 1;
+    }
+
+    free(done);
+}
+
+
 void
 io_init(void)
 {
@@ -100,6 +263,8 @@ io_init(void)
 	/* io[c] should be NULL. */
 	io[c] = io_last[c] = NULL;
     }
+
+    memset(io_fast, 0x00, sizeof(io_fast));
 }
 
 
@@ -141,6 +306,8 @@ io_sethandler(uint16_t base, int size,
 
 	io_last[base + c] = q;
     }
+
+    io_fast_update_range(base, size);
 }
 
 
@@ -182,6 +349,8 @@ io_removehandler(uint16_t base, int size,
 		p = q;
 	}
     }
+
+    io_fast_update_range(base, size);
 }
 
 
@@ -202,6 +371,31 @@ io_handler(int set, uint16_t base, int size,
 }
 
 
+/* Give the word handlers of a port installed with the given priv block
+   transfer callbacks. A callback moves up to count words between buf and the
+   device, exactly as that many inw()/outw() calls would, and returns how many
+   it moved. It may move fewer, or none, to leave any word with side effects
+   beyond the data (end of a sector, DMA completion, ...) to the normal word
+   handler. Removing the handler removes its block callbacks too. */
+void
+io_set_block_handler(uint16_t port,
+	int (*inw_block)(uint16_t addr, uint8_t *buf, int count, void *priv),
+	int (*outw_block)(uint16_t addr, uint8_t *buf, int count, void *priv),
+	void *priv)
+{
+    io_t *p;
+
+    for (p = io[port]; p != NULL; p = p->next) {
+	if (p->priv == priv) {
+		if (p->inw)
+			p->inw_block = inw_block;
+		if (p->outw)
+			p->outw_block = outw_block;
+	}
+    }
+}
+
+
 #ifdef PC98
 void
 io_sethandler_interleaved(uint16_t base, int size,
@@ -239,6 +433,8 @@ io_sethandler_interleaved(uint16_t base, int size,
 
 	q->priv = priv;
     }
+
+    io_fast_update_range(base, size);
 }
 
 
@@ -276,6 +472,8 @@ io_removehandler_interleaved(uint16_t base, int size,
 		p = q;
 	}
     }
+
+    io_fast_update_range(base, size);
 }
 #endif
 
@@ -288,15 +486,24 @@ inb(uint16_t port)
     int found = 0;
     int qfound = 0;
 
-    p = io[port];
-    while(p) {
-	q = p->next;
-	if (p->inb) {
-		ret &= p->inb(port, p->priv);
-		found |= 1;
-		qfound++;
+    io_fast[port].reads++;
+
+    p = io_fast[port].inb;
+    if (p != NULL) {
+	ret = p->inb(port, p->priv);
+	found = 1;
+	qfound = 1;
+    } else {
+	p = io[port];
+	while(p) {
+		q = p->next;
+		if (p->inb) {
+			ret &= p->inb(port, p->priv);
+			found |= 1;
+			qfound++;
+		}
+		p = q;
 	}
-	p = q;
     }
 
     if (port & 0x80)
@@ -322,17 +529,26 @@ outb(uint16_t port, uint8_t val)
     int found = 0;
     int qfound = 0;
 
-    p = io[port];
-    while(p) {
-	q = p->next;
-	if (p->outb) {
-		p->outb(port, val, p->priv);
-		found |= 1;
-		qfound++;
+    io_fast[port].writes++;
+
+    p = io_fast[port].outb;
+    if (p != NULL) {
+	p->outb(port, val, p->priv);
+	found = 1;
+	qfound = 1;
+    } else {
+	p = io[port];
+	while(p) {
+		q = p->next;
+		if (p->outb) {
+			p->outb(port, val, p->priv);
+			found |= 1;
+			qfound++;
+		}
+		p = q;
 	}
-	p = q;
     }
-	
+
     if (!found) {
 	cycles -= io_delay;
 #ifdef USE_DYNAREC
@@ -357,32 +573,49 @@ inw(uint16_t port)
     uint8_t ret8[2];
     int i = 0;
 
-    p = io[port];
-    while(p) {
-	q = p->next;
-	if (p->inw) {
-		ret &= p->inw(port, p->priv);
-		found |= 2;
-		qfound++;
-	}
-	p = q;
-    }
-
-    ret8[0] = ret & 0xff;
-    ret8[1] = (ret >> 8) & 0xff;
-    for (i = 0; i < 2; i++) {
-	p = io[(port + i) & 0xffff];
+    io_fast[port].reads++;
+
+    p = io_fast[port].inw;
+    if (p != NULL) {
+	ret = p->inw(port, p->priv);
+	found = 2;
+	qfound = 1;
+    } else if (io_fast[port].inw_split) {
+	p = io_fast[port].inb;
+	ret = p->inb(port, p->priv);
+	/* Look this one up only now, in case the first access remapped it. */
+	p = io_fast[(port + 1) & 0xffff].inb;
+	ret |= ((p != NULL) ? p->inb(port + 1, p->priv) : 0xff) << 8;
+	found = 1;
+	qfound = 2;
+    } else {
+	p = io[port];
 	while(p) {
 		q = p->next;
-		if (p->inb && !p->inw) {
-			ret8[i] &= p->inb(port + i, p->priv);
-			found |= 1;
+		if (p->inw) {
+			ret &= p->inw(port, p->priv);
+			found |= 2;
 			qfound++;
 		}
 		p = q;
 	}
+
+	ret8[0] = ret & 0xff;
+	ret8[1] = (ret >> 8) & 0xff;
+	for (i = 0; i < 2; i++) {
+		p = io[(port + i) & 0xffff];
+		while(p) {
+			q = p->next;
+			if (p->inb && !p->inw) {
+				ret8[i] &= p->inb(port + i, p->priv);
+				found |= 1;
+				qfound++;
+			}
+			p = q;
+		}
+	}
+	ret = (ret8[1] << 8) | ret8[0];
     }
-    ret = (ret8[1] << 8) | ret8[0];
 
     if (port & 0x80)
 	amstrad_latch = AMSTRAD_NOLATCH;
@@ -408,28 +641,46 @@ outw(uint16_t port, uint16_t val)
     int qfound = 0;
     int i = 0;
 
-    p = io[port];
-    while(p) {
-	q = p->next;
-	if (p->outw) {
-		p->outw(port, val, p->priv);
-		found |= 2;
-		qfound++;
-	}
-	p = q;
-    }
-
-    for (i = 0; i < 2; i++) {
-	p = io[(port + i) & 0xffff];
+    io_fast[port].writes++;
+
+    p = io_fast[port].outw;
+    if (p != NULL) {
+	p->outw(port, val, p->priv);
+	found = 2;
+	qfound = 1;
+    } else if (io_fast[port].outw_split) {
+	p = io_fast[port].outb;
+	p->outb(port, val & 0xff, p->priv);
+	/* Look this one up only now, in case the first access remapped it. */
+	p = io_fast[(port + 1) & 0xffff].outb;
+	if (p != NULL)
+		p->outb(port + 1, val >> 8, p->priv);
+	found = 1;
+	qfound = 2;
+    } else {
+	p = io[port];
 	while(p) {
 		q = p->next;
-		if (p->outb && !p->outw) {
-			p->outb(port + i, val >> (i << 3), p->priv);
-			found |= 1;
+		if (p->outw) {
+			p->outw(port, val, p->priv);
+			found |= 2;
 			qfound++;
 		}
 		p = q;
 	}
+
+	for (i = 0; i < 2; i++) {
+		p = io[(port + i) & 0xffff];
+		while(p) {
+			q = p->next;
+			if (p->outb && !p->outw) {
+				p->outb(port + i, val >> (i << 3), p->priv);
+				found |= 1;
+				qfound++;
+			}
+			p = q;
+		}
+	}
     }
 
     if (!found) {
@@ -457,50 +708,59 @@ inl(uint16_t port)
     int qfound = 0;
     int i = 0;
 
-    p = io[port];
-    while(p) {
-	q = p->next;
-	if (p->inl) {
-		ret &= p->inl(port, p->priv);
-		found |= 4;
-		qfound++;
-	}
-	p = q;
-    }
+    io_fast[port].reads++;
 
-    ret16[0] = ret & 0xffff;
-    ret16[1] = (ret >> 16) & 0xffff;
-    for (i = 0; i < 4; i += 2) {
-	p = io[(port + i) & 0xffff];
+    p = io_fast[port].inl;
+    if (p != NULL) {
+	ret = p->inl(port, p->priv);
+	found = 4;
+	qfound = 1;
+    } else {
+	p = io[port];
 	while(p) {
 		q = p->next;
-		if (p->inw && !p->inl) {
-			ret16[i >> 1] &= p->inw(port + i, p->priv);
-			found |= 2;
+		if (p->inl) {
+			ret &= p->inl(port, p->priv);
+			found |= 4;
 			qfound++;
 		}
 		p = q;
 	}
-    }
-    ret = (ret16[1] << 16) | ret16[0];
-
-    ret8[0] = ret & 0xff;
-    ret8[1] = (ret >> 8) & 0xff;
-    ret8[2] = (ret >> 16) & 0xff;
-    ret8[3] = (ret >> 24) & 0xff;
-    for (i = 0; i < 4; i++) {
-	p = io[(port + i) & 0xffff];
-	while(p) {
-		q = p->next;
-		if (p->inb && !p->inw && !p->inl) {
-			ret8[i] &= p->inb(port + i, p->priv);
-			found |= 1;
-			qfound++;
+
+	ret16[0] = ret & 0xffff;
+	ret16[1] = (ret >> 16) & 0xffff;
+	for (i = 0; i < 4; i += 2) {
+		p = io[(port + i) & 0xffff];
+		while(p) {
+			q = p->next;
+			if (p->inw && !p->inl) {
+				ret16[i >> 1] &= p->inw(port + i, p->priv);
+				found |= 2;
+				qfound++;
+			}
+			p = q;
 		}
-		p = q;
 	}
+	ret = (ret16[1] << 16) | ret16[0];
+
+	ret8[0] = ret & 0xff;
+	ret8[1] = (ret >> 8) & 0xff;
+	ret8[2] = (ret >> 16) & 0xff;
+	ret8[3] = (ret >> 24) & 0xff;
+	for (i = 0; i < 4; i++) {
+		p = io[(port + i) & 0xffff];
+		while(p) {
+			q = p->next;
+			if (p->inb && !p->inw && !p->inl) {
+				ret8[i] &= p->inb(port + i, p->priv);
+				found |= 1;
+				qfound++;
+			}
+			p = q;
+		}
+	}
+	ret = (ret8[3] << 24) | (ret8[2] << 16) | (ret8[1] << 8) | ret8[0];
     }
-    ret = (ret8[3] << 24) | (ret8[2] << 16) | (ret8[1] << 8) | ret8[0];
 
     if (port & 0x80)
 	amstrad_latch = AMSTRAD_NOLATCH;
@@ -526,42 +786,51 @@ outl(uint16_t port, uint32_t val)
     int qfound = 0;
     int i = 0;
 
-    p = io[port];
-    if (p) {
-	while(p) {
-		q = p->next;
-		if (p->outl) {
-			p->outl(port, val, p->priv);
-			found |= 4;
-			qfound++;
+    io_fast[port].writes++;
+
+    p = io_fast[port].outl;
+    if (p != NULL) {
+	p->outl(port, val, p->priv);
+	found = 4;
+	qfound = 1;
+    } else {
+	p = io[port];
+	if (p) {
+		while(p) {
+			q = p->next;
+			if (p->outl) {
+				p->outl(port, val, p->priv);
+				found |= 4;
+				qfound++;
+			}
+			p = q;
 		}
-		p = q;
 	}
-    }
 
-    for (i = 0; i < 4; i += 2) {
-	p = io[(port + i) & 0xffff];
-	while(p) {
-		q = p->next;
-		if (p->outw && !p->outl) {
-			p->outw(port + i, val >> (i << 3), p->priv);
-			found |= 2;
-			qfound++;
+	for (i = 0; i < 4; i += 2) {
+		p = io[(port + i) & 0xffff];
+		while(p) {
+			q = p->next;
+			if (p->outw && !p->outl) {
+				p->outw(port + i, val >> (i << 3), p->priv);
+				found |= 2;
+				qfound++;
+			}
+			p = q;
 		}
-		p = q;
 	}
-    }
 
-    for (i = 0; i < 4; i++) {
-	p = io[(port + i) & 0xffff];
-	while(p) {
-		q = p->next;
-		if (p->outb && !p->outw && !p->outl) {
-			p->outb(port + i, val >> (i << 3), p->priv);
-			found |= 1;
-			qfound++;
+	for (i = 0; i < 4; i++) {
+		p = io[(port + i) & 0xffff];
+		while(p) {
+			q = p->next;
+			if (p->outb && !p->outw && !p->outl) {
+				p->outb(port + i, val >> (i << 3), p->priv);
+				found |= 1;
+				qfound++;
+			}
+			p = q;
 		}
-		p = q;
 	}
     }
 
@@ -577,3 +846,56 @@ outl(uint16_t port, uint32_t val)
 
     return;
 }
+
+
+/* Block versions of inw() and outw() for REP INSW/OUTSW. They only work when
+   the port's word accesses go straight to a single handler that has a block
+   callback, and return the number of words moved, 0 meaning the caller has
+   to fall back to inw()/outw(). */
+int
+io_inw_block(uint16_t port, uint8_t *buf, int count)
+{
+    io_t *p;
+    int ret;
+
+    p = io_fast[port].inw;
+    if ((p == NULL) || (p->inw_block == NULL))
+	return(0);
+
+    ret = p->inw_block(port, buf, count, p->priv);
+    if (ret == 0)
+	return(0);
+
+    io_fast[port].reads += ret;
+
+    if (port & 0x80)
+	amstrad_latch = AMSTRAD_NOLATCH;
+    else if (port & 0x4000)
+	amstrad_latch = AMSTRAD_SW10;
+    else
+	amstrad_latch = AMSTRAD_SW9;
+
+    io_log("[%04X:%08X] (%i) in w(%04X) block of %i words\n", CS, cpu_state.pc, in_smm, port, ret);
+
+    return(ret);
+}
+
+
+int
+io_outw_block(uint16_t port, uint8_t *buf, int count)
+{
+    io_t *p;
+    int ret;
+
+    p = io_fast[port].outw;
+    if ((p == NULL) || (p->outw_block == NULL))
+	return(0);
+
+    ret = p->outw_block(port, buf, count, p->priv);
+
+    io_fast[port].writes += ret;
+
+    io_log("[%04X:%08X] (%i) outw(%04X) block of %i words\n", CS, cpu_state.pc, in_smm, port, ret);
+
+    return(ret);
+}
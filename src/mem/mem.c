@@ -35,6 +35,8 @@
 #include <86box/io.h>
 #include <86box/mem.h>
 #include <86box/rom.h>
+#include <86box/timer.h>
+#include <86box/snapshot.h>
 #ifdef USE_DYNAREC
 # include "codegen_public.h"
 #else
@@ -79,13 +81,7 @@ uint32_t		biosmask, biosaddr;
 uint32_t		pccache;
 uint8_t			*pccache2;
 
-int			readlnext;
-int			readlookup[256],
-			readlookupp[256];
 uintptr_t		*readlookup2;
-int			writelnext;
-int			writelookup[256],
-			writelookupp[256];
 uintptr_t		*writelookup2;
 
 uint32_t		mem_logical_addr;
@@ -94,7 +90,6 @@ int			shadowbios = 0,
 			shadowbios_write;
 int			readlnum = 0,
 			writelnum = 0;
-int			cachesize = 256;
 
 uint32_t		get_phys_virt,
 			get_phys_phys;
@@ -104,7 +99,12 @@ int			mem_a20_key = 0,
 			mem_a20_state = 0;
 
 int			mmuflush = 0;
-int			mmu_perm = 4;
+int			mmu_perm = 6;
+
+int			mmu_tlb_size = TLB_SIZE_DEFAULT,
+			mmu_tlb_contexts = 0;
+mmu_tlb_stats_t		mmu_tlb_stats;
+uint8_t			*mmu_pt_map = NULL;
 
 uint64_t		*byte_dirty_mask;
 uint64_t		*byte_code_present_mask;
@@ -114,6 +114,9 @@ int			purgeable_page_count = 0;
 
 int			use_phys_exec = 0;
 
+uint8_t			*ram_dirty_map = NULL;
+uint32_t		ram_dirty_pages = 0;
+
 
 /* FIXME: re-do this with a 'mem_ops' struct. */
 static mem_mapping_t	*base_mapping, *last_mapping;
@@ -123,6 +126,31 @@ static uint8_t		ff_pccache[4] = { 0xff, 0xff, 0xff, 0xff };
 static uint8_t		*_mem_exec[MEM_MAPPINGS_NO];
 static uint32_t		_mem_state[MEM_MAPPINGS_NO];
 
+/* The software TLB: every valid entry in readlookup2/writelookup2 has a slot
+   here, so flushes only have to walk the slots rather than the whole 4 GB
+   tables. The slots are split into sets of TLB_WAYS, selected by the low
+   bits of the virtual page number, and replaced round-robin within a set. */
+typedef struct {
+    int		*virt;			/* virtual page, or -1 if free */
+    uint32_t	*phys;			/* physical page address */
+    uint8_t	*perm;			/* mmu_perm at fill time */
+    uint8_t	*next;			/* per set replacement pointer */
+} tlb_t;
+
+/* A saved set of translations, put back when the same CR3 is loaded again. */
+typedef struct {
+    int		valid, nread, nwrite;
+    uint32_t	key_cr0, key_cr3, key_cr4;	/* control registers when saved */
+    uint32_t	*virt, *phys;
+    uint8_t	*perm;
+} tlb_ctx_t;
+
+static tlb_t		tlb_read, tlb_write;
+static int		tlb_sets;
+static tlb_ctx_t	tlb_ctx[TLB_CONTEXTS_MAX];
+static int		tlb_ctx_next,
+			tlb_ctx_tainted;	/* current entries may predate a PT write */
+
 
 #ifdef ENABLE_MEM_LOG
 int mem_do_log = ENABLE_MEM_LOG;
@@ -153,26 +181,186 @@ mem_addr_is_ram(uint32_t addr)
 }
 
 
-void
-resetreadlookup(void)
+static __inline void
+tlb_read_drop(int c)
+{
+    readlookup2[tlb_read.virt[c]] = LOOKUP_INV;
+    tlb_read.virt[c] = -1;
+}
+
+
+static __inline void
+tlb_write_drop(int c)
+{
+    page_lookup[tlb_write.virt[c]] = NULL;
+    writelookup2[tlb_write.virt[c]] = LOOKUP_INV;
+    tlb_write.virt[c] = -1;
+}
+
+
+/* Pick the slot for a new translation: a free way in its set if there is
+   one, otherwise the next one in turn. */
+static __inline int
+tlb_slot(tlb_t *tlb, uint32_t virt)
+{
+    int set = (virt >> 12) & (tlb_sets - 1);
+    int c = set * TLB_WAYS;
+    int w;
+
+    for (w = 0; w < TLB_WAYS; w++) {
+	if (tlb->virt[c + w] == -1)
+		return(c + w);
+    }
+
+    w = tlb->next[set];
+    tlb->next[set] = (w + 1) & (TLB_WAYS - 1);
+    mmu_tlb_stats.evictions++;
+
+    return(c + w);
+}
+
+
+static void
+tlb_read_fill(uint32_t virt, uint32_t phys)
+{
+#if (defined __amd64__ || defined _M_X64)
+    uint64_t a;
+#else
+    uint32_t a;
+#endif
+    int c = tlb_slot(&tlb_read, virt);
+
+    if (tlb_read.virt[c] != -1)
+	tlb_read_drop(c);
+
+#if (defined __amd64__ || defined _M_X64)
+    a = ((uint64_t)(phys & ~0xfff) - (uint64_t)(virt & ~0xfff));
+#else
+    a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
+#endif
+
+    if ((phys & ~0xfff) >= (1 << 30))
+	readlookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
+    else
+	readlookup2[virt>>12] = (uintptr_t)&ram[a];
+
+    tlb_read.virt[c] = virt >> 12;
+    tlb_read.phys[c] = phys & ~0xfff;
+    tlb_read.perm[c] = mmu_perm;
+}
+
+
+static void
+tlb_write_fill(uint32_t virt, uint32_t phys)
+{
+#if (defined __amd64__ || defined _M_X64)
+    uint64_t a;
+#else
+    uint32_t a;
+#endif
+    int c = tlb_slot(&tlb_write, virt);
+
+    if (tlb_write.virt[c] != -1)
+	tlb_write_drop(c);
+
+#ifdef USE_NEW_DYNAREC
+#ifdef USE_DYNAREC
+    if (pages[phys >> 12].block || (phys & ~0xfff) == recomp_page)
+#else
+    if (pages[phys >> 12].block)
+#endif
+#else
+#ifdef USE_DYNAREC
+    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3] || (phys & ~0xfff) == recomp_page)
+#else
+    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3])
+#endif
+#endif
+	page_lookup[virt >> 12] = &pages[phys >> 12];
+    else {
+#if (defined __amd64__ || defined _M_X64)
+	a = ((uint64_t)(phys & ~0xfff) - (uint64_t)(virt & ~0xfff));
+#else
+	a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
+#endif
+
+	if ((phys & ~0xfff) >= (1 << 30))
+		writelookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
+	else
+		writelookup2[virt>>12] = (uintptr_t)&ram[a];
+    }
+
+    tlb_write.virt[c] = virt >> 12;
+    tlb_write.phys[c] = phys & ~0xfff;
+    tlb_write.perm[c] = mmu_perm;
+}
+
+
+static void
+tlb_ctx_drop(void)
 {
     int c;
 
+    for (c = 0; c < mmu_tlb_contexts; c++) {
+	if (tlb_ctx[c].valid) {
+		tlb_ctx[c].valid = 0;
+		mmu_tlb_stats.ctx_drops++;
+	}
+    }
+}
+
+
+static void
+tlb_flush(void)
+{
+    int c;
+
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if (tlb_read.virt[c] != -1)
+		tlb_read_drop(c);
+	if (tlb_write.virt[c] != -1)
+		tlb_write_drop(c);
+    }
+
+    tlb_ctx_tainted = 0;
+    mmu_tlb_stats.flushes++;
+}
+
+
+static void
+tlb_alloc(tlb_t *tlb)
+{
+    tlb->virt = (int *) malloc(mmu_tlb_size * sizeof(int));
+    tlb->phys = (uint32_t *) malloc(mmu_tlb_size * sizeof(uint32_t));
+    tlb->perm = (uint8_t *) malloc(mmu_tlb_size);
+    tlb->next = (uint8_t *) malloc(tlb_sets);
+
+    memset(tlb->virt, 0xff, mmu_tlb_size * sizeof(int));
+    memset(tlb->next, 0x00, tlb_sets);
+}
+
+
+void
+resetreadlookup(void)
+{
     /* Initialize the page lookup table. */
     memset(page_lookup, 0x00, (1<<20)*sizeof(page_t *));
 
-    /* Initialize the tables for lower (<= 1024K) RAM. */
-    for (c = 0; c < 256; c++) {
-	readlookup[c] = 0xffffffff;
-	writelookup[c] = 0xffffffff;
-    }
+    /* Initialize the TLB slots. */
+    memset(tlb_read.virt, 0xff, mmu_tlb_size * sizeof(int));
+    memset(tlb_write.virt, 0xff, mmu_tlb_size * sizeof(int));
+    memset(tlb_read.next, 0x00, tlb_sets);
+    memset(tlb_write.next, 0x00, tlb_sets);
+
+    tlb_ctx_drop();
+    tlb_ctx_tainted = 0;
+    if (mmu_pt_map != NULL)
+	memset(mmu_pt_map, 0x00, (1 << 20) >> 3);
 
-    /* Initialize the tables for high (> 1024K) RAM. */
+    /* Initialize the lookup tables themselves. */
     memset(readlookup2, 0xff, (1<<20)*sizeof(uintptr_t));
     memset(writelookup2, 0xff, (1<<20)*sizeof(uintptr_t));
 
-    readlnext = 0;
-    writelnext = 0;
     pccache = 0xffffffff;
 }
 
@@ -180,19 +368,8 @@ resetreadlookup(void)
 void
 flushmmucache(void)
 {
-    int c;
-
-    for (c = 0; c < 256; c++) {
-	if (readlookup[c] != (int) 0xffffffff) {
-		readlookup2[readlookup[c]] = LOOKUP_INV;
-		readlookup[c] = 0xffffffff;
-	}
-	if (writelookup[c] != (int) 0xffffffff) {
-		page_lookup[writelookup[c]] = NULL;
-		writelookup2[writelookup[c]] = LOOKUP_INV;
-		writelookup[c] = 0xffffffff;
-	}
-    }
+    tlb_flush();
+    tlb_ctx_drop();
     mmuflush++;
 
     pccache = (uint32_t)0xffffffff;
@@ -207,38 +384,47 @@ flushmmucache(void)
 void
 flushmmucache_nopc(void)
 {
-    int c;
+    tlb_flush();
+    tlb_ctx_drop();
 
-    for (c = 0; c < 256; c++) {
-	if (readlookup[c] != (int) 0xffffffff) {
-		readlookup2[readlookup[c]] = LOOKUP_INV;
-		readlookup[c] = 0xffffffff;
-	}
-	if (writelookup[c] != (int) 0xffffffff) {
-		page_lookup[writelookup[c]] = NULL;
-		writelookup2[writelookup[c]] = LOOKUP_INV;
-		writelookup[c] = 0xffffffff;
-	}
-    }
+#ifdef USE_DYNAREC
+    codegen_flush();
+#endif
 }
 
 
 void
 flushmmucache_cr3(void)
+{
+    tlb_flush();
+    tlb_ctx_drop();
+
+#ifdef USE_DYNAREC
+    codegen_flush();
+#endif
+}
+
+
+/* Called when going to CPL 3. Entries filled at a higher privilege level
+   can give user code access to supervisor pages (or write access to read
+   only ones), so those have to go, but the user page entries stay. */
+void
+flushmmucache_cpl3(void)
 {
     int c;
 
-    for (c = 0; c < 256; c++) {
-	if (readlookup[c] != (int) 0xffffffff) {
-		readlookup2[readlookup[c]] = LOOKUP_INV;
-		readlookup[c] = 0xffffffff;
-	}
-	if (writelookup[c] != (int) 0xffffffff) {
-		page_lookup[writelookup[c]] = NULL;
-		writelookup2[writelookup[c]] = LOOKUP_INV;
-		writelookup[c] = 0xffffffff;
-	}
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if ((tlb_read.virt[c] != -1) && !(tlb_read.perm[c] & 4))
+		tlb_read_drop(c);
+	if ((tlb_write.virt[c] != -1) && ((tlb_write.perm[c] & 6) != 6))
+		tlb_write_drop(c);
     }
+
+    mmu_tlb_stats.cpl3_flushes++;
+
+#ifdef USE_DYNAREC
+    codegen_flush();
+#endif
 }
 
 
@@ -249,8 +435,8 @@ mem_flush_write_page(uint32_t addr, uint32_t virt)
     int c;
     uint32_t a;
 
-    for (c = 0; c < 256; c++) {
-	if (writelookup[c] != (int) 0xffffffff) {
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if (tlb_write.virt[c] != -1) {
 		a = (uintptr_t)(addr & ~0xfff) - (virt & ~0xfff);
 		uintptr_t target;
 
@@ -259,21 +445,64 @@ mem_flush_write_page(uint32_t addr, uint32_t virt)
 		else
 			target = (uintptr_t)&ram[a];
 
-		if (writelookup2[writelookup[c]] == target || page_lookup[writelookup[c]] == page_target) {
-			writelookup2[writelookup[c]] = LOOKUP_INV;
-			page_lookup[writelookup[c]] = NULL;
-			writelookup[c] = 0xffffffff;
-		}
+		if (writelookup2[tlb_write.virt[c]] == target || page_lookup[tlb_write.virt[c]] == page_target)
+			tlb_write_drop(c);
 	}
     }
 }
 
 
+/* A page was just found to hold page tables. From now on writes to it have
+   to take the slow path so mmu_pt_write() sees them, so drop the fast path
+   entries for it, and the saved contexts since they may have some too. */
+static void
+mmu_pt_add(uint32_t page)
+{
+    int c;
+
+    mmu_pt_map[page >> 3] |= (1 << (page & 7));
+
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if ((tlb_write.virt[c] != -1) && ((tlb_write.phys[c] >> 12) == page))
+		tlb_write_drop(c);
+    }
+
+    tlb_ctx_drop();
+}
+
+
+static __inline void
+mmu_pt_mark(uint64_t addr)
+{
+    uint32_t page;
+
+    if ((mmu_pt_map == NULL) || (addr > 0xffffffffULL))
+	return;
+
+    page = (uint32_t) (addr >> 12);
+    if (!(mmu_pt_map[page >> 3] & (1 << (page & 7))))
+	mmu_pt_add(page);
+}
+
+
 #define mmutranslate_read(addr) mmutranslatereal(addr,0)
 #define mmutranslate_write(addr) mmutranslatereal(addr,1)
 #define rammap(x)	((uint32_t *)(_mem_exec[(x) >> MEM_GRANULARITY_BITS]))[((x) >> 2) & MEM_GRANULARITY_QMASK]
 #define rammap64(x)	((uint64_t *)(_mem_exec[(x) >> MEM_GRANULARITY_BITS]))[((x) >> 3) & MEM_GRANULARITY_PMASK]
 
+
+/* Setting the accessed and dirty bits writes to guest RAM, so the page has
+   to go into the next incremental snapshot. This bypasses mem_dirty_set(),
+   as the walk's own updates must not count as page table writes. */
+static __inline void
+mmu_pt_dirty(uint64_t addr)
+{
+    uint64_t page = addr >> 12;
+
+    if (page < ram_dirty_pages)
+	ram_dirty_map[page >> 3] |= (1 << (page & 7));
+}
+
 static __inline uint64_t
 mmutranslatereal_normal(uint32_t addr, int rw)
 {
@@ -310,8 +539,10 @@ mmutranslatereal_normal(uint32_t addr, int rw)
 		return 0xffffffffffffffffULL;
 	}
 
-	mmu_perm = temp & 4;
+	mmu_perm = temp & 6;
+	mmu_pt_mark(addr2);
 	rammap(addr2) |= 0x20;
+	mmu_pt_dirty(addr2);
 
 	return (temp & ~0x3fffff) + (addr & 0x3fffff);
     }
@@ -328,9 +559,13 @@ mmutranslatereal_normal(uint32_t addr, int rw)
 	return 0xffffffffffffffffULL;
     }
 
-    mmu_perm = temp & 4;
+    mmu_perm = temp3 & 6;
+    mmu_pt_mark(addr2);
+    mmu_pt_mark(temp2 & ~0xfff);
     rammap(addr2) |= 0x20;
     rammap((temp2 & ~0xfff) + ((addr >> 10) & 0xffc)) |= (rw?0x60:0x20);
+    mmu_pt_dirty(addr2);
+    mmu_pt_dirty(temp2 & ~0xfff);
 
     return (uint64_t) ((temp&~0xfff)+(addr&0xfff));
 }
@@ -384,8 +619,11 @@ mmutranslatereal_pae(uint32_t addr, int rw)
 
 		return 0xffffffffffffffffULL;
 	}
-	mmu_perm = temp & 4;
+	mmu_perm = temp & 6;
+	mmu_pt_mark(addr2);
+	mmu_pt_mark(addr3);
 	rammap64(addr3) |= 0x20;
+	mmu_pt_dirty(addr3);
 
 	return ((temp & ~0x1fffffULL) + (addr & 0x1fffffULL)) & 0x000000ffffffffffULL;
     }
@@ -403,9 +641,14 @@ mmutranslatereal_pae(uint32_t addr, int rw)
 	return 0xffffffffffffffffULL;
     }
 
-    mmu_perm = temp & 4;
+    mmu_perm = temp3 & 6;
+    mmu_pt_mark(addr2);
+    mmu_pt_mark(addr3);
+    mmu_pt_mark(addr4);
     rammap64(addr3) |= 0x20;
     rammap64(addr4) |= (rw? 0x60 : 0x20);
+    mmu_pt_dirty(addr3);
+    mmu_pt_dirty(addr4);
 
     return ((temp & ~0xfffULL) + ((uint64_t) (addr & 0xfff))) & 0x000000ffffffffffULL;
 }
@@ -449,6 +692,9 @@ mmutranslate_noabrt_normal(uint32_t addr, int rw)
 	if (((CPL == 3) && !(temp & 4) && !cpl_override) || (rw && !(temp & 2) && ((CPL == 3) || (cr0 & WP_FLAG))))
 		return 0xffffffffffffffffULL;
 
+	mmu_perm = temp & 6;
+	mmu_pt_mark(addr2);
+
 	return (temp & ~0x3fffff) + (addr & 0x3fffff);
     }
 
@@ -458,6 +704,10 @@ mmutranslate_noabrt_normal(uint32_t addr, int rw)
     if (!(temp & 1) || ((CPL == 3) && !(temp3 & 4) && !cpl_override) || (rw && !(temp3 & 2) && ((CPL == 3) || (cr0 & WP_FLAG))))
 	return 0xffffffffffffffffULL;
 
+    mmu_perm = temp3 & 6;
+    mmu_pt_mark(addr2);
+    mmu_pt_mark(temp2 & ~0xfff);
+
     return (uint64_t) ((temp & ~0xfff) + (addr & 0xfff));
 }
 
@@ -489,6 +739,10 @@ mmutranslate_noabrt_pae(uint32_t addr, int rw)
 	if (((CPL == 3) && !(temp & 4) && !cpl_override) || (rw && !(temp & 2) && ((CPL == 3) || (cr0 & WP_FLAG))))
 		return 0xffffffffffffffffULL;
 
+	mmu_perm = temp & 6;
+	mmu_pt_mark(addr2);
+	mmu_pt_mark(addr3);
+
 	return ((temp & ~0x1fffffULL) + (addr & 0x1fffff)) & 0x000000ffffffffffULL;
     }
 
@@ -499,6 +753,11 @@ mmutranslate_noabrt_pae(uint32_t addr, int rw)
     if (!(temp&1) || ((CPL == 3) && !(temp3 & 4) && !cpl_override) || (rw && !(temp3 & 2) && ((CPL == 3) || (cr0 & WP_FLAG))))
 	return 0xffffffffffffffffULL;
 
+    mmu_perm = temp3 & 6;
+    mmu_pt_mark(addr2);
+    mmu_pt_mark(addr3);
+    mmu_pt_mark(addr4);
+
     return ((temp & ~0xfffULL) + ((uint64_t) (addr & 0xfff))) & 0x000000ffffffffffULL;
 }
 
@@ -513,10 +772,167 @@ mmutranslate_noabrt(uint32_t addr, int rw)
 }
 
 
+/* INVLPG. Drop the whole 4 MB region around the address, which also covers
+   large pages and page directory entries that were changed. */
 void
 mmu_invalidate(uint32_t addr)
 {
-    flushmmucache_cr3();
+    int region = addr >> 22;
+    int c;
+
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if ((tlb_read.virt[c] != -1) && ((tlb_read.virt[c] >> 10) == region))
+		tlb_read_drop(c);
+	if ((tlb_write.virt[c] != -1) && ((tlb_write.virt[c] >> 10) == region))
+		tlb_write_drop(c);
+    }
+
+    mmu_tlb_stats.invalidations++;
+
+#ifdef USE_DYNAREC
+    codegen_flush();
+#endif
+}
+
+
+/* Called for every write to a page that holds page tables. Keeping the
+   current translations in sync is up to the guest, but the saved contexts
+   would outlive the CR3 load it uses for that, so they have to go, and the
+   current entries can no longer be saved either. */
+void
+mmu_pt_write(uint32_t addr)
+{
+    tlb_ctx_drop();
+    tlb_ctx_tainted = 1;
+}
+
+
+static void
+tlb_ctx_save(void)
+{
+    tlb_ctx_t *ctx = NULL;
+    int c, n = 0;
+
+    if (tlb_ctx_tainted)
+	return;
+
+    for (c = 0; c < mmu_tlb_contexts; c++) {
+	if (tlb_ctx[c].valid && (tlb_ctx[c].key_cr3 == cr3)) {
+		ctx = &tlb_ctx[c];
+		break;
+	}
+    }
+    if (ctx == NULL) {
+	ctx = &tlb_ctx[tlb_ctx_next];
+	tlb_ctx_next = (tlb_ctx_next + 1) % mmu_tlb_contexts;
+    }
+
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if (tlb_read.virt[c] != -1) {
+		ctx->virt[n] = tlb_read.virt[c];
+		ctx->phys[n] = tlb_read.phys[c];
+		ctx->perm[n++] = tlb_read.perm[c];
+	}
+    }
+    ctx->nread = n;
+
+    for (c = 0; c < mmu_tlb_size; c++) {
+	if (tlb_write.virt[c] != -1) {
+		ctx->virt[n] = tlb_write.virt[c];
+		ctx->phys[n] = tlb_write.phys[c];
+		ctx->perm[n++] = tlb_write.perm[c];
+	}
+    }
+    ctx->nwrite = n - ctx->nread;
+
+    ctx->key_cr0 = cr0;
+    ctx->key_cr3 = cr3;
+    ctx->key_cr4 = cr4;
+    ctx->valid = 1;
+}
+
+
+static void
+tlb_ctx_restore(void)
+{
+    tlb_ctx_t *ctx = NULL;
+    int c, old_perm = mmu_perm;
+    uint32_t virt;
+
+    for (c = 0; c < mmu_tlb_contexts; c++) {
+	if (tlb_ctx[c].valid && (tlb_ctx[c].key_cr3 == cr3) &&
+	    (tlb_ctx[c].key_cr0 == cr0) && (tlb_ctx[c].key_cr4 == cr4)) {
+		ctx = &tlb_ctx[c];
+		break;
+	}
+    }
+    if (ctx == NULL) {
+	mmu_tlb_stats.ctx_misses++;
+	return;
+    }
+
+    for (c = 0; c < ctx->nread; c++) {
+	mmu_perm = ctx->perm[c];
+	tlb_read_fill(ctx->virt[c] << 12, ctx->phys[c]);
+    }
+
+    for (; c < (ctx->nread + ctx->nwrite); c++) {
+	virt = ctx->virt[c];
+	if ((writelookup2[virt] != (uintptr_t) LOOKUP_INV) || page_lookup[virt])
+		continue;
+	mmu_perm = ctx->perm[c];
+	mem_dirty_set(ctx->phys[c]);
+	tlb_write_fill(virt << 12, ctx->phys[c]);
+    }
+
+    mmu_perm = old_perm;
+
+    mmu_tlb_stats.ctx_hits++;
+    mmu_tlb_stats.ctx_entries += ctx->nread + ctx->nwrite;
+}
+
+
+/* MOV to CR3. Without saved contexts this is just a flush. With them, the
+   outgoing translations are kept and the incoming ones are put back, much
+   like a TLB tagged by CR3, which is safe as long as no page tables were
+   written in the meantime (see mmu_pt_write()). */
+void
+mmu_load_cr3(uint32_t val)
+{
+    if ((mmu_tlb_contexts == 0) || !(cr0 >> 31)) {
+	cr3 = val;
+	flushmmucache();
+	return;
+    }
+
+    tlb_ctx_save();
+
+    cr3 = val;
+    tlb_flush();
+    mmuflush++;
+
+    pccache = (uint32_t)0xffffffff;
+    pccache2 = (uint8_t *)0xffffffff;
+
+#ifdef USE_DYNAREC
+    codegen_flush();
+#endif
+
+    tlb_ctx_restore();
+}
+
+
+void
+mmu_tlb_stats_reset(void)
+{
+    mem_log("TLB: %u/%u fills, %u evictions, %u flushes, %u INVLPG, %u CPL 3, "
+	    "contexts %u/%u (%u entries), %u dropped\n",
+	    mmu_tlb_stats.read_fills, mmu_tlb_stats.write_fills, mmu_tlb_stats.evictions,
+	    mmu_tlb_stats.flushes, mmu_tlb_stats.invalidations, mmu_tlb_stats.cpl3_flushes,
+	    mmu_tlb_stats.ctx_hits, mmu_tlb_stats.ctx_misses, mmu_tlb_stats.ctx_entries,
+	    mmu_tlb_stats.ctx_drops);
+
+    memset(&mmu_tlb_stats, 0x00, sizeof(mmu_tlb_stats_t));
 }
 
 
@@ -544,33 +960,12 @@ mem_addr_translate(uint32_t addr, uint32_t chunk_start, uint32_t len)
 void
 addreadlookup(uint32_t virt, uint32_t phys)
 {
-#if (defined __amd64__ || defined _M_X64)
-    uint64_t a;
-#else
-    uint32_t a;
-#endif
-
     if (virt == 0xffffffff) return;
 
     if (readlookup2[virt>>12] != (uintptr_t) LOOKUP_INV) return;
 
-    if (readlookup[readlnext] != (int) 0xffffffff)
-	readlookup2[readlookup[readlnext]] = LOOKUP_INV;
-
-#if (defined __amd64__ || defined _M_X64)
-    a = ((uint64_t)(phys & ~0xfff) - (uint64_t)(virt & ~0xfff));
-#else
-    a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
-#endif
-
-    if ((phys & ~0xfff) >= (1 << 30))
-	readlookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
-    else
-	readlookup2[virt>>12] = (uintptr_t)&ram[a];
-
-    readlookupp[readlnext] = mmu_perm;
-    readlookup[readlnext++] = virt >> 12;
-    readlnext &= (cachesize-1);
+    tlb_read_fill(virt, phys);
+    mmu_tlb_stats.read_fills++;
 
     cycles -= 9;
 }
@@ -579,51 +974,25 @@ addreadlookup(uint32_t virt, uint32_t phys)
 void
 addwritelookup(uint32_t virt, uint32_t phys)
 {
-#if (defined __amd64__ || defined _M_X64)
-    uint64_t a;
-#else
-    uint32_t a;
-#endif
-
     if (virt == 0xffffffff) return;
 
     if (page_lookup[virt >> 12]) return;
 
-    if (writelookup[writelnext] != -1) {
-	page_lookup[writelookup[writelnext]] = NULL;
-	writelookup2[writelookup[writelnext]] = LOOKUP_INV;
-    }
+    /* Any write through the lookup tables has to come through here first
+       after a flushmmucache(), so this is where snapshot dirty tracking
+       hooks into the fast path. */
+    mem_dirty_set(phys);
 
-#ifdef USE_NEW_DYNAREC
-#ifdef USE_DYNAREC
-    if (pages[phys >> 12].block || (phys & ~0xfff) == recomp_page)
-#else
-    if (pages[phys >> 12].block)
-#endif
-#else
-#ifdef USE_DYNAREC
-    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3] || (phys & ~0xfff) == recomp_page)
-#else
-    if (pages[phys >> 12].block[0] || pages[phys >> 12].block[1] || pages[phys >> 12].block[2] || pages[phys >> 12].block[3])
-#endif
-#endif
-	page_lookup[virt >> 12] = &pages[phys >> 12];
-    else {
-#if (defined __amd64__ || defined _M_X64)
-	a = ((uint64_t)(phys & ~0xfff) - (uint64_t)(virt & ~0xfff));
-#else
-	a = ((uint32_t)(phys & ~0xfff) - (uint32_t)(virt & ~0xfff));
-#endif
+    /* Page tables are always written through the slow path. */
+    if ((mmu_pt_map != NULL) && (mmu_pt_map[phys >> 15] & (1 << ((phys >> 12) & 7))))
+	return;
 
-	if ((phys & ~0xfff) >= (1 << 30))
-		writelookup2[virt>>12] = (uintptr_t)&ram2[a - (1 << 30)];
-	else
-		writelookup2[virt>>12] = (uintptr_t)&ram[a];
-    }
+    /* Not every write checks the fast path first, so don't fill twice. */
+    if (writelookup2[virt >> 12] != (uintptr_t) LOOKUP_INV)
+	return;
 
-    writelookupp[writelnext] = mmu_perm;
-    writelookup[writelnext++] = virt >> 12;
-    writelnext &= (cachesize - 1);
+    tlb_write_fill(virt, phys);
+    mmu_tlb_stats.write_fills++;
 
     cycles -= 9;
 }
@@ -1653,6 +2022,53 @@ mem_write_phys(void *src, uint32_t addr, int transfer_size)
 }
 
 
+/* Bulk copies for bus master DMA. If the page at addr is plain RAM, copy len
+   bytes (which must not cross the end of the page) directly and return len,
+   otherwise return 0 and leave it to the caller to go through the mappings. */
+uint32_t
+mem_read_phys_ram(void *dest, uint32_t addr, uint32_t len)
+{
+    mem_mapping_t *map = read_mapping[addr >> MEM_GRANULARITY_BITS];
+
+    if (use_phys_exec || (map == NULL))
+	return 0;
+
+    if (map->read_l == mem_read_raml)
+	memcpy(dest, &ram[addr], len);
+    else if (map->read_l == mem_read_ram_2gbl)
+	memcpy(dest, &ram2[addr - (1 << 30)], len);
+    else
+	return 0;
+
+    return len;
+}
+
+
+uint32_t
+mem_write_phys_ram(const void *src, uint32_t addr, uint32_t len)
+{
+    mem_mapping_t *map = write_mapping[addr >> MEM_GRANULARITY_BITS];
+
+    if (use_phys_exec || (map == NULL) || (map->write_l != mem_write_raml))
+	return 0;
+
+    if (AT)
+	memcpy(&pages[addr >> 12].mem[addr & 0xfff], src, len);
+    else
+	memcpy(&ram[addr], src, len);
+
+    /* This skips the page write functions, so do their bookkeeping here. */
+    mem_dirty_set(addr);
+    mem_invalidate_range(addr, addr + len - 1);
+#ifdef USE_NEW_DYNAREC
+    if ((addr >> 12) < pages_sz)
+	page_invalidate_bytes(&pages[addr >> 12], addr, len);
+#endif
+
+    return len;
+}
+
+
 uint8_t
 mem_read_ram(uint32_t addr, void *priv)
 {
@@ -1740,6 +2156,24 @@ mem_read_ram_2gbl(uint32_t addr, void *priv)
 }
 
 
+/* The page write functions get the virtual address, so work the RAM page out
+   from the page's backing memory instead. */
+static __inline void
+mem_dirty_set_page(page_t *p)
+{
+    if ((p == NULL) || (p->mem == NULL))
+	return;
+
+#if (!(defined __amd64__ || defined _M_X64))
+    if ((ram2 != NULL) && (p->mem >= ram2) && (p->mem < (ram2 + (mem_size << 10) - (1 << 30)))) {
+	mem_dirty_set((1 << 30) + (uint32_t) (p->mem - ram2));
+	return;
+    }
+#endif
+    mem_dirty_set((uint32_t) ((uintptr_t) p->mem - (uintptr_t) ram));
+}
+
+
 #ifdef USE_NEW_DYNAREC
 static inline int
 page_index(page_t *p)
@@ -1756,6 +2190,11 @@ page_add_to_evict_list(page_t *p)
     p->evict_prev = 0;
     purgable_page_list_head = pages[purgable_page_list_head].evict_prev;
     purgeable_page_count++;
+
+#ifdef USE_DYNAREC
+    /* Blocks on the page may be stale now, stop jumping to them directly. */
+    codegen_unlink_page(p);
+#endif
 }
 
 
@@ -1781,6 +2220,8 @@ mem_write_ramb_page(uint32_t addr, uint8_t val, page_t *p)
     if ((p != NULL) && (p->mem == page_ff))
 	return;
 
+    mem_dirty_set_page(p);
+
 #ifdef USE_DYNAREC
     if (val != p->mem[addr & 0xfff] || codegen_in_recompile) {
 #else
@@ -1807,6 +2248,8 @@ mem_write_ramw_page(uint32_t addr, uint16_t val, page_t *p)
     if ((p != NULL) && (p->mem == page_ff))
 	return;
 
+    mem_dirty_set_page(p);
+
 #ifdef USE_DYNAREC
     if (val != *(uint16_t *)&p->mem[addr & 0xfff] || codegen_in_recompile) {
 #else
@@ -1843,6 +2286,8 @@ mem_write_raml_page(uint32_t addr, uint32_t val, page_t *p)
     if ((p != NULL) && (p->mem == page_ff))
 	return;
 
+    mem_dirty_set_page(p);
+
 #ifdef USE_DYNAREC
     if (val != *(uint32_t *)&p->mem[addr & 0xfff] || codegen_in_recompile) {
 #else
@@ -1875,6 +2320,8 @@ mem_write_ramb_page(uint32_t addr, uint8_t val, page_t *p)
     if ((p != NULL) && (p->mem == page_ff))
 	return;
 
+    mem_dirty_set_page(p);
+
 #ifdef USE_DYNAREC
     if ((p == NULL) || (p->mem == NULL) || (val != p->mem[addr & 0xfff]) || codegen_in_recompile) {
 #else
@@ -1893,6 +2340,8 @@ mem_write_ramw_page(uint32_t addr, uint16_t val, page_t *p)
     if ((p != NULL) && (p->mem == page_ff))
 	return;
 
+    mem_dirty_set_page(p);
+
 #ifdef USE_DYNAREC
     if ((p == NULL) || (p->mem == NULL) || (val != *(uint16_t *)&p->mem[addr & 0xfff]) || codegen_in_recompile) {
 #else
@@ -1913,6 +2362,8 @@ mem_write_raml_page(uint32_t addr, uint32_t val, page_t *p)
     if ((p != NULL) && (p->mem == page_ff))
 	return;
 
+    mem_dirty_set_page(p);
+
 #ifdef USE_DYNAREC
     if ((p == NULL) || (p->mem == NULL) || (val != *(uint32_t *)&p->mem[addr & 0xfff]) || codegen_in_recompile) {
 #else
@@ -1938,8 +2389,10 @@ mem_write_ram(uint32_t addr, uint8_t val, void *priv)
     if (AT) {	
 	addwritelookup(mem_logical_addr, addr);
 	mem_write_ramb_page(addr, val, &pages[addr >> 12]);
-    } else
+    } else {
+	mem_dirty_set(addr);
 	ram[addr] = val;
+    }
 }
 
 
@@ -1953,8 +2406,10 @@ mem_write_ramw(uint32_t addr, uint16_t val, void *priv)
     if (AT) {
 	addwritelookup(mem_logical_addr, addr);
 	mem_write_ramw_page(addr, val, &pages[addr >> 12]);
-    } else
+    } else {
+	mem_dirty_set(addr);
 	*(uint16_t *)&ram[addr] = val;
+    }
 }
 
 
@@ -1968,8 +2423,10 @@ mem_write_raml(uint32_t addr, uint32_t val, void *priv)
     if (AT) {
 	addwritelookup(mem_logical_addr, addr);
 	mem_write_raml_page(addr, val, &pages[addr >> 12]);
-    } else
+    } else {
+	mem_dirty_set(addr);
 	*(uint32_t *)&ram[addr] = val;
+    }
 }
 
 
@@ -2015,8 +2472,10 @@ mem_write_remapped(uint32_t addr, uint8_t val, void *priv)
     if (AT) {
 	addwritelookup(mem_logical_addr, addr);
 	mem_write_ramb_page(addr, val, &pages[oldaddr >> 12]);
-    } else
+    } else {
+	mem_dirty_set(addr);
 	ram[addr] = val;
+    }
 }
 
 
@@ -2029,8 +2488,10 @@ mem_write_remappedw(uint32_t addr, uint16_t val, void *priv)
     if (AT) {
 	addwritelookup(mem_logical_addr, addr);
 	mem_write_ramw_page(addr, val, &pages[oldaddr >> 12]);
-    } else
+    } else {
+	mem_dirty_set(addr);
 	*(uint16_t *)&ram[addr] = val;
+    }
 }
 
 
@@ -2043,8 +2504,10 @@ mem_write_remappedl(uint32_t addr, uint32_t val, void *priv)
     if (AT) {
 	addwritelookup(mem_logical_addr, addr);
 	mem_write_raml_page(addr, val, &pages[oldaddr >> 12]);
-    } else
+    } else {
+	mem_dirty_set(addr);
 	*(uint32_t *)&ram[addr] = val;
+    }
 }
 
 
@@ -2656,6 +3119,15 @@ mem_reset(void)
     memset(byte_code_present_mask, 0, (mem_size * 1024) / 8);
 #endif
 
+    /* Everything is dirty until the first snapshot has been taken. */
+    if (ram_dirty_map) {
+	free(ram_dirty_map);
+	ram_dirty_map = NULL;
+    }
+    ram_dirty_pages = ((mem_size << 10) + 4095) >> 12;
+    ram_dirty_map = (uint8_t *)malloc((ram_dirty_pages + 7) >> 3);
+    memset(ram_dirty_map, 0xff, (ram_dirty_pages + 7) >> 3);
+
     for (c = 0; c < pages_sz; c++) {
 	if ((c << 12) >= (mem_size << 10))
 		pages[c].mem = page_ff;
@@ -2770,6 +3242,8 @@ mem_reset(void)
 void
 mem_init(void)
 {
+    int c;
+
     /* Perform a one-time init. */
     ram = rom = NULL;
     ram2 = NULL;
@@ -2779,6 +3253,35 @@ mem_init(void)
     page_lookup = (page_t **)malloc((1<<20)*sizeof(page_t *));
     readlookup2  = malloc((1<<20)*sizeof(uintptr_t));
     writelookup2 = malloc((1<<20)*sizeof(uintptr_t));
+
+    /* The TLB size has to be a power of two, TLB_WAYS or more. */
+    c = TLB_WAYS;
+    while ((c < TLB_SIZE_MAX) && ((c << 1) <= mmu_tlb_size))
+	c <<= 1;
+    mmu_tlb_size = c;
+    tlb_sets = mmu_tlb_size / TLB_WAYS;
+
+    tlb_alloc(&tlb_read);
+    tlb_alloc(&tlb_write);
+
+    if (mmu_tlb_contexts > TLB_CONTEXTS_MAX)
+	mmu_tlb_contexts = TLB_CONTEXTS_MAX;
+    else if (mmu_tlb_contexts < 0)
+	mmu_tlb_contexts = 0;
+
+    for (c = 0; c < mmu_tlb_contexts; c++) {
+	tlb_ctx[c].virt = (uint32_t *) malloc(2 * mmu_tlb_size * sizeof(uint32_t));
+	tlb_ctx[c].phys = (uint32_t *) malloc(2 * mmu_tlb_size * sizeof(uint32_t));
+	tlb_ctx[c].perm = (uint8_t *) malloc(2 * mmu_tlb_size);
+	tlb_ctx[c].valid = 0;
+    }
+
+    if (mmu_tlb_contexts > 0) {
+	mmu_pt_map = (uint8_t *) malloc((1 << 20) >> 3);
+	memset(mmu_pt_map, 0x00, (1 << 20) >> 3);
+    }
+
+    mem_log("MEM: %i entry %i-way TLB, %i saved contexts\n", mmu_tlb_size, TLB_WAYS, mmu_tlb_contexts);
 }
 
 
@@ -2870,3 +3373,79 @@ mem_a20_recalc(void)
 
     mem_a20_state = state;
 }
+
+
+/* Return the host address of the given 4K page of guest RAM. */
+uint8_t *
+mem_ram_page(uint32_t page)
+{
+#if (!(defined __amd64__ || defined _M_X64))
+    if ((ram2 != NULL) && (page >= ((1 << 30) >> 12)))
+	return &ram2[(page << 12) - (1 << 30)];
+#endif
+    return &ram[page << 12];
+}
+
+
+/* Start a new dirty tracking interval. Flushing the MMU cache forces every
+   subsequent write to a page back through addwritelookup(). */
+void
+mem_dirty_clear(void)
+{
+    if (ram_dirty_map != NULL)
+	memset(ram_dirty_map, 0x00, (ram_dirty_pages + 7) >> 3);
+
+    flushmmucache();
+}
+
+
+/* Save or restore the memory mapping state. The mappings themselves are
+   owned by the devices, which register them in the same order on every
+   hard reset, so only their placement has to be stored. */
+void
+mem_state(snapshot_t *s)
+{
+    mem_mapping_t *map;
+    uint32_t count = 0, base, size;
+    int enable;
+
+    for (map = base_mapping; map != NULL; map = map->next)
+	count++;
+
+    snapshot_item(s, count);
+    if (s->loading) {
+	for (map = base_mapping; map != NULL; map = map->next)
+		count--;
+	if (count != 0) {
+		s->error = 1;
+		return;
+	}
+    }
+
+    for (map = base_mapping; map != NULL; map = map->next) {
+	base = map->base;
+	size = map->size;
+	enable = map->enable;
+	snapshot_item(s, base);
+	snapshot_item(s, size);
+	snapshot_item(s, enable);
+	if (s->loading) {
+		map->base = base;
+		map->size = size;
+		map->enable = enable;
+	}
+    }
+
+    snapshot_var(s, _mem_state, sizeof(_mem_state));
+    snapshot_item(s, rammask);
+    snapshot_item(s, mem_a20_key);
+    snapshot_item(s, mem_a20_alt);
+    snapshot_item(s, mem_a20_state);
+    snapshot_item(s, shadowbios);
+    snapshot_item(s, shadowbios_write);
+
+    if (s->loading && !s->error) {
+	mem_mapping_recalc(0ULL, 0x100000000ULL);
+	flushmmucache();
+    }
+}
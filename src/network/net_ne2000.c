@@ -811,6 +811,68 @@ nic_pnp_address_writeb(uint16_t addr, uint8_t val, void *priv)
 }
 
 
+/*
+ * Number of words that can be moved through the data register as a block
+ * for REP INSW/OUTSW. Only a word-wide remote DMA inside the packet memory
+ * qualifies, and the word that wraps the ring or completes the transfer is
+ * left to asic_read()/asic_write().
+ */
+static int
+asic_block_len(nic_t *dev, int count)
+{
+    dp8390_t *dp = dev->dp8390;
+    int ring_end = dp->page_stop << 8;
+
+    if (!dp->DCR.wdsize || (dp->remote_dma < dp->mem_start) || (dp->remote_dma & 1))
+	return(0);
+
+    count = MIN(count, (dp->remote_bytes - 1) >> 1);
+    count = MIN(count, (dp->mem_end - dp->remote_dma) >> 1);
+    if (dp->remote_dma < ring_end)
+	count = MIN(count, ((ring_end - dp->remote_dma) >> 1) - 1);
+
+    return(MAX(count, 0));
+}
+
+
+static int
+nic_readw_block(uint16_t addr, uint8_t *buf, int count, void *priv)
+{
+    nic_t *dev = (nic_t *)priv;
+
+    if ((addr - dev->base_address) != 0x10)
+	return(0);
+
+    count = asic_block_len(dev, count);
+    if (count) {
+	memcpy(buf, &dev->dp8390->mem[dev->dp8390->remote_dma - dev->dp8390->mem_start], count << 1);
+	dev->dp8390->remote_dma += (count << 1);
+	dev->dp8390->remote_bytes -= (count << 1);
+    }
+
+    return(count);
+}
+
+
+static int
+nic_writew_block(uint16_t addr, uint8_t *buf, int count, void *priv)
+{
+    nic_t *dev = (nic_t *)priv;
+
+    if ((addr - dev->base_address) != 0x10)
+	return(0);
+
+    count = asic_block_len(dev, count);
+    if (count) {
+	memcpy(&dev->dp8390->mem[dev->dp8390->remote_dma - dev->dp8390->mem_start], buf, count << 1);
+	dev->dp8390->remote_dma += (count << 1);
+	dev->dp8390->remote_bytes -= (count << 1);
+    }
+
+    return(count);
+}
+
+
 static void
 nic_iocheckset(nic_t *dev, uint16_t addr)
 {
@@ -842,6 +904,8 @@ nic_ioset(nic_t *dev, uint16_t addr)
 	io_sethandler(addr+0x1f, 1,
 			 nic_readb, nic_readw, nic_readl,
 			 nic_writeb, nic_writew, nic_writel, dev);
+	io_set_block_handler(addr+0x10,
+			 nic_readw_block, nic_writew_block, dev);
     } else {
 	io_sethandler(addr, 16,
 			 nic_readb, NULL, NULL,
@@ -854,6 +918,8 @@ nic_ioset(nic_t *dev, uint16_t addr)
 		io_sethandler(addr+16, 16,
 				 nic_readb, nic_readw, NULL,
 				 nic_writeb, nic_writew, NULL, dev);
+		io_set_block_handler(addr+0x10,
+				 nic_readw_block, nic_writew_block, dev);
 	}
 	io_sethandler(addr+0x1f, 1,
 			 nic_readb, NULL, NULL,
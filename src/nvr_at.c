@@ -237,6 +237,7 @@
 #include <86box/rom.h>
 #include <86box/device.h>
 #include <86box/nvr.h>
+#include <86box/snapshot.h>
 
 
 /* RTC registers and bit definitions. */
@@ -900,6 +901,29 @@ nvr_lock_set(int base, int size, int lock, nvr_t *nvr)
 }
 
 
+static void
+nvr_at_state(void *priv, snapshot_t *s)
+{
+    nvr_t *nvr = (nvr_t *) priv;
+    local_t *local = (local_t *) nvr->data;
+
+    snapshot_var(s, nvr->regs, sizeof(nvr->regs));
+    snapshot_item(s, nvr->onesec_cnt);
+    snapshot_timer(s, &nvr->onesec_time);
+
+    snapshot_item(s, local->stat);
+    snapshot_item(s, local->addr);
+    snapshot_item(s, local->wp);
+    snapshot_item(s, local->bank);
+    snapshot_item(s, local->count);
+    snapshot_item(s, local->state);
+    snapshot_item(s, local->ecount);
+    snapshot_item(s, local->rtc_time);
+    snapshot_timer(s, &local->update_timer);
+    snapshot_timer(s, &local->rtc_timer);
+}
+
+
 static void *
 nvr_at_init(const device_t *info)
 {
@@ -1029,7 +1053,7 @@ const device_t at_nvr_old_device = {
     0,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t at_nvr_device = {
@@ -1038,7 +1062,7 @@ const device_t at_nvr_device = {
     1,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t ps_nvr_device = {
@@ -1047,7 +1071,7 @@ const device_t ps_nvr_device = {
     2,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t amstrad_nvr_device = {
@@ -1056,7 +1080,7 @@ const device_t amstrad_nvr_device = {
     3,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t ibmat_nvr_device = {
@@ -1065,7 +1089,7 @@ const device_t ibmat_nvr_device = {
     4,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t piix4_nvr_device = {
@@ -1074,7 +1098,7 @@ const device_t piix4_nvr_device = {
     9,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t ls486e_nvr_device = {
@@ -1083,7 +1107,7 @@ const device_t ls486e_nvr_device = {
     13,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t ami_apollo_nvr_device = {
@@ -1092,7 +1116,7 @@ const device_t ami_apollo_nvr_device = {
     14,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
 
 const device_t via_nvr_device = {
@@ -1101,5 +1125,5 @@ const device_t via_nvr_device = {
     15,
     nvr_at_init, nvr_at_close, NULL,
     { NULL }, nvr_at_speed_changed,
-    NULL
+    NULL, NULL, nvr_at_state
 };
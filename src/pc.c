@@ -79,6 +79,7 @@
 #include <86box/plat.h>
 #include <86box/plat_midi.h>
 #include <86box/version.h>
+#include <86box/snapshot.h>
 
 
 /* Stuff that used to be globally declared in plat.h but is now extern there
@@ -102,6 +103,8 @@ int	video_fps = RENDER_FPS;			/* (O) render speed in fps */
 #endif
 int	settings_only = 0;			/* (O) show only the settings dialog */
 int	confirm_exit_cmdl = 1;			/* (O) do not ask for confirmation on quit if set to 0 */
+int	unthrottled = 0;			/* (O) run as fast as possible */
+int	headless = 0;				/* (O) run without the UI window */
 #ifdef _WIN32
 uint64_t	unique_id = 0;
 uint64_t	source_hwnd = 0;
@@ -131,6 +134,7 @@ int	serial_enabled[SERIAL_MAX] = {0,0},	/* (C) enable serial ports */
 	isartc_type = 0;			/* (C) enable ISA RTC card */
 int	gfxcard = 0;				/* (C) graphics/video card */
 int	sound_is_float = 1,			/* (C) sound uses FP values */
+	sound_workers = 0,			/* (C) sound synthesis threads */
 	GAMEBLASTER = 0,			/* (C) sound option */
 	GUS = 0,				/* (C) sound option */
 	SSI2001 = 0,				/* (C) sound option */
@@ -140,6 +144,10 @@ int	cpu_use_dynarec = 0,			/* (C) cpu uses/needs Dyna */
 	cpu = 0,				/* (C) cpu type */
 	fpu_type = 0;				/* (C) fpu type */
 int	time_sync = 0;				/* (C) enable time sync */
+int	hdd_async_io = 0;			/* (C) hard disk I/O thread */
+int	hdd_vhd_mmap = 0;			/* (C) memory-map fixed VHDs */
+int	cdrom_read_ahead = 64,			/* (C) CD-ROM image read-ahead (KB) */
+	cdrom_mmap = 0;				/* (C) memory-map CD-ROM images */
 int	confirm_reset = 1,			/* (C) enable reset confirmation */
 	confirm_exit = 1,			/* (C) enable exit confirmation */
 	confirm_save = 1;			/* (C) enable save confirmation */
@@ -155,6 +163,8 @@ extern int
 	writelnum;
 
 int	fps, framecount;			/* emulator % */
+static uint64_t	main_frames;			/* 10 ms guest slices run */
+static uint32_t	main_start;			/* host ticks at start */
 
 extern int	CPUID;
 extern int	output;
@@ -369,10 +379,13 @@ usage:
 		printf("-P or --vmpath path  - set 'path' to be root for vm\n");
 		printf("-S or --settings     - show only the settings dialog\n");
 		printf("-N or --noconfirm    - do not ask for confirmation on quit\n");
+		printf("-U or --unthrottled  - run as fast as possible, not in real time\n");
+		printf("-X or --headless     - run without the UI window\n");
 #ifdef _WIN32
 		printf("-H or --hwnd id,hwnd - sends back the main dialog's hwnd\n");
 #endif
 		printf("-R or --crashdump    - enables crashdump on exception\n");
+		printf("-V or --vmstate path - restore machine snapshot 'path' on start\n");
 		printf("\nA config file can be specified. If none is, the default file will be used.\n");
 		return(0);
 	} else if (!wcscasecmp(argv[c], L"--dumpcfg") ||
@@ -402,9 +415,22 @@ usage:
 	} else if (!wcscasecmp(argv[c], L"--noconfirm") ||
 		   !wcscasecmp(argv[c], L"-N")) {
 		confirm_exit_cmdl = 0;
+	} else if (!wcscasecmp(argv[c], L"--unthrottled") ||
+		   !wcscasecmp(argv[c], L"-U")) {
+		unthrottled = 1;
+	} else if (!wcscasecmp(argv[c], L"--headless") ||
+		   !wcscasecmp(argv[c], L"-X")) {
+		headless = 1;
+		confirm_exit_cmdl = 0;
 	} else if (!wcscasecmp(argv[c], L"--crashdump") ||
 		   !wcscasecmp(argv[c], L"-R")) {
 		enable_crashdump = 1;
+	} else if (!wcscasecmp(argv[c], L"--vmstate") ||
+		   !wcscasecmp(argv[c], L"-V")) {
+		if ((c+1) == argc) goto usage;
+
+		wcscpy(snapshot_path, argv[++c]);
+		snapshot_request(SNAPSHOT_LOAD, snapshot_path);
 #ifdef _WIN32
 	} else if (!wcscasecmp(argv[c], L"--hwnd") ||
 		   !wcscasecmp(argv[c], L"-H")) {
@@ -501,6 +527,10 @@ usage:
     /* At this point, we can safely create the full path name. */
     plat_append_filename(cfg_path, usr_path, p);
 
+    /* Machine snapshots go next to the config file by default. */
+    if (snapshot_path[0] == L'\0')
+	plat_append_filename(snapshot_path, usr_path, SNAPSHOT_FILE);
+
     /*
      * This is where we start outputting to the log file,
      * if there is one. Create a little info header first.
@@ -849,6 +879,21 @@ pc_reset_hard(void)
 }
 
 
+/* Report the guest time run versus the host time it took. */
+static void
+pc_report_speed(void)
+{
+    uint32_t host_ms = plat_get_ticks() - main_start;
+
+    if (host_ms == 0)
+	host_ms = 1;
+
+    printf("Ran %" PRIu64 " ms of guest time in %u ms, %.2fx real time\n",
+	   main_frames * 10, host_ms, (double) (main_frames * 10) / (double) host_ms);
+    fflush(stdout);
+}
+
+
 void
 pc_close(thread_t *ptr)
 {
@@ -857,6 +902,11 @@ pc_close(thread_t *ptr)
     /* Wait a while so things can shut down. */
     plat_delay_ms(200);
 
+    if (unthrottled)
+	pc_report_speed();
+
+    io_log_counts();
+
     /* Claim the video blitter. */
     startblit();
 
@@ -941,22 +991,33 @@ pc_thread(void *param)
     main_time = 0;
     framecountx = 0;
     title_update = 1;
-    old_time = plat_get_ticks();
+    old_time = main_start = plat_get_ticks();
+    main_frames = 0;
     done = drawits = frames = 0;
     while (! *quitp) {
 	/* See if it is time to run a frame of code. */
 	new_time = plat_get_ticks();
 	drawits += (new_time - old_time);
 	old_time = new_time;
-	if (drawits > 0 && !dopause) {
+	if ((drawits > 0 || unthrottled) && !dopause) {
 		/* Yes, so do one frame now. */
 		start_time = plat_timer_read();
-		drawits -= 10;
-		if (drawits > 50)
+		if (unthrottled) {
+			/* Run frames back to back; guest time is kept
+			   by the timers, not by the host clock. */
 			drawits = 0;
+		} else {
+			drawits -= 10;
+			if (drawits > 50)
+				drawits = 0;
+		}
 
 		/* Run a block of code. */
 		startblit();
+
+		/* Snapshots are only taken between two blocks. */
+		snapshot_process();
+
 		clockrate = cpu_s->rspeed;
 
 		if (is386) {
@@ -980,16 +1041,30 @@ pc_thread(void *param)
 
 		/* Done with this frame, update statistics. */
 		framecount++;
+		main_frames++;
 		if (++framecountx >= 100) {
 			framecountx = 0;
 
 			readlnum = writelnum = 0;
 			egareads = egawrites = 0;
 			mmuflush = 0;
+			mmu_tlb_stats_reset();
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+			if (cpu_use_dynarec) {
+				exec386_dynarec_stats_reset();
+				codegen_ir_opt_stats_reset();
+				codegen_block_stats_reset();
+			}
+#endif
 			frames = 0;
 		}
 
-		if (title_update) {
+		if (title_update && headless) {
+			/* No window, so report the speed on the console. */
+			printf("%i%% of real time\n", fps);
+			fflush(stdout);
+			title_update = 0;
+		} else if (title_update) {
 			mbstowcs(wmachine, machine_getname(), strlen(machine_getname())+1);
 			mbstowcs(wcpufamily, cpu_f->name,
 				 strlen(cpu_f->name)+1);
@@ -1027,7 +1102,9 @@ pc_thread(void *param)
 	}
 
 	/* If needed, handle a screen resize. */
-	if (doresize && !video_fullscreen) {
+	if (doresize && headless)
+		doresize = 0;
+	else if (doresize && !video_fullscreen) {
 		plat_resize(scrnsz_x, scrnsz_y);
 
 		doresize = 0;
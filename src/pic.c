@@ -16,6 +16,7 @@
  *		Copyright 2016-2020 Miran Grca.
  */
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,7 @@
 #include <86box/apm.h>
 #include <86box/nvr.h>
 #include <86box/acpi.h>
+#include <86box/snapshot.h>
 
 
 enum
@@ -668,3 +670,17 @@ picinterrupt()
 
     return ret;
 }
+
+
+/* Save or restore both PIC's; the slave pointers are rebuilt by init. */
+void
+pic_state(snapshot_t *s)
+{
+    snapshot_var(s, &pic, offsetof(pic_t, slaves));
+    snapshot_var(s, &pic2, offsetof(pic_t, slaves));
+    snapshot_item(s, shadow);
+    snapshot_item(s, elcr_enabled);
+    snapshot_item(s, latched);
+    snapshot_item(s, pic_pending);
+    snapshot_timer(s, &pic_timer);
+}
@@ -17,6 +17,7 @@
 #include <inttypes.h>
 #include <math.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -38,6 +39,7 @@
 #include <86box/sound.h>
 #include <86box/snd_speaker.h>
 #include <86box/video.h>
+#include <86box/snapshot.h>
 
 
 pit_t		*pit, *pit2;
@@ -844,6 +846,21 @@ pit_close(void *priv)
 }
 
 
+static void
+pit_state(void *priv, snapshot_t *s)
+{
+    pit_t *dev = (pit_t *) priv;
+    int i;
+
+    /* The load and OUT handlers are set up by the machine and are kept. */
+    for (i = 0; i < 3; i++)
+	snapshot_var(s, &dev->counters[i], offsetof(ctr_t, load_func));
+    snapshot_item(s, dev->ctrl);
+    snapshot_item(s, dev->clock);
+    snapshot_timer(s, &dev->callback_timer);
+}
+
+
 static void *
 pit_init(const device_t *info)
 {
@@ -871,7 +888,7 @@ const device_t i8253_device =
 	PIT_8253,
         pit_init, pit_close, NULL,
         { NULL }, NULL, NULL,
-	NULL
+	NULL, pit_state
 };
 
 
@@ -882,7 +899,7 @@ const device_t i8254_device =
 	PIT_8254,
         pit_init, pit_close, NULL,
         { NULL }, NULL, NULL,
-	NULL
+	NULL, pit_state
 };
 
 
@@ -893,7 +910,7 @@ const device_t i8254_ext_io_device =
 	PIT_8254 | PIT_EXT_IO,
         pit_init, pit_close, NULL,
         { NULL }, NULL, NULL,
-	NULL
+	NULL, pit_state
 };
 
 
@@ -904,7 +921,7 @@ const device_t i8254_ps2_device =
 	PIT_8254 | PIT_PS2 | PIT_EXT_IO,
         pit_init, pit_close, NULL,
         { NULL }, NULL, NULL,
-	NULL
+	NULL, pit_state
 };
 
 
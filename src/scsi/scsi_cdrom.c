@@ -1002,6 +1002,14 @@ scsi_cdrom_read_data(scsi_cdrom_t *dev, int msf, int type, int flags, int32_t *l
     dev->old_len = 0;
     *len = 0;
 
+    /* Plain 2048-byte reads (READ (10) and friends) of a data track do not
+       need the per-sector formatting, so take them from the image at once. */
+    if ((type == 8) && (flags == 0x10) && !msf &&
+	cdrom_read_data_blocks(dev->drv, dev->buffer, dev->sector_pos, dev->requested_blocks)) {
+	*len = dev->old_len = dev->requested_blocks * 2048;
+	return 1;
+    }
+
     for (i = 0; i < dev->requested_blocks; i++) {
 	ret = cdrom_readsector_raw(dev->drv, dev->buffer + data_pos,
 				   dev->sector_pos + i, msf, type, flags, &temp_len);
@@ -401,6 +401,16 @@ scsi_disk_lba_out_of_range(scsi_disk_t *dev)
 }
 
 
+static void
+scsi_disk_write_error(scsi_disk_t *dev)
+{
+    scsi_disk_sense_key = SENSE_MEDIUM_ERROR;
+    scsi_disk_asc = ASC_WRITE_ERROR;
+    scsi_disk_ascq = 0;
+    scsi_disk_cmd_error(dev);
+}
+
+
 static void
 scsi_disk_invalid_field(scsi_disk_t *dev)
 {
@@ -454,6 +464,13 @@ scsi_disk_pre_execution_check(scsi_disk_t *dev, uint8_t *cdb)
     if (cdb[0] != GPCMD_REQUEST_SENSE)
 	scsi_disk_sense_clear(dev, cdb[0]);
 
+    /* A write queued by an earlier command failed, report it on this one. */
+    if ((cdb[0] != GPCMD_REQUEST_SENSE) && hdd_image_write_error(dev->id)) {
+	scsi_disk_log("SCSI HD %i: Deferred write error\n", dev->id);
+	scsi_disk_write_error(dev);
+	return 0;
+    }
+
     scsi_disk_log("SCSI HD %i: Continuing with command\n", dev->id);
 
     return 1;
@@ -713,6 +730,9 @@ scsi_disk_command(scsi_common_t *sc, uint8_t *cdb)
 				hdd_image_read(dev->id, dev->sector_pos, *BufLen >> 9, dev->temp_buffer);
 			else
 				hdd_image_read(dev->id, dev->sector_pos, dev->requested_blocks, dev->temp_buffer);
+
+			/* The data is needed right away, so read the next blocks ahead instead. */
+			hdd_image_prefetch(dev->id, dev->sector_pos + dev->requested_blocks, dev->requested_blocks);
 		}
 
 		if (dev->requested_blocks > 1)
@@ -0,0 +1,502 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Machine snapshot (save state) handling.
+ *
+ *		The CPU, memory mapping, PIC and DMA state is handled here
+ *		and in the respective modules; everything else goes through
+ *		the state hook of each attached device. A machine with a
+ *		device that has no hook cannot be saved or restored, as a
+ *		restore would leave that device out of step with the rest.
+ *
+ *		Hooks exist for the PIT, the AT CMOS, the AT and PS/2
+ *		keyboard controllers, the floppy controllers and drives,
+ *		the serial ports, the game port, the IDE controllers and
+ *		the VGA, which covers a plain AT with IDE hard disks. The
+ *		contents of disk and floppy images are not part of a
+ *		snapshot, ATAPI drives are refused, and so is a save while
+ *		a floppy drive is transferring data.
+ */
+#define _LARGEFILE_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include "cpu.h"
+#include "x86.h"
+#include "x87.h"
+#include <86box/device.h>
+#include <86box/timer.h>
+#include <86box/machine.h>
+#include <86box/mem.h>
+#include <86box/pic.h>
+#include <86box/dma.h>
+#include <86box/plat.h>
+#include <86box/snapshot.h>
+
+
+#define SNAPSHOT_MAGIC		"86BoxSNP"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_RAM_OFFSET	4096ULL
+
+
+typedef struct {
+    char	magic[8];
+    uint32_t	version, mem_size,
+		ram_pages, dev_hash;
+    char	machine[64];
+    uint64_t	state_offset;
+    uint32_t	state_size, pad;
+} snapshot_hdr_t;
+
+
+wchar_t			snapshot_path[1024];
+
+static volatile int	snapshot_op = SNAPSHOT_NONE;
+static wchar_t		snapshot_op_path[1024];
+
+/* The file which matches the RAM contents as of the last clean point. */
+static wchar_t		snapshot_inc_path[1024];
+static uint32_t		snapshot_inc_pages = 0;
+
+
+#ifdef ENABLE_SNAPSHOT_LOG
+int snapshot_do_log = ENABLE_SNAPSHOT_LOG;
+
+
+static void
+snapshot_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (snapshot_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define snapshot_log(fmt, ...)
+#endif
+
+
+void
+snapshot_var(snapshot_t *s, void *p, uint32_t len)
+{
+    if (s->error)
+	return;
+
+    if (s->loading) {
+	if ((s->pos + len) > s->end) {
+		s->error = 1;
+		return;
+	}
+	memcpy(p, s->buf + s->pos, len);
+    } else {
+	if ((s->pos + len) > s->size) {
+		while ((s->pos + len) > s->size)
+			s->size = s->size ? (s->size << 1) : 65536;
+		s->buf = (uint8_t *) realloc(s->buf, s->size);
+		if (s->buf == NULL) {
+			s->error = 1;
+			return;
+		}
+	}
+	memcpy(s->buf + s->pos, p, len);
+    }
+
+    s->pos += len;
+}
+
+
+/* Timestamps are absolute, which is fine as the TSC is restored first. */
+void
+snapshot_timer(snapshot_t *s, pc_timer_t *timer)
+{
+    uint64_t ts = timer->ts.ts64;
+    double period = timer->period;
+    int flags = timer->flags;
+
+    snapshot_item(s, ts);
+    snapshot_item(s, period);
+    snapshot_item(s, flags);
+
+    if (s->loading && !s->error) {
+	timer_disable(timer);
+	timer->ts.ts64 = ts;
+	timer->period = period;
+	timer->flags = flags & ~TIMER_ENABLED;
+	if (flags & TIMER_ENABLED)
+		timer_enable(timer);
+    }
+}
+
+
+int
+snapshot_chunk_begin(snapshot_t *s, const char *tag)
+{
+    uint32_t len = 0;
+    char temp[4];
+
+    s->chunk = s->pos;
+
+    if (! s->loading) {
+	snapshot_var(s, (void *) tag, 4);
+	snapshot_item(s, len);
+	return(!s->error);
+    }
+
+    snapshot_var(s, temp, 4);
+    snapshot_item(s, len);
+    if (s->error || memcmp(temp, tag, 4) || ((s->pos + len) > s->size)) {
+	s->error = 1;
+	return(0);
+    }
+
+    s->end = s->pos + len;
+
+    return(1);
+}
+
+
+void
+snapshot_chunk_end(snapshot_t *s)
+{
+    uint32_t len;
+
+    if (s->error)
+	return;
+
+    if (s->loading) {
+	/* Skip whatever a newer writer may have appended. */
+	s->pos = s->end;
+	s->end = s->size;
+    } else {
+	/* Chunks are not aligned in the buffer. */
+	len = s->pos - s->chunk - 8;
+	memcpy(&s->buf[s->chunk + 4], &len, sizeof(len));
+    }
+}
+
+
+static void
+snapshot_cpu(snapshot_t *s)
+{
+    uint64_t old_tsc = tsc;
+
+    snapshot_item(s, cpu_state);
+    snapshot_item(s, cr2);
+    snapshot_item(s, cr3);
+    snapshot_item(s, cr4);
+    snapshot_var(s, dr, sizeof(dr));
+    snapshot_item(s, gdt);
+    snapshot_item(s, ldt);
+    snapshot_item(s, idt);
+    snapshot_item(s, tr);
+    snapshot_item(s, msr);
+    snapshot_item(s, tsc);
+    snapshot_item(s, cpu_cur_status);
+    snapshot_item(s, use32);
+    snapshot_item(s, stack32);
+    snapshot_item(s, cpl_override);
+    snapshot_item(s, in_smm);
+    snapshot_item(s, smi_latched);
+    snapshot_item(s, smm_in_hlt);
+    snapshot_item(s, smbase);
+    snapshot_item(s, amd_efer);
+    snapshot_item(s, star);
+    snapshot_item(s, x87_pc_off);
+    snapshot_item(s, x87_op_off);
+    snapshot_item(s, x87_pc_seg);
+    snapshot_item(s, x87_op_seg);
+
+    if (s->loading && !s->error) {
+	cpu_state.ea_seg = &cpu_state.seg_ds;
+
+	/* Keep the timers not owned by a device (and so not in the
+	   snapshot) running at the same distance from the (new) TSC. */
+	timer_shift((int64_t) (tsc - old_tsc));
+    }
+}
+
+
+static void
+snapshot_state(snapshot_t *s)
+{
+    if (snapshot_chunk_begin(s, "CPU ")) {
+	snapshot_cpu(s);
+	snapshot_chunk_end(s);
+    }
+
+    if (snapshot_chunk_begin(s, "MEM ")) {
+	mem_state(s);
+	snapshot_chunk_end(s);
+    }
+
+    if (snapshot_chunk_begin(s, "PIC ")) {
+	pic_state(s);
+	snapshot_chunk_end(s);
+    }
+
+    if (snapshot_chunk_begin(s, "DMA ")) {
+	dma_state(s);
+	snapshot_chunk_end(s);
+    }
+
+    device_state_all(s);
+
+    if (snapshot_chunk_begin(s, "END "))
+	snapshot_chunk_end(s);
+}
+
+
+/* Read or write RAM pages, coalescing runs of consecutive pages. If a dirty
+   map is given, only the pages marked in it are transferred. */
+static uint32_t
+snapshot_ram(FILE *f, int write, uint8_t *dirty)
+{
+    uint32_t c, n, len, done = 0;
+    uint32_t ram_len = mem_size << 10;
+    size_t ret;
+
+    for (c = 0; c < ram_dirty_pages; c += n) {
+	n = 1;
+	if ((dirty != NULL) && !(dirty[c >> 3] & (1 << (c & 7))))
+		continue;
+
+	/* Extend the run, without crossing the 1 GB (ram2) boundary. */
+	while (((c + n) < ram_dirty_pages) && ((c + n) & 0x3ffff) &&
+	       ((dirty == NULL) || (dirty[(c + n) >> 3] & (1 << ((c + n) & 7)))))
+		n++;
+
+	len = n << 12;
+	if (((c << 12) + len) > ram_len)
+		len = ram_len - (c << 12);
+
+	fseeko64(f, SNAPSHOT_RAM_OFFSET + ((uint64_t) c << 12), SEEK_SET);
+	if (write)
+		ret = fwrite(mem_ram_page(c), 1, len, f);
+	else
+		ret = fread(mem_ram_page(c), 1, len, f);
+	if (ret != len)
+		return(0xffffffff);
+
+	done += n;
+    }
+
+    return(done);
+}
+
+
+int
+snapshot_save(wchar_t *fn)
+{
+    snapshot_hdr_t hdr;
+    snapshot_t s;
+    uint32_t pages;
+    const char *dev;
+    FILE *f = NULL;
+    int inc;
+
+    dev = device_state_missing();
+    if (dev != NULL) {
+	pclog("Snapshot: device \"%s\" cannot save its state, not saving\n", dev);
+	return(0);
+    }
+
+    memset(&s, 0x00, sizeof(snapshot_t));
+    snapshot_state(&s);
+    if (s.error) {
+	pclog("Snapshot: unable to serialize the machine state\n");
+	goto fail;
+    }
+
+    /* Only rewrite the dirty pages if the file still holds our last image. */
+    inc = (snapshot_inc_pages == ram_dirty_pages) && !wcscmp(fn, snapshot_inc_path);
+    if (inc)
+	f = plat_fopen(fn, L"r+b");
+    if (f == NULL) {
+	inc = 0;
+	f = plat_fopen(fn, L"wb");
+    }
+    if (f == NULL) {
+	pclog("Snapshot: unable to open '%ls' for writing\n", fn);
+	goto fail;
+    }
+
+    memset(&hdr, 0x00, sizeof(snapshot_hdr_t));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, 8);
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.mem_size = mem_size;
+    hdr.ram_pages = ram_dirty_pages;
+    hdr.dev_hash = device_state_hash();
+    strncpy(hdr.machine, machine_get_internal_name(), sizeof(hdr.machine) - 1);
+    hdr.state_offset = SNAPSHOT_RAM_OFFSET + ((uint64_t) ram_dirty_pages << 12);
+    hdr.state_size = s.pos;
+
+    if (fwrite(&hdr, 1, sizeof(snapshot_hdr_t), f) != sizeof(snapshot_hdr_t))
+	goto fail;
+
+    pages = snapshot_ram(f, 1, inc ? ram_dirty_map : NULL);
+    if (pages == 0xffffffff)
+	goto fail;
+
+    fseeko64(f, hdr.state_offset, SEEK_SET);
+    if (fwrite(s.buf, 1, s.pos, f) != s.pos)
+	goto fail;
+
+    fclose(f);
+    free(s.buf);
+
+    snapshot_log("Snapshot: saved '%ls', %u of %u RAM pages written\n",
+		 fn, pages, ram_dirty_pages);
+
+    mem_dirty_clear();
+    wcsncpy(snapshot_inc_path, fn, sizeof_w(snapshot_inc_path) - 1);
+    snapshot_inc_pages = ram_dirty_pages;
+
+    return(1);
+
+fail:
+    if (f != NULL) {
+	pclog("Snapshot: error writing '%ls'\n", fn);
+	fclose(f);
+    }
+    if (s.buf != NULL)
+	free(s.buf);
+
+    /* The file contents are unknown now. */
+    snapshot_inc_path[0] = L'\0';
+
+    return(0);
+}
+
+
+int
+snapshot_load(wchar_t *fn)
+{
+    snapshot_hdr_t hdr;
+    snapshot_t s;
+#ifdef ENABLE_SNAPSHOT_LOG
+    uint32_t start = plat_get_ticks();
+#endif
+    const char *dev;
+    FILE *f;
+
+    dev = device_state_missing();
+    if (dev != NULL) {
+	pclog("Snapshot: device \"%s\" cannot restore its state, not loading\n", dev);
+	return(0);
+    }
+
+    f = plat_fopen(fn, L"rb");
+    if (f == NULL) {
+	pclog("Snapshot: unable to open '%ls'\n", fn);
+	return(0);
+    }
+
+    if ((fread(&hdr, 1, sizeof(snapshot_hdr_t), f) != sizeof(snapshot_hdr_t)) ||
+	memcmp(hdr.magic, SNAPSHOT_MAGIC, 8) || (hdr.version != SNAPSHOT_VERSION)) {
+	pclog("Snapshot: '%ls' is not a valid snapshot\n", fn);
+	fclose(f);
+	return(0);
+    }
+
+    /* Refuse to restore onto a differently configured machine. */
+    hdr.machine[sizeof(hdr.machine) - 1] = '\0';
+    if ((hdr.mem_size != mem_size) || (hdr.ram_pages != ram_dirty_pages) ||
+	(hdr.dev_hash != device_state_hash()) || strcmp(hdr.machine, machine_get_internal_name())) {
+	pclog("Snapshot: '%ls' was taken with a different configuration\n", fn);
+	fclose(f);
+	return(0);
+    }
+
+    memset(&s, 0x00, sizeof(snapshot_t));
+    s.loading = 1;
+    s.size = s.end = hdr.state_size;
+    s.buf = (uint8_t *) malloc(hdr.state_size);
+    if (s.buf == NULL) {
+	fclose(f);
+	return(0);
+    }
+    fseeko64(f, hdr.state_offset, SEEK_SET);
+    if (fread(s.buf, 1, hdr.state_size, f) != hdr.state_size) {
+	pclog("Snapshot: '%ls' is truncated\n", fn);
+	free(s.buf);
+	fclose(f);
+	return(0);
+    }
+
+    /* Past this point, the running machine gets overwritten. */
+    if (snapshot_ram(f, 0, NULL) == 0xffffffff)
+	s.error = 1;
+    fclose(f);
+
+    if (! s.error)
+	snapshot_state(&s);
+    free(s.buf);
+
+    if (s.error) {
+	pclog("Snapshot: '%ls' is corrupt, resetting the machine\n", fn);
+	snapshot_inc_path[0] = L'\0';
+	pc_reset_hard();
+	return(0);
+    }
+
+    /* All translated code and cached translations are stale now. */
+    flushmmucache();
+#ifdef USE_DYNAREC
+    codegen_reset();
+#endif
+
+    mem_dirty_clear();
+    wcsncpy(snapshot_inc_path, fn, sizeof_w(snapshot_inc_path) - 1);
+    snapshot_inc_pages = ram_dirty_pages;
+
+#ifdef ENABLE_SNAPSHOT_LOG
+    snapshot_log("Snapshot: restored '%ls' in %u ms\n", fn, plat_get_ticks() - start);
+#endif
+
+    return(1);
+}
+
+
+void
+snapshot_request(int op, wchar_t *fn)
+{
+    if (fn == NULL)
+	fn = snapshot_path;
+
+    wcsncpy(snapshot_op_path, fn, sizeof_w(snapshot_op_path) - 1);
+    snapshot_op = op;
+}
+
+
+/* Run by the emulation thread between two slices of guest code. */
+void
+snapshot_process(void)
+{
+    int op = snapshot_op;
+
+    if (op == SNAPSHOT_NONE)
+	return;
+
+    snapshot_op = SNAPSHOT_NONE;
+
+    if (op == SNAPSHOT_SAVE)
+	snapshot_save(snapshot_op_path);
+    else if (op == SNAPSHOT_LOAD)
+	snapshot_load(snapshot_op_path);
+}
@@ -45,12 +45,10 @@ typedef struct adlib_t
 static void adlib_get_buffer(int32_t *buffer, int len, void *p)
 {
         adlib_t *adlib = (adlib_t *)p;
-        int c;
 
         opl2_update(&adlib->opl);
         
-        for (c = 0; c < len * 2; c++)
-                buffer[c] += (int32_t)adlib->opl.buffer[c];
+        sound_mix_add(buffer, adlib->opl.buffer, len * 2);
 
         adlib->opl.pos = 0;
 }
@@ -121,6 +119,8 @@ void adlib_close(void *p)
 {
         adlib_t *adlib = (adlib_t *)p;
 
+        opl_close(&adlib->opl);
+
         free(adlib);
 }
 
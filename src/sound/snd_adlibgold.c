@@ -824,6 +824,8 @@ void adgold_close(void *p)
                 fclose(f);
         }
 
+        opl_close(&adgold->opl);
+
         free(adgold);
 }
 
@@ -871,12 +871,10 @@ static void
 azt2316a_get_buffer(int32_t *buffer, int len, void *p)
 {
         azt2316a_t *azt2316a = (azt2316a_t *)p;
-        int c;
 
         /* wss part */
         ad1848_update(&azt2316a->ad1848);
-        for (c = 0; c < len * 2; c++)
-		buffer[c] += (azt2316a->ad1848.buffer[c] / 2);
+        sound_mix_add_16_half(buffer, azt2316a->ad1848.buffer, len * 2);
 
         azt2316a->ad1848.pos = 0;
 
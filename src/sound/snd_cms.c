@@ -97,12 +97,9 @@ void cms_get_buffer(int32_t *buffer, int len, void *p)
 {
         cms_t *cms = (cms_t *)p;
         
-        int c;
-
         cms_update(cms);
         
-        for (c = 0; c < len * 2; c++)
-                buffer[c] += cms->buffer[c];
+        sound_mix_add_16(buffer, cms->buffer, len * 2);
 
         cms->pos = 0;
 }
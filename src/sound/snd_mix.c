@@ -0,0 +1,412 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Mixing and sample format conversion kernels.
+ *
+ *		The sound core and the sound cards mix into 32-bit buffers
+ *		which are then converted to float or saturated to 16-bit.
+ *		The kernels here have scalar, SSE2, AVX2 and NEON versions;
+ *		the best compile-time one is used by default and AVX2 is
+ *		selected at run time if the host supports it.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+# define USE_AVX2
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+# define USE_NEON
+#endif
+#include <86box/86box.h>
+#include <86box/sound.h>
+
+
+#define SAMPLE_SCALE	(1.0f / 32768.0f)
+
+
+static void
+mix_add_c(int32_t *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] += src[c];
+}
+
+
+static void
+mix_add_16_c(int32_t *dst, const int16_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] += src[c];
+}
+
+
+static void
+mix_add_16_half_c(int32_t *dst, const int16_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] += (src[c] / 2);
+}
+
+
+static void
+mix_to_float_c(float *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] = ((float) src[c]) * SAMPLE_SCALE;
+}
+
+
+static void
+mix_to_int16_c(int16_t *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++) {
+	if (src[c] > 32767)
+		dst[c] = 32767;
+	else if (src[c] < -32768)
+		dst[c] = -32768;
+	else
+		dst[c] = src[c];
+    }
+}
+
+
+#if defined(__SSE2__)
+/* Sign extend eight 16-bit samples to two vectors of 32-bit ones. */
+#define SSE2_WIDEN(v, lo, hi)	lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16); \
+				hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)
+
+/* Divide by two, rounding towards zero like C does. */
+#define SSE2_HALF(v)		_mm_srai_epi32(_mm_add_epi32(v, _mm_srli_epi32(v, 31)), 1)
+
+
+static void
+mix_add_sse2(int32_t *dst, const int32_t *src, int len)
+{
+    __m128i a, b;
+    int c;
+
+    for (c = 0; c <= (len - 4); c += 4) {
+	a = _mm_loadu_si128((__m128i *) &dst[c]);
+	b = _mm_loadu_si128((__m128i *) &src[c]);
+	_mm_storeu_si128((__m128i *) &dst[c], _mm_add_epi32(a, b));
+    }
+
+    mix_add_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_add_16_sse2(int32_t *dst, const int16_t *src, int len)
+{
+    __m128i v, lo, hi;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	v = _mm_loadu_si128((__m128i *) &src[c]);
+	SSE2_WIDEN(v, lo, hi);
+	_mm_storeu_si128((__m128i *) &dst[c], _mm_add_epi32(_mm_loadu_si128((__m128i *) &dst[c]), lo));
+	_mm_storeu_si128((__m128i *) &dst[c + 4], _mm_add_epi32(_mm_loadu_si128((__m128i *) &dst[c + 4]), hi));
+    }
+
+    mix_add_16_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_add_16_half_sse2(int32_t *dst, const int16_t *src, int len)
+{
+    __m128i v, lo, hi;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	v = _mm_loadu_si128((__m128i *) &src[c]);
+	SSE2_WIDEN(v, lo, hi);
+	lo = SSE2_HALF(lo);
+	hi = SSE2_HALF(hi);
+	_mm_storeu_si128((__m128i *) &dst[c], _mm_add_epi32(_mm_loadu_si128((__m128i *) &dst[c]), lo));
+	_mm_storeu_si128((__m128i *) &dst[c + 4], _mm_add_epi32(_mm_loadu_si128((__m128i *) &dst[c + 4]), hi));
+    }
+
+    mix_add_16_half_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_to_float_sse2(float *dst, const int32_t *src, int len)
+{
+    __m128 scale = _mm_set1_ps(SAMPLE_SCALE);
+    __m128i v;
+    int c;
+
+    for (c = 0; c <= (len - 4); c += 4) {
+	v = _mm_loadu_si128((__m128i *) &src[c]);
+	_mm_storeu_ps(&dst[c], _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+
+    mix_to_float_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_to_int16_sse2(int16_t *dst, const int32_t *src, int len)
+{
+    __m128i a, b;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	a = _mm_loadu_si128((__m128i *) &src[c]);
+	b = _mm_loadu_si128((__m128i *) &src[c + 4]);
+	_mm_storeu_si128((__m128i *) &dst[c], _mm_packs_epi32(a, b));
+    }
+
+    mix_to_int16_c(&dst[c], &src[c], len - c);
+}
+#endif
+
+
+#if defined(USE_AVX2)
+#define AVX2_FUNC	__attribute__((target("avx2")))
+
+
+static AVX2_FUNC void
+mix_add_avx2(int32_t *dst, const int32_t *src, int len)
+{
+    __m256i a, b;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	a = _mm256_loadu_si256((__m256i *) &dst[c]);
+	b = _mm256_loadu_si256((__m256i *) &src[c]);
+	_mm256_storeu_si256((__m256i *) &dst[c], _mm256_add_epi32(a, b));
+    }
+
+    mix_add_c(&dst[c], &src[c], len - c);
+}
+
+
+static AVX2_FUNC void
+mix_add_16_avx2(int32_t *dst, const int16_t *src, int len)
+{
+    __m256i v;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) &src[c]));
+	_mm256_storeu_si256((__m256i *) &dst[c], _mm256_add_epi32(_mm256_loadu_si256((__m256i *) &dst[c]), v));
+    }
+
+    mix_add_16_c(&dst[c], &src[c], len - c);
+}
+
+
+static AVX2_FUNC void
+mix_add_16_half_avx2(int32_t *dst, const int16_t *src, int len)
+{
+    __m256i v;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) &src[c]));
+	v = _mm256_srai_epi32(_mm256_add_epi32(v, _mm256_srli_epi32(v, 31)), 1);
+	_mm256_storeu_si256((__m256i *) &dst[c], _mm256_add_epi32(_mm256_loadu_si256((__m256i *) &dst[c]), v));
+    }
+
+    mix_add_16_half_c(&dst[c], &src[c], len - c);
+}
+
+
+static AVX2_FUNC void
+mix_to_float_avx2(float *dst, const int32_t *src, int len)
+{
+    __m256 scale = _mm256_set1_ps(SAMPLE_SCALE);
+    __m256i v;
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8) {
+	v = _mm256_loadu_si256((__m256i *) &src[c]);
+	_mm256_storeu_ps(&dst[c], _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+
+    mix_to_float_c(&dst[c], &src[c], len - c);
+}
+
+
+static AVX2_FUNC void
+mix_to_int16_avx2(int16_t *dst, const int32_t *src, int len)
+{
+    __m256i a, b;
+    int c;
+
+    for (c = 0; c <= (len - 16); c += 16) {
+	a = _mm256_loadu_si256((__m256i *) &src[c]);
+	b = _mm256_loadu_si256((__m256i *) &src[c + 8]);
+	/* The pack works per 128-bit lane, so put the quadwords back in order. */
+	a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+	_mm256_storeu_si256((__m256i *) &dst[c], a);
+    }
+
+    mix_to_int16_c(&dst[c], &src[c], len - c);
+}
+#endif
+
+
+#if defined(USE_NEON)
+static void
+mix_add_neon(int32_t *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c <= (len - 4); c += 4)
+	vst1q_s32(&dst[c], vaddq_s32(vld1q_s32(&dst[c]), vld1q_s32(&src[c])));
+
+    mix_add_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_add_16_neon(int32_t *dst, const int16_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c <= (len - 4); c += 4)
+	vst1q_s32(&dst[c], vaddw_s16(vld1q_s32(&dst[c]), vld1_s16(&src[c])));
+
+    mix_add_16_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_add_16_half_neon(int32_t *dst, const int16_t *src, int len)
+{
+    int32x4_t v;
+    int c;
+
+    for (c = 0; c <= (len - 4); c += 4) {
+	v = vmovl_s16(vld1_s16(&src[c]));
+	/* Divide by two, rounding towards zero like C does. */
+	v = vshrq_n_s32(vaddq_s32(v, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(v), 31))), 1);
+	vst1q_s32(&dst[c], vaddq_s32(vld1q_s32(&dst[c]), v));
+    }
+
+    mix_add_16_half_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_to_float_neon(float *dst, const int32_t *src, int len)
+{
+    float32x4_t scale = vdupq_n_f32(SAMPLE_SCALE);
+    int c;
+
+    for (c = 0; c <= (len - 4); c += 4)
+	vst1q_f32(&dst[c], vmulq_f32(vcvtq_f32_s32(vld1q_s32(&src[c])), scale));
+
+    mix_to_float_c(&dst[c], &src[c], len - c);
+}
+
+
+static void
+mix_to_int16_neon(int16_t *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c <= (len - 8); c += 8)
+	vst1q_s16(&dst[c], vcombine_s16(vqmovn_s32(vld1q_s32(&src[c])), vqmovn_s32(vld1q_s32(&src[c + 4]))));
+
+    mix_to_int16_c(&dst[c], &src[c], len - c);
+}
+#endif
+
+
+#if defined(__SSE2__)
+# define MIX_DEFAULT(name)	name##_sse2
+#elif defined(USE_NEON)
+# define MIX_DEFAULT(name)	name##_neon
+#else
+# define MIX_DEFAULT(name)	name##_c
+#endif
+
+static void	(*mix_add)(int32_t *dst, const int32_t *src, int len) = MIX_DEFAULT(mix_add);
+static void	(*mix_add_16)(int32_t *dst, const int16_t *src, int len) = MIX_DEFAULT(mix_add_16);
+static void	(*mix_add_16_half)(int32_t *dst, const int16_t *src, int len) = MIX_DEFAULT(mix_add_16_half);
+static void	(*mix_to_float)(float *dst, const int32_t *src, int len) = MIX_DEFAULT(mix_to_float);
+static void	(*mix_to_int16)(int16_t *dst, const int32_t *src, int len) = MIX_DEFAULT(mix_to_int16);
+
+
+void
+sound_mix_init(void)
+{
+#if defined(USE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	mix_add = mix_add_avx2;
+	mix_add_16 = mix_add_16_avx2;
+	mix_add_16_half = mix_add_16_half_avx2;
+	mix_to_float = mix_to_float_avx2;
+	mix_to_int16 = mix_to_int16_avx2;
+    }
+#endif
+}
+
+
+/* dst += src */
+void
+sound_mix_add(int32_t *dst, const int32_t *src, int len)
+{
+    mix_add(dst, src, len);
+}
+
+
+/* dst += src, for cards that render 16-bit samples. */
+void
+sound_mix_add_16(int32_t *dst, const int16_t *src, int len)
+{
+    mix_add_16(dst, src, len);
+}
+
+
+/* dst += src / 2, for codecs that are mixed at half volume. */
+void
+sound_mix_add_16_half(int32_t *dst, const int16_t *src, int len)
+{
+    mix_add_16_half(dst, src, len);
+}
+
+
+/* Convert to float samples in the -1.0 to 1.0 range. */
+void
+sound_mix_to_float(float *dst, const int32_t *src, int len)
+{
+    mix_to_float(dst, src, len);
+}
+
+
+/* Saturate to 16-bit samples. */
+void
+sound_mix_to_int16(int16_t *dst, const int32_t *src, int len)
+{
+    mix_to_int16(dst, src, len);
+}
@@ -29,8 +29,10 @@
 #include <86box/timer.h>
 #include "cpu.h"
 #include <86box/io.h>
+#include <86box/plat.h>
 #include <86box/sound.h>
 #include <86box/snd_opl.h>
+#include <86box/snd_worker.h>
 #include <86box/snd_opl_nuked.h>
 
 
@@ -148,7 +150,12 @@ static void
 opl_write(opl_t *dev, uint16_t port, uint8_t val)
 {
     if ((port & 0x0001) == 0x0001) {
-	nuked_write_reg_buffered(dev->opl, dev->port, val);
+	if (dev->worker != NULL)
+		sound_worker_write(dev->worker, dev->port, val);
+	else
+		nuked_write_reg_buffered(dev->opl, dev->port, val);
+	if (dev->port == 0x0105)
+		dev->newm = val & 0x01;
 
 	switch (dev->port) {
 		case 0x02:	/* Timer 1 */
@@ -173,6 +180,13 @@ opl_write(opl_t *dev, uint16_t port, uint8_t val)
 			}
 			break;
 	}
+    } else if (dev->worker != NULL) {
+	/* The chip belongs to the worker, so use our copy of NEW. */
+	dev->port = val;
+	if ((port & 0x0002) && ((val == 0x05) || dev->newm))
+		dev->port |= 0x0100;
+	if (!(dev->flags & FLAG_OPL3))
+		dev->port &= 0x00ff;
     } else {
 	dev->port = nuked_write_addr(dev->opl, port, val) & 0x01ff;
 
@@ -192,6 +206,46 @@ opl_set_do_cycles(opl_t *dev, int8_t do_cycles)
 }
 
 
+/* Called on the worker thread. */
+static void
+opl_worker_write(void *priv, uint16_t reg, uint8_t val)
+{
+    opl_t *dev = (opl_t *)priv;
+
+    nuked_write_reg_buffered(dev->opl, reg, val);
+}
+
+
+static void
+opl_worker_generate(void *priv, int32_t *buffer, int len)
+{
+    opl_t *dev = (opl_t *)priv;
+    int c;
+
+    nuked_generate_stream(dev->opl, buffer, len);
+
+    for (c = 0; c < len * 2; c += 2) {
+	buffer[c] /= 2;
+	if (dev->flags & FLAG_OPL3)
+		buffer[c + 1] /= 2;
+	else
+		buffer[c + 1] = buffer[c];
+    }
+}
+
+
+/* With a worker, the whole period is fetched from it at the end. */
+static void
+opl_worker_update(opl_t *dev)
+{
+    if ((sound_pos_global < SOUNDBUFLEN) || (dev->pos >= sound_pos_global))
+	return;
+
+    sound_worker_get(dev->worker, dev->buffer);
+    dev->pos = sound_pos_global;
+}
+
+
 static void
 opl_init(opl_t *dev, int is_opl3)
 {
@@ -208,12 +262,19 @@ opl_init(opl_t *dev, int is_opl3)
 
     timer_add(&dev->timers[0], timer_1, dev, 0);
     timer_add(&dev->timers[1], timer_2, dev, 0);
+
+    dev->worker = sound_worker_add(opl_worker_write, opl_worker_generate, dev);
 }
 
 
 void
 opl_close(opl_t *dev)
 {
+    if (dev->worker) {
+	sound_worker_close(dev->worker);
+	dev->worker = NULL;
+    }
+
     /* Release the NukedOPL object. */
     if (dev->opl) {
 	nuked_close(dev->opl);
@@ -257,6 +318,11 @@ opl2_init(opl_t *dev)
 void
 opl2_update(opl_t *dev)
 {
+    if (dev->worker != NULL) {
+	opl_worker_update(dev);
+	return;
+    }
+
     if (dev->pos >= sound_pos_global)
 	return;
 
@@ -307,6 +373,11 @@ opl3_init(opl_t *dev)
 void
 opl3_update(opl_t *dev)
 {
+    if (dev->worker != NULL) {
+	opl_worker_update(dev);
+	return;
+    }
+
     if (dev->pos >= sound_pos_global)
 	return;
 
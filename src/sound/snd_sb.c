@@ -1470,6 +1470,11 @@ sb_close(void *p)
     sb_t *sb = (sb_t *)p;
     sb_dsp_close(&sb->dsp);
 
+    if (sb->opl_enabled) {
+	opl_close(&sb->opl);
+	opl_close(&sb->opl2);
+    }
+
     free(sb);
 }
 
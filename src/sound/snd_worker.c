@@ -0,0 +1,204 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Sound synthesis worker threads.
+ *
+ *		The pool has sound_workers threads, which are started when
+ *		the first generator is registered and then stay around for
+ *		as long as the emulator runs.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/sound.h>
+#include <86box/snd_worker.h>
+
+
+#define WORKERS_MAX	8
+
+
+static int		workers_num;
+static mutex_t		*jobs_mutex;
+static event_t		*jobs_event;
+static sound_worker_t	*jobs_head, *jobs_tail;
+
+
+#ifdef ENABLE_SOUND_WORKER_LOG
+int sound_worker_do_log = ENABLE_SOUND_WORKER_LOG;
+
+
+static void
+sound_worker_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (sound_worker_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define sound_worker_log(fmt, ...)
+#endif
+
+
+/* Render one period, applying each write at the sample it was made at. */
+static void
+sound_worker_render(sound_worker_t *dev)
+{
+    sound_worker_write_t *w = dev->writes[dev->job];
+    int i, pos = 0;
+
+    for (i = 0; i < dev->nwrites[dev->job]; i++, w++) {
+	if (w->pos > pos) {
+		dev->generate(dev->priv, &dev->buffer[pos * 2], w->pos - pos);
+		pos = w->pos;
+	}
+	dev->write(dev->priv, w->reg, w->val);
+    }
+
+    if (pos < SOUNDBUFLEN)
+	dev->generate(dev->priv, &dev->buffer[pos * 2], SOUNDBUFLEN - pos);
+}
+
+
+static void
+sound_worker_thread(void *param)
+{
+    sound_worker_t *dev;
+
+    while (1) {
+	thread_wait_event(jobs_event, -1);
+
+	while (1) {
+		thread_wait_mutex(jobs_mutex);
+		dev = jobs_head;
+		if (dev != NULL) {
+			jobs_head = dev->next;
+			if (jobs_head == NULL)
+				jobs_tail = NULL;
+			else
+				thread_set_event(jobs_event);	/* wake up another worker */
+		}
+		thread_release_mutex(jobs_mutex);
+
+		if (dev == NULL)
+			break;
+
+		sound_worker_render(dev);
+		thread_set_event(dev->done);
+	}
+    }
+}
+
+
+sound_worker_t *
+sound_worker_add(void (*write)(void *priv, uint16_t reg, uint8_t val),
+		 void (*generate)(void *priv, int32_t *buffer, int len),
+		 void *priv)
+{
+    sound_worker_t *dev;
+    int i;
+
+    if (sound_workers <= 0)
+	return(NULL);
+
+    if (workers_num == 0) {
+	jobs_mutex = thread_create_mutex();
+	jobs_event = thread_create_event();
+
+	workers_num = MIN(sound_workers, WORKERS_MAX);
+	for (i = 0; i < workers_num; i++)
+		thread_create(sound_worker_thread, NULL);
+
+	sound_worker_log("Sound: started %i synthesis worker(s)\n", workers_num);
+    }
+
+    dev = (sound_worker_t *) malloc(sizeof(sound_worker_t));
+    memset(dev, 0x00, sizeof(sound_worker_t));
+
+    dev->write = write;
+    dev->generate = generate;
+    dev->priv = priv;
+    dev->job = 1;
+    dev->done = thread_create_event();
+
+    return(dev);
+}
+
+
+void
+sound_worker_close(sound_worker_t *dev)
+{
+    if (dev == NULL)
+	return;
+
+    /* Let the block being rendered finish first, it uses the device. */
+    if (dev->posted)
+	thread_wait_event(dev->done, -1);
+
+    thread_destroy_event(dev->done);
+    free(dev->writes[0]);
+    free(dev->writes[1]);
+    free(dev);
+}
+
+
+/* Queue a register write, it is applied when this period is rendered. */
+void
+sound_worker_write(sound_worker_t *dev, uint16_t reg, uint8_t val)
+{
+    sound_worker_write_t *w;
+    int q = dev->cur;
+
+    if (dev->nwrites[q] == dev->size[q]) {
+	dev->size[q] = dev->size[q] ? (dev->size[q] << 1) : 256;
+	dev->writes[q] = (sound_worker_write_t *) realloc(dev->writes[q], dev->size[q] * sizeof(sound_worker_write_t));
+    }
+
+    w = &dev->writes[q][dev->nwrites[q]++];
+    w->pos = MIN(sound_pos_global, SOUNDBUFLEN);
+    w->reg = reg;
+    w->val = val;
+}
+
+
+/* End of a period: collect the previous block and start on this one. */
+void
+sound_worker_get(sound_worker_t *dev, int32_t *buffer)
+{
+    if (dev->posted) {
+	thread_wait_event(dev->done, -1);
+	dev->posted = 0;
+    }
+
+    memcpy(buffer, dev->buffer, SOUNDBUFLEN * 2 * sizeof(int32_t));
+
+    dev->job = dev->cur;
+    dev->cur ^= 1;
+    dev->nwrites[dev->cur] = 0;
+    dev->posted = 1;
+
+    thread_wait_mutex(jobs_mutex);
+    dev->next = NULL;
+    if (jobs_tail != NULL)
+	jobs_tail->next = dev;
+    else
+	jobs_head = dev;
+    jobs_tail = dev;
+    thread_release_mutex(jobs_mutex);
+
+    thread_set_event(jobs_event);
+}
@@ -69,6 +69,7 @@ static pc_timer_t sound_poll_timer;
 static uint64_t sound_poll_latch;
 
 static int16_t cd_buffer[CDROM_NUM][CD_BUFLEN * 2];
+static int32_t cd_mix_buffer[CD_BUFLEN * 2];
 static float cd_out_buffer[CD_BUFLEN * 2];
 static int16_t cd_out_buffer_int16[CD_BUFLEN * 2];
 static unsigned int cd_vol_l, cd_vol_r;
@@ -195,10 +196,21 @@ sound_set_cd_volume(unsigned int vol_l, unsigned int vol_r)
 static void
 sound_cd_clean_buffers(void)
 {
-    if (sound_is_float)
-	memset(cd_out_buffer, 0, (CD_BUFLEN * 2) * sizeof(float));
-    else
-	memset(cd_out_buffer_int16, 0, (CD_BUFLEN * 2) * sizeof(int16_t));
+    memset(cd_mix_buffer, 0, (CD_BUFLEN * 2) * sizeof(int32_t));
+}
+
+
+/* Each drive is clamped to 16 bits and rounded to the nearest step before
+   it goes into the mix, in both float and 16-bit output modes. */
+static __inline int32_t
+sound_cd_sample(double s)
+{
+    if (s > 32767.0)
+	return 32767;
+    if (s < -32768.0)
+	return -32768;
+
+    return (int32_t) floor(s + 0.5);
 }
 
 
@@ -287,29 +299,18 @@ sound_cd_thread(void *param)
 				filter_cd_audio(1, &(cd_buffer_temp[1]), filter_cd_audio_p);
 			}
 
-			if (sound_is_float) {
-				cd_out_buffer[c] += (float) (cd_buffer_temp[0] / 32768.0);
-				cd_out_buffer[c+1] += (float) (cd_buffer_temp[1] / 32768.0);
-			} else {
-				if (cd_buffer_temp[0] > 32767)
-					cd_buffer_temp[0] = 32767;
-				if (cd_buffer_temp[0] < -32768)
-					cd_buffer_temp[0] = -32768;
-				if (cd_buffer_temp[1] > 32767)
-					cd_buffer_temp[1] = 32767;
-				if (cd_buffer_temp[1] < -32768)
-					cd_buffer_temp[1] = -32768;
-
-				cd_out_buffer_int16[c] += (int16_t) cd_buffer_temp[0];
-				cd_out_buffer_int16[c+1] += (int16_t) cd_buffer_temp[1];
-			}
+			cd_mix_buffer[c] += sound_cd_sample(cd_buffer_temp[0]);
+			cd_mix_buffer[c+1] += sound_cd_sample(cd_buffer_temp[1]);
 		}
 	}
 
-	if (sound_is_float)
+	if (sound_is_float) {
+		sound_mix_to_float(cd_out_buffer, cd_mix_buffer, CD_BUFLEN * 2);
 		givealbuffer_cd(cd_out_buffer);
-	else
+	} else {
+		sound_mix_to_int16(cd_out_buffer_int16, cd_mix_buffer, CD_BUFLEN * 2);
 		givealbuffer_cd(cd_out_buffer_int16);
+	}
     }
 }
 
@@ -339,6 +340,8 @@ sound_init(void)
     outbuffer_ex = NULL;
     outbuffer_ex_int16 = NULL;
 
+    sound_mix_init();
+
     outbuffer = malloc(SOUNDBUFLEN * 2 * sizeof(int32_t));
 
     for (i = 0; i < CDROM_NUM; i++) {
@@ -400,23 +403,13 @@ sound_poll(void *priv)
 	for (c = 0; c < sound_handlers_num; c++)
 		sound_handlers[c].get_buffer(outbuffer, SOUNDBUFLEN, sound_handlers[c].priv);
 
-	for (c = 0; c < SOUNDBUFLEN * 2; c++) {
-		if (sound_is_float)
-			outbuffer_ex[c] = ((float) outbuffer[c]) / 32768.0;
-		else {
-			if (outbuffer[c] > 32767)
-				outbuffer[c] = 32767;
-			if (outbuffer[c] < -32768)
-				outbuffer[c] = -32768;
-
-			outbuffer_ex_int16[c] = outbuffer[c];
-		}
-	}
-
-	if (sound_is_float)
+	if (sound_is_float) {
+		sound_mix_to_float(outbuffer_ex, outbuffer, SOUNDBUFLEN * 2);
 		givealbuffer(outbuffer_ex);
-	else
+	} else {
+		sound_mix_to_int16(outbuffer_ex_int16, outbuffer, SOUNDBUFLEN * 2);
 		givealbuffer(outbuffer_ex_int16);
+	}
 
 	if (cd_thread_enable) {
                 cd_buf_update--;
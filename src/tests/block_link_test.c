@@ -0,0 +1,311 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check that block link exits patched by codegen_block_link()
+ *		jump straight to the next block on the x86-64 backend.
+ *
+ *		Blocks that count their runs in a guest register and set
+ *		EIP to each other are compiled and linked, then run. They
+ *		should go round without leaving the generated code while
+ *		the link checks pass, and leave through
+ *		exec386_dynarec_link() as soon as one fails or an exit has
+ *		been patched back.
+ *
+ *		Built and run by "make -C src/tests check" on x86-64 hosts.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <sys/mman.h>
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include "x86.h"
+#include "codegen.h"
+#include "codegen_allocator.h"
+#include "codegen_backend.h"
+#include "codegen_ir.h"
+#include "codegen_reg.h"
+#include "codegen_public.h"
+
+
+#define NR_MEM_BLOCKS	256
+#define NR_PAGES	16
+
+struct mem_block_t
+{
+    int		nr;
+};
+
+cpu_state_t	cpu_state;
+uint8_t		*ram;
+uintptr_t	*readlookup2, *writelookup2;
+page_t		*pages;
+codeblock_t	*codeblock;
+uint16_t	*codeblock_hash;
+uint8_t		*block_write_data;
+int		block_current, block_pos;
+int		cpu_block_end;
+uint16_t	cpu_cur_status;
+uint32_t	timer_target;
+int		smi_line, nmi;
+pic_t		pic;
+int		codegen_reloc_enabled;
+
+static struct mem_block_t mem_blocks[NR_MEM_BLOCKS];
+static uint8_t	*mem_block_data;
+static int	mem_blocks_used;
+
+/*Calls to exec386_dynarec_link(), and the block that made the last one*/
+static int	link_calls, link_block;
+
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+
+struct mem_block_t *
+codegen_allocator_allocate(struct mem_block_t *parent, int code_block)
+{
+    if (mem_blocks_used == NR_MEM_BLOCKS)
+	fatal("out of code memory\n");
+    mem_blocks[mem_blocks_used].nr = mem_blocks_used;
+    return &mem_blocks[mem_blocks_used++];
+}
+
+
+uint8_t *
+codeblock_allocator_get_ptr(struct mem_block_t *block)
+{
+    return &mem_block_data[block->nr * MEM_BLOCK_SIZE];
+}
+
+
+void *
+exec386_dynarec_link(void)
+{
+    link_calls++;
+    link_block = codegen_link.block;
+
+    return NULL;
+}
+
+
+void	codegen_set_loop_start(struct ir_data_t *ir, int first_instruction) { }
+void	codegen_reloc_start(codeblock_t *block)	{ }
+void	codegen_reloc_add(codeblock_t *block, int type, void *site, void *target) { }
+void	codegen_reloc_end(codeblock_t *block, void *end) { }
+void	codegen_reloc_init(void **routines, int nr)	{ }
+int	loadseg(uint16_t seg, x86seg *s)	{ abort(); }
+void	x86_int(int num)			{ abort(); }
+void	x86gpf(char *s, uint16_t error)		{ abort(); }
+uint8_t	readmembl(uint32_t addr)		{ abort(); }
+uint16_t readmemwl(uint32_t addr)		{ abort(); }
+uint32_t readmemll(uint32_t addr)		{ abort(); }
+uint64_t readmemql(uint32_t addr)		{ abort(); }
+void	writemembl(uint32_t addr, uint8_t val)	{ abort(); }
+void	writememwl(uint32_t addr, uint16_t val)	{ abort(); }
+void	writememll(uint32_t addr, uint32_t val)	{ abort(); }
+void	writememql(uint32_t addr, uint64_t val)	{ abort(); }
+
+
+/*Compile block nr at pc, adding 1 to guest register reg, taking 10 cycles
+  and setting EIP to next_pc. The block is put on the list of its page.*/
+static codeblock_t *
+compile(int nr, uint32_t pc, uint32_t next_pc, int reg)
+{
+    codeblock_t *block = &codeblock[nr];
+    page_t *page = &pages[pc >> 12];
+    ir_data_t *ir;
+
+    memset(block, 0, sizeof(codeblock_t));
+    block->pc = block->phys = pc;
+    block->page_mask = 1;
+    block->dirty_mask = &page->dirty_mask;
+    block->next = page->block;
+    page->block = nr;
+
+    block_current = nr;
+    block->head_mem_block = codegen_allocator_allocate(NULL, block_current);
+    block->data = codeblock_allocator_get_ptr(block->head_mem_block);
+
+    ir = codegen_ir_init();
+    ir->block = block;
+    codegen_reg_reset();
+    uop_ADD_IMM(ir, reg, reg, 1);
+    uop_SUB_IMM(ir, IREG_cycles, IREG_cycles, 10);
+    uop_MOV_IMM(ir, IREG_pc, next_pc);
+    codegen_ir_compile(ir, block);
+
+    block->flags = CODEBLOCK_WAS_RECOMPILED;
+
+    return block;
+}
+
+
+/*Set up the link checks the way exec386_dynarec() does, with cycle_limit as
+  the cycle count below which link exits are not taken*/
+static void
+link_start(int cycle_limit)
+{
+    codegen_link.cycle_limit = cycle_limit;
+    codegen_link.timer = timer_target;
+    codegen_link.cs_base = cs;
+    codegen_link.status = cpu_cur_status;
+}
+
+
+static void
+enter(codeblock_t *block, int cycles_start)
+{
+    void (*code)(void) = (void *)&block->data[BLOCK_START];
+    int c;
+
+    for (c = 0; c < 8; c++)
+	cpu_state.regs[c].l = 0;
+    cycles = cycles_start;
+    link_calls = 0;
+
+    code();
+}
+
+
+static void
+run(codeblock_t *block, int cycles_start, int cycle_limit)
+{
+    link_start(cycle_limit);
+    enter(block, cycles_start);
+}
+
+
+static int
+check(const char *name, codeblock_t *from, int ecx, int esi, int edi)
+{
+    if ((link_calls != 1) || (link_block != get_block_nr(from)) ||
+	(cpu_state.regs[1].l != ecx) || (cpu_state.regs[6].l != esi) || (cpu_state.regs[7].l != edi)) {
+	printf("%-14s %i calls, last from block %i, ECX=%i ESI=%i EDI=%i, expected from block %i, ECX=%i ESI=%i EDI=%i\n",
+	       name, link_calls, link_block, cpu_state.regs[1].l, cpu_state.regs[6].l, cpu_state.regs[7].l,
+	       get_block_nr(from), ecx, esi, edi);
+	return 1;
+    }
+    printf("%-14s ok\n", name);
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    codeblock_t *a, *b, *c;
+    int fail = 0;
+    int n;
+
+    mem_block_data = mmap(NULL, NR_MEM_BLOCKS * MEM_BLOCK_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_block_data == MAP_FAILED)
+	fatal("mmap failed\n");
+    ram = malloc(1 << 20);
+    pages = calloc(NR_PAGES, sizeof(page_t));
+    for (n = 0; n < NR_PAGES; n++)
+	pages[n].evict_prev = EVICT_NOT_IN_LIST;
+
+    codegen_backend_init();
+    codegen_ir_opt = CODEGEN_IR_OPT_ALL;
+
+    /*A and B jump to each other within page 1, C on page 2 jumps to A*/
+    a = compile(1, 0x1000, 0x1100, IREG_ECX);
+    b = compile(2, 0x1100, 0x1000, IREG_ESI);
+    c = compile(3, 0x2000, 0x1000, IREG_EDI);
+
+    run(a, 100, 0);
+    fail |= check("not linked", a, 1, 0, 0);
+
+    codegen_block_link(a, b);
+    codegen_block_link(b, a);
+    codegen_block_link(c, a);
+    if ((a->link_patched != 1) || (b->link_patched != 1) || (c->link_patched != 1) ||
+	a->link_far || b->link_far || (c->link_far != 1)) {
+	printf("%-14s patched %i %i %i, far %i %i %i\n", "patch", a->link_patched, b->link_patched,
+	       c->link_patched, a->link_far, b->link_far, c->link_far);
+	fail = 1;
+    }
+
+    run(a, 100, 0);
+    fail |= check("chained", b, 5, 5, 0);
+    run(a, 100, 50);
+    fail |= check("timer due", a, 3, 2, 0);
+    run(c, 30, 0);
+    fail |= check("far", b, 1, 1, 1);
+
+    nmi = 1;
+    run(a, 100, 0);
+    fail |= check("NMI", a, 1, 0, 0);
+    nmi = 0;
+
+    cpu_state.flags = I_FLAG;
+    pic.int_pending = 1;
+    run(a, 100, 0);
+    fail |= check("interrupt", a, 1, 0, 0);
+    cpu_state.flags = 0;
+    run(a, 100, 0);
+    fail |= check("masked", b, 5, 5, 0);
+    pic.int_pending = 0;
+
+    /*Status or CS changed since the first block was entered*/
+    link_start(0);
+    cpu_cur_status = 1;
+    enter(a, 100);
+    fail |= check("status", a, 1, 0, 0);
+    cpu_cur_status = 0;
+    link_start(0);
+    cpu_state.seg_cs.base = 0x10;
+    enter(a, 100);
+    fail |= check("CS", a, 1, 0, 0);
+    cpu_state.seg_cs.base = 0;
+
+    /*A flush only patches back the exit leaving the page*/
+    codegen_flush();
+    run(c, 30, 0);
+    fail |= check("flushed", c, 0, 0, 1);
+    run(a, 100, 0);
+    fail |= check("flush near", b, 5, 5, 0);
+
+    /*As does a write to the page, for the exits going there*/
+    codegen_unlink_page(&pages[1]);
+    run(a, 100, 0);
+    fail |= check("page written", a, 1, 0, 0);
+
+    codegen_block_link(a, b);
+    codegen_block_link(b, a);
+    run(a, 100, 0);
+    fail |= check("relinked", b, 5, 5, 0);
+
+    codegen_block_unlink(b);
+    run(a, 100, 0);
+    fail |= check("deleted", a, 1, 0, 0);
+    if (a->link_patched || b->link_patched || a->link_in || b->link_in) {
+	printf("%-14s patched %i %i, incoming %08x %08x\n", "unlinked", a->link_patched, b->link_patched,
+	       a->link_in, b->link_in);
+	fail = 1;
+    }
+
+    return fail;
+}
@@ -0,0 +1,413 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check that code saved by the persistent code cache runs
+ *		again in a later session on the x86-64 backend.
+ *
+ *		Blocks are compiled and saved, then the backend routines,
+ *		code memory and guest RAM are set up again at other
+ *		addresses, as they would be in a new session, and the
+ *		blocks looked up, run and linked. A block addressing
+ *		memory outside the image and guest RAM should only come
+ *		back as a compile hint, and one whose guest bytes have
+ *		changed not at all.
+ *
+ *		Built and run by "make -C src/tests check" on x86-64 hosts.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <sys/mman.h>
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include <86box/plat.h>
+#include "x86.h"
+#include "codegen.h"
+#include "codegen_allocator.h"
+#include "codegen_backend.h"
+#include "codegen_ir.h"
+#include "codegen_reg.h"
+#include "codegen_public.h"
+
+
+#define NR_MEM_BLOCKS	256
+#define NR_PAGES	16
+#define RAM_SIZE	(1 << 20)
+
+struct mem_block_t
+{
+    int		nr;
+};
+
+cpu_state_t	cpu_state;
+uint8_t		*ram;
+uintptr_t	*readlookup2, *writelookup2;
+page_t		*pages;
+codeblock_t	*codeblock;
+uint16_t	*codeblock_hash;
+uint8_t		*block_write_data;
+int		block_current, block_pos;
+int		cpu_block_end;
+uint16_t	cpu_cur_status;
+uint32_t	timer_target;
+int		smi_line, nmi;
+pic_t		pic;
+wchar_t		usr_path[1024];
+uint32_t	mem_size, rammask;
+int		cpu;
+cpu_family_t	*cpu_f;
+
+static cpu_family_t family = { .internal_name = "test" };
+static struct mem_block_t mem_blocks[NR_MEM_BLOCKS];
+static uint8_t	*mem_block_data;
+static int	mem_blocks_used;
+static char	cache_dir[64];
+
+/*Blocks handed out by the lookup, and how*/
+static int	next_block, hinted, removed;
+static int	link_calls, link_block, func_calls;
+static uint32_t	*heap_value;
+
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+
+struct mem_block_t *
+codegen_allocator_allocate(struct mem_block_t *parent, int code_block)
+{
+    if (mem_blocks_used == NR_MEM_BLOCKS)
+	fatal("out of code memory\n");
+    mem_blocks[mem_blocks_used].nr = mem_blocks_used;
+    return &mem_blocks[mem_blocks_used++];
+}
+
+
+uint8_t *
+codeblock_allocator_get_ptr(struct mem_block_t *block)
+{
+    return &mem_block_data[block->nr * MEM_BLOCK_SIZE];
+}
+
+
+void *
+exec386_dynarec_link(void)
+{
+    link_calls++;
+    link_block = codegen_link.block;
+
+    return NULL;
+}
+
+
+static codeblock_t *
+block_get(uint32_t phys_addr, int flags, uint64_t page_mask)
+{
+    codeblock_t *block = &codeblock[next_block];
+
+    memset(block, 0, sizeof(codeblock_t));
+    block_current = next_block++;
+    block->pc = cs + cpu_state.pc;
+    block->_cs = cs;
+    block->phys = phys_addr;
+    block->status = cpu_cur_status;
+    block->flags = flags;
+    block->page_mask = page_mask;
+    block->dirty_mask = &pages[phys_addr >> 12].dirty_mask;
+
+    return block;
+}
+
+
+codeblock_t *
+codegen_block_init_cached(uint32_t phys_addr, int flags, uint64_t page_mask, uint64_t page_mask2, uint32_t endpc)
+{
+    codeblock_t *block = block_get(phys_addr, flags, page_mask);
+
+    block->head_mem_block = codegen_allocator_allocate(NULL, block_current);
+    block->data = codeblock_allocator_get_ptr(block->head_mem_block);
+
+    return block;
+}
+
+
+codeblock_t *
+codegen_block_init_hinted(uint32_t phys_addr, int flags, uint32_t endpc)
+{
+    hinted++;
+
+    return block_get(phys_addr, flags & (CODEBLOCK_BYTE_MASK | CODEBLOCK_NO_IMMEDIATES), 1);
+}
+
+
+void
+codegen_block_remove(void)
+{
+    codeblock[block_current].pc = BLOCK_PC_INVALID;
+    removed++;
+}
+
+
+void
+plat_append_filename(wchar_t *dest, wchar_t *s1, wchar_t *s2)
+{
+    swprintf(dest, 1024, L"%ls/%ls", s1, s2);
+}
+
+
+FILE *
+plat_fopen(wchar_t *path, wchar_t *mode)
+{
+    char temp[1024], temp_mode[8];
+
+    wcstombs(temp, path, sizeof(temp));
+    wcstombs(temp_mode, mode, sizeof(temp_mode));
+
+    return fopen(temp, temp_mode);
+}
+
+
+void
+plat_get_exe_name(wchar_t *s, int size)
+{
+    mbstowcs(s, "/proc/self/exe", size);
+}
+
+
+void	codegen_allocator_clean_blocks(struct mem_block_t *block) { }
+char	*machine_get_internal_name(void)	{ return "test"; }
+uint8_t	mem_readb_phys(uint32_t addr)		{ return ram[addr]; }
+int	mem_addr_is_ram(uint32_t addr)		{ abort(); }
+uint64_t mmutranslate_noabrt(uint32_t addr, int rw) { abort(); }
+void	addreadlookup(uint32_t virt, uint32_t phys) { abort(); }
+void	codegen_set_loop_start(struct ir_data_t *ir, int first_instruction) { }
+int	loadseg(uint16_t seg, x86seg *s)	{ abort(); }
+void	x86_int(int num)			{ abort(); }
+void	x86gpf(char *s, uint16_t error)		{ abort(); }
+uint8_t	readmembl(uint32_t addr)		{ abort(); }
+uint16_t readmemwl(uint32_t addr)		{ abort(); }
+uint32_t readmemll(uint32_t addr)		{ abort(); }
+uint64_t readmemql(uint32_t addr)		{ abort(); }
+void	writemembl(uint32_t addr, uint8_t val)	{ abort(); }
+void	writememwl(uint32_t addr, uint16_t val)	{ abort(); }
+void	writememll(uint32_t addr, uint32_t val)	{ abort(); }
+void	writememql(uint32_t addr, uint64_t val)	{ abort(); }
+
+
+static void
+count_call(void)
+{
+    func_calls++;
+}
+
+
+/*Start a session, with code memory, guest RAM and the backend routines at
+  new addresses. The old ones are left allocated so they can't be reused*/
+static void
+session_start(void)
+{
+    uint8_t *old_ram = ram;
+    int n;
+
+    mem_block_data = mmap(NULL, NR_MEM_BLOCKS * MEM_BLOCK_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_block_data == MAP_FAILED)
+	fatal("mmap failed\n");
+    mem_blocks_used = 0;
+
+    ram = malloc(RAM_SIZE);
+    if (old_ram)
+	memcpy(ram, old_ram, RAM_SIZE);
+    else
+	memset(ram, 0x90, RAM_SIZE);
+
+    memset(codeblock, 0, BLOCK_SIZE * sizeof(codeblock_t));
+    memset(pages, 0, NR_PAGES * sizeof(page_t));
+    for (n = 0; n < NR_PAGES; n++)
+	pages[n].evict_prev = EVICT_NOT_IN_LIST;
+    next_block = 10;
+    hinted = removed = 0;
+
+    block_current = 0;
+    codegen_backend_init();
+    codegen_ir_opt = CODEGEN_IR_OPT_ALL;
+    codegen_cache_load();
+}
+
+
+/*Compile block nr at pc, adding 1 to guest register reg, taking 10 cycles
+  and setting EIP to next_pc. A block with NO_IMMEDIATES also calls
+  count_call(), one without reads *heap_value into ESI*/
+static codeblock_t *
+compile(int nr, uint32_t pc, uint32_t next_pc, int reg, int flags)
+{
+    codeblock_t *block = &codeblock[nr];
+    page_t *page = &pages[pc >> 12];
+    ir_data_t *ir;
+
+    memset(block, 0, sizeof(codeblock_t));
+    block->pc = block->phys = pc;
+    block->page_mask = 1;
+    block->dirty_mask = &page->dirty_mask;
+    block->flags = flags;
+
+    block_current = nr;
+    block->head_mem_block = codegen_allocator_allocate(NULL, block_current);
+    block->data = codeblock_allocator_get_ptr(block->head_mem_block);
+
+    ir = codegen_ir_init();
+    ir->block = block;
+    codegen_reg_reset();
+    uop_ADD_IMM(ir, reg, reg, 1);
+    if (flags & CODEBLOCK_NO_IMMEDIATES)
+	uop_CALL_FUNC(ir, count_call);
+    else if (heap_value)
+	uop_MOV_REG_PTR(ir, IREG_ESI, heap_value);
+    uop_SUB_IMM(ir, IREG_cycles, IREG_cycles, 10);
+    uop_MOV_IMM(ir, IREG_pc, next_pc);
+    codegen_ir_compile(ir, block);
+
+    block->flags |= CODEBLOCK_WAS_RECOMPILED;
+
+    return block;
+}
+
+
+static codeblock_t *
+lookup(uint32_t pc)
+{
+    cpu_state.pc = pc;
+
+    return codegen_cache_lookup(pc);
+}
+
+
+static void
+run(codeblock_t *block, int cycles_start)
+{
+    void (*code)(void) = (void *)&block->data[BLOCK_START];
+    int c;
+
+    codegen_link.cycle_limit = 0;
+    codegen_link.timer = timer_target;
+    codegen_link.cs_base = cs;
+    codegen_link.status = cpu_cur_status;
+
+    for (c = 0; c < 8; c++)
+	cpu_state.regs[c].l = 0;
+    cycles = cycles_start;
+    link_calls = func_calls = 0;
+
+    code();
+}
+
+
+static int
+check(const char *name, codeblock_t *block, int ecx, int calls)
+{
+    if (!block || !(block->flags & CODEBLOCK_WAS_RECOMPILED)) {
+	printf("%-14s not taken from the cache, %i hinted, %i removed\n", name, hinted, removed);
+	return 1;
+    }
+
+    run(block, 100);
+    if ((link_calls != 1) || (link_block != get_block_nr(block)) ||
+	(cpu_state.regs[1].l != ecx) || (func_calls != calls)) {
+	printf("%-14s %i exits, last from block %i, ECX=%i, %i calls, expected from block %i, ECX=%i, %i calls\n",
+	       name, link_calls, link_block, cpu_state.regs[1].l, func_calls, get_block_nr(block), ecx, calls);
+	return 1;
+    }
+    printf("%-14s ok\n", name);
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    codeblock_t *a, *b, *c;
+    wchar_t cache_path[1024];
+    char temp[1024];
+    int fail = 0;
+
+    strcpy(cache_dir, "/tmp/code_cache_testXXXXXX");
+    if (!mkdtemp(cache_dir))
+	fatal("mkdtemp failed\n");
+    mbstowcs(usr_path, cache_dir, 1024);
+
+    codeblock = calloc(BLOCK_SIZE, sizeof(codeblock_t));
+    pages = calloc(NR_PAGES, sizeof(page_t));
+    heap_value = malloc(sizeof(uint32_t));
+    *heap_value = 0;
+    cpu_f = &family;
+    mem_size = RAM_SIZE >> 10;
+    rammask = RAM_SIZE - 1;
+    codegen_cache_enabled = 1;
+
+    /*A on page 1 loops to itself and calls a C function, B on page 2 reads
+      from the heap, C on page 3 is written to before the next session*/
+    session_start();
+    compile(1, 0x1000, 0x1000, IREG_ECX, CODEBLOCK_NO_IMMEDIATES);
+    compile(2, 0x2000, 0x1000, IREG_ECX, 0);
+    compile(3, 0x3000, 0x1000, IREG_ECX, CODEBLOCK_NO_IMMEDIATES);
+    codegen_cache_save();
+
+    session_start();
+    ram[0x3010] = 0xcc;
+
+    a = lookup(0x1000);
+    fail |= check("relocated", a, 1, 1);
+
+    codegen_block_link(a, a);
+    run(a, 100);
+    if ((link_calls != 1) || (cpu_state.regs[1].l != 10) || (func_calls != 10)) {
+	printf("%-14s %i exits, ECX=%i, %i calls\n", "linked", link_calls, cpu_state.regs[1].l, func_calls);
+	fail = 1;
+    } else
+	printf("%-14s ok\n", "linked");
+
+    b = lookup(0x2000);
+    if (!b || (b->flags & CODEBLOCK_WAS_RECOMPILED) || (hinted != 1)) {
+	printf("%-14s %s, %i hinted\n", "heap", b ? "code used" : "not found", hinted);
+	fail = 1;
+    } else
+	printf("%-14s ok\n", "heap");
+
+    c = lookup(0x3000);
+    if (c) {
+	printf("%-14s block %i found\n", "stale", get_block_nr(c));
+	fail = 1;
+    } else
+	printf("%-14s ok\n", "stale");
+
+    /*A is saved again from the block it was installed as, linked or not*/
+    codegen_cache_save();
+    session_start();
+    fail |= check("saved again", lookup(0x1000), 1, 1);
+
+    plat_append_filename(cache_path, usr_path, L"dynarec.cache");
+    wcstombs(temp, cache_path, sizeof(temp));
+    remove(temp);
+    remove(cache_dir);
+
+    return fail;
+}
@@ -0,0 +1,224 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check that immediate forms created by the IR optimisation
+ *		passes compile correctly on the x86-64 backend.
+ *
+ *		Copy propagation and constant folding can leave an OR_IMM or
+ *		XOR_IMM whose source register is not its destination. Each
+ *		sequence is compiled with every pass enabled, run, and the
+ *		guest registers compared with the expected values.
+ *
+ *		Built and run by "make -C src/tests check" on x86-64 hosts.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <sys/mman.h>
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/mem.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include "x86.h"
+#include "codegen.h"
+#include "codegen_allocator.h"
+#include "codegen_backend.h"
+#include "codegen_ir.h"
+#include "codegen_reg.h"
+#include "codegen_public.h"
+
+
+#define NR_MEM_BLOCKS	256
+
+struct mem_block_t
+{
+    int		nr;
+};
+
+cpu_state_t	cpu_state;
+uint8_t		*ram;
+uintptr_t	*readlookup2, *writelookup2;
+page_t		*pages;
+codeblock_t	*codeblock;
+uint16_t	*codeblock_hash;
+uint8_t		*block_write_data;
+int		block_current, block_pos;
+int		cpu_block_end;
+uint16_t	cpu_cur_status;
+uint32_t	timer_target;
+int		smi_line, nmi;
+pic_t		pic;
+int		codegen_reloc_enabled;
+
+static struct mem_block_t mem_blocks[NR_MEM_BLOCKS];
+static uint8_t	*mem_block_data;
+static int	mem_blocks_used;
+
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+
+struct mem_block_t *
+codegen_allocator_allocate(struct mem_block_t *parent, int code_block)
+{
+    if (mem_blocks_used == NR_MEM_BLOCKS)
+	fatal("out of code memory\n");
+    mem_blocks[mem_blocks_used].nr = mem_blocks_used;
+    return &mem_blocks[mem_blocks_used++];
+}
+
+
+uint8_t *
+codeblock_allocator_get_ptr(struct mem_block_t *block)
+{
+    return &mem_block_data[block->nr * MEM_BLOCK_SIZE];
+}
+
+
+void	*exec386_dynarec_link(void)		{ return NULL; }
+void	codegen_set_loop_start(struct ir_data_t *ir, int first_instruction) { }
+void	codegen_reloc_start(codeblock_t *block)	{ }
+void	codegen_reloc_add(codeblock_t *block, int type, void *site, void *target) { }
+void	codegen_reloc_end(codeblock_t *block, void *end) { }
+void	codegen_reloc_init(void **routines, int nr)	{ }
+int	loadseg(uint16_t seg, x86seg *s)	{ abort(); }
+void	x86_int(int num)			{ abort(); }
+void	x86gpf(char *s, uint16_t error)		{ abort(); }
+uint8_t	readmembl(uint32_t addr)		{ abort(); }
+uint16_t readmemwl(uint32_t addr)		{ abort(); }
+uint32_t readmemll(uint32_t addr)		{ abort(); }
+uint64_t readmemql(uint32_t addr)		{ abort(); }
+void	writemembl(uint32_t addr, uint8_t val)	{ abort(); }
+void	writememwl(uint32_t addr, uint16_t val)	{ abort(); }
+void	writememll(uint32_t addr, uint32_t val)	{ abort(); }
+void	writememql(uint32_t addr, uint64_t val)	{ abort(); }
+
+
+/*Compile and run the uOPs built by gen(). Returns the uOP that should have
+  become an immediate form.*/
+static uop_t *
+run(void (*gen)(ir_data_t *ir), uint32_t *ecx, uint32_t *esi)
+{
+    codeblock_t *block = &codeblock[1];
+    void (*code)(void);
+    ir_data_t *ir;
+    uop_t *last;
+
+    memset(block, 0, sizeof(codeblock_t));
+    block_current = 1;
+    block->head_mem_block = codegen_allocator_allocate(NULL, block_current);
+    block->data = codeblock_allocator_get_ptr(block->head_mem_block);
+
+    ir = codegen_ir_init();
+    ir->block = block;
+    codegen_reg_reset();
+    gen(ir);
+    last = &ir->uops[ir->wr_pos - 1];
+    codegen_ir_compile(ir, block);
+
+    cpu_state.regs[1].l = *ecx;
+    cpu_state.regs[6].l = *esi;
+    code = (void *)&block->data[BLOCK_START];
+    code();
+    *ecx = cpu_state.regs[1].l;
+    *esi = cpu_state.regs[6].l;
+
+    return last;
+}
+
+
+/*mov esi,ecx ; or esi,0x10*/
+static void
+gen_copy_or(ir_data_t *ir)
+{
+    uop_MOV(ir, IREG_ESI, IREG_ECX);
+    uop_OR_IMM(ir, IREG_ESI, IREG_ESI, 0x10);
+}
+
+
+/*mov esi,ecx ; xor esi,0x10*/
+static void
+gen_copy_xor(ir_data_t *ir)
+{
+    uop_MOV(ir, IREG_ESI, IREG_ECX);
+    uop_XOR_IMM(ir, IREG_ESI, IREG_ESI, 0x10);
+}
+
+
+/*mov esi,5 ; or esi,ecx*/
+static void
+gen_const_or(ir_data_t *ir)
+{
+    uop_MOV_IMM(ir, IREG_ESI, 5);
+    uop_OR(ir, IREG_ESI, IREG_ESI, IREG_ECX);
+}
+
+
+/*mov esi,5 ; xor esi,ecx*/
+static void
+gen_const_xor(ir_data_t *ir)
+{
+    uop_MOV_IMM(ir, IREG_ESI, 5);
+    uop_XOR(ir, IREG_ESI, IREG_ESI, IREG_ECX);
+}
+
+
+static int
+check(const char *name, void (*gen)(ir_data_t *ir), uint32_t type, uint32_t expect)
+{
+    uint32_t ecx = 0x12345600, esi = 0xdeadbeef;
+    uop_t *uop;
+
+    uop = run(gen, &ecx, &esi);
+    if (uop->type != type || uop->src_reg_a.reg != IREG_ECX) {
+	printf("%-14s not optimised (type %08x, src %02x)\n", name, uop->type, uop->src_reg_a.reg);
+	return 1;
+    }
+    if (esi != expect || ecx != 0x12345600) {
+	printf("%-14s ESI=%08x ECX=%08x, expected ESI=%08x\n", name, esi, ecx, expect);
+	return 1;
+    }
+    printf("%-14s ok\n", name);
+    return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int fail = 0;
+
+    mem_block_data = mmap(NULL, NR_MEM_BLOCKS * MEM_BLOCK_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem_block_data == MAP_FAILED)
+	fatal("mmap failed\n");
+    ram = malloc(1 << 20);
+
+    codegen_backend_init();
+    codegen_ir_opt = CODEGEN_IR_OPT_ALL;
+
+    fail |= check("copy OR_IMM", gen_copy_or, UOP_OR_IMM, 0x12345610);
+    fail |= check("copy XOR_IMM", gen_copy_xor, UOP_XOR_IMM, 0x12345610);
+    fail |= check("const OR", gen_const_or, UOP_OR_IMM, 0x12345605);
+    fail |= check("const XOR", gen_const_xor, UOP_XOR_IMM, 0x12345605);
+
+    return fail;
+}
@@ -0,0 +1,96 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check that bus master DMA into a page holding code marks the
+ *		byte masks used by blocks compiled with CODEBLOCK_BYTE_MASK.
+ *
+ *		Built and run by "make -C src/tests check".
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#include <86box/mem.h>
+
+
+uint32_t	purgable_page_list_head = 0;
+static int	evict_adds;
+
+
+void
+page_add_to_evict_list(page_t *p)
+{
+    p->evict_prev = 0;
+    evict_adds++;
+}
+
+
+static int
+check(const char *name, uint32_t code_off, uint32_t code_len,
+      uint32_t dma_off, uint32_t dma_len, int expect_evict)
+{
+    uint64_t dirty[64], code[64];
+    page_t p;
+    uint32_t c;
+    int ret = 0;
+
+    memset(&p, 0, sizeof(p));
+    memset(dirty, 0, sizeof(dirty));
+    memset(code, 0, sizeof(code));
+    p.byte_dirty_mask = dirty;
+    p.byte_code_present_mask = code;
+    p.evict_prev = EVICT_NOT_IN_LIST;
+    evict_adds = 0;
+
+    for (c = code_off; c < (code_off + code_len); c++)
+	code[c >> PAGE_BYTE_MASK_SHIFT] |= (uint64_t)1 << (c & PAGE_BYTE_MASK_MASK);
+
+    page_invalidate_bytes(&p, 0x12345000 + dma_off, dma_len);
+
+    for (c = 0; c < 4096; c++) {
+	int in = (c >= dma_off) && (c < (dma_off + dma_len));
+	int set = !!(dirty[c >> PAGE_BYTE_MASK_SHIFT] & ((uint64_t)1 << (c & PAGE_BYTE_MASK_MASK)));
+	if (in != set) {
+		printf("%s: byte %03x dirty=%i, expected %i\n", name, c, set, in);
+		ret = 1;
+		break;
+	}
+    }
+
+    if ((evict_adds != 0) != expect_evict) {
+	printf("%s: evict list add=%i, expected %i\n", name, evict_adds, expect_evict);
+	ret = 1;
+    }
+    if (evict_adds > 1) {
+	printf("%s: page added to evict list %i times\n", name, evict_adds);
+	ret = 1;
+    }
+
+    printf("%s: %s\n", name, ret ? "FAIL" : "ok");
+    return ret;
+}
+
+
+int
+main(void)
+{
+    int ret = 0;
+
+    /* Sector sized DMA straight over a block. */
+    ret |= check("sector over code", 0x210, 0x30, 0x200, 0x200, 1);
+    /* Whole page, code at the very end. */
+    ret |= check("full page", 0xfff, 1, 0x000, 0x1000, 1);
+    /* Unaligned run touching only the last byte of the code. */
+    ret |= check("unaligned edge", 0x100, 0x43, 0x142, 0x7, 1);
+    /* DMA next to, but not over, the code. */
+    ret |= check("adjacent", 0x400, 0x40, 0x440, 0x100, 0);
+    /* No code in the page at all. */
+    ret |= check("no code", 0, 0, 0x000, 0x1000, 0);
+
+    return ret;
+}
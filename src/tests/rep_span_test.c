@@ -0,0 +1,305 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check the page-span fast path of the REP string instructions
+ *		against the per-element path, and time both over 1 MB.
+ *
+ *		Random REP MOVS/STOS/LODS/SCAS runs, aligned and misaligned,
+ *		are executed once with every page unmapped in the lookup
+ *		tables (per-element path) and once with most pages mapped
+ *		(span path). Memory, registers, flags and the cycles charged
+ *		must come out the same. The per-element memory functions are
+ *		stand-ins that charge timing_misaligned the way mem.c does.
+ *
+ *		Built and run by "make -C src/tests check".
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <time.h>
+#define syscall cpu_syscall_
+#include <86box/86box.h>
+#include "cpu.h"
+#undef syscall
+#include <86box/mem.h>
+#include <86box/io.h>
+static uint32_t *eal_r, *eal_w;
+static uint32_t easeg;
+#include "x86.h"
+#include "386_common.h"
+#include "x86_flags.h"
+
+#define PREFETCH_RUN(a,b,c,d,e,f,g,h) do {} while (0)
+#define CPU_BLOCK_END() do {} while (0)
+#define CLOCK_CYCLES(c) do {} while (0)
+#define PREFETCH_PREFIX() do {} while (0)
+
+
+cpu_state_t	cpu_state;
+int		cpu_use_dynarec, is386, is486, trap;
+int		timing_misaligned = 3;
+uintptr_t	*readlookup2, *writelookup2;
+uint32_t	pccache;
+uint8_t		*pccache2;
+uint8_t		znptable8[256];
+uint16_t	znptable16[65536];
+
+
+uint8_t  inb(uint16_t port)		{ return 0xff; }
+uint16_t inw(uint16_t port)		{ return 0xffff; }
+uint32_t inl(uint16_t port)		{ return 0xffffffff; }
+void	 outb(uint16_t port, uint8_t val)	{ }
+void	 outw(uint16_t port, uint16_t val)	{ }
+void	 outl(uint16_t port, uint32_t val)	{ }
+int	 io_inw_block(uint16_t port, uint8_t *buf, int count)  { return 0; }
+int	 io_outw_block(uint16_t port, uint8_t *buf, int count) { return 0; }
+void	 x86gpf(char *s, uint16_t error)	{ abort(); }
+void	 x86np(char *s, uint16_t error)		{ abort(); }
+void	 x86ss(char *s, uint16_t error)		{ abort(); }
+void	 x86gpf_expected(char *s, uint16_t error)	{ abort(); }
+int	 checkio(int port)			{ return 0; }
+uint8_t	 *getpccache(uint32_t a)		{ abort(); }
+uint64_t mmutranslatereal(uint32_t addr, int rw)	{ return addr; }
+
+typedef int (*OpFn)(uint32_t fetchdat);
+OpFn		x86_opcodes[1024], x86_opcodes_REPE[1024], x86_opcodes_REPNE[1024];
+
+
+#include "x86_ops_rep.h"
+
+
+#define MEMSZ	(4 << 20)
+
+static uint8_t	 *ram_;
+static uintptr_t rl[1 << 20], wl[1 << 20];
+
+
+uint8_t
+readmembl(uint32_t addr)
+{
+    return ram_[addr % MEMSZ];
+}
+
+
+uint16_t
+readmemwl(uint32_t addr)
+{
+    if (addr & 1)
+	cycles -= timing_misaligned;
+    return ram_[addr % MEMSZ] | (ram_[(addr + 1) % MEMSZ] << 8);
+}
+
+
+uint32_t
+readmemll(uint32_t addr)
+{
+    if (addr & 3)
+	cycles -= timing_misaligned;
+    return ram_[addr % MEMSZ] | (ram_[(addr + 1) % MEMSZ] << 8) |
+	   (ram_[(addr + 2) % MEMSZ] << 16) | ((uint32_t) ram_[(addr + 3) % MEMSZ] << 24);
+}
+
+
+void
+writemembl(uint32_t addr, uint8_t val)
+{
+    ram_[addr % MEMSZ] = val;
+}
+
+
+void
+writememwl(uint32_t addr, uint16_t val)
+{
+    if (addr & 1)
+	cycles -= timing_misaligned;
+    ram_[addr % MEMSZ] = val;
+    ram_[(addr + 1) % MEMSZ] = val >> 8;
+}
+
+
+void
+writememll(uint32_t addr, uint32_t val)
+{
+    if (addr & 3)
+	cycles -= timing_misaligned;
+    ram_[addr % MEMSZ] = val;
+    ram_[(addr + 1) % MEMSZ] = val >> 8;
+    ram_[(addr + 2) % MEMSZ] = val >> 16;
+    ram_[(addr + 3) % MEMSZ] = val >> 24;
+}
+
+
+/* Map no pages for the per-element path, or most of them for the span
+   path, leaving some holes so runs fall back part way through. */
+static void
+setup(int span)
+{
+    int c;
+
+    for (c = 0; c < (1 << 20); c++)
+	rl[c] = wl[c] = (uintptr_t) LOOKUP_INV;
+
+    if (span) for (c = 0; c < (MEMSZ >> 12); c++) {
+	if ((c % 7) != 3)
+		rl[c] = (uintptr_t) ram_;
+	if ((c % 5) != 2)
+		wl[c] = (uintptr_t) ram_;
+    }
+}
+
+
+/* Run an instruction to completion, returning the cycles it took. */
+static int64_t
+run(OpFn op)
+{
+    int64_t used = 0;
+
+    do {
+	cycles = 100000;
+	cpu_state.pc = 0;
+	cpu_state.oldpc = 1;
+	op(0);
+	used += 100000 - cycles;
+    } while (cpu_state.pc == cpu_state.oldpc);
+
+    return used;
+}
+
+
+static void
+make_flag_tables(void)
+{
+    int c, p;
+
+    for (c = 0; c < 65536; c++) {
+	p = __builtin_parity(c & 0xff) ? 0 : P_FLAG;
+	if (c < 256)
+		znptable8[c] = (c ? 0 : Z_FLAG) | ((c & 0x80) ? N_FLAG : 0) | p;
+	znptable16[c] = (c ? 0 : Z_FLAG) | ((c & 0x8000) ? N_FLAG : 0) | p;
+    }
+}
+
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    static const OpFn ops[] = {
+	opREP_MOVSB_a32, opREP_MOVSW_a32, opREP_MOVSL_a32,
+	opREP_STOSB_a32, opREP_STOSW_a32, opREP_STOSL_a32,
+	opREP_LODSB_a32, opREP_LODSW_a32, opREP_LODSL_a32,
+	opREP_SCASB_a32_NE, opREP_SCASB_a32_E,
+	opREP_MOVSB_a16, opREP_MOVSL_a16, opREP_STOSW_a16, opREP_SCASB_a16_NE
+    };
+    const int nops = sizeof(ops) / sizeof(ops[0]), first_a16 = 11;
+    uint32_t si, di, cnt, eax, sbase, dbase, res[2][6];
+    int64_t used[2];
+    uint8_t *ref;
+    double start;
+    int it, i, oi, a16, span, k, fails = 0;
+
+    make_flag_tables();
+    ram_ = (uint8_t *) malloc(MEMSZ);
+    ref = (uint8_t *) malloc(MEMSZ);
+    readlookup2 = rl;
+    writelookup2 = wl;
+    is386 = is486 = 1;
+    cpu_use_dynarec = 1;
+
+    cpu_state.seg_ds.base = 0;
+    cpu_state.seg_ds.limit_low = 0;
+    cpu_state.seg_ds.limit_high = 0xffffffff;
+    cpu_state.seg_es = cpu_state.seg_ds;
+    cpu_state.ea_seg = &cpu_state.seg_ds;
+
+    srand(2);
+    for (it = 0; it < 3000; it++) {
+	oi = rand() % nops;
+	a16 = (oi >= first_a16);
+	si = rand() % (MEMSZ - 0x40000);
+	di = (rand() & 1) ? (si + (rand() % 9) - 4) : (rand() % (MEMSZ - 0x40000));
+	cnt = rand() % 20000;
+	sbase = dbase = 0;
+	if (a16) {
+		sbase = si & ~0xffff;
+		dbase = di & ~0xffff;
+		si &= 0xffff;
+		di &= 0xffff;
+		cnt &= 0x3fff;
+	}
+	eax = rand();
+	if (rand() & 1)
+		eax = (sbase + si) % 13;
+
+	for (span = 0; span < 2; span++) {
+		for (i = 0; i < MEMSZ; i++)
+			ram_[i] = (i < (MEMSZ / 2)) ? ((i * 7 + (i >> 9)) % 13) : ((i >> 11) % 13);
+		setup(span);
+		cpu_state.seg_ds.base = sbase;
+		cpu_state.seg_es.base = dbase;
+		ESI = si;
+		EDI = di;
+		ECX = cnt;
+		EAX = eax;
+		cpu_state.flags = 0;
+		cpu_state.flags_op = FLAGS_UNKNOWN;
+
+		used[span] = run(ops[oi]);
+
+		flags_rebuild();
+		res[span][0] = ESI;
+		res[span][1] = EDI;
+		res[span][2] = ECX;
+		res[span][3] = EAX;
+		res[span][4] = cpu_state.flags & 0x8d5;
+		res[span][5] = (uint32_t) used[span];
+		if (! span)
+			memcpy(ref, ram_, MEMSZ);
+	}
+
+	if (memcmp(ref, ram_, MEMSZ) || memcmp(res[0], res[1], sizeof(res[0]))) {
+		if (fails++ < 10)
+			printf("FAIL: op %i, si %08x, di %08x, count %i, cycles %i/%i\n",
+			       oi, si, di, cnt, res[0][5], res[1][5]);
+	}
+    }
+    printf("%i random runs, %i failures\n", it, fails);
+
+    /* 1 MB REP MOVSD followed by 1 MB REP STOSD. */
+    for (span = 0; span < 2; span++) {
+	setup(span);
+	start = now_ms();
+	for (k = 0; k < 50; k++) {
+		cpu_state.seg_ds.base = cpu_state.seg_es.base = 0;
+		cpu_state.flags = 0;
+		ESI = 0;
+		EDI = 0x200000;
+		ECX = 0x40000;
+		run(opREP_MOVSL_a32);
+		EDI = 0x100000;
+		ECX = 0x40000;
+		EAX = k;
+		run(opREP_STOSL_a32);
+	}
+	printf("%s: %.2f ms per 1 MB MOVSD + STOSD pair\n",
+	       span ? "page span" : "per element", (now_ms() - start) / 50.0);
+    }
+
+    return !!fails;
+}
@@ -0,0 +1,499 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Save and restore a snapshot of the devices of a plain AT.
+ *
+ *		The PIT, PIC, DMA, CMOS, keyboard controller, FDC, serial
+ *		ports, ISA IDE controller and VGA are the real modules and
+ *		are set up the way machine_at_ibm_init() and pc_reset_hard()
+ *		do for an IBM AT with a VGA card and an IDE controller. The
+ *		CPU, memory and platform layers are stand-ins, with 64 MB of
+ *		guest RAM.
+ *
+ *		After programming the devices, the machine is saved, every
+ *		device is reprogrammed, and the snapshot is loaded again.
+ *		The registers read back through the I/O ports must match the
+ *		values from before the save, and saving again must produce
+ *		the same file. Saving with a device without a state hook
+ *		attached must fail.
+ *
+ *		Built and run by "make -C src/tests check".
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <time.h>
+#include <86box/86box.h>
+#include "cpu.h"
+#include "x86.h"
+#include "x87.h"
+#include <86box/device.h>
+#include <86box/timer.h>
+#include <86box/io.h>
+#include <86box/dma.h>
+#include <86box/mem.h>
+#include <86box/rom.h>
+#include <86box/nmi.h>
+#include <86box/pic.h>
+#include <86box/pit.h>
+#include <86box/ppi.h>
+#include <86box/nvr.h>
+#include <86box/machine.h>
+#include <86box/keyboard.h>
+#include <86box/fdd.h>
+#include <86box/fdc.h>
+#include <86box/serial.h>
+#include <86box/hdd.h>
+#include <86box/hdc.h>
+#include <86box/hdc_ide.h>
+#include <86box/video.h>
+#include <86box/vid_svga.h>
+#include <86box/sound.h>
+#include <86box/gameport.h>
+#include <86box/snd_speaker.h>
+#include <86box/plat.h>
+#include <86box/ui.h>
+#include <86box/snapshot.h>
+
+
+#define RAM_MB		64
+#define SNP_A		L"snapshot_test_a.snp"
+#define SNP_B		L"snapshot_test_b.snp"
+
+
+extern const device_t	vga_device;
+
+
+/* The CPU. */
+cpu_state_t	cpu_state;
+uint32_t	cr2, cr3, cr4, dr[8];
+x86seg		gdt, ldt, idt, tr;
+msr_t		msr;
+uint64_t	tsc, amd_efer, star, xt_cpu_multi = 1;
+uint32_t	cpu_cur_status, use32, smbase;
+uint32_t	x87_pc_off, x87_op_off;
+uint16_t	x87_pc_seg, x87_op_seg;
+uint16_t	cpu_fast_off_count, cpu_fast_off_val;
+uint32_t	cpu_fast_off_flags;
+int		stack32, cpl_override, in_smm, smi_line, smi_latched, smm_in_hlt;
+int		is8086, is286, is386, is486 = 0, is486sx, is486dx, is486sx2, is486dx2, isdx4;
+int		cpu_16bitbus, cpu_64bitbus, cpu_busspeed = 8000000, cpu_pci_speed = 8000000;
+int		isa_cycles, cpu_use_dynarec, pic_pending, is_vpc, soft_reset_mask, alt_access;
+int		nmi, nmi_mask, nmi_auto_clear, acpi_rtc_status, amstrad_latch;
+CPU		*cpu_s;
+
+static CPU	at_cpu = { "286/8", CPU_286, NULL, 8000000 };
+
+/* The machine and memory. */
+int		AT = 1, PCI = 0, machine = 0, time_sync = 0, gfxcard = 0;
+int		serial_enabled[SERIAL_MAX] = { 1, 1, 0, 0 };
+uint32_t	mem_size = RAM_MB << 10;
+uint32_t	ram_dirty_pages = RAM_MB << 8;
+uint8_t		*ram, *ram2, *ram_dirty_map;
+int		mem_a20_key;
+wchar_t		usr_path[1024];
+hard_disk_t	hdd[HDD_NUM];
+const machine_t	machines[] = {
+    { "[ISA] IBM AT", "ibmat", MACHINE_TYPE_286, .flags = MACHINE_AT, .nvrmask = 63 }
+};
+
+/* Video. */
+int		changeframecount = 2, enable_overscan, suppress_overscan, xsize = 640, ysize = 480;
+int		overscan_x, overscan_y, egareads, egawrites;
+int		video_timing_read_b, video_timing_read_w, video_timing_read_l;
+int		video_timing_write_b, video_timing_write_w, video_timing_write_l;
+uint8_t		edatlookup[4][4];
+uint32_t	*video_6to8, *video_15to32, *video_16to32;
+bitmap_t	*buffer32;
+dbcs_font_t	*fontdatksc5601, *fontdatksc5601_user;
+
+/* Sound and input. */
+PPI		ppi;
+int		ppispeakon, speakon, speaker_mute, speaker_gated, speaker_enable, was_speaker_enable;
+int		mouse_scan;
+
+static int	reset_hard;
+
+
+void
+pclog(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+
+FILE *
+plat_fopen(wchar_t *path, wchar_t *mode)
+{
+    char p[1024], m[16];
+
+    wcstombs(p, path, sizeof(p));
+    wcstombs(m, mode, sizeof(m));
+    return fopen(p, m);
+}
+
+
+uint8_t *
+mem_ram_page(uint32_t page)
+{
+    return &ram[page << 12];
+}
+
+
+void
+mem_dirty_clear(void)
+{
+    memset(ram_dirty_map, 0x00, ram_dirty_pages >> 3);
+}
+
+
+/* Everything but the RAM image is covered by the device modules. */
+void		mem_state(snapshot_t *s)		{ }
+void		pc_reset_hard(void)			{ reset_hard++; }
+char		*machine_get_internal_name(void)	{ return (char *) machines[machine].internal_name; }
+const device_t	*machine_getdevice(int m)		{ return NULL; }
+void		flushmmucache(void)			{ }
+void		softresetx86(void)			{ }
+void		cpu_set_edx(void)			{ }
+void		refreshread(void)			{ }
+void		update_tsc(void)			{ }
+void		mem_a20_recalc(void)			{ }
+void		mem_invalidate_range(uint32_t start, uint32_t end) { }
+void		mem_mapping_add(mem_mapping_t *m, uint32_t base, uint32_t size,
+				uint8_t (*rb)(uint32_t a, void *p), uint16_t (*rw)(uint32_t a, void *p),
+				uint32_t (*rl)(uint32_t a, void *p), void (*wb)(uint32_t a, uint8_t v, void *p),
+				void (*ww)(uint32_t a, uint16_t v, void *p), void (*wl)(uint32_t a, uint32_t v, void *p),
+				uint8_t *exec, uint32_t flags, void *p) { }
+void		mem_mapping_set_addr(mem_mapping_t *m, uint32_t base, uint32_t size) { }
+uint8_t		mem_readb_phys(uint32_t addr)		{ return 0xff; }
+uint16_t	mem_readw_phys(uint32_t addr)		{ return 0xffff; }
+uint32_t	mem_readl_phys(uint32_t addr)		{ return 0xffffffff; }
+void		mem_writeb_phys(uint32_t addr, uint8_t val) { }
+void		mem_read_phys(void *dest, uint32_t addr, int tranfer_size) { }
+void		mem_write_phys(void *src, uint32_t addr, int tranfer_size) { }
+uint32_t	mem_read_phys_ram(void *dest, uint32_t addr, uint32_t len) { return 0; }
+uint32_t	mem_write_phys_ram(const void *src, uint32_t addr, uint32_t len) { return 0; }
+void		ps2_cache_clean(void)			{ }
+int		rom_init(rom_t *rom, wchar_t *fn, uint32_t addr, int sz, int mask, int off, uint32_t flags) { return 1; }
+int		rom_present(wchar_t *fn)		{ return 1; }
+uint32_t	random_generate(void)			{ return 0; }
+int		config_get_int(char *head, char *name, int def) { return def; }
+void		config_set_int(char *head, char *name, int val) { }
+int		config_get_hex16(char *head, char *name, int def) { return def; }
+void		config_set_hex16(char *head, char *name, int val) { }
+int		config_get_hex20(char *head, char *name, int def) { return def; }
+void		config_set_hex20(char *head, char *name, int val) { }
+int		config_get_mac(char *head, char *name, int def) { return def; }
+void		config_set_mac(char *head, char *name, int val) { }
+char		*config_get_string(char *head, char *name, char *def) { return def; }
+wchar_t		*plat_get_extension(wchar_t *s)		{ return NULL; }
+void		plat_path_slash(wchar_t *path)		{ }
+int		plat_dir_check(wchar_t *path)		{ return 1; }
+int		plat_dir_create(wchar_t *path)		{ return 0; }
+void		ui_sb_update_icon(int tag, int active)	{ }
+void		ui_sb_update_icon_state(int tag, int state) { }
+void		video_inform(int type, const video_timings_t *ptr) { }
+void		video_reset(int card)			{ }
+void		video_update_timing(void)		{ }
+void		video_wait_for_buffer(void)		{ }
+void		video_blit_memtoscreen(int x, int y, int y1, int y2, int w, int h) { }
+void		video_force_resize_set(uint8_t res)	{ }
+uint8_t		video_force_resize_get(void)		{ return 0; }
+int		video_is_mda(void)			{ return 0; }
+void		set_screen_size(int x, int y)		{ }
+void		sound_speed_changed(void)		{ }
+void		speaker_update(void)			{ }
+void		speaker_set_count(uint8_t new_m, int new_count) { }
+int		hdd_image_load(int id)			{ return 0; }
+void		hdd_image_close(uint8_t id)		{ }
+void		hdd_image_prefetch(uint8_t id, uint32_t sector, uint32_t count) { }
+void		hdd_image_read(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer) { }
+void		hdd_image_write(uint8_t id, uint32_t sector, uint32_t count, uint8_t *buffer) { }
+void		hdd_image_zero(uint8_t id, uint32_t sector, uint32_t count) { }
+int		hdd_image_write_error(uint8_t id)	{ return 0; }
+void		xi8088_turbo_set(uint8_t value)		{ }
+uint8_t		xi8088_turbo_get(void)			{ return 0; }
+void		t3100e_notify_set(uint8_t value)	{ }
+void		t3100e_display_set(uint8_t value)	{ }
+void		t3100e_turbo_set(uint8_t value)		{ }
+void		t3100e_mono_set(uint8_t value)		{ }
+uint8_t		t3100e_config_get(void)			{ return 0; }
+uint8_t		t3100e_mono_get(void)			{ return 0; }
+
+/* No floppy images. */
+void	img_init(void)				{ }
+void	img_load(int drive, wchar_t *fn)	{ }
+void	img_close(int drive)			{ }
+void	img_set_fdc(void *fdc)			{ }
+void	imd_init(void)				{ }
+void	imd_load(int drive, wchar_t *fn)	{ }
+void	imd_close(int drive)			{ }
+void	imd_set_fdc(void *fdc)			{ }
+void	fdi_load(int drive, wchar_t *fn)	{ }
+void	fdi_close(int drive)			{ }
+void	fdi_set_fdc(void *fdc)			{ }
+void	json_init(void)				{ }
+void	json_load(int drive, wchar_t *fn)	{ }
+void	json_close(int drive)			{ }
+void	mfm_load(int drive, wchar_t *fn)	{ }
+void	mfm_close(int drive)			{ }
+void	mfm_set_fdc(void *fdc)			{ }
+void	td0_init(void)				{ }
+void	td0_load(int drive, wchar_t *fn)	{ }
+void	td0_close(int drive)			{ }
+
+const device_t	fdc_pii151b_device, fdc_pii158b_device;
+const joystick_if_t joystick_standard, joystick_standard_4button, joystick_standard_6button,
+		joystick_standard_8button, joystick_4axis_4button, joystick_ch_flightstick_pro,
+		joystick_sw_pad, joystick_tm_fcs;
+
+
+/* A device which cannot save its state. */
+static void *	hookless_init(const device_t *info)	{ return (void *) info; }
+
+static const device_t hookless_device = {
+    "No state hook", 0, 0,
+    hookless_init, NULL, NULL,
+    { NULL }, NULL, NULL, NULL
+};
+
+
+static void
+at_init(void)
+{
+    timer_init();
+    io_init();
+    device_init();
+
+    /* machine_common_init() and machine_at_common_init_ex(). */
+    pic_init();
+    dma_init();
+    pit_common_init(1, pit_irq0_timer, NULL);
+    pic2_init();
+    dma16_init();
+    device_add(&ibmat_nvr_device);
+
+    /* machine_at_ibm_common_init(). */
+    device_add(&keyboard_at_device);
+    device_add(&fdc_at_device);
+
+    /* pc_reset_hard_init(). */
+    device_add(&vga_device);
+    serial_standalone_init();
+    fdd_reset();
+    device_add(&ide_isa_device);
+}
+
+
+/* Program every device, with a different set of values per pass. */
+static void
+program(svga_t *svga, int pass)
+{
+    uint8_t v = pass ? 0x5a : 0xa5;
+    int c;
+
+    outb(0x43, 0xb6);			/* PIT counter 2, mode 3 */
+    outb(0x42, v);
+    outb(0x42, v ^ 0xff);
+    outb(0x61, pass ? 0x01 : 0x03);
+
+    outb(0x21, v);			/* PIC masks */
+    outb(0xa1, v ^ 0xff);
+
+    outb(0x0a, 0x05);			/* DMA channel 1 */
+    outb(0x02, v);
+    outb(0x02, v >> 1);
+    outb(0x83, v);
+
+    outb(0x70, 0x20);			/* CMOS */
+    outb(0x71, v);
+
+    outb(0x64, 0x60);			/* KBC command byte */
+    outb(0x60, pass ? 0x45 : 0x65);
+
+    outb(0x3f2, pass ? 0x0c : 0x1c);	/* FDC DOR */
+
+    outb(0x3fb, 0x83);			/* COM1 divisor, LCR, scratch */
+    outb(0x3f8, v);
+    outb(0x3fb, pass ? 0x03 : 0x1b);
+    outb(0x3ff, v);
+    outb(0x2ff, v ^ 0xff);
+
+    outb(0x1f2, v);			/* IDE sector count, LBA low */
+    outb(0x1f3, v ^ 0x0f);
+
+    outb(0x3c4, 0x02);			/* VGA map mask, bit mask, CRTC, DAC */
+    outb(0x3c5, 0x0f);
+    outb(0x3ce, 0x08);
+    outb(0x3cf, 0xff);
+    outb(0x3d4, 0x0c);
+    outb(0x3d5, v);
+    outb(0x3c8, 0x10);
+    for (c = 0; c < 3; c++)
+	outb(0x3c9, (v + c) & 0x3f);
+    for (c = 0; c < 4096; c++)
+	svga_write(0xa0000 + c, (uint8_t) (c * v), svga);
+
+    ram[0] = ram[(RAM_MB << 20) - 1] = v;
+
+    /* Read the KBC command byte back and move time on, so that it
+       reaches the output buffer. */
+    outb(0x64, 0x20);
+    tsc += 10000 + pass;
+    timer_process();
+}
+
+
+/* Read back what program() set, as far as the ports allow it. */
+static void
+fingerprint(svga_t *svga, uint8_t *fp)
+{
+    int c;
+
+    outb(0x70, 0x20);
+    fp[0] = inb(0x71);
+    fp[1] = inb(0x21);
+    fp[2] = inb(0xa1);
+    fp[3] = inb(0x83);
+    fp[4] = inb(0x61);
+    fp[20] = inb(0x60);		/* the KBC command byte, before the status */
+    fp[5] = inb(0x64);
+    fp[6] = inb(0x3fb);
+    fp[7] = inb(0x3ff);
+    fp[8] = inb(0x2ff);
+    fp[9] = inb(0x1f2);
+    fp[10] = inb(0x1f3);
+    outb(0x3d4, 0x0c);
+    fp[11] = inb(0x3d5);
+    outb(0x3c7, 0x10);
+    for (c = 0; c < 3; c++)
+	fp[12 + c] = inb(0x3c9);
+    fp[15] = svga_read(0xa0000 + 0x123, svga);
+    fp[16] = ram[0];
+    fp[17] = ram[(RAM_MB << 20) - 1];
+    fp[18] = inb(0x3f4);
+    fp[19] = pit->counters[2].l;
+}
+
+
+static int
+files_equal(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    int ca, cb, ret = 0;
+
+    if ((fa != NULL) && (fb != NULL)) {
+	do {
+		ca = fgetc(fa);
+		cb = fgetc(fb);
+	} while ((ca == cb) && (ca != EOF));
+	ret = (ca == cb);
+    }
+
+    if (fa != NULL)
+	fclose(fa);
+    if (fb != NULL)
+	fclose(fb);
+
+    return ret;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    uint8_t before[21], after[21];
+    struct timespec t0, t1;
+    svga_t *svga;
+    int c, fail = 0;
+
+    ram = calloc(1, RAM_MB << 20);
+    ram_dirty_map = calloc(1, ram_dirty_pages >> 3);
+    video_6to8 = malloc(256 * sizeof(uint32_t));
+    for (c = 0; c < 256; c++)
+	video_6to8[c] = (c & 0x3f) << 2;
+    cpu_s = &at_cpu;
+    pit_set_clock(cpu_s->rspeed);
+    cpu_state.ea_seg = &cpu_state.seg_ds;
+
+    at_init();
+    svga = (svga_t *) device_get_priv(&vga_device);
+
+    program(svga, 0);
+    fingerprint(svga, before);
+    /* A load always asks for the screen to be redrawn in full. */
+    svga->fullchange = changeframecount;
+
+    if (! snapshot_save(SNP_A)) {
+	printf("save failed\n");
+	return 1;
+    }
+
+    program(svga, 1);
+    fingerprint(svga, after);
+    if (! memcmp(before, after, sizeof(before))) {
+	printf("second pass did not change the machine\n");
+	return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (! snapshot_load(SNP_A) || reset_hard) {
+	printf("load failed\n");
+	return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("restored %i MB in %.0f ms\n", RAM_MB,
+	   (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1000000.0);
+
+    fingerprint(svga, after);
+    for (c = 0; c < (int) sizeof(before); c++) {
+	if (before[c] != after[c]) {
+		printf("register %i is %02x after the restore, expected %02x\n", c, after[c], before[c]);
+		fail = 1;
+	}
+    }
+
+    /* Nothing may be lost or added between a save and the next one. */
+    if (! snapshot_save(SNP_B) || !files_equal("snapshot_test_a.snp", "snapshot_test_b.snp")) {
+	printf("saving the restored machine gave a different file\n");
+	fail = 1;
+    }
+
+    device_add(&hookless_device);
+    if (snapshot_save(SNP_B)) {
+	printf("saved with a device without a state hook\n");
+	fail = 1;
+    }
+
+    remove("snapshot_test_a.snp");
+    remove("snapshot_test_b.snp");
+
+    if (! fail)
+	printf("ok\n");
+
+    return fail;
+}
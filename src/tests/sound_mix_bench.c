@@ -0,0 +1,237 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check the mixing and conversion kernels of snd_mix.c against
+ *		the scalar loops they replaced, and time them.
+ *
+ *		Every kernel built for this host (scalar, SSE2, AVX2, NEON)
+ *		must give the same output as the old loop from sound_poll()
+ *		or the card get_buffer callbacks, over random samples that
+ *		include values outside the 16-bit range. Each kernel is then
+ *		timed on one SOUNDBUFLEN period.
+ *
+ *		Built by "make -C src/tests"; it is not run by check.
+ */
+#include <stdlib.h>
+#include <time.h>
+#include "../sound/snd_mix.c"
+
+
+#define LEN	(SOUNDBUFLEN * 2)
+#define RUNS	20000
+
+
+typedef struct {
+    const char	*name;
+    void	(*add)(int32_t *dst, const int32_t *src, int len);
+    void	(*add_16)(int32_t *dst, const int16_t *src, int len);
+    void	(*add_16_half)(int32_t *dst, const int16_t *src, int len);
+    void	(*to_float)(float *dst, const int32_t *src, int len);
+    void	(*to_int16)(int16_t *dst, const int32_t *src, int len);
+} kernels_t;
+
+
+#define KERNELS(n)	{ #n, mix_add_##n, mix_add_16_##n, mix_add_16_half_##n, \
+			  mix_to_float_##n, mix_to_int16_##n }
+
+
+/* The loops as they were before the kernels. */
+static void
+old_add(int32_t *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] += src[c];
+}
+
+
+static void
+old_add_16(int32_t *dst, const int16_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] += src[c];
+}
+
+
+static void
+old_add_16_half(int32_t *dst, const int16_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] += (src[c] / 2);
+}
+
+
+static void
+old_to_float(float *dst, const int32_t *src, int len)
+{
+    int c;
+
+    for (c = 0; c < len; c++)
+	dst[c] = ((float) src[c]) / 32768.0;
+}
+
+
+static void
+old_to_int16(int16_t *dst, const int32_t *src, int len)
+{
+    int32_t s;
+    int c;
+
+    for (c = 0; c < len; c++) {
+	s = src[c];
+	if (s > 32767)
+		s = 32767;
+	if (s < -32768)
+		s = -32768;
+
+	dst[c] = s;
+    }
+}
+
+
+static const kernels_t old = {
+    "old loop", old_add, old_add_16, old_add_16_half, old_to_float, old_to_int16
+};
+
+static const kernels_t kernels[] = {
+    KERNELS(c),
+#if defined(__SSE2__)
+    KERNELS(sse2),
+#endif
+#if defined(USE_AVX2)
+    KERNELS(avx2),
+#endif
+#if defined(USE_NEON)
+    KERNELS(neon),
+#endif
+};
+
+
+static int32_t	src32[LEN], dst32[LEN], ref32[LEN];
+static int16_t	src16[LEN], dst16[LEN], ref16[LEN];
+static float	dstf[LEN], reff[LEN];
+
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+
+static void
+fill(void)
+{
+    int c;
+
+    for (c = 0; c < LEN; c++) {
+	src32[c] = (rand() % 196608) - 98304;
+	src16[c] = rand();
+	dst32[c] = ref32[c] = (rand() % 65536) - 32768;
+    }
+}
+
+
+/* Compare a kernel set with the old loops, returning the failures. */
+static int
+check(const kernels_t *k)
+{
+    int it, fails = 0;
+
+    for (it = 0; it < 100; it++) {
+	fill();
+	k->add(dst32, src32, LEN - it);
+	old.add(ref32, src32, LEN - it);
+	k->add_16(dst32, src16, LEN - it);
+	old.add_16(ref32, src16, LEN - it);
+	k->add_16_half(dst32, src16, LEN - it);
+	old.add_16_half(ref32, src16, LEN - it);
+	fails += !!memcmp(dst32, ref32, sizeof(dst32));
+
+	memset(dstf, 0, sizeof(dstf));
+	memset(reff, 0, sizeof(reff));
+	k->to_float(dstf, src32, LEN - it);
+	old.to_float(reff, src32, LEN - it);
+	fails += !!memcmp(dstf, reff, sizeof(dstf));
+
+	memset(dst16, 0, sizeof(dst16));
+	memset(ref16, 0, sizeof(ref16));
+	k->to_int16(dst16, src32, LEN - it);
+	old.to_int16(ref16, src32, LEN - it);
+	fails += !!memcmp(dst16, ref16, sizeof(dst16));
+    }
+
+    return fails;
+}
+
+
+static void
+bench(const kernels_t *k)
+{
+    double t[5];
+    int c;
+
+    t[0] = now_ms();
+    for (c = 0; c < RUNS; c++)
+	k->add(dst32, src32, LEN);
+    t[1] = now_ms();
+    for (c = 0; c < RUNS; c++)
+	k->add_16(dst32, src16, LEN);
+    t[2] = now_ms();
+    for (c = 0; c < RUNS; c++)
+	k->to_float(dstf, src32, LEN);
+    t[3] = now_ms();
+    for (c = 0; c < RUNS; c++)
+	k->to_int16(dst16, src32, LEN);
+    t[4] = now_ms();
+
+    /* Nanoseconds per period. */
+    printf("%-10s add %7.0f  add_16 %7.0f  to_float %7.0f  to_int16 %7.0f\n", k->name,
+	   (t[1] - t[0]) * 1000000.0 / RUNS, (t[2] - t[1]) * 1000000.0 / RUNS,
+	   (t[3] - t[2]) * 1000000.0 / RUNS, (t[4] - t[3]) * 1000000.0 / RUNS);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    int n = sizeof(kernels) / sizeof(kernels[0]);
+    int i, f, fails = 0;
+
+#if defined(USE_AVX2)
+    /* The AVX2 set is the last one on x86. */
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) {
+	printf("Host has no AVX2, skipping those kernels\n");
+	n--;
+    }
+#endif
+
+    srand(5);
+    for (i = 0; i < n; i++) {
+	f = check(&kernels[i]);
+	printf("%s: %i mismatches\n", kernels[i].name, f);
+	fails += f;
+    }
+
+    printf("\nns per %i samples:\n", LEN);
+    fill();
+    bench(&old);
+    for (i = 0; i < n; i++)
+	bench(&kernels[i]);
+
+    return !!fails;
+}
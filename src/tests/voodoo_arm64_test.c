@@ -0,0 +1,1081 @@
+/*
+ * 86Box	A hypervisor and IBM PC system emulator that specializes in
+ *		running old operating systems and software designed for IBM
+ *		PC systems and compatibles from 1981 through fairly recent
+ *		system designs based on the PCI bus.
+ *
+ *		This file is part of the 86Box distribution.
+ *
+ *		Check the ARM64 Voodoo code generator against the C renderer.
+ *
+ *		vid_voodoo_render.c is built here with the ARM64 code
+ *		generator selected, whatever the host. Random triangles are
+ *		drawn once with the C renderer and once with the generated
+ *		code, and the frame and depth buffers and the pixel counts
+ *		must come out the same. The generated code is run by a small
+ *		AArch64 interpreter that covers the integer instructions the
+ *		generator emits, and on AArch64 hosts it is also run natively.
+ *
+ *		The interpreter clobbers the caller-saved registers on every
+ *		call out to C, fills the unused registers with junk on entry
+ *		and checks the callee-saved registers and SP on return, so
+ *		that ABI mistakes show up as mismatches too.
+ *
+ *		  voodoo_arm64_test [cases] [seed]
+ *
+ *		Built and run by "make -C src/tests check".
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __aarch64__
+# define HOST_ARM64 1
+#else
+/*Only selects the code generator; vid_voodoo_span.h still picks the host's
+  vector unit, as it checks for SSE2 first*/
+# define __aarch64__ 1
+#endif
+
+
+typedef struct arm64_cpu_t
+{
+    uint64_t	x[31];
+    uint64_t	sp, pc;
+    int		n, z, c, v;
+} arm64_cpu_t;
+
+struct voodoo_state_t;
+struct voodoo_params_t;
+
+static uint8_t	arm64_sim_draw(void *code, struct voodoo_state_t *state,
+			       struct voodoo_params_t *params, int x, int real_y);
+
+/*The generated span function is called through the interpreter*/
+#define voodoo_draw(state, params, x, real_y) arm64_sim_draw((void *)voodoo_draw, state, params, x, real_y)
+
+#define syscall cpu_syscall_
+#include "../video/vid_voodoo_render.c"
+#undef syscall
+
+
+#define FB_SIZE		(2 << 20)
+#define AUX_OFFSET	(1 << 20)
+#define SCREEN_W	256
+#define SCREEN_H	128
+#define TEX_SIZE	(texture_offset[LOD_MAX + 2] + 16)
+
+#define SIM_RETURN	0x5a5a5a5a00000000ull
+#define SIM_STACK	4096
+#define SIM_MAX_STEPS	50000000
+
+int		tris;
+
+static uint32_t	rand_state;
+static int	sim_native;
+static int	sim_failed;
+static uint64_t	sim_steps;
+static uint8_t	*sim_code;
+
+
+void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+
+uint64_t	plat_timer_read(void)			{ return 0; }
+thread_t	*thread_create(void (*thread_func)(void *param), void *param) { abort(); }
+void		thread_kill(thread_t *arg)		{ }
+event_t		*thread_create_event(void)		{ return NULL; }
+void		thread_set_event(event_t *arg)		{ }
+void		thread_reset_event(event_t *arg)	{ }
+int		thread_wait_event(event_t *arg, int timeout) { return 0; }
+void		thread_destroy_event(event_t *arg)	{ }
+mutex_t		*thread_create_mutex(void)		{ return NULL; }
+void		thread_close_mutex(mutex_t *arg)	{ }
+int		thread_wait_mutex(mutex_t *arg)		{ return 0; }
+int		thread_release_mutex(mutex_t *mutex)	{ return 0; }
+int		thread_get_cpu_count(void)		{ return 1; }
+void		voodoo_use_texture(voodoo_t *voodoo, voodoo_params_t *params, int tmu) { abort(); }
+
+
+static uint32_t
+rnd(void)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 16) | ((rand_state * 1103515245 + 12345) & 0xffff0000);
+}
+
+
+static uint32_t
+rnd_range(uint32_t n)
+{
+    return rnd() % n;
+}
+
+
+static int64_t
+rnd_signed(int64_t range)
+{
+    return (int64_t)(((uint64_t)rnd() << 32) | rnd()) % range;
+}
+
+
+/*AArch64 interpreter, for the instructions voodoo_generate() emits*/
+static uint64_t
+sim_reg(arm64_cpu_t *cpu, int r, int sf)
+{
+    if (r == 31)
+	return 0;
+    return sf ? cpu->x[r] : (uint32_t)cpu->x[r];
+}
+
+
+static uint64_t
+sim_reg_sp(arm64_cpu_t *cpu, int r, int sf)
+{
+    if (r == 31)
+	return sf ? cpu->sp : (uint32_t)cpu->sp;
+    return sim_reg(cpu, r, sf);
+}
+
+
+static void
+sim_set(arm64_cpu_t *cpu, int r, uint64_t val, int sf)
+{
+    if (r != 31)
+	cpu->x[r] = sf ? val : (uint32_t)val;
+}
+
+
+static void
+sim_set_sp(arm64_cpu_t *cpu, int r, uint64_t val, int sf)
+{
+    if (r == 31)
+	cpu->sp = sf ? val : (uint32_t)val;
+    else
+	sim_set(cpu, r, val, sf);
+}
+
+
+static uint64_t
+sim_add(arm64_cpu_t *cpu, uint64_t a, uint64_t b, int carry, int sf, int set_flags)
+{
+    uint64_t mask = sf ? ~0ull : 0xffffffffull;
+    uint64_t sign = sf ? (1ull << 63) : (1ull << 31);
+    uint64_t res;
+
+    a &= mask;
+    b &= mask;
+    res = (a + b + carry) & mask;
+    if (set_flags) {
+	cpu->n = !!(res & sign);
+	cpu->z = !res;
+	if (sf)
+		cpu->c = (res < a) || (carry && res == a);
+	else
+		cpu->c = (a + b + carry) > mask;
+	cpu->v = !!((a ^ res) & (b ^ res) & sign);
+    }
+    return res;
+}
+
+
+static uint64_t
+sim_shift(uint64_t val, int type, int amount, int sf)
+{
+    int size = sf ? 64 : 32;
+
+    if (!sf)
+	val = (uint32_t)val;
+    if (!amount)
+	return val;
+    switch (type) {
+	case 0: /*LSL*/
+		val <<= amount;
+		break;
+	case 1: /*LSR*/
+		val >>= amount;
+		break;
+	case 2: /*ASR*/
+		if (sf)
+			val = (uint64_t)((int64_t)val >> amount);
+		else
+			val = (uint32_t)((int32_t)val >> amount);
+		break;
+	case 3: /*ROR*/
+		val = (val >> amount) | (val << (size - amount));
+		break;
+    }
+    return sf ? val : (uint32_t)val;
+}
+
+
+static uint64_t
+sim_ror(uint64_t val, int amount, int size)
+{
+    uint64_t mask = (size == 64) ? ~0ull : ((1ull << size) - 1);
+
+    val &= mask;
+    if (!amount)
+	return val;
+    return ((val >> amount) | (val << (size - amount))) & mask;
+}
+
+
+static uint64_t
+sim_replicate(uint64_t elem, int esize, int size)
+{
+    uint64_t val = 0;
+    int c;
+
+    for (c = 0; c < size; c += esize)
+	val |= elem << c;
+    return val;
+}
+
+
+static uint64_t
+sim_ones(int n)
+{
+    return (n >= 64) ? ~0ull : ((1ull << n) - 1);
+}
+
+
+/*DecodeBitMasks() from the Arm ARM. Returns 0 for reserved encodings*/
+static int
+sim_bit_masks(int n, int imms, int immr, int size, int immediate, uint64_t *wmask, uint64_t *tmask)
+{
+    int val = (n << 6) | (~imms & 0x3f);
+    int len, levels, s, r, d, esize;
+
+    for (len = 6; len >= 0; len--) {
+	if (val & (1 << len))
+		break;
+    }
+    if (len < 1)
+	return 0;
+    levels = (1 << len) - 1;
+    if (immediate && (imms & levels) == levels)
+	return 0;
+    esize = 1 << len;
+    if (esize > size)
+	return 0;
+    s = imms & levels;
+    r = immr & levels;
+    d = (s - r) & levels;
+    *wmask = sim_replicate(sim_ror(sim_ones(s + 1), r, esize), esize, size);
+    *tmask = sim_replicate(sim_ones(d + 1), esize, size);
+    return 1;
+}
+
+
+static int
+sim_cond(arm64_cpu_t *cpu, int cond)
+{
+    int res;
+
+    switch ((cond >> 1) & 7) {
+	case 0: res = cpu->z; break;
+	case 1: res = cpu->c; break;
+	case 2: res = cpu->n; break;
+	case 3: res = cpu->v; break;
+	case 4: res = cpu->c && !cpu->z; break;
+	case 5: res = cpu->n == cpu->v; break;
+	case 6: res = (cpu->n == cpu->v) && !cpu->z; break;
+	default: res = 1; break;
+    }
+    if ((cond & 1) && cond != 0xf)
+	res = !res;
+    return res;
+}
+
+
+static uint64_t
+sim_load(uint64_t addr, int size)
+{
+    uint64_t val = 0;
+
+    memcpy(&val, (void *)(uintptr_t)addr, size);
+    return val;
+}
+
+
+static void
+sim_store(uint64_t addr, uint64_t val, int size)
+{
+    memcpy((void *)(uintptr_t)addr, &val, size);
+}
+
+
+static int
+sim_fail(arm64_cpu_t *cpu, uint32_t insn, const char *why)
+{
+    printf("pc=+%04x insn=%08x: %s\n", (int)(cpu->pc - (uintptr_t)sim_code), insn, why);
+    sim_failed = 1;
+    return 1;
+}
+
+
+static void
+sim_clobber(arm64_cpu_t *cpu, int from, int to)
+{
+    int c;
+
+    for (c = from; c <= to; c++)
+	cpu->x[c] = 0xdead000000000000ull | ((uint64_t)rnd() << 8) | c;
+}
+
+
+/*Calls out of the generated code, which may only go to the texture fetch
+  helpers*/
+static int
+sim_call(arm64_cpu_t *cpu, uint64_t target)
+{
+    if (target == (uintptr_t)voodoo_tmu_fetch)
+	voodoo_tmu_fetch((voodoo_t *)(uintptr_t)cpu->x[0], (voodoo_params_t *)(uintptr_t)cpu->x[1],
+			 (voodoo_state_t *)(uintptr_t)cpu->x[2], (int)cpu->x[3], (int)cpu->x[4]);
+    else if (target == (uintptr_t)voodoo_tmu_fetch_and_blend)
+	voodoo_tmu_fetch_and_blend((voodoo_t *)(uintptr_t)cpu->x[0], (voodoo_params_t *)(uintptr_t)cpu->x[1],
+				   (voodoo_state_t *)(uintptr_t)cpu->x[2], (int)cpu->x[3]);
+    else
+	return 0;
+
+    sim_clobber(cpu, 0, 18);
+    return 1;
+}
+
+
+static int
+sim_step(arm64_cpu_t *cpu)
+{
+    uint32_t insn = *(uint32_t *)(uintptr_t)cpu->pc;
+    uint64_t next = cpu->pc + 4;
+    int sf = insn >> 31;
+    int rd = insn & 31, rn = (insn >> 5) & 31, rm = (insn >> 16) & 31;
+
+    if ((insn & 0x1f800000) == 0x11000000) {
+	/*ADD/SUB (immediate)*/
+	int sub = (insn >> 30) & 1, s = (insn >> 29) & 1;
+	uint64_t imm = (insn >> 10) & 0xfff;
+	uint64_t res;
+
+	if (insn & (1 << 22))
+		imm <<= 12;
+	res = sim_add(cpu, sim_reg_sp(cpu, rn, sf), sub ? ~imm : imm, sub, sf, s);
+	if (s)
+		sim_set(cpu, rd, res, sf);
+	else
+		sim_set_sp(cpu, rd, res, sf);
+    } else if ((insn & 0x1f800000) == 0x12000000) {
+	/*Logical (immediate)*/
+	int opc = (insn >> 29) & 3;
+	uint64_t wmask, tmask, a, res;
+
+	if (!sf && (insn & (1 << 22)))
+		return sim_fail(cpu, insn, "bad logical immediate");
+	if (!sim_bit_masks((insn >> 22) & 1, (insn >> 10) & 0x3f, (insn >> 16) & 0x3f, sf ? 64 : 32, 1, &wmask, &tmask))
+		return sim_fail(cpu, insn, "reserved logical immediate");
+	a = sim_reg(cpu, rn, sf);
+	switch (opc) {
+		case 0: case 3: res = a & wmask; break;
+		case 1: res = a | wmask; break;
+		default: res = a ^ wmask; break;
+	}
+	if (opc == 3) {
+		cpu->n = !!(res & (sf ? (1ull << 63) : (1ull << 31)));
+		cpu->z = !(sf ? res : (uint32_t)res);
+		cpu->c = cpu->v = 0;
+		sim_set(cpu, rd, res, sf);
+	} else
+		sim_set_sp(cpu, rd, res, sf);
+    } else if ((insn & 0x1f800000) == 0x12800000) {
+	/*Move wide*/
+	int opc = (insn >> 29) & 3, hw = (insn >> 21) & 3;
+	uint64_t imm = (uint64_t)((insn >> 5) & 0xffff) << (hw * 16);
+
+	if (!sf && hw > 1)
+		return sim_fail(cpu, insn, "bad move wide");
+	switch (opc) {
+		case 0: sim_set(cpu, rd, ~imm, sf); break;
+		case 2: sim_set(cpu, rd, imm, sf); break;
+		case 3: sim_set(cpu, rd, (sim_reg(cpu, rd, sf) & ~(0xffffull << (hw * 16))) | imm, sf); break;
+		default: return sim_fail(cpu, insn, "bad move wide");
+	}
+    } else if ((insn & 0x1f800000) == 0x13000000) {
+	/*Bitfield*/
+	int opc = (insn >> 29) & 3, size = sf ? 64 : 32;
+	int immr = (insn >> 16) & 0x3f, imms = (insn >> 10) & 0x3f;
+	uint64_t wmask, tmask, src, bot, top, res;
+
+	if (((insn >> 22) & 1) != sf || opc == 3)
+		return sim_fail(cpu, insn, "bad bitfield");
+	if (!sim_bit_masks((insn >> 22) & 1, imms, immr, size, 0, &wmask, &tmask))
+		return sim_fail(cpu, insn, "reserved bitfield");
+	src = sim_reg(cpu, rn, sf);
+	bot = sim_ror(src, immr, size);
+	if (opc == 1) {
+		/*BFM*/
+		uint64_t dst = sim_reg(cpu, rd, sf);
+
+		bot = (dst & ~wmask) | (bot & wmask);
+		res = (dst & ~tmask) | (bot & tmask);
+	} else {
+		bot &= wmask;
+		top = (opc == 0 && (src >> imms) & 1) ? ~0ull : 0;
+		res = (top & ~tmask) | (bot & tmask);
+	}
+	sim_set(cpu, rd, res, sf);
+    } else if ((insn & 0x1f000000) == 0x0a000000) {
+	/*Logical (shifted register)*/
+	int opc = (insn >> 29) & 3, amount = (insn >> 10) & 0x3f;
+	uint64_t b, res;
+
+	if (!sf && amount >= 32)
+		return sim_fail(cpu, insn, "bad shift");
+	b = sim_shift(sim_reg(cpu, rm, sf), (insn >> 22) & 3, amount, sf);
+	if (insn & (1 << 21))
+		b = ~b;
+	switch (opc) {
+		case 0: case 3: res = sim_reg(cpu, rn, sf) & b; break;
+		case 1: res = sim_reg(cpu, rn, sf) | b; break;
+		default: res = sim_reg(cpu, rn, sf) ^ b; break;
+	}
+	if (!sf)
+		res = (uint32_t)res;
+	if (opc == 3) {
+		cpu->n = !!(res & (sf ? (1ull << 63) : (1ull << 31)));
+		cpu->z = !res;
+		cpu->c = cpu->v = 0;
+	}
+	sim_set(cpu, rd, res, sf);
+    } else if ((insn & 0x1f200000) == 0x0b000000) {
+	/*ADD/SUB (shifted register)*/
+	int sub = (insn >> 30) & 1, s = (insn >> 29) & 1;
+	int type = (insn >> 22) & 3, amount = (insn >> 10) & 0x3f;
+	uint64_t b;
+
+	if (type == 3 || (!sf && amount >= 32))
+		return sim_fail(cpu, insn, "bad shift");
+	b = sim_shift(sim_reg(cpu, rm, sf), type, amount, sf);
+	sim_set(cpu, rd, sim_add(cpu, sim_reg(cpu, rn, sf), sub ? ~b : b, sub, sf, s), sf);
+    } else if ((insn & 0x1fe00000) == 0x1a800000) {
+	/*Conditional select*/
+	int op = (insn >> 30) & 1, op2 = (insn >> 10) & 3;
+	uint64_t res;
+
+	if (op2 > 1)
+		return sim_fail(cpu, insn, "bad conditional select");
+	if (sim_cond(cpu, (insn >> 12) & 15))
+		res = sim_reg(cpu, rn, sf);
+	else {
+		res = sim_reg(cpu, rm, sf);
+		if (op)
+			res = ~res;
+		if (op2)
+			res++;
+	}
+	sim_set(cpu, rd, res, sf);
+    } else if ((insn & 0x5fe00000) == 0x1ac00000) {
+	/*Data processing (2 source)*/
+	uint64_t a = sim_reg(cpu, rn, sf), b = sim_reg(cpu, rm, sf);
+	int size = sf ? 64 : 32;
+
+	switch ((insn >> 10) & 0x3f) {
+		case 0x02: /*UDIV*/
+			sim_set(cpu, rd, b ? a / b : 0, sf);
+			break;
+		case 0x03: /*SDIV*/
+			if (!b)
+				sim_set(cpu, rd, 0, sf);
+			else if (sf)
+				sim_set(cpu, rd, ((int64_t)a == INT64_MIN && (int64_t)b == -1) ? a : (uint64_t)((int64_t)a / (int64_t)b), sf);
+			else
+				sim_set(cpu, rd, ((int32_t)a == INT32_MIN && (int32_t)b == -1) ? a : (uint64_t)(uint32_t)((int32_t)a / (int32_t)b), sf);
+			break;
+		case 0x08: case 0x09: case 0x0a: case 0x0b: /*LSLV, LSRV, ASRV, RORV*/
+			sim_set(cpu, rd, sim_shift(a, (insn >> 10) & 3, b % size, sf), sf);
+			break;
+		default:
+			return sim_fail(cpu, insn, "unknown 2 source instruction");
+	}
+    } else if ((insn & 0x5fe00000) == 0x5ac00000) {
+	/*Data processing (1 source)*/
+	uint64_t a = sim_reg(cpu, rn, sf);
+	int size = sf ? 64 : 32, c;
+
+	if (((insn >> 10) & 0x3f) != 0x04)
+		return sim_fail(cpu, insn, "unknown 1 source instruction");
+	for (c = 0; c < size; c++) {
+		if (a & (1ull << (size - 1 - c)))
+			break;
+	}
+	sim_set(cpu, rd, c, sf);
+    } else if ((insn & 0x1f000000) == 0x1b000000) {
+	/*Data processing (3 source)*/
+	uint64_t prod = sim_reg(cpu, rn, sf) * sim_reg(cpu, rm, sf);
+	uint64_t acc = sim_reg(cpu, (insn >> 10) & 31, sf);
+
+	if ((insn >> 21) & 7)
+		return sim_fail(cpu, insn, "unknown 3 source instruction");
+	sim_set(cpu, rd, (insn & (1 << 15)) ? acc - prod : acc + prod, sf);
+    } else if ((insn & 0x3b000000) == 0x39000000 || (insn & 0x3b200c00) == 0x38200800) {
+	/*Load/store (unsigned immediate, or register offset)*/
+	int size = insn >> 30, opc = (insn >> 22) & 3;
+	uint64_t addr;
+
+	if (insn & (1 << 26))
+		return sim_fail(cpu, insn, "SIMD load/store");
+	if (rn == 31 && (cpu->sp & 15))
+		return sim_fail(cpu, insn, "misaligned SP");
+	if (insn & (1 << 24))
+		addr = sim_reg_sp(cpu, rn, 1) + ((uint64_t)((insn >> 10) & 0xfff) << size);
+	else {
+		int option = (insn >> 13) & 7;
+		int amount = (insn & (1 << 12)) ? size : 0;
+		uint64_t off = sim_reg(cpu, rm, 1);
+
+		switch (option) {
+			case 2: off = (uint32_t)off; break;
+			case 3: case 7: break;
+			case 6: off = (uint64_t)(int64_t)(int32_t)off; break;
+			default: return sim_fail(cpu, insn, "bad extend");
+		}
+		addr = sim_reg_sp(cpu, rn, 1) + (off << amount);
+	}
+	switch (opc) {
+		case 0:
+			sim_store(addr, sim_reg(cpu, rd, 1), 1 << size);
+			break;
+		case 1:
+			sim_set(cpu, rd, sim_load(addr, 1 << size), 1);
+			break;
+		case 2: case 3:
+		{
+			uint64_t val = sim_load(addr, 1 << size);
+			int bits = 8 << size;
+
+			if (size >= 3 - (opc == 3))
+				return sim_fail(cpu, insn, "bad signed load");
+			val = (uint64_t)((int64_t)(val << (64 - bits)) >> (64 - bits));
+			sim_set(cpu, rd, val, opc == 2);
+			break;
+		}
+	}
+    } else if ((insn & 0x3a000000) == 0x28000000) {
+	/*Load/store pair*/
+	int opc = insn >> 30, mode = (insn >> 23) & 3, load = (insn >> 22) & 1;
+	int scale = (opc == 2) ? 3 : 2;
+	int64_t imm = (int64_t)((int32_t)(insn << 10) >> 25) << scale;
+	int rt2 = (insn >> 10) & 31;
+	uint64_t addr = sim_reg_sp(cpu, rn, 1);
+
+	if ((insn & (1 << 26)) || opc & 1 || opc == 3)
+		return sim_fail(cpu, insn, "unknown load/store pair");
+	if (rn == 31 && (cpu->sp & 15))
+		return sim_fail(cpu, insn, "misaligned SP");
+	if (mode != 1)
+		addr += imm;
+	if (load) {
+		uint64_t a = sim_load(addr, 1 << scale), b = sim_load(addr + (1 << scale), 1 << scale);
+
+		sim_set(cpu, rd, a, 1);
+		sim_set(cpu, rt2, b, 1);
+	} else {
+		sim_store(addr, sim_reg(cpu, rd, 1), 1 << scale);
+		sim_store(addr + (1 << scale), sim_reg(cpu, rt2, 1), 1 << scale);
+	}
+	if (mode == 1)
+		sim_set_sp(cpu, rn, addr + imm, 1);
+	else if (mode == 3)
+		sim_set_sp(cpu, rn, addr, 1);
+    } else if ((insn & 0x7c000000) == 0x14000000) {
+	/*B, BL*/
+	int64_t off = (int64_t)((int32_t)(insn << 6) >> 6) << 2;
+
+	if (insn & 0x80000000)
+		cpu->x[30] = next;
+	next = cpu->pc + off;
+    } else if ((insn & 0xff000010) == 0x54000000) {
+	/*B.cond*/
+	if (sim_cond(cpu, insn & 15))
+		next = cpu->pc + ((int64_t)((int32_t)(insn << 8) >> 13) << 2);
+    } else if ((insn & 0x7e000000) == 0x34000000) {
+	/*CBZ, CBNZ*/
+	int zero = !sim_reg(cpu, rd, sf);
+
+	if (zero != !!(insn & (1 << 24)))
+		next = cpu->pc + ((int64_t)((int32_t)(insn << 8) >> 13) << 2);
+    } else if ((insn & 0xff9ffc1f) == 0xd61f0000) {
+	/*BR, BLR, RET*/
+	uint64_t target = sim_reg(cpu, rn, 1);
+	int link = (insn >> 21) & 3;
+
+	if (link == 1) {
+		cpu->x[30] = next;
+		if (target < (uintptr_t)sim_code || target >= (uintptr_t)sim_code + BLOCK_SIZE) {
+			if (!sim_call(cpu, target))
+				return sim_fail(cpu, insn, "call to an unknown function");
+			target = next;
+		}
+	}
+	next = target;
+    } else if (insn == 0xd503201f) {
+	/*NOP*/
+    } else
+	return sim_fail(cpu, insn, "unknown instruction");
+
+    cpu->pc = next;
+    return 0;
+}
+
+
+static int
+sim_run(arm64_cpu_t *cpu)
+{
+    uint64_t steps = 0;
+
+    while (cpu->pc != SIM_RETURN) {
+	if (cpu->pc < (uintptr_t)sim_code || cpu->pc >= (uintptr_t)sim_code + BLOCK_SIZE || (cpu->pc & 3)) {
+		printf("pc=%016llx outside the code block\n", (unsigned long long)cpu->pc);
+		sim_failed = 1;
+		return 1;
+	}
+	if (++steps > SIM_MAX_STEPS) {
+		printf("span did not finish\n");
+		sim_failed = 1;
+		return 1;
+	}
+	if (sim_step(cpu))
+		return 1;
+    }
+    sim_steps += steps;
+    return 0;
+}
+
+
+static uint8_t
+arm64_sim_draw(void *code, struct voodoo_state_t *state, struct voodoo_params_t *params, int x, int real_y)
+{
+    static uint64_t stack[SIM_STACK / 8];
+    arm64_cpu_t cpu;
+    uint64_t saved[12];
+    int c;
+
+#ifdef HOST_ARM64
+    if (sim_native)
+	return ((uint8_t (*)(voodoo_state_t *, voodoo_params_t *, int, int))code)(state, params, x, real_y);
+#endif
+    if (sim_failed)
+	return 0;
+
+    memset(&cpu, 0, sizeof(cpu));
+    sim_clobber(&cpu, 0, 30);
+    cpu.x[0] = (uintptr_t)state;
+    cpu.x[1] = (uintptr_t)params;
+    cpu.x[2] = (uint32_t)x | 0xdead000000000000ull;
+    cpu.x[3] = (uint32_t)real_y | 0xdead000000000000ull;
+    cpu.x[30] = SIM_RETURN;
+    cpu.sp = (uintptr_t)&stack[SIM_STACK / 8];
+    cpu.pc = (uintptr_t)code;
+    cpu.n = rnd() & 1;
+    cpu.z = rnd() & 1;
+    cpu.c = rnd() & 1;
+    cpu.v = rnd() & 1;
+    for (c = 0; c < 11; c++)
+	saved[c] = cpu.x[19 + c];
+    saved[11] = cpu.sp;
+    sim_code = code;
+
+    if (sim_run(&cpu))
+	return 0;
+
+    for (c = 0; c < 11; c++) {
+	if (cpu.x[19 + c] != saved[c]) {
+		printf("X%i not preserved\n", 19 + c);
+		sim_failed = 1;
+	}
+    }
+    if (cpu.sp != saved[11]) {
+	printf("SP not preserved\n");
+	sim_failed = 1;
+    }
+    return 0;
+}
+
+
+/*Check the interpreter itself on instructions assembled by llvm-mc*/
+static int
+sim_self_test(void)
+{
+    static const struct {
+	uint32_t	insn;
+	const char	*text;
+	uint64_t	x0, x1, x2;
+	int		reg;
+	uint64_t	expect;
+    } tests[] = {
+	{ 0x530a3c41, "ubfx w1, w2, #10, #6",	0, 0, 0x12345678,	1, 0x15 },
+	{ 0x13042c41, "sbfx w1, w2, #4, #8",	0, 0, 0x00000f80,	1, 0xfffffff8 },
+	{ 0x531b6841, "lsl w1, w2, #5",		0, 0, 0x87654321,	1, 0xeca86420 },
+	{ 0x131f7c41, "asr w1, w2, #31",	0, 0, 0x80000000,	1, 0xffffffff },
+	{ 0x12002c20, "and w0, w1, #0xfff",	0, 0xffffabcd, 0,	0, 0xbcd },
+	{ 0x0aa47c84, "bic w4, w4, w4, asr #31", 0, 0, 0,		4, 0 },
+	{ 0x0b422020, "add w0, w1, w2, lsr #8",	0, 0x100, 0x1234,	0, 0x112 },
+	{ 0x5ac01022, "clz w2, w1",		0, 0x00010000, 0,	2, 15 },
+	{ 0x1ac32421, "lsr w1, w1, w3",		0, 0x80000000, 0,	1, 0x80000000 },
+	{ 0x12801fa3, "mov w3, #-254",		0, 0, 0,		3, 0xffffff02 },
+	{ 0xf2c24690, "movk x16, #4660, lsl #32", 0, 0, 0,		16, 0x0000123400000000ull },
+	{ 0x1a84c364, "csel w4, w27, w4, gt",	0, 0, 0,		4, 0xff }
+    };
+    arm64_cpu_t cpu;
+    uint32_t code[2];
+    int c, fail = 0;
+
+    for (c = 0; c < (int)(sizeof(tests) / sizeof(tests[0])); c++) {
+	memset(&cpu, 0, sizeof(cpu));
+	cpu.x[0] = tests[c].x0;
+	cpu.x[1] = tests[c].x1;
+	cpu.x[2] = tests[c].x2;
+	cpu.x[4] = 0x80000010;
+	cpu.x[27] = 0xff;
+	cpu.n = cpu.v = 0;	/*GT holds*/
+	code[0] = tests[c].insn;
+	sim_code = (uint8_t *)code;
+	cpu.pc = (uintptr_t)code;
+	if (sim_step(&cpu) || cpu.x[tests[c].reg] != tests[c].expect) {
+		printf("interpreter: %s gave %016llx, expected %016llx\n", tests[c].text,
+		       (unsigned long long)cpu.x[tests[c].reg], (unsigned long long)tests[c].expect);
+		fail = 1;
+	}
+    }
+
+    /*cmp w0, w1 ; b.cs: unsigned compare, as used by the depth test*/
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.x[0] = 0x8000;
+    cpu.x[1] = 0x7fff;
+    code[0] = 0x6b01001f;
+    cpu.pc = (uintptr_t)code;
+    sim_step(&cpu);
+    if (!sim_cond(&cpu, COND_CS) || sim_cond(&cpu, COND_LS) || sim_cond(&cpu, COND_EQ)) {
+	printf("interpreter: cmp w0, w1 gave the wrong flags\n");
+	fail = 1;
+    }
+
+    sim_failed = 0;
+    return fail;
+}
+
+
+static void
+setup_voodoo(voodoo_t *voodoo, int recompiler, uint8_t *fb, uint32_t *tex[2])
+{
+    int tmu;
+
+    memset(voodoo, 0, sizeof(voodoo_t));
+    voodoo->fb_mem = fb;
+    voodoo->fb_mask = FB_SIZE - 1;
+    voodoo->v_disp = SCREEN_H;
+    voodoo->use_recompiler = recompiler;
+    for (tmu = 0; tmu < 2; tmu++) {
+	voodoo->texture_cache[tmu] = calloc(1, sizeof(texture_t));
+	voodoo->texture_cache[tmu][0].data = tex[tmu];
+    }
+    if (recompiler)
+	voodoo_codegen_init(voodoo);
+}
+
+
+static void
+random_params(voodoo_t *voodoo, voodoo_params_t *params, uint32_t *tex[2])
+{
+    int tmu, lod, c;
+
+    memset(params, 0, sizeof(voodoo_params_t));
+
+    params->fbzColorPath = rnd_range(4) | (rnd_range(3) << 2) | (rnd() & 0x390) | (rnd_range(3) << 5) |
+			   (rnd_range(6) << 10) | (rnd() & 0x02472000) | (rnd_range(3) << 14) | (rnd_range(5) << 19) |
+			   (rnd() & (3 << 23)) | (rnd() & FBZ_PARAM_ADJUST) | (rnd() & FBZCP_TEXTURE_ENABLED);
+    params->fbzMode = rnd() & (1 | FBZ_CHROMAKEY | FBZ_W_BUFFER | FBZ_DEPTH_ENABLE | (7 << 5) | FBZ_DITHER |
+			       FBZ_RGB_WMASK | FBZ_DEPTH_WMASK | FBZ_DITHER_2x2 | FBZ_DEPTH_BIAS | (1 << 17) |
+			       FBZ_DEPTH_SOURCE);
+    if (!(params->fbzColorPath & FBZCP_TEXTURE_ENABLED)) {
+	/*Without texturing the texture colour is whatever the last
+	  triangle left in the state, so do not use it*/
+	if (_rgb_sel == CC_LOCALSELECT_TEX)
+		params->fbzColorPath &= ~3;
+	if (a_sel == A_SEL_TEX)
+		params->fbzColorPath &= ~(3 << 2);
+	if (cc_mselect >= CC_MSELECT_TEX)
+		params->fbzColorPath &= ~(7 << 10);
+	if (cca_mselect == CCA_MSELECT_TEX)
+		params->fbzColorPath &= ~(7 << 19);
+	params->fbzColorPath &= ~(1 << 7);
+    }
+    if (rnd() & 1)
+	params->fbzMode |= FBZ_RGB_WMASK;
+    params->alphaMode = rnd() & 0xff00001f;
+    c = rnd_range(16);
+    params->alphaMode |= ((c == AFUNC_ACOLORBEFOREFOG) ? AFUNC_AONE : c) << 8;
+    params->alphaMode |= rnd_range(16) << 12;
+    params->fogMode = rnd() & 0x3f;
+    params->zaColor = rnd();
+    params->color0 = rnd();
+    params->color1 = rnd();
+    params->fogColor.r = rnd();
+    params->fogColor.g = rnd();
+    params->fogColor.b = rnd();
+    for (c = 0; c < 64; c++) {
+	params->fogTable[c].fog = rnd();
+	params->fogTable[c].dfog = rnd();
+    }
+
+    params->col_tiled = rnd() & 1;
+    params->aux_tiled = rnd() & 1;
+    params->row_width = params->col_tiled ? (SCREEN_W / 64) * 4096 : 1024;
+    params->aux_row_width = (SCREEN_W / 64) * 4096;
+    params->draw_offset = 0;
+    params->aux_offset = AUX_OFFSET;
+    params->front_offset = 0;
+
+    params->clipLeft = rnd_range(SCREEN_W / 2);
+    params->clipRight = params->clipLeft + 1 + rnd_range(SCREEN_W - params->clipLeft);
+    params->clipLowY = rnd_range(SCREEN_H / 2);
+    params->clipHighY = params->clipLowY + 1 + rnd_range(SCREEN_H - params->clipLowY);
+
+    params->startR = rnd_signed(300 << 12);
+    params->startG = rnd_signed(300 << 12);
+    params->startB = rnd_signed(300 << 12);
+    params->startA = rnd_signed(300 << 12);
+    params->dRdX = rnd_signed(8 << 12);
+    params->dGdX = rnd_signed(8 << 12);
+    params->dBdX = rnd_signed(8 << 12);
+    params->dAdX = rnd_signed(8 << 12);
+    params->dRdY = rnd_signed(8 << 12);
+    params->dGdY = rnd_signed(8 << 12);
+    params->dBdY = rnd_signed(8 << 12);
+    params->dAdY = rnd_signed(8 << 12);
+    params->startZ = rnd();
+    params->dZdX = rnd_signed(1 << 24);
+    params->dZdY = rnd_signed(1 << 24);
+    switch (rnd_range(3)) {
+	case 0:
+		params->startW = rnd_range(1 << 16);
+		break;
+	case 1:
+		params->startW = (uint64_t)rnd() & 0xffffffffull;
+		break;
+	default:
+		params->startW = (int64_t)rnd_signed(1ll << 40);
+		break;
+    }
+    params->dWdX = rnd_signed(1 << 24);
+    params->dWdY = rnd_signed(1 << 24);
+
+    for (tmu = 0; tmu < 2; tmu++) {
+	params->tmu[tmu].startS = rnd_signed(1ll << 36);
+	params->tmu[tmu].startT = rnd_signed(1ll << 36);
+	params->tmu[tmu].startW = (1ll << 30) + rnd_signed(1ll << 29);
+	params->tmu[tmu].dSdX = rnd_signed(1ll << 32);
+	params->tmu[tmu].dTdX = rnd_signed(1ll << 32);
+	params->tmu[tmu].dWdX = rnd_signed(1ll << 20);
+	params->tmu[tmu].dSdY = rnd_signed(1ll << 32);
+	params->tmu[tmu].dTdY = rnd_signed(1ll << 32);
+	params->tmu[tmu].dWdY = rnd_signed(1ll << 20);
+	params->textureMode[tmu] = rnd() & (0x3ffff000 | TEXTUREMODE_TRILINEAR | TEXTUREMODE_TCLAMPS |
+					    TEXTUREMODE_TCLAMPT | 7);
+	switch (rnd_range(4)) {
+		case 0:
+			params->textureMode[tmu] &= ~TEXTUREMODE_MASK;
+			break;
+		case 1:
+			params->textureMode[tmu] = (params->textureMode[tmu] & ~TEXTUREMODE_LOCAL_MASK) | TEXTUREMODE_LOCAL;
+			break;
+	}
+	params->tLOD[tmu] = (rnd() & (LOD_TMIRROR_S | LOD_TMIRROR_T)) | (rnd_range(9) << 6) | ((rnd() & 0x3f) << 12);
+	params->tex_entry[tmu] = 0;
+	for (lod = 0; lod <= LOD_MAX; lod++) {
+		params->tex_w_mask[tmu][lod] = (256 >> lod) - 1;
+		params->tex_h_mask[tmu][lod] = (256 >> lod) - 1;
+		params->tex_shift[tmu][lod] = 8 - lod;
+		params->tex_lod[tmu][lod] = lod;
+	}
+    }
+    c = rnd_range(4);
+    params->chromaKey_r = (tex[0][c] >> 16) & 0xff;
+    params->chromaKey_g = (tex[0][c] >> 8) & 0xff;
+    params->chromaKey_b = tex[0][c] & 0xff;
+
+    voodoo->dual_tmus = rnd() & 1;
+    voodoo->bilinear_enabled = rnd() & 1;
+    voodoo->trexInit1[0] = (rnd_range(8) == 0) ? (1 << 18) : 0;
+    voodoo->tmuConfig = rnd();
+}
+
+
+static void
+random_triangle(voodoo_params_t *params)
+{
+    int x0 = rnd_range(SCREEN_W - 64), y0 = rnd_range(SCREEN_H - 64);
+    int vx[3], vy[3], c;
+
+    for (c = 0; c < 3; c++) {
+	vx[c] = (x0 << 4) + rnd_range(64 << 4);
+	vy[c] = (y0 << 4) + rnd_range(64 << 4);
+    }
+    /*Sort on y, A at the top and C at the bottom*/
+    for (c = 0; c < 2; c++) {
+	if (vy[1] < vy[0]) {
+		int t = vy[1]; vy[1] = vy[0]; vy[0] = t;
+		t = vx[1]; vx[1] = vx[0]; vx[0] = t;
+	}
+	if (vy[2] < vy[1]) {
+		int t = vy[2]; vy[2] = vy[1]; vy[1] = t;
+		t = vx[2]; vx[2] = vx[1]; vx[1] = t;
+	}
+    }
+    params->vertexAx = vx[0];
+    params->vertexAy = vy[0];
+    params->vertexBx = vx[1];
+    params->vertexBy = vy[1];
+    params->vertexCx = vx[2];
+    params->vertexCy = vy[2];
+    /*B to the left of AC means spans are drawn right to left*/
+    params->sign = ((int64_t)(vx[2] - vx[0]) * (vy[1] - vy[0]) - (int64_t)(vx[1] - vx[0]) * (vy[2] - vy[0])) > 0;
+    if (!(params->fbzMode & 1)) {
+	params->clipLeft = 0;
+	params->clipRight = SCREEN_W;
+	params->clipLowY = 0;
+	params->clipHighY = SCREEN_H;
+    }
+}
+
+
+static int
+compare(int n, voodoo_t *ref, voodoo_t *jit, const char *how)
+{
+    voodoo_params_t *params = &ref->params;
+    int c;
+
+    /*Like the x86 code generators, the generated code only counts texels
+      for textured triangles*/
+    if (!memcmp(ref->fb_mem, jit->fb_mem, FB_SIZE) &&
+	ref->pixel_count[0] == jit->pixel_count[0] &&
+	(ref->texel_count[0] == jit->texel_count[0] || !(params->fbzColorPath & FBZCP_TEXTURE_ENABLED)) &&
+	ref->fbiPixelsIn == jit->fbiPixelsIn)
+	return 0;
+
+    printf("case %i (%s): fbzColorPath=%08x fbzMode=%08x alphaMode=%08x fogMode=%08x textureMode=%08x,%08x dual=%i tiled=%i,%i\n",
+	   n, how, params->fbzColorPath, params->fbzMode, params->alphaMode, params->fogMode,
+	   params->textureMode[0], params->textureMode[1], ref->dual_tmus, params->col_tiled, params->aux_tiled);
+    /*First difference in the colour buffer and in the depth buffer*/
+    for (c = 0; c < FB_SIZE; c += 2) {
+	if (*(uint16_t *)&ref->fb_mem[c] != *(uint16_t *)&jit->fb_mem[c]) {
+		printf("  %s %06x: C %04x, generated %04x\n", (c >= AUX_OFFSET) ? "depth" : "colour", c,
+		       *(uint16_t *)&ref->fb_mem[c], *(uint16_t *)&jit->fb_mem[c]);
+		if (c >= AUX_OFFSET)
+			break;
+		c = AUX_OFFSET - 2;
+	}
+    }
+    printf("  pixels %i/%i texels %i/%i\n", ref->pixel_count[0], jit->pixel_count[0],
+	   ref->texel_count[0], jit->texel_count[0]);
+    return 1;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    static voodoo_t ref, jit;
+    int cases = (argc > 1) ? atoi(argv[1]) : 1000;
+    uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+    uint8_t *fb_init = malloc(FB_SIZE), *fb_ref = malloc(FB_SIZE), *fb_jit = malloc(FB_SIZE);
+    uint32_t *tex[2];
+    int n, c, tmu, fail = 0;
+
+    if (sim_self_test())
+	return 1;
+
+    rand_state = seed;
+    for (tmu = 0; tmu < 2; tmu++) {
+	tex[tmu] = malloc(TEX_SIZE * sizeof(uint32_t));
+	/*Few distinct texels, so that the chroma key matches now and then*/
+	for (c = 0; c < TEX_SIZE; c++)
+		tex[tmu][c] = (c < 4) ? rnd() : tex[tmu][rnd_range(4)] ^ ((rnd_range(4) == 0) ? rnd() : 0);
+    }
+    setup_voodoo(&ref, 0, fb_ref, tex);
+    setup_voodoo(&jit, 1, fb_jit, tex);
+
+    for (n = 0; n < cases && !fail; n++) {
+	int native;
+
+	for (c = 0; c < FB_SIZE; c += 4)
+		*(uint32_t *)&fb_init[c] = rnd();
+	random_params(&ref, &ref.params, tex);
+	jit.params = ref.params;
+	jit.dual_tmus = ref.dual_tmus;
+	jit.bilinear_enabled = ref.bilinear_enabled;
+	jit.trexInit1[0] = ref.trexInit1[0];
+	jit.tmuConfig = ref.tmuConfig;
+
+#ifdef HOST_ARM64
+	for (native = 0; native < 2 && !fail; native++)
+#else
+	for (native = 0; native < 1; native++)
+#endif
+	{
+		uint32_t tri_seed = rnd();
+
+		sim_native = native;
+		memcpy(fb_ref, fb_init, FB_SIZE);
+		memcpy(fb_jit, fb_init, FB_SIZE);
+		ref.pixel_count[0] = jit.pixel_count[0] = 0;
+		ref.texel_count[0] = jit.texel_count[0] = 0;
+		ref.fbiPixelsIn = jit.fbiPixelsIn = 0;
+
+		/*Two triangles with the same state, so that the second one
+		  finds its block already generated*/
+		for (c = 0; c < 2; c++) {
+			uint32_t save = rand_state;
+
+			rand_state = tri_seed + c;
+			random_triangle(&ref.params);
+			jit.params.vertexAx = ref.params.vertexAx;
+			jit.params.vertexAy = ref.params.vertexAy;
+			jit.params.vertexBx = ref.params.vertexBx;
+			jit.params.vertexBy = ref.params.vertexBy;
+			jit.params.vertexCx = ref.params.vertexCx;
+			jit.params.vertexCy = ref.params.vertexCy;
+			jit.params.sign = ref.params.sign;
+			jit.params.clipLeft = ref.params.clipLeft;
+			jit.params.clipRight = ref.params.clipRight;
+			jit.params.clipLowY = ref.params.clipLowY;
+			jit.params.clipHighY = ref.params.clipHighY;
+			rand_state = save;
+
+			voodoo_triangle(&ref, &ref.params, 0, NULL);
+			voodoo_triangle(&jit, &jit.params, 0, NULL);
+		}
+		fail |= sim_failed;
+		fail |= compare(n, &ref, &jit, native ? "native" : "interpreted");
+	}
+    }
+
+    printf("%i cases, %i blocks generated, %llu instructions interpreted: %s\n", n, voodoo_recomp,
+	   (unsigned long long)sim_steps, fail ? "FAIL" : "ok");
+    return fail;
+}
@@ -1,7 +1,11 @@
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
+#define HAVE_STDARG_H
 #include <86box/86box.h>
 #include <86box/timer.h>
 
@@ -9,18 +13,164 @@
 uint64_t TIMER_USEC;
 uint32_t timer_target;
 
-/*Enabled timers are stored in a linked list, with the first timer to expire at
-  the head.*/
+/*Enabled timers are stored either in a linked list, with the first timer to
+  expire at the head, or in a binary min-heap. With either engine, timer_head
+  points at the first timer to expire.*/
 pc_timer_t *timer_head = NULL;
 
 /* Are we initialized? */
 int timer_inited = 0;
 
+/* Requested queue engine, and the one in use since the last timer_init(). */
+int timer_engine = TIMER_ENGINE_HEAP;
+int timer_engine_cur = TIMER_ENGINE_HEAP;
+
+static pc_timer_t	**timer_heap = NULL;
+static int		timer_heap_count = 0, timer_heap_size = 0;
+static uint32_t		timer_seq = 0;
+static timer_stats_t	timer_stats;
+
+
+#ifdef ENABLE_TIMER_LOG
+int timer_do_log = ENABLE_TIMER_LOG;
+
+
+static void
+timer_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (timer_do_log) {
+	va_start(ap, fmt);
+	pclog_ex(fmt, ap);
+	va_end(ap);
+    }
+}
+#else
+#define timer_log(fmt, ...)
+#endif
+
+
+static void
+timer_count_steps(uint32_t steps)
+{
+    timer_stats.inserts++;
+    timer_stats.steps += steps;
+    if (steps > timer_stats.max_steps)
+	timer_stats.max_steps = steps;
+}
+
+
+/*True if timer a has to be processed before timer b. On equal timestamps, the
+  most recently enabled timer goes first, same as in the list.*/
+static __inline int
+timer_heap_before(pc_timer_t *a, pc_timer_t *b)
+{
+    int64_t diff = (int64_t) (a->ts.ts64 - b->ts.ts64);
+
+    if (diff != 0)
+	return (diff < 0);
+
+    return ((int32_t) (a->seq - b->seq) > 0);
+}
+
+
+static __inline void
+timer_heap_place(pc_timer_t *timer, int idx)
+{
+    timer_heap[idx] = timer;
+    timer->heap_idx = idx;
+}
+
+
+static uint32_t
+timer_heap_sift_up(int idx)
+{
+    pc_timer_t *timer = timer_heap[idx];
+    uint32_t steps = 0;
+    int parent;
+
+    while (idx > 0) {
+	parent = (idx - 1) >> 1;
+	if (!timer_heap_before(timer, timer_heap[parent]))
+		break;
+	timer_heap_place(timer_heap[parent], idx);
+	idx = parent;
+	steps++;
+    }
+
+    timer_heap_place(timer, idx);
+
+    return steps;
+}
+
+
+static void
+timer_heap_sift_down(int idx)
+{
+    pc_timer_t *timer = timer_heap[idx];
+    int child;
+
+    while ((child = (idx << 1) + 1) < timer_heap_count) {
+	if (((child + 1) < timer_heap_count) &&
+	    timer_heap_before(timer_heap[child + 1], timer_heap[child]))
+		child++;
+	if (!timer_heap_before(timer_heap[child], timer))
+		break;
+	timer_heap_place(timer_heap[child], idx);
+	idx = child;
+    }
+
+    timer_heap_place(timer, idx);
+}
+
+
+static void
+timer_heap_insert(pc_timer_t *timer)
+{
+    if (timer_heap_count == timer_heap_size) {
+	timer_heap_size = timer_heap_size ? (timer_heap_size << 1) : 64;
+	timer_heap = (pc_timer_t **) realloc(timer_heap, timer_heap_size * sizeof(pc_timer_t *));
+	if (timer_heap == NULL)
+		fatal("timer_enable - out of memory\n");
+    }
+
+    timer_heap[timer_heap_count] = timer;
+    timer_count_steps(timer_heap_sift_up(timer_heap_count++));
+
+    timer_head = timer_heap[0];
+    if (timer_head == timer)
+	timer_target = timer_head->ts.ts32.integer;
+}
+
+
+static void
+timer_heap_remove(pc_timer_t *timer)
+{
+    int idx = timer->heap_idx;
+    pc_timer_t *last;
+
+    if ((idx < 0) || (idx >= timer_heap_count) || (timer_heap[idx] != timer))
+	fatal("timer_disable - timer not in heap\n");
+
+    last = timer_heap[--timer_heap_count];
+    if (idx < timer_heap_count) {
+	timer_heap_place(last, idx);
+	if ((idx > 0) && timer_heap_before(last, timer_heap[(idx - 1) >> 1]))
+		timer_heap_sift_up(idx);
+	else
+		timer_heap_sift_down(idx);
+    }
+
+    timer_head = timer_heap_count ? timer_heap[0] : NULL;
+}
+
 
 void
 timer_enable(pc_timer_t *timer)
 {
     pc_timer_t *timer_node = timer_head;
+    uint32_t steps = 0;
 
     if (!timer_inited || (timer == NULL))
 	return;
@@ -32,18 +182,27 @@ timer_enable(pc_timer_t *timer)
 	fatal("timer_enable - timer->next\n");
 
     timer->flags |= TIMER_ENABLED;
+    timer->seq = timer_seq++;
+
+    if (timer_engine_cur != TIMER_ENGINE_LIST) {
+	timer_heap_insert(timer);
+	return;
+    }
 
     /*List currently empty - add to head*/
     if (!timer_head) {
 	timer_head = timer;
 	timer->next = timer->prev = NULL;
 	timer_target = timer_head->ts.ts32.integer;
+	timer_count_steps(0);
 	return;
     }
 
     timer_node = timer_head;
 
     while(1) {
+	steps++;
+
 	/*Timer expires before timer_node. Add to list in front of timer_node*/
 	if (TIMER_LESS_THAN(timer, timer_node)) {
 		timer->next = timer_node;
@@ -55,6 +214,7 @@ timer_enable(pc_timer_t *timer)
 			timer_head = timer;
 			timer_target = timer_head->ts.ts32.integer;
 		}
+		timer_count_steps(steps);
 		return;
 	}
 
@@ -62,6 +222,7 @@ timer_enable(pc_timer_t *timer)
 	if (!timer_node->next) {
 		timer_node->next = timer;
 		timer->prev = timer_node;
+		timer_count_steps(steps);
 		return;
 	}
 
@@ -76,6 +237,12 @@ timer_disable(pc_timer_t *timer)
     if (!timer_inited || (timer == NULL) || !(timer->flags & TIMER_ENABLED))
 	return;
 
+    if (timer_engine_cur != TIMER_ENGINE_LIST) {
+	timer->flags &= ~TIMER_ENABLED;
+	timer_heap_remove(timer);
+	return;
+    }
+
     if (!timer->next && !timer->prev && timer != timer_head)
 	fatal("timer_disable - !timer->next\n");
 
@@ -99,6 +266,15 @@ timer_remove_head(void)
     if (!timer_inited)
 	return;
 
+    if (timer_engine_cur != TIMER_ENGINE_LIST) {
+	if (timer_head) {
+		timer = timer_head;
+		timer->flags &= ~TIMER_ENABLED;
+		timer_heap_remove(timer);
+	}
+	return;
+    }
+
     if (timer_head) {
 	timer = timer_head;
 	timer_head = timer->next;
@@ -142,14 +318,24 @@ void
 timer_close(void)
 {
     pc_timer_t *t = timer_head, *r;
+    int i;
+
+    timer_log("Timer: %" PRIu64 " inserts, %" PRIu64 " steps (max %u) with the %s engine\n",
+	      timer_stats.inserts, timer_stats.steps, timer_stats.max_steps,
+	      (timer_engine_cur == TIMER_ENGINE_LIST) ? "list" : "heap");
 
     /* Set all timers' prev and next to NULL so it is assured that
        timers that are not in malloc'd structs don't keep pointing
        to timers that may be in malloc'd structs. */
-    while (t != NULL) {
+    if (timer_engine_cur != TIMER_ENGINE_LIST) {
+	for (i = 0; i < timer_heap_count; i++)
+		timer_heap[i]->flags &= ~TIMER_ENABLED;
+	timer_heap_count = 0;
+    } else while (t != NULL) {
 	r = t;
-	r->prev = r->next = NULL;
 	t = r->next;
+	r->prev = r->next = NULL;
+	r->flags &= ~TIMER_ENABLED;
     }
 
     timer_head = NULL;
@@ -164,10 +350,45 @@ timer_init(void)
     timer_target = 0ULL;
     tsc = 0;
 
+    timer_engine_cur = timer_engine;
+    timer_heap_count = 0;
+    timer_seq = 0;
+    memset(&timer_stats, 0, sizeof(timer_stats_t));
+
     timer_inited = 1;
 }
 
 
+/*Move every queued timer by the given number of TSC cycles, used when the
+  TSC itself is replaced (e.g. by restoring a snapshot). The relative order is
+  unchanged, so neither the list nor the heap has to be rebuilt.*/
+void
+timer_shift(int64_t delta)
+{
+    pc_timer_t *t;
+    int i;
+
+    if (!timer_inited)
+	return;
+
+    if (timer_engine_cur != TIMER_ENGINE_LIST) {
+	for (i = 0; i < timer_heap_count; i++)
+		timer_heap[i]->ts.ts64 += ((uint64_t) delta) << 32;
+    } else for (t = timer_head; t != NULL; t = t->next)
+	t->ts.ts64 += ((uint64_t) delta) << 32;
+
+    if (timer_head)
+	timer_target = timer_head->ts.ts32.integer;
+}
+
+
+void
+timer_get_stats(timer_stats_t *stats)
+{
+    memcpy(stats, &timer_stats, sizeof(timer_stats_t));
+}
+
+
 void
 timer_add(pc_timer_t *timer, void (*callback)(void *p), void *p, int start_timer)
 {
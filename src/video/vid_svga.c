@@ -21,6 +21,7 @@
  */
 #include <inttypes.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -37,6 +38,7 @@
 #include <86box/video.h>
 #include <86box/vid_svga.h>
 #include <86box/vid_svga_render.h>
+#include <86box/snapshot.h>
 
 
 void svga_doblit(int y1, int y2, int wx, int wy, svga_t *svga);
@@ -948,6 +950,39 @@ svga_init(const device_t *info, svga_t *svga, void *p, int memsize,
 }
 
 
+/* Save or restore the core state, for the state hooks of the cards built
+   around it. The memory mapping is restored by the memory module; card
+   specific registers and any RAMDAC or clock chip are up to the card. */
+void
+svga_state(svga_t *svga, snapshot_t *s)
+{
+    uint32_t vram_len = svga->vram_max, len;
+
+    snapshot_var(s, &svga->fast, offsetof(svga_t, map8) - offsetof(svga_t, fast));
+    snapshot_var(s, svga->pallook, sizeof(svga->pallook));
+    snapshot_var(s, &svga->vgapal, offsetof(svga_t, timer) - offsetof(svga_t, vgapal));
+    snapshot_timer(s, &svga->timer);
+    snapshot_var(s, &svga->clock, offsetof(svga_t, render) - offsetof(svga_t, clock));
+    snapshot_item(s, svga->override);
+    snapshot_var(s, svga->crtc, offsetof(svga_t, vram) - offsetof(svga_t, crtc));
+    snapshot_var(s, &svga->crtcreg, offsetof(svga_t, ramdac) - offsetof(svga_t, crtcreg));
+
+    /* vram_max never exceeds the size that was allocated. */
+    len = vram_len;
+    snapshot_item(s, len);
+    if (len != vram_len) {
+	s->error = 1;
+	return;
+    }
+    snapshot_var(s, svga->vram, vram_len);
+
+    if (s->loading && !s->error) {
+	svga_recalctimings(svga);
+	svga->fullchange = changeframecount;
+    }
+}
+
+
 void
 svga_close(svga_t *svga)
 {
@@ -29,6 +29,7 @@
 #include <86box/timer.h>
 #include <86box/video.h>
 #include <86box/vid_svga.h>
+#include <86box/snapshot.h>
 
 
 typedef struct vga_t
@@ -183,6 +184,13 @@ void vga_force_redraw(void *p)
         vga->svga.fullchange = changeframecount;
 }
 
+static void vga_state(void *p, snapshot_t *s)
+{
+        vga_t *vga = (vga_t *)p;
+
+        svga_state(&vga->svga, s);
+}
+
 const device_t vga_device =
 {
         "VGA",
@@ -194,7 +202,8 @@ const device_t vga_device =
         { vga_available },
         vga_speed_changed,
         vga_force_redraw,
-        NULL
+        NULL,
+        vga_state
 };
 
 const device_t ps1vga_device =
@@ -208,7 +217,8 @@ const device_t ps1vga_device =
         { vga_available },
         vga_speed_changed,
         vga_force_redraw,
-        NULL
+        NULL,
+        vga_state
 };
 
 const device_t ps1vga_mca_device =
@@ -222,5 +232,6 @@ const device_t ps1vga_mca_device =
         { vga_available },
         vga_speed_changed,
         vga_force_redraw,
-        NULL
+        NULL,
+        vga_state
 };
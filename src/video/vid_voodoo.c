@@ -890,6 +890,12 @@ void *voodoo_card_init()
         voodoo->fb_size = device_get_config_int("framebuffer_memory");
         voodoo->fb_mask = (voodoo->fb_size << 20) - 1;
         voodoo->render_threads = device_get_config_int("render_threads");
+        voodoo->texture_cache_size = device_get_config_int("texture_cache");
+        if (!voodoo->render_threads)
+        {
+                voodoo->render_tiled = 1;
+                voodoo->render_threads = 1;
+        }
         voodoo->odd_even_mask = voodoo->render_threads - 1;
 #ifndef NO_CODEGEN
         voodoo->use_recompiler = device_get_config_int("recompiler");
@@ -923,17 +929,7 @@ void *voodoo_card_init()
         voodoo->tex_mem_w[0] = (uint16_t *)voodoo->tex_mem[0];
         voodoo->tex_mem_w[1] = (uint16_t *)voodoo->tex_mem[1];
         
-        for (c = 0; c < TEX_CACHE_MAX; c++) {
-                voodoo->texture_cache[0][c].data = malloc((256*256 + 256*256 + 128*128 + 64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2) * 4);
-                voodoo->texture_cache[0][c].base = -1; /*invalid*/
-                voodoo->texture_cache[0][c].refcount = 0;
-                if (voodoo->dual_tmus)
-                {
-                        voodoo->texture_cache[1][c].data = malloc((256*256 + 256*256 + 128*128 + 64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2) * 4);
-                        voodoo->texture_cache[1][c].base = -1; /*invalid*/
-                        voodoo->texture_cache[1][c].refcount = 0;
-                }
-        }
+        voodoo_texture_cache_init(voodoo);
 
         timer_add(&voodoo->timer, voodoo_callback, voodoo, 1);
         
@@ -952,7 +948,10 @@ void *voodoo_card_init()
         voodoo->render_not_full_event[2] = thread_create_event();
         voodoo->render_not_full_event[3] = thread_create_event();
         voodoo->fifo_thread = thread_create(voodoo_fifo_thread, voodoo);
-        voodoo->render_thread[0] = thread_create(voodoo_render_thread_1, voodoo);
+        if (voodoo->render_tiled)
+                voodoo_tile_init(voodoo);
+        else
+                voodoo->render_thread[0] = thread_create(voodoo_render_thread_1, voodoo);
         if (voodoo->render_threads >= 2)
                 voodoo->render_thread[1] = thread_create(voodoo_render_thread_2, voodoo);
         if (voodoo->render_threads == 4) {
@@ -1027,6 +1026,12 @@ void *voodoo_2d3d_card_init(int type)
         voodoo->bilinear_enabled = device_get_config_int("bilinear");
         voodoo->scrfilter = device_get_config_int("dacfilter");
         voodoo->render_threads = device_get_config_int("render_threads");
+        voodoo->texture_cache_size = device_get_config_int("texture_cache");
+        if (!voodoo->render_threads)
+        {
+                voodoo->render_tiled = 1;
+                voodoo->render_threads = 1;
+        }
         voodoo->odd_even_mask = voodoo->render_threads - 1;
 #ifndef NO_CODEGEN
         voodoo->use_recompiler = device_get_config_int("recompiler");
@@ -1037,17 +1042,7 @@ void *voodoo_2d3d_card_init(int type)
 	/*generate filter lookup tables*/
 	voodoo_generate_filter_v2(voodoo);
 
-        for (c = 0; c < TEX_CACHE_MAX; c++) {
-                voodoo->texture_cache[0][c].data = malloc((256*256 + 256*256 + 128*128 + 64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2) * 4);
-                voodoo->texture_cache[0][c].base = -1; /*invalid*/
-                voodoo->texture_cache[0][c].refcount = 0;
-                if (voodoo->dual_tmus)
-                {
-                        voodoo->texture_cache[1][c].data = malloc((256*256 + 256*256 + 128*128 + 64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2) * 4);
-                        voodoo->texture_cache[1][c].base = -1; /*invalid*/
-                        voodoo->texture_cache[1][c].refcount = 0;
-                }
-        }
+        voodoo_texture_cache_init(voodoo);
 
         timer_add(&voodoo->timer, voodoo_callback, voodoo, 1);
 
@@ -1065,7 +1060,10 @@ void *voodoo_2d3d_card_init(int type)
         voodoo->render_not_full_event[2] = thread_create_event();
         voodoo->render_not_full_event[3] = thread_create_event();
         voodoo->fifo_thread = thread_create(voodoo_fifo_thread, voodoo);
-        voodoo->render_thread[0] = thread_create(voodoo_render_thread_1, voodoo);
+        if (voodoo->render_tiled)
+                voodoo_tile_init(voodoo);
+        else
+                voodoo->render_thread[0] = thread_create(voodoo_render_thread_1, voodoo);
         if (voodoo->render_threads >= 2)
                 voodoo->render_thread[1] = thread_create(voodoo_render_thread_2, voodoo);
         if (voodoo->render_threads == 4) {
@@ -1194,7 +1192,6 @@ void voodoo_card_close(voodoo_t *voodoo)
 /* #ifndef RELEASE_BUILD
         FILE *f;
 #endif */
-        int c;
         
 /* #ifndef RELEASE_BUILD        
         f = rom_fopen(L"texram.dmp", L"wb");
@@ -1210,7 +1207,10 @@ void voodoo_card_close(voodoo_t *voodoo)
 
 
         thread_kill(voodoo->fifo_thread);
-        thread_kill(voodoo->render_thread[0]);
+        if (voodoo->render_tiled)
+                voodoo_tile_close(voodoo);
+        else
+                thread_kill(voodoo->render_thread[0]);
         if (voodoo->render_threads >= 2)
                 thread_kill(voodoo->render_thread[1]);
         if (voodoo->render_threads == 4) {
@@ -1225,12 +1225,7 @@ void voodoo_card_close(voodoo_t *voodoo)
         thread_destroy_event(voodoo->render_not_full_event[0]);
         thread_destroy_event(voodoo->render_not_full_event[1]);
 
-        for (c = 0; c < TEX_CACHE_MAX; c++)
-        {
-                if (voodoo->dual_tmus)
-                        free(voodoo->texture_cache[1][c].data);
-                free(voodoo->texture_cache[0][c].data);
-        }
+        voodoo_texture_cache_close(voodoo);
 #ifndef NO_CODEGEN
         voodoo_codegen_close(voodoo);
 #endif
@@ -1351,12 +1346,40 @@ static const device_config_t voodoo_config[] =
                                 .description = "4",
                                 .value = 4
                         },
+                        {
+                                .description = "Tiled (all host cores)",
+                                .value = 0
+                        },
                         {
                                 .description = ""
                         }
                 },
                 .default_int = 2
         },
+        {
+                .name = "texture_cache",
+                .description = "Texture cache size",
+                .type = CONFIG_SELECTION,
+                .selection =
+                {
+                        {
+                                .description = "64 textures",
+                                .value = 64
+                        },
+                        {
+                                .description = "128 textures",
+                                .value = 128
+                        },
+                        {
+                                .description = "256 textures",
+                                .value = 256
+                        },
+                        {
+                                .description = ""
+                        }
+                },
+                .default_int = 64
+        },
         {
                 .name = "sli",
                 .description = "SLI",
@@ -2513,12 +2513,40 @@ static const device_config_t banshee_sgram_config[] =
                                 .description = "4",
                                 .value = 4
                         },
+                        {
+                                .description = "Tiled (all host cores)",
+                                .value = 0
+                        },
                         {
                                 .description = ""
                         }
                 },
                 .default_int = 2
         },
+        {
+                .name = "texture_cache",
+                .description = "Texture cache size",
+                .type = CONFIG_SELECTION,
+                .selection =
+                {
+                        {
+                                .description = "64 textures",
+                                .value = 64
+                        },
+                        {
+                                .description = "128 textures",
+                                .value = 128
+                        },
+                        {
+                                .description = "256 textures",
+                                .value = 256
+                        },
+                        {
+                                .description = ""
+                        }
+                },
+                .default_int = 64
+        },
 #ifndef NO_CODEGEN
         {
                 .name = "recompiler",
@@ -2564,12 +2592,40 @@ static const device_config_t banshee_sdram_config[] =
                                 .description = "4",
                                 .value = 4
                         },
+                        {
+                                .description = "Tiled (all host cores)",
+                                .value = 0
+                        },
                         {
                                 .description = ""
                         }
                 },
                 .default_int = 2
         },
+        {
+                .name = "texture_cache",
+                .description = "Texture cache size",
+                .type = CONFIG_SELECTION,
+                .selection =
+                {
+                        {
+                                .description = "64 textures",
+                                .value = 64
+                        },
+                        {
+                                .description = "128 textures",
+                                .value = 128
+                        },
+                        {
+                                .description = "256 textures",
+                                .value = 256
+                        },
+                        {
+                                .description = ""
+                        }
+                },
+                .default_int = 64
+        },
 #ifndef NO_CODEGEN
         {
                 .name = "recompiler",
@@ -159,6 +159,8 @@ static uint32_t cmdfifo_get(voodoo_t *voodoo)
 	if (!voodoo->cmdfifo_in_sub) {
 		while (voodoo->cmdfifo_depth_rd == voodoo->cmdfifo_depth_wr)
 		{
+			if (voodoo->render_tiled)
+				voodoo_wake_render_thread(voodoo);
 			thread_wait_event(voodoo->wake_fifo_thread, -1);
 			thread_reset_event(voodoo->wake_fifo_thread);
 		}
@@ -540,6 +542,8 @@ void voodoo_fifo_thread(void *param)
                         end_time = plat_timer_read();
                         voodoo->time += end_time - start_time;
                 }
+                if (voodoo->render_tiled)
+                        voodoo_wake_render_thread(voodoo); /*Schedule triangles still waiting in tiles*/
                 voodoo->voodoo_busy = 0;
         }
 }
@@ -110,6 +110,71 @@ voodoo_render_log(const char *fmt, ...)
 #define voodoo_render_log(fmt, ...)
 #endif
 
+/*Tiled renderer.
+
+  Rather than each render thread drawing every triangle's odd or even lines,
+  triangles are binned into 64x32 screen tiles as they are queued. A tile with
+  triangles pending is handed to one worker at a time, which draws them in
+  order, clipped to the tile. Each worker has its own queue of tiles; a worker
+  that runs out takes the most recently queued tile from another's. Tiles in
+  the first and last row and column extend to the edge of the coordinate
+  space.
+
+  params_buffer entries are retired once no tile still has them queued. In
+  this mode params_read_idx[0] is the retire index, so PARAM_FULL(0) and
+  PARAM_EMPTY(0) keep their meaning for the rest of the Voodoo code.*/
+#define TILE_SHIFT_X 6
+#define TILE_SHIFT_Y 5
+#define TILES_X 32
+#define TILES_Y 64
+#define TILES_NR (TILES_X * TILES_Y)
+#define TILE_EDGE (1 << 30)
+
+#define TILE_QUEUE_SIZE 128
+#define TILE_QUEUE_MASK (TILE_QUEUE_SIZE - 1)
+
+#define TILE_BATCH 16 /*Triangles queued between schedules*/
+#define TILE_STATS_INTERVAL 5 /*Seconds between worker statistics*/
+
+typedef struct voodoo_tile_t
+{
+        int x_min, x_max, y_min, y_max;
+
+        volatile int read_idx, write_idx;
+        int scheduled; /*Queued to or being drawn by a worker*/
+
+        int queue[TILE_QUEUE_SIZE];
+} voodoo_tile_t;
+
+typedef struct voodoo_tile_worker_t
+{
+        voodoo_t *voodoo;
+        int nr;
+        int busy;
+
+        thread_t *thread;
+        event_t *wake;
+
+        int queue[TILES_NR];
+        int head, tail;
+
+        uint64_t busy_time, idle_time;
+        int tiles_drawn, tiles_stolen;
+} voodoo_tile_worker_t;
+
+typedef struct voodoo_tiles_t
+{
+        voodoo_tile_t tile[TILES_NR];
+        int tiles_w, tiles_h; /*Extent of tiles binned into so far*/
+
+        voodoo_tile_worker_t worker[RENDER_THREADS_MAX];
+        int nr_workers;
+
+        mutex_t *lock;
+
+        uint64_t stats_time;
+} voodoo_tiles_t;
+
 
 static uint8_t logtable[256] =
 {
@@ -215,10 +280,8 @@ typedef struct voodoo_texture_state_t
         int tex_shift;
 } voodoo_texture_state_t;
 
-static inline void tex_read(voodoo_state_t *state, voodoo_texture_state_t *texture_state, int tmu)
+static inline uint32_t tex_fetch(voodoo_state_t *state, voodoo_texture_state_t *texture_state, int tmu)
 {
-        uint32_t dat;
-
         if (texture_state->s & ~texture_state->w_mask)
         {
                 if (state->clamp_s[tmu])
@@ -244,7 +307,12 @@ static inline void tex_read(voodoo_state_t *state, voodoo_texture_state_t *textu
                         texture_state->t &= texture_state->h_mask;
         }
 
-        dat = state->tex[tmu][state->lod][texture_state->s + (texture_state->t << texture_state->tex_shift)];
+        return state->tex[tmu][state->lod][texture_state->s + (texture_state->t << texture_state->tex_shift)];
+}
+
+static inline void tex_read(voodoo_state_t *state, voodoo_texture_state_t *texture_state, int tmu)
+{
+        uint32_t dat = tex_fetch(state, texture_state, tmu);
 
         state->tex_b[tmu] = dat & 0xff;
         state->tex_g[tmu] = (dat >> 8) & 0xff;
@@ -255,10 +323,9 @@ static inline void tex_read(voodoo_state_t *state, voodoo_texture_state_t *textu
 #define LOW4(x)  ((x & 0x0f) | ((x & 0x0f) << 4))
 #define HIGH4(x) ((x & 0xf0) | ((x & 0xf0) >> 4))
 
-static inline void tex_read_4(voodoo_state_t *state, voodoo_texture_state_t *texture_state, int s, int t, int *d, int tmu, int x)
+/*Fetch the 2x2 texels with (s, t) at the top left, for bilinear filtering*/
+static inline void tex_fetch_4(voodoo_state_t *state, voodoo_texture_state_t *texture_state, int s, int t, int tmu, rgba_u *dat)
 {
-        rgba_u dat[4];
-
         if (((s | (s + 1)) & ~texture_state->w_mask) || ((t | (t + 1)) & ~texture_state->h_mask))
         {
                 int c;
@@ -301,6 +368,13 @@ static inline void tex_read_4(voodoo_state_t *state, voodoo_texture_state_t *tex
                 dat[2].u = state->tex[tmu][state->lod][s +     ((t + 1) << texture_state->tex_shift)];
                 dat[3].u = state->tex[tmu][state->lod][s + 1 + ((t + 1) << texture_state->tex_shift)];
         }
+}
+
+static inline void tex_read_4(voodoo_state_t *state, voodoo_texture_state_t *texture_state, int s, int t, int *d, int tmu, int x)
+{
+        rgba_u dat[4];
+
+        tex_fetch_4(state, texture_state, s, t, tmu, dat);
 
         state->tex_r[tmu] = (dat[0].rgba.r * d[0] + dat[1].rgba.r * d[1] + dat[2].rgba.r * d[2] + dat[3].rgba.r * d[3]) >> 8;
         state->tex_g[tmu] = (dat[0].rgba.g * d[0] + dat[1].rgba.g * d[1] + dat[2].rgba.g * d[2] + dat[3].rgba.g * d[3]) >> 8;
@@ -308,16 +382,16 @@ static inline void tex_read_4(voodoo_state_t *state, voodoo_texture_state_t *tex
         state->tex_a[tmu] = (dat[0].rgba.a * d[0] + dat[1].rgba.a * d[1] + dat[2].rgba.a * d[2] + dat[3].rgba.a * d[3]) >> 8;
 }
 
-static inline void voodoo_get_texture(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int tmu, int x)
+/*Work out the texels to sample for the current pixel. For a bilinear filtered
+  texture this returns 1, with the top left texel in s and t and the weights
+  in d. Otherwise it returns 0, with the texel in texture_state.*/
+static inline int voodoo_tex_coords(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int tmu, voodoo_texture_state_t *texture_state, int *s, int *t, int *d)
 {
-        voodoo_texture_state_t texture_state;
-        int d[4];
-        int s, t;
         int tex_lod = state->tex_lod[tmu][state->lod];
 
-        texture_state.w_mask = state->tex_w_mask[tmu][state->lod];
-        texture_state.h_mask = state->tex_h_mask[tmu][state->lod];
-        texture_state.tex_shift = 8 - tex_lod;
+        texture_state->w_mask = state->tex_w_mask[tmu][state->lod];
+        texture_state->h_mask = state->tex_h_mask[tmu][state->lod];
+        texture_state->tex_shift = 8 - tex_lod;
 
         if (params->tLOD[tmu] & LOD_TMIRROR_S)
         {
@@ -337,62 +411,43 @@ static inline void voodoo_get_texture(voodoo_t *voodoo, voodoo_params_t *params,
                 state->tex_s -= 1 << (3+tex_lod);
                 state->tex_t -= 1 << (3+tex_lod);
 
-                s = state->tex_s >> tex_lod;
-                t = state->tex_t >> tex_lod;
+                *s = state->tex_s >> tex_lod;
+                *t = state->tex_t >> tex_lod;
 
-                _ds = s & 0xf;
-                dt = t & 0xf;
+                _ds = *s & 0xf;
+                dt = *t & 0xf;
+
+                *s >>= 4;
+                *t >>= 4;
 
-                s >>= 4;
-                t >>= 4;
-//if (x == 80)
-//if (voodoo_output)
-//        voodoo_render_log("s=%08x t=%08x _ds=%02x _dt=%02x\n", s, t, _ds, dt);
                 d[0] = (16 - _ds) * (16 - dt);
                 d[1] =  _ds * (16 - dt);
                 d[2] = (16 - _ds) * dt;
                 d[3] = _ds * dt;
 
-//                texture_state.s = s;
-//                texture_state.t = t;
-                tex_read_4(state, &texture_state, s, t, d, tmu, x);
-
-
-/*                state->tex_r = (tex_samples[0].rgba.r * d[0] + tex_samples[1].rgba.r * d[1] + tex_samples[2].rgba.r * d[2] + tex_samples[3].rgba.r * d[3]) >> 8;
-                state->tex_g = (tex_samples[0].rgba.g * d[0] + tex_samples[1].rgba.g * d[1] + tex_samples[2].rgba.g * d[2] + tex_samples[3].rgba.g * d[3]) >> 8;
-                state->tex_b = (tex_samples[0].rgba.b * d[0] + tex_samples[1].rgba.b * d[1] + tex_samples[2].rgba.b * d[2] + tex_samples[3].rgba.b * d[3]) >> 8;
-                state->tex_a = (tex_samples[0].rgba.a * d[0] + tex_samples[1].rgba.a * d[1] + tex_samples[2].rgba.a * d[2] + tex_samples[3].rgba.a * d[3]) >> 8;*/
-/*                state->tex_r = tex_samples[0].r;
-                state->tex_g = tex_samples[0].g;
-                state->tex_b = tex_samples[0].b;
-                state->tex_a = tex_samples[0].a;*/
+                return 1;
         }
-        else
-        {
-        //        rgba_t tex_samples;
-        //        voodoo_texture_state_t texture_state;
-//                int s = state->tex_s >> (18+state->lod);
-//                int t = state->tex_t >> (18+state->lod);
-        //        int s, t;
 
-//                state->tex_s -= 1 << (17+state->lod);
-//                state->tex_t -= 1 << (17+state->lod);
+        texture_state->s = state->tex_s >> (4+tex_lod);
+        texture_state->t = state->tex_t >> (4+tex_lod);
 
-                s = state->tex_s >> (4+tex_lod);
-                t = state->tex_t >> (4+tex_lod);
+        return 0;
+}
 
-                texture_state.s = s;
-                texture_state.t = t;
-                tex_read(state, &texture_state, tmu);
+static inline void voodoo_get_texture(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int tmu, int x)
+{
+        voodoo_texture_state_t texture_state;
+        int d[4];
+        int s, t;
 
-/*                state->tex_r = tex_samples[0].rgba.r;
-                state->tex_g = tex_samples[0].rgba.g;
-                state->tex_b = tex_samples[0].rgba.b;
-                state->tex_a = tex_samples[0].rgba.a;*/
-        }
+        if (voodoo_tex_coords(voodoo, params, state, tmu, &texture_state, &s, &t, d))
+                tex_read_4(state, &texture_state, s, t, d, tmu, x);
+        else
+                tex_read(state, &texture_state, tmu);
 }
 
-static inline void voodoo_tmu_fetch(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int tmu, int x)
+/*Texture coordinates and LOD for the current pixel*/
+static inline void voodoo_tmu_lod(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int tmu)
 {
         if (params->textureMode[tmu] & 1)
         {
@@ -436,7 +491,11 @@ static inline void voodoo_tmu_fetch(voodoo_t *voodoo, voodoo_params_t *params, v
                 state->lod = state->lod_max[tmu];
         state->lod_frac[tmu] = state->lod & 0xff;
         state->lod >>= 8;
+}
 
+static inline void voodoo_tmu_fetch(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int tmu, int x)
+{
+        voodoo_tmu_lod(voodoo, params, state, tmu);
         voodoo_get_texture(voodoo, params, state, tmu, x);
 }
 
@@ -684,7 +743,9 @@ static inline void voodoo_tmu_fetch_and_blend(voodoo_t *voodoo, voodoo_params_t
                 state->tex_a[0] ^= 0xff;
 }
 
-#if (defined i386 || defined __i386 || defined __i386__ || defined _X86_ || defined WIN32 || defined _WIN32 || defined _WIN32) && !(defined __amd64__)
+#if (defined __aarch64__)
+#include <86box/vid_voodoo_codegen_arm64.h>
+#elif (defined i386 || defined __i386 || defined __i386__ || defined _X86_ || defined WIN32 || defined _WIN32 || defined _WIN32) && !(defined __amd64__)
 #include <86box/vid_voodoo_codegen_x86.h>
 #elif (defined __amd64__)
 #include <86box/vid_voodoo_codegen_x86-64.h>
@@ -692,7 +753,25 @@ static inline void voodoo_tmu_fetch_and_blend(voodoo_t *voodoo, voodoo_params_t
 int voodoo_recomp = 0;
 #endif
 
-static void voodoo_half_triangle(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int ystart, int yend, int odd_even)
+static inline void voodoo_step_x(voodoo_params_t *params, voodoo_state_t *state, int dx)
+{
+        state->ir += params->dRdX*dx;
+        state->ig += params->dGdX*dx;
+        state->ib += params->dBdX*dx;
+        state->ia += params->dAdX*dx;
+        state->z += params->dZdX*dx;
+        state->tmu0_s += params->tmu[0].dSdX*dx;
+        state->tmu0_t += params->tmu[0].dTdX*dx;
+        state->tmu0_w += params->tmu[0].dWdX*dx;
+        state->tmu1_s += params->tmu[1].dSdX*dx;
+        state->tmu1_t += params->tmu[1].dTdX*dx;
+        state->tmu1_w += params->tmu[1].dWdX*dx;
+        state->w += params->dWdX*dx;
+}
+
+#include <86box/vid_voodoo_span.h>
+
+static void voodoo_half_triangle(voodoo_t *voodoo, voodoo_params_t *params, voodoo_state_t *state, int ystart, int yend, int odd_even, voodoo_tile_t *tile)
 {
 /*        int rgb_sel                 = params->fbzColorPath & 3;
         int a_sel                   = (params->fbzColorPath >> 2) & 3;
@@ -720,6 +799,7 @@ static void voodoo_half_triangle(voodoo_t *voodoo, voodoo_params_t *params, vood
         int dither = params->fbzMode & FBZ_DITHER;*/
         int texels;
         int c;
+        int span_ok = voodoo_span_supported(voodoo, params);
 #ifndef NO_CODEGEN
         uint8_t (*voodoo_draw)(voodoo_state_t *state, voodoo_params_t *params, int x, int real_y);
 #endif
@@ -856,7 +936,12 @@ static void voodoo_half_triangle(voodoo_t *voodoo, voodoo_params_t *params, vood
                 else
                         real_y >>= 4;
 
-                if (SLI_ENABLED)
+                if (tile)
+                {
+                        if (real_y < tile->y_min || real_y >= tile->y_max)
+                                goto next_line;
+                }
+                else if (SLI_ENABLED)
                 {
                         if (((real_y >> 1) & voodoo->odd_even_mask) != odd_even)
                                 goto next_line;
@@ -946,6 +1031,30 @@ static void voodoo_half_triangle(voodoo_t *voodoo, voodoo_params_t *params, vood
                         }
                 }
 
+                if (tile)
+                {
+                        if (state->xdir > 0)
+                        {
+                                if (x < tile->x_min)
+                                {
+                                        voodoo_step_x(params, state, tile->x_min - x);
+                                        x = tile->x_min;
+                                }
+                                if (x2 >= tile->x_max)
+                                        x2 = tile->x_max-1;
+                        }
+                        else
+                        {
+                                if (x >= tile->x_max)
+                                {
+                                        voodoo_step_x(params, state, (tile->x_max-1) - x);
+                                        x = tile->x_max-1;
+                                }
+                                if (x2 < tile->x_min)
+                                        x2 = tile->x_min;
+                        }
+                }
+
                 if (x2 < x && state->xdir > 0)
                         goto next_line;
                 if (x2 > x && state->xdir < 0)
@@ -981,6 +1090,9 @@ static void voodoo_half_triangle(voodoo_t *voodoo, voodoo_params_t *params, vood
                 }
                 else
 #endif
+                if (span_ok)
+                        voodoo_span_draw(voodoo, params, state, fb_mem, aux_mem, x, x2, real_y, odd_even, texels);
+                else
                 do
                 {
                         int x_tiled = (x & 63) | ((x >> 6) * 128*32/2);
@@ -1435,11 +1547,14 @@ next_line:
                 state->xend += state->dx2;
         }
 
-        voodoo->texture_cache[0][params->tex_entry[0]].refcount_r[odd_even]++;
-        voodoo->texture_cache[1][params->tex_entry[1]].refcount_r[odd_even]++;
+        if (!tile) /*Tiled triangles are counted when retired*/
+        {
+                voodoo->texture_cache[0][params->tex_entry[0]].refcount_r[odd_even]++;
+                voodoo->texture_cache[1][params->tex_entry[1]].refcount_r[odd_even]++;
+        }
 }
 
-void voodoo_triangle(voodoo_t *voodoo, voodoo_params_t *params, int odd_even)
+void voodoo_triangle(voodoo_t *voodoo, voodoo_params_t *params, int odd_even, voodoo_tile_t *tile)
 {
         voodoo_state_t state;
         int vertexAy_adjusted;
@@ -1583,7 +1698,7 @@ void voodoo_triangle(voodoo_t *voodoo, voodoo_params_t *params, int odd_even)
         state.tmu[1].lod = LOD + (lodbias << 6);
 
 
-        voodoo_half_triangle(voodoo, params, &state, vertexAy_adjusted, vertexCy_adjusted, odd_even);
+        voodoo_half_triangle(voodoo, params, &state, vertexAy_adjusted, vertexCy_adjusted, odd_even, tile);
 }
 
 
@@ -1604,7 +1719,7 @@ static void render_thread(void *param, int odd_even)
                         uint64_t end_time;
                         voodoo_params_t *params = &voodoo->params_buffer[voodoo->params_read_idx[odd_even] & PARAM_MASK];
 
-                        voodoo_triangle(voodoo, params, odd_even);
+                        voodoo_triangle(voodoo, params, odd_even, NULL);
 
                         voodoo->params_read_idx[odd_even]++;
 
@@ -1636,10 +1751,361 @@ void voodoo_render_thread_4(void *param)
         render_thread(param, 3);
 }
 
+/*Take a tile to draw, from the worker's own queue if possible, otherwise from
+  the back of another worker's. Called with the tile lock held*/
+static int voodoo_tile_get(voodoo_tiles_t *tiles, voodoo_tile_worker_t *worker)
+{
+        int c;
+
+        if (worker->head != worker->tail)
+                return worker->queue[worker->head++ & (TILES_NR - 1)];
+
+        for (c = 1; c < tiles->nr_workers; c++)
+        {
+                voodoo_tile_worker_t *victim = &tiles->worker[(worker->nr + c) % tiles->nr_workers];
+
+                if (victim->head != victim->tail)
+                {
+                        worker->tiles_stolen++;
+                        return victim->queue[--victim->tail & (TILES_NR - 1)];
+                }
+        }
+
+        return -1;
+}
+
+static void voodoo_tile_worker(void *param)
+{
+        voodoo_tile_worker_t *worker = (voodoo_tile_worker_t *)param;
+        voodoo_t *voodoo = worker->voodoo;
+        voodoo_tiles_t *tiles = voodoo->tiles;
+
+        while (1)
+        {
+                uint64_t start_time, end_time;
+                voodoo_tile_t *tile;
+                int tile_nr;
+
+                thread_wait_mutex(tiles->lock);
+                tile_nr = voodoo_tile_get(tiles, worker);
+                worker->busy = (tile_nr != -1);
+                thread_release_mutex(tiles->lock);
+
+                start_time = plat_timer_read();
+                if (tile_nr == -1)
+                {
+                        thread_wait_event(worker->wake, -1);
+                        thread_reset_event(worker->wake);
+                        worker->idle_time += plat_timer_read() - start_time;
+                        continue;
+                }
+
+                tile = &tiles->tile[tile_nr];
+                while (1)
+                {
+                        while (tile->read_idx != tile->write_idx)
+                        {
+                                voodoo_params_t *params = &voodoo->params_buffer[tile->queue[tile->read_idx & TILE_QUEUE_MASK] & PARAM_MASK];
+
+                                voodoo_triangle(voodoo, params, worker->nr, tile);
+
+                                tile->read_idx++;
+                        }
+
+                        /*Only give the tile up if nothing was added while drawing*/
+                        thread_wait_mutex(tiles->lock);
+                        if (tile->read_idx == tile->write_idx)
+                        {
+                                tile->scheduled = 0;
+                                thread_release_mutex(tiles->lock);
+                                break;
+                        }
+                        thread_release_mutex(tiles->lock);
+                }
+
+                end_time = plat_timer_read();
+                worker->busy_time += end_time - start_time;
+                worker->tiles_drawn++;
+                voodoo->render_time[worker->nr] += end_time - start_time;
+
+                thread_set_event(voodoo->render_not_full_event[0]);
+        }
+}
+
+/*Retire params_buffer entries older than anything still queued in a tile.
+  Called with the tile lock held*/
+static void voodoo_tile_retire(voodoo_t *voodoo)
+{
+        voodoo_tiles_t *tiles = voodoo->tiles;
+        int oldest = voodoo->params_write_idx;
+        int x, y;
+
+        for (y = 0; y < tiles->tiles_h; y++)
+        {
+                for (x = 0; x < tiles->tiles_w; x++)
+                {
+                        voodoo_tile_t *tile = &tiles->tile[y * TILES_X + x];
+                        int read_idx, entry = 0;
+
+                        /*The producer may reuse the slot once the worker moves
+                          on, so only trust the entry if read_idx didn't change*/
+                        do
+                        {
+                                read_idx = tile->read_idx;
+                                if (read_idx == tile->write_idx)
+                                        break;
+                                entry = tile->queue[read_idx & TILE_QUEUE_MASK];
+                        } while (read_idx != tile->read_idx);
+
+                        if (read_idx != tile->write_idx && (entry - oldest) < 0)
+                                oldest = entry;
+                }
+        }
+
+        while (voodoo->params_read_idx[0] != oldest)
+        {
+                voodoo_params_t *params = &voodoo->params_buffer[voodoo->params_read_idx[0] & PARAM_MASK];
+
+                voodoo->texture_cache[0][params->tex_entry[0]].refcount_r[0]++;
+                voodoo->texture_cache[1][params->tex_entry[1]].refcount_r[0]++;
+                voodoo->params_read_idx[0]++;
+        }
+
+        voodoo->render_voodoo_busy[0] = !PARAM_EMPTY(0);
+}
+
+#ifdef ENABLE_VOODOO_RENDER_LOG
+static void voodoo_tile_stats(voodoo_t *voodoo)
+{
+        voodoo_tiles_t *tiles = voodoo->tiles;
+        uint64_t time = plat_timer_read();
+        int c;
+
+        if (!tiles->stats_time)
+                tiles->stats_time = time;
+        if ((time - tiles->stats_time) < (timer_freq * TILE_STATS_INTERVAL))
+                return;
+
+        for (c = 0; c < tiles->nr_workers; c++)
+        {
+                voodoo_tile_worker_t *worker = &tiles->worker[c];
+                uint64_t total = worker->busy_time + worker->idle_time;
+
+                voodoo_render_log("Voodoo tile worker %i: busy %i%%, idle %i%%, %i tiles drawn, %i stolen\n", c,
+                                  total ? (int)((worker->busy_time * 100) / total) : 0,
+                                  total ? (int)((worker->idle_time * 100) / total) : 0,
+                                  worker->tiles_drawn, worker->tiles_stolen);
+
+                worker->busy_time = worker->idle_time = 0;
+                worker->tiles_drawn = worker->tiles_stolen = 0;
+        }
+
+        tiles->stats_time = time;
+}
+#else
+#define voodoo_tile_stats(voodoo)
+#endif
+
+/*Queue tiles with triangles pending that no worker has yet, wake idle
+  workers to take them, and retire finished triangles*/
+void voodoo_tile_flush(voodoo_t *voodoo)
+{
+        voodoo_tiles_t *tiles = voodoo->tiles;
+        int wake[RENDER_THREADS_MAX];
+        int x, y, c;
+        int queued = 0;
+
+        thread_wait_mutex(tiles->lock);
+
+        for (y = 0; y < tiles->tiles_h; y++)
+        {
+                for (x = 0; x < tiles->tiles_w; x++)
+                {
+                        int tile_nr = y * TILES_X + x;
+                        voodoo_tile_t *tile = &tiles->tile[tile_nr];
+
+                        if (!tile->scheduled && tile->read_idx != tile->write_idx)
+                        {
+                                voodoo_tile_worker_t *worker = &tiles->worker[x % tiles->nr_workers];
+
+                                tile->scheduled = 1;
+                                worker->queue[worker->tail++ & (TILES_NR - 1)] = tile_nr;
+                                queued++;
+                        }
+                }
+        }
+
+        voodoo_tile_retire(voodoo);
+        voodoo_tile_stats(voodoo);
+
+        for (c = 0; c < tiles->nr_workers; c++)
+                wake[c] = queued && !tiles->worker[c].busy;
+
+        thread_release_mutex(tiles->lock);
+
+        for (c = 0; c < tiles->nr_workers; c++)
+        {
+                if (wake[c])
+                        thread_set_event(tiles->worker[c].wake);
+        }
+}
+
+static void voodoo_tile_bin(voodoo_t *voodoo, voodoo_params_t *params, int params_idx)
+{
+        voodoo_tiles_t *tiles = voodoo->tiles;
+        int ax = (int16_t)params->vertexAx, ay = (int16_t)params->vertexAy;
+        int bx = (int16_t)params->vertexBx, by = (int16_t)params->vertexBy;
+        int cx = (int16_t)params->vertexCx, cy = (int16_t)params->vertexCy;
+        int x_min, x_max, y_min, y_max;
+        int tile_x_min, tile_x_max, tile_y_min, tile_y_max;
+        int x, y;
+
+        /*Conservative bounds, with a pixel or two of slack for edge rounding*/
+        x_min = (MIN(ax, MIN(bx, cx)) >> 4) - 2;
+        x_max = (MAX(ax, MAX(bx, cx)) >> 4) + 2;
+        y_min = ((MIN(ay, MIN(by, cy)) + 7) >> 4) - 1;
+        y_max = ((MAX(ay, MAX(by, cy)) + 7) >> 4) + 1;
+
+        if (params->fbzMode & 1)
+        {
+                x_min = MAX(x_min, params->clipLeft);
+                x_max = MIN(x_max, params->clipRight-1);
+                y_min = MAX(y_min, params->clipLowY);
+                y_max = MIN(y_max, params->clipHighY-1);
+        }
+        if (x_min > x_max || y_min > y_max)
+                return;
+
+        if (params->fbzMode & (1 << 17))
+        {
+                int temp = (voodoo->v_disp-1) - y_max;
+
+                y_max = (voodoo->v_disp-1) - y_min;
+                y_min = temp;
+        }
+
+        tile_x_min = MIN(MAX(x_min >> TILE_SHIFT_X, 0), TILES_X-1);
+        tile_x_max = MIN(MAX(x_max >> TILE_SHIFT_X, 0), TILES_X-1);
+        tile_y_min = MIN(MAX(y_min >> TILE_SHIFT_Y, 0), TILES_Y-1);
+        tile_y_max = MIN(MAX(y_max >> TILE_SHIFT_Y, 0), TILES_Y-1);
+
+        if (tile_x_max >= tiles->tiles_w)
+                tiles->tiles_w = tile_x_max + 1;
+        if (tile_y_max >= tiles->tiles_h)
+                tiles->tiles_h = tile_y_max + 1;
+
+        for (y = tile_y_min; y <= tile_y_max; y++)
+        {
+                for (x = tile_x_min; x <= tile_x_max; x++)
+                {
+                        voodoo_tile_t *tile = &tiles->tile[y * TILES_X + x];
+
+                        while ((tile->write_idx - tile->read_idx) >= TILE_QUEUE_SIZE)
+                        {
+                                voodoo_tile_flush(voodoo);
+                                thread_wait_event(voodoo->render_not_full_event[0], 1); /*Wait for room in tile*/
+                        }
+
+                        tile->queue[tile->write_idx & TILE_QUEUE_MASK] = params_idx;
+                        tile->write_idx++;
+                }
+        }
+}
+
+static void voodoo_tile_queue_triangle(voodoo_t *voodoo, voodoo_params_t *params)
+{
+        voodoo_params_t *params_new = &voodoo->params_buffer[voodoo->params_write_idx & PARAM_MASK];
+
+        while (PARAM_FULL(0))
+        {
+                voodoo_tile_flush(voodoo);
+                if (PARAM_FULL(0))
+                        thread_wait_event(voodoo->render_not_full_event[0], 1); /*Wait for room in ringbuffer*/
+        }
+
+        voodoo_use_texture(voodoo, params, 0);
+        if (voodoo->dual_tmus)
+                voodoo_use_texture(voodoo, params, 1);
+
+        memcpy(params_new, params, sizeof(voodoo_params_t));
+
+        voodoo->render_voodoo_busy[0] = 1;
+        voodoo_tile_bin(voodoo, params_new, voodoo->params_write_idx);
+        voodoo->params_write_idx++;
+
+        if (!(voodoo->params_write_idx & (TILE_BATCH - 1)) || PARAM_ENTRIES(0) <= TILE_BATCH)
+                voodoo_tile_flush(voodoo);
+}
+
+void voodoo_tile_init(voodoo_t *voodoo)
+{
+        voodoo_tiles_t *tiles = malloc(sizeof(voodoo_tiles_t));
+        int x, y, c;
+
+        memset(tiles, 0, sizeof(voodoo_tiles_t));
+
+        for (y = 0; y < TILES_Y; y++)
+        {
+                for (x = 0; x < TILES_X; x++)
+                {
+                        voodoo_tile_t *tile = &tiles->tile[y * TILES_X + x];
+
+                        tile->x_min = x ? (x << TILE_SHIFT_X) : -TILE_EDGE;
+                        tile->x_max = (x < TILES_X-1) ? ((x + 1) << TILE_SHIFT_X) : TILE_EDGE;
+                        tile->y_min = y ? (y << TILE_SHIFT_Y) : -TILE_EDGE;
+                        tile->y_max = (y < TILES_Y-1) ? ((y + 1) << TILE_SHIFT_Y) : TILE_EDGE;
+                }
+        }
+
+        /*Leave a host core for the emulated CPU*/
+        tiles->nr_workers = thread_get_cpu_count() - 1;
+        if (tiles->nr_workers < 1)
+                tiles->nr_workers = 1;
+        if (tiles->nr_workers > RENDER_THREADS_MAX)
+                tiles->nr_workers = RENDER_THREADS_MAX;
+
+        tiles->lock = thread_create_mutex();
+        voodoo->tiles = tiles;
+
+        for (c = 0; c < tiles->nr_workers; c++)
+        {
+                voodoo_tile_worker_t *worker = &tiles->worker[c];
+
+                worker->voodoo = voodoo;
+                worker->nr = c;
+                worker->wake = thread_create_event();
+                worker->thread = thread_create(voodoo_tile_worker, worker);
+        }
+
+        voodoo_render_log("Voodoo tiled renderer: %i worker threads\n", tiles->nr_workers);
+}
+
+void voodoo_tile_close(voodoo_t *voodoo)
+{
+        voodoo_tiles_t *tiles = voodoo->tiles;
+        int c;
+
+        for (c = 0; c < tiles->nr_workers; c++)
+        {
+                thread_kill(tiles->worker[c].thread);
+                thread_destroy_event(tiles->worker[c].wake);
+        }
+        thread_close_mutex(tiles->lock);
+
+        free(tiles);
+        voodoo->tiles = NULL;
+}
+
 void voodoo_queue_triangle(voodoo_t *voodoo, voodoo_params_t *params)
 {
         voodoo_params_t *params_new = &voodoo->params_buffer[voodoo->params_write_idx & PARAM_MASK];
 
+        if (voodoo->render_tiled)
+        {
+                voodoo_tile_queue_triangle(voodoo, params);
+                return;
+        }
+
         while (PARAM_FULL(0) || (voodoo->render_threads >= 2 && PARAM_FULL(1)) ||
                 (voodoo->render_threads == 4 && (PARAM_FULL(2) || PARAM_FULL(3))))
         {
@@ -158,13 +158,109 @@ void voodoo_recalc_tex(voodoo_t *voodoo, int tmu)
 
 #define makergba(r, g, b, a)  ((b) | ((g) << 8) | ((r) << 16) | ((a) << 24))
 
+static inline int texture_hash(uint32_t base, uint32_t tLOD, uint32_t palette_checksum)
+{
+        uint32_t hash = base ^ (tLOD * 0x9e3779b1) ^ (palette_checksum * 0x85ebca6b);
+
+        hash ^= hash >> 15;
+        hash ^= hash >> 7;
+
+        return hash & (TEX_HASH_SIZE-1);
+}
+
+/*Returns the number of 1kB texture memory pages covered by one address range
+  of a cached texture, and the first of them. Ranges wrap at the end of
+  texture memory, as the texel fetches do.*/
+static int texture_range_pages(voodoo_t *voodoo, texture_t *texture, int range, int *first)
+{
+        int page_mask = voodoo->texture_mask >> TEX_DIRTY_SHIFT;
+        int last;
+
+        if (!texture->addr_end[range])
+                return 0;
+
+        *first = (texture->addr_start[range] & voodoo->texture_mask) >> TEX_DIRTY_SHIFT;
+        last = (texture->addr_end[range] & voodoo->texture_mask) >> TEX_DIRTY_SHIFT;
+
+        return ((last - *first) & page_mask) + 1;
+}
+
+static int texture_in_use(voodoo_t *voodoo, texture_t *texture)
+{
+        int c;
+
+        for (c = 0; c < voodoo->render_threads; c++)
+        {
+                if (texture->refcount != texture->refcount_r[c])
+                        return 1;
+        }
+
+        return 0;
+}
+
+/*Add a decoded texture to the hash table and to the address range index*/
+static void texture_cache_link(voodoo_t *voodoo, int tmu, int c)
+{
+        texture_t *texture = &voodoo->texture_cache[tmu][c];
+        int page_mask = voodoo->texture_mask >> TEX_DIRTY_SHIFT;
+        int hash = texture_hash(texture->base, texture->tLOD, texture->palette_checksum);
+        int d;
+
+        texture->hash_next = voodoo->texture_hash[tmu][hash];
+        voodoo->texture_hash[tmu][hash] = c;
+
+        for (d = 0; d < 4; d++)
+        {
+                int page, nr_pages;
+
+                nr_pages = texture_range_pages(voodoo, texture, d, &page);
+                while (nr_pages--)
+                {
+                        voodoo->texture_present[tmu][page]++;
+                        voodoo->texture_range[tmu][page >> (TEX_RANGE_SHIFT - TEX_DIRTY_SHIFT)][c >> 6] |= (1ull << (c & 63));
+                        page = (page + 1) & page_mask;
+                }
+        }
+}
+
+/*Remove a texture from the hash table and the address range index, and mark
+  the entry invalid*/
+static void texture_cache_unlink(voodoo_t *voodoo, int tmu, int c)
+{
+        texture_t *texture = &voodoo->texture_cache[tmu][c];
+        int page_mask = voodoo->texture_mask >> TEX_DIRTY_SHIFT;
+        int *prev = &voodoo->texture_hash[tmu][texture_hash(texture->base, texture->tLOD, texture->palette_checksum)];
+        int d;
+
+        while (*prev != c)
+                prev = &voodoo->texture_cache[tmu][*prev].hash_next;
+        *prev = texture->hash_next;
+
+        for (d = 0; d < 4; d++)
+        {
+                int page, nr_pages;
+
+                nr_pages = texture_range_pages(voodoo, texture, d, &page);
+                while (nr_pages--)
+                {
+                        voodoo->texture_present[tmu][page]--;
+                        voodoo->texture_range[tmu][page >> (TEX_RANGE_SHIFT - TEX_DIRTY_SHIFT)][c >> 6] &= ~(1ull << (c & 63));
+                        page = (page + 1) & page_mask;
+                }
+        }
+
+        texture->base = -1;
+}
+
 void voodoo_use_texture(voodoo_t *voodoo, voodoo_params_t *params, int tmu)
 {
-        int c, d;
+        int c;
         int lod;
         int lod_min, lod_max;
-        uint32_t addr = 0, addr_end;
+        uint32_t addr = 0;
+        uint32_t tLOD = params->tLOD[tmu] & 0xf00fff;
         uint32_t palette_checksum;
+        uint64_t start_time, end_time;
 
         lod_min = (params->tLOD[tmu] >> 2) & 15;
         lod_max = (params->tLOD[tmu] >> 8) & 15;
@@ -193,43 +289,43 @@ void voodoo_use_texture(voodoo_t *voodoo, voodoo_params_t *params, int tmu)
                 addr = params->texBaseAddr[tmu];
 
         /*Try to find texture in cache*/
-        for (c = 0; c < TEX_CACHE_MAX; c++)
+        for (c = voodoo->texture_hash[tmu][texture_hash(addr, tLOD, palette_checksum)]; c != -1; c = voodoo->texture_cache[tmu][c].hash_next)
         {
                 if (voodoo->texture_cache[tmu][c].base == addr &&
-                    voodoo->texture_cache[tmu][c].tLOD == (params->tLOD[tmu] & 0xf00fff) &&
+                    voodoo->texture_cache[tmu][c].tLOD == tLOD &&
                     voodoo->texture_cache[tmu][c].palette_checksum == palette_checksum)
                 {
                         params->tex_entry[tmu] = c;
                         voodoo->texture_cache[tmu][c].refcount++;
+                        voodoo->tex_cache_hits[tmu]++;
                         return;
                 }
         }
-        
+        voodoo->tex_cache_misses[tmu]++;
+
         /*Texture not found, search for unused texture*/
         do
         {
-                for (c = 0; c < TEX_CACHE_MAX; c++)
+                for (c = 0; c < voodoo->texture_cache_size; c++)
                 {
                         voodoo->texture_last_removed++;
-                        voodoo->texture_last_removed &= (TEX_CACHE_MAX-1);
-                        if (voodoo->texture_cache[tmu][voodoo->texture_last_removed].refcount == voodoo->texture_cache[tmu][voodoo->texture_last_removed].refcount_r[0] &&
-                            (voodoo->render_threads == 1 || voodoo->texture_cache[tmu][voodoo->texture_last_removed].refcount == voodoo->texture_cache[tmu][voodoo->texture_last_removed].refcount_r[1]))
+                        voodoo->texture_last_removed &= (voodoo->texture_cache_size-1);
+                        if (!texture_in_use(voodoo, &voodoo->texture_cache[tmu][voodoo->texture_last_removed]))
                                 break;
                 }
-                if (c == TEX_CACHE_MAX)
+                if (c == voodoo->texture_cache_size)
                         voodoo_wait_for_render_thread_idle(voodoo);
-        } while (c == TEX_CACHE_MAX);
-        if (c == TEX_CACHE_MAX)
-                fatal("Texture cache full!\n");
+        } while (c == voodoo->texture_cache_size);
 
         c = voodoo->texture_last_removed;
 
+        if (voodoo->texture_cache[tmu][c].base != -1)
+                texture_cache_unlink(voodoo, tmu, c);
 
-        if ((voodoo->params.tLOD[tmu] & LOD_SPLIT) && (voodoo->params.tLOD[tmu] & LOD_ODD) && (voodoo->params.tLOD[tmu] & LOD_TMULTIBASEADDR))
-                voodoo->texture_cache[tmu][c].base = params->texBaseAddr1[tmu];
-        else
-                voodoo->texture_cache[tmu][c].base = params->texBaseAddr[tmu];
-        voodoo->texture_cache[tmu][c].tLOD = params->tLOD[tmu] & 0xf00fff;
+        start_time = plat_timer_read();
+
+        voodoo->texture_cache[tmu][c].base = addr;
+        voodoo->texture_cache[tmu][c].tLOD = tLOD;
 
         lod_min = (params->tLOD[tmu] >> 2) & 15;
         lod_max = (params->tLOD[tmu] >> 8) & 15;
@@ -499,18 +595,10 @@ void voodoo_use_texture(voodoo_t *voodoo, voodoo_params_t *params, int tmu)
         else
                 voodoo->texture_cache[tmu][c].addr_start[3] = voodoo->texture_cache[tmu][c].addr_end[3] = 0;
 
+        texture_cache_link(voodoo, tmu, c);
 
-        for (d = 0; d < 4; d++)
-        {
-                addr = voodoo->texture_cache[tmu][c].addr_start[d];
-                addr_end = voodoo->texture_cache[tmu][c].addr_end[d];
-
-                if (addr_end != 0)
-                {
-                        for (; addr <= addr_end; addr += (1 << TEX_DIRTY_SHIFT))
-                                voodoo->texture_present[tmu][(addr & voodoo->texture_mask) >> TEX_DIRTY_SHIFT] = 1;
-                }
-        }
+        end_time = plat_timer_read();
+        voodoo->tex_decode_time[tmu] += end_time - start_time;
 
         params->tex_entry[tmu] = c;
         voodoo->texture_cache[tmu][c].refcount++;
@@ -518,52 +606,91 @@ void voodoo_use_texture(voodoo_t *voodoo, voodoo_params_t *params, int tmu)
 
 void flush_texture_cache(voodoo_t *voodoo, uint32_t dirty_addr, int tmu)
 {
+        uint64_t *range = voodoo->texture_range[tmu][dirty_addr >> TEX_RANGE_SHIFT];
+        int page_mask = voodoo->texture_mask >> TEX_DIRTY_SHIFT;
+        int dirty_page = dirty_addr >> TEX_DIRTY_SHIFT;
         int wait_for_idle = 0;
-        int c;
+        int c, d, w;
 
-        memset(voodoo->texture_present[tmu], 0, sizeof(voodoo->texture_present[0]));
-//        voodoo_texture_log("Evict %08x %i\n", dirty_addr, sizeof(voodoo->texture_present));
-        for (c = 0; c < TEX_CACHE_MAX; c++)
+//        voodoo_texture_log("Evict %08x\n", dirty_addr);
+        /*Only textures indexed under the written region can overlap it*/
+        for (w = 0; w < voodoo->texture_cache_size / 64; w++)
         {
-                if (voodoo->texture_cache[tmu][c].base != -1)
+                uint64_t entries = range[w];
+
+                for (c = w * 64; entries; c++, entries >>= 1)
                 {
-                        int d;
+                        texture_t *texture = &voodoo->texture_cache[tmu][c];
+
+                        if (!(entries & 1))
+                                continue;
 
                         for (d = 0; d < 4; d++)
                         {
-                                int addr_start = voodoo->texture_cache[tmu][c].addr_start[d];
-                                int addr_end = voodoo->texture_cache[tmu][c].addr_end[d];
+                                int page, nr_pages;
 
-                                if (addr_end != 0)
-                                {
-                                        int addr_start_masked = addr_start & voodoo->texture_mask & ~0x3ff;
-                                        int addr_end_masked = ((addr_end & voodoo->texture_mask) + 0x3ff) & ~0x3ff;
-
-                                        if (addr_end_masked < addr_start_masked)
-                                                addr_end_masked = voodoo->texture_mask+1;
-                                        if (dirty_addr >= addr_start_masked && dirty_addr < addr_end_masked)
-                                        {
-//                                voodoo_texture_log("  Evict texture %i %08x\n", c, voodoo->texture_cache[tmu][c].base);
-
-                                                if (voodoo->texture_cache[tmu][c].refcount != voodoo->texture_cache[tmu][c].refcount_r[0] ||
-                                                    (voodoo->render_threads == 2 && voodoo->texture_cache[tmu][c].refcount != voodoo->texture_cache[tmu][c].refcount_r[1]))
-                                                        wait_for_idle = 1;
-
-                                                voodoo->texture_cache[tmu][c].base = -1;
-                                        }
-                                        else
-                                        {
-                                                for (; addr_start <= addr_end; addr_start += (1 << TEX_DIRTY_SHIFT))
-                                                        voodoo->texture_present[tmu][(addr_start & voodoo->texture_mask) >> TEX_DIRTY_SHIFT] = 1;
-                                        }
-                                }
+                                nr_pages = texture_range_pages(voodoo, texture, d, &page);
+                                if (((dirty_page - page) & page_mask) < nr_pages)
+                                        break;
                         }
+                        if (d == 4)
+                                continue;
+
+//                        voodoo_texture_log("  Evict texture %i %08x\n", c, texture->base);
+                        if (texture_in_use(voodoo, texture))
+                                wait_for_idle = 1;
+
+                        texture_cache_unlink(voodoo, tmu, c);
+                        voodoo->tex_cache_flushes[tmu]++;
                 }
         }
         if (wait_for_idle)
                 voodoo_wait_for_render_thread_idle(voodoo);
 }
 
+void voodoo_texture_cache_init(voodoo_t *voodoo)
+{
+        int c, tmu;
+
+        if (voodoo->texture_cache_size < TEX_CACHE_DEFAULT || voodoo->texture_cache_size > TEX_CACHE_MAX ||
+            (voodoo->texture_cache_size & (voodoo->texture_cache_size - 1)))
+                voodoo->texture_cache_size = TEX_CACHE_DEFAULT;
+
+        /*The render threads index TMU 1's entries even on single TMU boards,
+          so both tables are always allocated; only texel storage is skipped*/
+        for (tmu = 0; tmu < 2; tmu++)
+        {
+                voodoo->texture_cache[tmu] = malloc(voodoo->texture_cache_size * sizeof(texture_t));
+                memset(voodoo->texture_cache[tmu], 0, voodoo->texture_cache_size * sizeof(texture_t));
+
+                for (c = 0; c < voodoo->texture_cache_size; c++)
+                {
+                        if (tmu == 0 || voodoo->dual_tmus)
+                                voodoo->texture_cache[tmu][c].data = malloc((256*256 + 256*256 + 128*128 + 64*64 + 32*32 + 16*16 + 8*8 + 4*4 + 2*2) * 4);
+                        voodoo->texture_cache[tmu][c].base = -1; /*invalid*/
+                        voodoo->texture_cache[tmu][c].refcount = 0;
+                }
+                for (c = 0; c < TEX_HASH_SIZE; c++)
+                        voodoo->texture_hash[tmu][c] = -1;
+        }
+}
+
+void voodoo_texture_cache_close(voodoo_t *voodoo)
+{
+        int c, tmu;
+
+        for (tmu = 0; tmu < 2; tmu++)
+        {
+                voodoo_texture_log("TMU %i texture cache: %u hits, %u misses, %u flushed, %llu us decoding\n", tmu,
+                                voodoo->tex_cache_hits[tmu], voodoo->tex_cache_misses[tmu], voodoo->tex_cache_flushes[tmu],
+                                (unsigned long long)(voodoo->tex_decode_time[tmu] * 1000000 / timer_freq));
+
+                for (c = 0; c < voodoo->texture_cache_size; c++)
+                        free(voodoo->texture_cache[tmu][c].data);
+                free(voodoo->texture_cache[tmu]);
+        }
+}
+
 void voodoo_tex_writel(uint32_t addr, uint32_t val, void *p)
 {
         int lod, s, t;
@@ -249,6 +249,9 @@ static struct {
     int		busy;
     int		buffer_in_use;
 
+    int		nrects;
+    video_rect_t rects[VIDEO_RECTS_MAX];
+
     thread_t	*blit_thread;
     event_t	*wake_blit_thread;
     event_t	*blit_complete;
@@ -258,6 +261,12 @@ static struct {
 
 static void (*blit_func)(int x, int y, int y1, int y2, int w, int h);
 
+/* Changed areas of the render buffer, built while copying a frame. */
+static video_rect_t	dirty_rects[VIDEO_RECTS_MAX];
+static int		dirty_nrects,
+			dirty_w = -1;
+static uint32_t		dirty_line[2048 + 64];
+
 
 #ifdef ENABLE_VIDEO_LOG
 int sdl_do_log = ENABLE_VIDEO_LOG;
@@ -290,6 +299,8 @@ void blit_thread(void *param)
 		blit_func(blit_data.x, blit_data.y,
 			  blit_data.y1, blit_data.y2,
 			  blit_data.w, blit_data.h);
+	else
+		video_blit_complete();	/* no renderer, e.g. headless */
 
 	blit_data.busy = 0;
 	thread_set_event(blit_data.blit_complete);
@@ -313,6 +324,26 @@ video_blit_complete(void)
 }
 
 
+/* Get the changed areas of the render buffer for the current blit. The
+   list is only valid until the blit function returns. */
+int
+video_blit_rects(const video_rect_t **rects)
+{
+    *rects = blit_data.rects;
+
+    return(blit_data.nrects);
+}
+
+
+/* Treat all of the next frame as changed, e.g. after the renderer lost
+   its copy of the screen. */
+void
+video_blit_invalidate(void)
+{
+    dirty_w = -1;
+}
+
+
 void
 video_wait_for_blit(void)
 {
@@ -444,18 +475,69 @@ video_transform_copy(uint32_t *dst, uint32_t *src, int len)
 }
 
 
+/* Add a changed span of a line, merging it with the line above. */
+static void
+video_dirty_add(int y, int x1, int x2)
+{
+    video_rect_t *r = (dirty_nrects > 0) ? &dirty_rects[dirty_nrects - 1] : NULL;
+
+    if ((r != NULL) && ((dirty_nrects == VIDEO_RECTS_MAX) || ((r->y + r->h) == y))) {
+	if (x1 < r->x) {
+		r->w += (r->x - x1);
+		r->x = x1;
+	}
+	if (x2 > (r->x + r->w))
+		r->w = x2 - r->x;
+	r->h = y + 1 - r->y;
+	return;
+    }
+
+    r = &dirty_rects[dirty_nrects++];
+    r->x = x1;
+    r->y = y;
+    r->w = x2 - x1;
+    r->h = 1;
+}
+
+
+/* Copy a line to the render buffer, only writing (and reporting) the
+   span that actually differs from what the renderer has already got. */
+static void
+video_copy_line(uint32_t *dst, uint32_t *src, int y, int w, int full)
+{
+    int x1 = 0, x2 = w;
+
+    if (! full) {
+	while ((x1 < w) && (dst[x1] == src[x1]))
+		x1++;
+	if (x1 == w)
+		return;
+	while (dst[x2 - 1] == src[x2 - 1])
+		x2--;
+    }
+
+    memcpy(&dst[x1], &src[x1], (x2 - x1) << 2);
+    video_dirty_add(y, x1, x2);
+}
+
+
 void
 video_blit_memtoscreen(int x, int y, int y1, int y2, int w, int h)
 {
-    int yy;
+    int yy, full;
+
+    full = (w != dirty_w);
+    dirty_nrects = 0;
 
     if (y2 > 0) {
+	dirty_w = w;
 	for (yy = y1; yy < y2; yy++) {
 		if (((y + yy) >= 0) && ((y + yy) < buffer32->h)) {
-			if (video_grayscale || invert_display)
-				video_transform_copy(&(render_buffer->dat)[yy * w], &(buffer32->line[y + yy][x]), w);
-			else
-				memcpy(&(render_buffer->dat)[yy * w], &(buffer32->line[y + yy][x]), w << 2);
+			if (video_grayscale || invert_display) {
+				video_transform_copy(dirty_line, &(buffer32->line[y + yy][x]), w);
+				video_copy_line(&(render_buffer->dat)[yy * w], dirty_line, yy, w, full);
+			} else
+				video_copy_line(&(render_buffer->dat)[yy * w], &(buffer32->line[y + yy][x]), yy, w, full);
 		}
 	}
     }
@@ -474,6 +556,8 @@ video_blit_memtoscreen(int x, int y, int y1, int y2, int w, int h)
 
     blit_data.busy = 1;
     blit_data.buffer_in_use = 1;
+    blit_data.nrects = dirty_nrects;
+    memcpy(blit_data.rects, dirty_rects, dirty_nrects * sizeof(video_rect_t));
     blit_data.x = x;
     blit_data.y = y;
     blit_data.y1 = y1;
@@ -42,6 +42,7 @@
 static rfbScreenInfoPtr	rfb = NULL;
 static int	clients;
 static int	updatingSize;
+static volatile int	redrawAll;
 static int	allowedX,
 		allowedY;
 static int	ptr_x, ptr_y, ptr_but;
@@ -162,6 +163,10 @@ vnc_display(rfbClientPtr cl)
 
 	allowedX = rfb->width;
 	allowedY = rfb->height;
+
+	/* Damage dropped during the resize, or clipped to the old size,
+	   was never sent; the next blit resends the whole screen. */
+	redrawAll = 1;
     }
 }
 
@@ -169,20 +174,38 @@ vnc_display(rfbClientPtr cl)
 static void
 vnc_blit(int x, int y, int y1, int y2, int w, int h)
 {
+    const video_rect_t *r;
     uint32_t *p;
-    int yy;
+    int i, n, yy;
 
-    for (yy=y1; yy<y2; yy++) {
-	p = (uint32_t *)&(((uint32_t *)rfb->frameBuffer)[yy*VNC_MAX_X]);
+    /* Only copy and send what has changed since the last frame. */
+    n = video_blit_rects(&r);
+    for (i = 0; i < n; i++) {
+	for (yy = r[i].y; yy < (r[i].y + r[i].h); yy++) {
+		p = (uint32_t *)&(((uint32_t *)rfb->frameBuffer)[yy*VNC_MAX_X + r[i].x]);
 
-	if ((y+yy) >= 0 && (y+yy) < VNC_MAX_Y)
-		memcpy(p, &(render_buffer->dat[yy * w]), w*4);
+		if ((y+yy) >= 0 && (y+yy) < VNC_MAX_Y)
+			memcpy(p, &(render_buffer->dat[yy * w + r[i].x]), r[i].w*4);
+	}
     }
  
     video_blit_complete();
 
-    if (! updatingSize)
-	rfbMarkRectAsModified(rfb, 0,0, allowedX,allowedY);
+    if (updatingSize)
+	return;
+
+    if (redrawAll) {
+	redrawAll = 0;
+	rfbMarkRectAsModified(rfb, 0, 0, allowedX, allowedY);
+    } else {
+	for (i = 0; i < n; i++) {
+		if ((r[i].x >= allowedX) || (r[i].y >= allowedY))
+			continue;
+		rfbMarkRectAsModified(rfb, r[i].x, r[i].y,
+				      MIN(r[i].x + r[i].w, allowedX),
+				      MIN(r[i].y + r[i].h, allowedY));
+	}
+    }
 }
 
 
@@ -234,6 +257,8 @@ vnc_init(UNUSED(void *arg))
  
     /* Set up our BLIT handlers. */
     video_setblit(vnc_blit);
+    video_blit_invalidate();
+    redrawAll = 1;
 
     clients = 0;
 
@@ -277,6 +302,7 @@ vnc_resize(int x, int y)
  
 	allowedX = (rfb->width < x) ? rfb->width : x;
 	allowedY = (rfb->width < y) ? rfb->width : y;
+	redrawAll = 1;
  
 	rfb->width = x;
 	rfb->height = y;
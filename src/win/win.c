@@ -274,6 +274,54 @@ CloseConsole(void)
 }
 
 
+/* Stop a headless session on Ctrl+C or when the console closes. */
+static BOOL WINAPI
+headless_ctrl_handler(DWORD type)
+{
+    quited = 1;
+
+    return(TRUE);
+}
+
+
+/* Run the emulator without any UI window, for batch jobs. */
+static int
+headless_run(void)
+{
+    uint32_t old_time;
+
+    ghMutex = CreateMutex(NULL, FALSE, NULL);
+
+    if (! pc_init_modules()) {
+	printf("No ROMs found, cannot run.\n");
+	return(6);
+    }
+
+    /* There is no renderer, the blitter just drops the frames. */
+    pc_reset_hard_init();
+
+    SetConsoleCtrlHandler(headless_ctrl_handler, TRUE);
+
+    do_start();
+
+    /* The UI normally drives this from its 1-second timer. */
+    old_time = plat_get_ticks();
+    while (! quited) {
+	plat_delay_ms(100);
+	if ((plat_get_ticks() - old_time) >= 1000) {
+		old_time += 1000;
+		pc_onesec();
+	}
+    }
+
+    timeEndPeriod(1);
+
+    do_stop();
+
+    return(0);
+}
+
+
 /* Process the commandline, and create standard argc/argv array. */
 static int
 ProcessCommandLine(wchar_t ***argw)
@@ -382,13 +430,16 @@ WinMain(HINSTANCE hInst, HINSTANCE hPrev, LPSTR lpszArg, int nCmdShow)
 	InitCrashDump();
 
     /* Create console window. */
-    if (force_debug) {
+    if (force_debug || headless) {
 	CreateConsole(1);
 	atexit(CloseConsole);
 }
 
-    /* Handle our GUI. */
-    i = ui_init(nCmdShow);
+    /* Handle our GUI, unless we run without one. */
+    if (headless)
+	i = headless_run();
+    else
+	i = ui_init(nCmdShow);
 
     free(argbuf);
     free(argw);
@@ -231,8 +231,9 @@ sdl_stretch(int *w, int *h, int *x, int *y)
 static void
 sdl_blit(int x, int y, int y1, int y2, int w, int h)
 {
+    const video_rect_t *r;
     SDL_Rect r_src;
-    int ret;
+    int i, n, ret;
 
     if (!sdl_enabled || (y1 == y2) || (h <= 0) || (render_buffer == NULL)) {
 	video_blit_complete();
@@ -241,11 +242,15 @@ sdl_blit(int x, int y, int y1, int y2, int w, int h)
 
     SDL_LockMutex(sdl_mutex);
 
-    r_src.x = 0;
-    r_src.y = y1;
-    r_src.w = w;
-    r_src.h = y2 - y1;
-    SDL_UpdateTexture(sdl_tex, &r_src, &(render_buffer->dat)[y1 * w], w * 4);
+    /* Only upload the parts of the screen that have changed. */
+    n = video_blit_rects(&r);
+    for (i = 0; i < n; i++) {
+	r_src.x = r[i].x;
+	r_src.y = r[i].y;
+	r_src.w = r[i].w;
+	r_src.h = r[i].h;
+	SDL_UpdateTexture(sdl_tex, &r_src, &(render_buffer->dat)[r[i].y * w + r[i].x], w * 4);
+    }
     video_blit_complete();
 
     SDL_RenderClear(sdl_render);
@@ -353,6 +358,9 @@ sdl_reinit_texture(void)
 
     sdl_tex = SDL_CreateTexture(sdl_render, SDL_PIXELFORMAT_ARGB8888,
 				SDL_TEXTUREACCESS_STREAMING, 2048, 2048);
+
+    /* The new texture is empty, so upload the whole next frame. */
+    video_blit_invalidate();
 }
 
 
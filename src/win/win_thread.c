@@ -167,3 +167,14 @@ thread_release_mutex(mutex_t *mutex)
 
     return(!!ReleaseMutex((HANDLE)mutex));
 }
+
+
+int
+thread_get_cpu_count(void)
+{
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+
+    return(si.dwNumberOfProcessors);
+}
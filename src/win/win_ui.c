@@ -32,11 +32,15 @@
 #include <86box/86box.h>
 #include <86box/config.h>
 #include "../cpu/cpu.h"
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+# include "../cpu/codegen_public.h"
+#endif
 #include <86box/device.h>
 #include <86box/keyboard.h>
 #include <86box/mouse.h>
 #include <86box/timer.h>
 #include <86box/nvr.h>
+#include <86box/snapshot.h>
 #include <86box/video.h>
 #include <86box/vid_ega.h>		// for update_overscan
 #include <86box/plat_midi.h>
@@ -185,6 +189,10 @@ ResetAllMenus(void)
 
     CheckMenuItem(menuMain, IDM_UPDATE_ICONS, MF_UNCHECKED);
 
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+    CheckMenuItem(menuMain, IDM_DYNAREC_PROFILE, MF_UNCHECKED);
+#endif
+
 #ifdef ENABLE_LOG_TOGGLES
 # ifdef ENABLE_BUSLOGIC_LOG
     CheckMenuItem(menuMain, IDM_LOG_BUSLOGIC, MF_UNCHECKED);
@@ -246,6 +254,10 @@ ResetAllMenus(void)
 
     CheckMenuItem(menuMain, IDM_UPDATE_ICONS, update_icons ? MF_CHECKED : MF_UNCHECKED);
 
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+    CheckMenuItem(menuMain, IDM_DYNAREC_PROFILE, codegen_profile_enabled ? MF_CHECKED : MF_UNCHECKED);
+#endif
+
 #ifdef ENABLE_LOG_TOGGLES
 # ifdef ENABLE_BUSLOGIC_LOG
     CheckMenuItem(menuMain, IDM_LOG_BUSLOGIC, buslogic_do_log?MF_CHECKED:MF_UNCHECKED);
@@ -504,6 +516,14 @@ MainWindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 				pc_send_cad();
 				break;
 
+			case IDM_ACTION_SNAPSHOT_SAVE:
+				snapshot_request(SNAPSHOT_SAVE, NULL);
+				break;
+
+			case IDM_ACTION_SNAPSHOT_LOAD:
+				snapshot_request(SNAPSHOT_LOAD, NULL);
+				break;
+
 			case IDM_ACTION_EXIT:
 				win_notify_dlg_open();
 				if (confirm_exit && confirm_exit_cmdl)
@@ -558,6 +578,18 @@ MainWindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 				config_save();
 				break;
 
+#if defined(USE_DYNAREC) && defined(USE_NEW_DYNAREC)
+			case IDM_DYNAREC_PROFILE:
+				/* Applied by the CPU thread, between blocks. */
+				codegen_profile_toggle = 1;
+				CheckMenuItem(hmenu, IDM_DYNAREC_PROFILE, codegen_profile_enabled ? MF_UNCHECKED : MF_CHECKED);
+				break;
+
+			case IDM_DYNAREC_PROFILE_DUMP:
+				codegen_profile_dump_pending = 1;
+				break;
+#endif
+
 			case IDM_VID_RESIZE:
 				vid_resize = !vid_resize;
 				CheckMenuItem(hmenu, IDM_VID_RESIZE, (vid_resize)? MF_CHECKED : MF_UNCHECKED);